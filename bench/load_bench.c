@@ -0,0 +1,196 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Benchmark for the text and binary IR loaders)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ *
+ * Usage: load_bench <input.ir> <output.bin> [iterations]
+ *
+ * Converts the text module into the binary format and then measures
+ * ir_load() against ir_load_bin_file(). Loaded functions are released
+ * without compilation, so only the loading cost is measured.
+ */
+
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct _bench_loader {
+	ir_loader loader;
+	FILE     *bin_file;
+	uint32_t  funcs_count;
+	uint64_t  insns_count;
+} bench_loader;
+
+static double bench_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static bool bench_external_sym_dcl(ir_loader *loader, const char *name, uint32_t flags)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_external_sym_dcl(name, flags, l->bin_file);
+}
+
+static bool bench_external_func_dcl(ir_loader *loader, const char *name, uint32_t flags,
+                                    ir_type ret_type, uint32_t params_count, const uint8_t *param_types)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file
+		|| ir_save_bin_external_func_dcl(name, flags, ret_type, params_count, param_types, l->bin_file);
+}
+
+static bool bench_forward_func_dcl(ir_loader *loader, const char *name, uint32_t flags,
+                                   ir_type ret_type, uint32_t params_count, const uint8_t *param_types)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file
+		|| ir_save_bin_forward_func_dcl(name, flags, ret_type, params_count, param_types, l->bin_file);
+}
+
+static bool bench_sym_dcl(ir_loader *loader, const char *name, uint32_t flags, size_t size)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_dcl(name, flags, size, l->bin_file);
+}
+
+static bool bench_sym_data(ir_loader *loader, ir_type type, uint32_t count, const void *data)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_data(type, count, data, l->bin_file);
+}
+
+static bool bench_sym_data_str(ir_loader *loader, const char *str, size_t len)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_data_str(str, len, l->bin_file);
+}
+
+static bool bench_sym_data_pad(ir_loader *loader, size_t offset)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_data_pad(offset, l->bin_file);
+}
+
+static bool bench_sym_data_ref(ir_loader *loader, ir_op op, const char *ref, uintptr_t offset)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_data_ref(op, ref, offset, l->bin_file);
+}
+
+static bool bench_sym_data_end(ir_loader *loader, uint32_t flags)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	return !l->bin_file || ir_save_bin_sym_data_end(flags, l->bin_file);
+}
+
+static bool bench_func_init(ir_loader *loader, ir_ctx *ctx, const char *name)
+{
+	ir_init(ctx, loader->default_func_flags, 256, 1024);
+	return 1;
+}
+
+static bool bench_func_process(ir_loader *loader, ir_ctx *ctx, const char *name)
+{
+	bench_loader *l = (bench_loader*) loader;
+
+	l->funcs_count++;
+	l->insns_count += ctx->insns_count;
+	return !l->bin_file || ir_save_bin_func(ctx, name, l->bin_file);
+}
+
+int main(int argc, char **argv)
+{
+	bench_loader l;
+	uint32_t i, iterations = 100;
+	double start, text_time, bin_time;
+	FILE *f;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <input.ir> <output.bin> [iterations]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3) {
+		iterations = atoi(argv[3]);
+	}
+
+	memset(&l, 0, sizeof(l));
+	l.loader.default_func_flags = IR_FUNCTION | IR_OPT_FOLDING;
+	l.loader.external_sym_dcl   = bench_external_sym_dcl;
+	l.loader.external_func_dcl  = bench_external_func_dcl;
+	l.loader.forward_func_dcl   = bench_forward_func_dcl;
+	l.loader.sym_dcl            = bench_sym_dcl;
+	l.loader.sym_data           = bench_sym_data;
+	l.loader.sym_data_str       = bench_sym_data_str;
+	l.loader.sym_data_pad       = bench_sym_data_pad;
+	l.loader.sym_data_ref       = bench_sym_data_ref;
+	l.loader.sym_data_end       = bench_sym_data_end;
+	l.loader.func_init          = bench_func_init;
+	l.loader.func_process       = bench_func_process;
+
+	ir_loader_init();
+
+	/* Convert */
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		fprintf(stderr, "ERROR: Cannot open input file '%s'\n", argv[1]);
+		return 1;
+	}
+	l.bin_file = fopen(argv[2], "wb");
+	if (!l.bin_file || !ir_save_bin_header(l.bin_file) || !ir_load(&l.loader, f)) {
+		fprintf(stderr, "ERROR: Cannot convert '%s' into '%s'\n", argv[1], argv[2]);
+		return 1;
+	}
+	fclose(l.bin_file);
+	fclose(f);
+	l.bin_file = NULL;
+
+	/* Text loader */
+	l.funcs_count = 0;
+	l.insns_count = 0;
+	start = bench_time();
+	for (i = 0; i < iterations; i++) {
+		f = fopen(argv[1], "rb");
+		if (!f || !ir_load(&l.loader, f)) {
+			fprintf(stderr, "ERROR: Cannot load '%s'\n", argv[1]);
+			return 1;
+		}
+		fclose(f);
+	}
+	text_time = bench_time() - start;
+
+	/* Binary loader */
+	l.funcs_count = 0;
+	l.insns_count = 0;
+	start = bench_time();
+	for (i = 0; i < iterations; i++) {
+		if (!ir_load_bin_file(&l.loader, argv[2])) {
+			fprintf(stderr, "ERROR: Cannot load '%s'\n", argv[2]);
+			return 1;
+		}
+	}
+	bin_time = bench_time() - start;
+
+	ir_loader_free();
+
+	printf("functions: %u, instructions: %d, iterations: %u\n",
+		l.funcs_count / iterations, (int)(l.insns_count / iterations), iterations);
+	printf("text   load time = %0.6f\n", text_time);
+	printf("binary load time = %0.6f\n", bin_time);
+	printf("speedup          = %0.2fx\n", bin_time > 0.0 ? text_time / bin_time : 0.0);
+	return 0;
+}
@@ -94,6 +94,7 @@ int main(int argc, char **argv)
 	int opt_level = 2;
 	uint32_t flags = 0;
 	uint32_t mflags = 0;
+	uint32_t debug_flags = 0;
 	uint64_t debug_regset = 0xffffffffffffffff;
 
 	ir_consistency_check();
@@ -117,13 +118,13 @@ int main(int argc, char **argv)
 			flags |= IR_USE_FRAME_POINTER;
 #ifdef IR_DEBUG
 		} else if (strcmp(argv[i], "--debug-sccp") == 0) {
-			flags |= IR_DEBUG_SCCP;
+			debug_flags |= IR_DEBUG_SCCP;
 		} else if (strcmp(argv[i], "--debug-gcm") == 0) {
-			flags |= IR_DEBUG_GCM;
+			debug_flags |= IR_DEBUG_GCM;
 		} else if (strcmp(argv[i], "--debug-schedule") == 0) {
-			flags |= IR_DEBUG_SCHEDULE;
+			debug_flags |= IR_DEBUG_SCHEDULE;
 		} else if (strcmp(argv[i], "--debug-ra") == 0) {
-			flags |= IR_DEBUG_RA;
+			debug_flags |= IR_DEBUG_RA;
 #endif
 		} else if (strcmp(argv[i], "--debug-regset") == 0) {
 			if (i + 1 == argc || argv[i + 1][0] == '-') {
@@ -156,6 +157,7 @@ int main(int argc, char **argv)
 		flags |= IR_OPT_FOLDING | IR_OPT_CFG | IR_OPT_CODEGEN;
 	}
 	ir_init(&ctx, flags, 256, 1024);
+	ctx.flags2 |= debug_flags;
 	ctx.mflags = mflags;
 	ctx.fixed_regset = ~debug_regset;
 	ctx.ret_type = IR_I32;
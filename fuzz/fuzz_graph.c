@@ -269,6 +269,9 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 #if FUZZ_OPT_LEVEL > 0
 	flags |= IR_OPT_FOLDING;
 #endif
+#if FUZZ_OPT_LEVEL > 1
+	flags |= IR_OPT_RANGES | IR_OPT_GVN | IR_OPT_LOOPS | IR_OPT_JUMP_THREAD;
+#endif
 
 	ir_init(&ctx, flags, IR_CONSTS_LIMIT_MIN, IR_INSNS_LIMIT_MIN);
 
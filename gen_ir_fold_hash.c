@@ -8,6 +8,7 @@
  */
 
 #include "ir.h"
+#include <stdlib.h>
 #include <string.h>
 
 #include "ir_strtab.c"
@@ -238,6 +239,30 @@ static int parse_rule(const char *buf)
 	return mask;
 }
 
+/* Extract the rule pattern from "IR_FOLD(pattern)" */
+static char *get_rule_text(const char *buf)
+{
+	const char *p = buf + sizeof("IR_FOLD(") - 1;
+	const char *q = p;
+	int level = 1;
+	char *text;
+
+	while (*q) {
+		if (*q == '(') {
+			level++;
+		} else if (*q == ')') {
+			if (--level == 0) {
+				break;
+			}
+		}
+		q++;
+	}
+	text = malloc(q - p + 1);
+	memcpy(text, p, q - p);
+	text[q - p] = 0;
+	return text;
+}
+
 int main(int argc, char **argv)
 {
 	char buf[4096];
@@ -247,6 +272,7 @@ int main(int argc, char **argv)
 	int i;
 	uint32_t mask[MAX_RULES];
 	uint32_t rule[MAX_RULES];
+	char *rule_text[MAX_RULES];
 
 	ir_strtab_init(&strtab, IR_LAST_OP, 0);
 
@@ -278,6 +304,7 @@ int main(int argc, char **argv)
 			}
 			// TODO: few masks may share the same rule ???
 			rule[rules] = line;
+			rule_text[rules] = get_rule_text(buf);
 			mask[rules] = i | (rules << 21);
 			rules++;
 		}
@@ -298,6 +325,16 @@ int main(int argc, char **argv)
 	printf("\t_IR_RULE_LAST\n");
 	printf("} ir_fold_rule_id;\n\n");
 
+	printf("#ifdef IR_FOLD_STATS\n");
+	printf("static ir_fold_stats _ir_fold_stats[_IR_RULE_LAST + 1] = {\n");
+	for (i = 0; i < rules; i++) {
+		printf("\t{\"%s\", %d, 0, 0, 0, 0},\n", rule_text[i], rule[i]);
+		free(rule_text[i]);
+	}
+	printf("\t{NULL, 0, 0, 0, 0, 0}\n");
+	printf("};\n");
+	printf("#endif\n\n");
+
 	if (!find_hash(mask, rules)) {
 		fprintf(stderr, "ERROR: Cannot find a good hash function\n");
 		return 1;
@@ -37,12 +37,23 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 
 #ifdef HAVE_VALGRIND
 # include <valgrind/valgrind.h>
 #endif
 
-#define IR_TYPE_FLAGS(name, type, field, flags) ((flags)|sizeof(type)),
+/* vectors are represented by plain C arrays (only their size is used) */
+typedef int8_t  i8x16_t[16];
+typedef int32_t i32x4_t[4];
+typedef float   f32x4_t[4];
+typedef double  f64x2_t[2];
+typedef int8_t  i8x32_t[32];
+typedef int32_t i32x8_t[8];
+typedef float   f32x8_t[8];
+typedef double  f64x4_t[4];
+
+#define IR_TYPE_FLAGS(name, type, field, flags) ((flags)|(sizeof(type) & 0xf)),
 #define IR_TYPE_NAME(name, type, field, flags)  #name,
 #define IR_TYPE_CNAME(name, type, field, flags) #type,
 #define IR_TYPE_SIZE(name, type, field, flags)  sizeof(type),
@@ -135,6 +146,14 @@ void ir_print_const(const ir_ctx *ctx, const ir_insn *insn, FILE *f, bool quoted
 		return;
 	}
 	IR_ASSERT(IR_IS_CONST_OP(insn->op) || insn->op == IR_FUNC_ADDR);
+	if (IR_IS_TYPE_VEC(insn->type)) {
+		/* vector constants are splats, print their lane value */
+		ir_insn lane = *insn;
+
+		lane.type = ir_vec_lane_type(insn->type);
+		ir_print_const(ctx, &lane, f, quoted);
+		return;
+	}
 	switch (insn->type) {
 		case IR_BOOL:
 			fprintf(f, "%u", insn->val.b);
@@ -351,16 +370,24 @@ static void ir_grow_top(ir_ctx *ctx)
 	ctx->ir_base = buf + ctx->consts_limit;
 
 	if (ctx->use_lists) {
-		ctx->use_lists = ir_mem_realloc(ctx->use_lists, ctx->insns_limit * sizeof(ir_use_list));
+		ctx->use_lists = ir_ctx_realloc(ctx, ctx->use_lists,
+			old_insns_limit * sizeof(ir_use_list), ctx->insns_limit * sizeof(ir_use_list));
 		memset(ctx->use_lists + old_insns_limit, 0,
 			(ctx->insns_limit - old_insns_limit) * sizeof(ir_use_list));
 	}
 
 	if (ctx->cfg_map) {
-		ctx->cfg_map = ir_mem_realloc(ctx->cfg_map, ctx->insns_limit * sizeof(uint32_t));
+		ctx->cfg_map = ir_ctx_realloc(ctx, ctx->cfg_map,
+			old_insns_limit * sizeof(uint32_t), ctx->insns_limit * sizeof(uint32_t));
 		memset(ctx->cfg_map + old_insns_limit, 0,
 			(ctx->insns_limit - old_insns_limit) * sizeof(uint32_t));
 	}
+
+	if (ctx->alias_classes) {
+		ctx->alias_classes = ir_mem_realloc(ctx->alias_classes, ctx->insns_limit * sizeof(uint16_t));
+		memset(ctx->alias_classes + old_insns_limit, 0,
+			(ctx->insns_limit - old_insns_limit) * sizeof(uint16_t));
+	}
 }
 
 static ir_ref ir_next_insn(ir_ctx *ctx)
@@ -385,13 +412,8 @@ void ir_truncate(ir_ctx *ctx)
 	ctx->ir_base = buf + ctx->consts_limit;
 }
 
-void ir_init(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit)
+static void ir_init_buf(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit, ir_insn *buf)
 {
-	ir_insn *buf;
-
-	IR_ASSERT(consts_limit >= IR_CONSTS_LIMIT_MIN);
-	IR_ASSERT(insns_limit >= IR_INSNS_LIMIT_MIN);
-
 	memset(ctx, 0, sizeof(ir_ctx));
 
 	ctx->insns_count = IR_UNUSED + 1;
@@ -406,7 +428,6 @@ void ir_init(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limi
 	ctx->spill_base = -1;
 	ctx->fixed_stack_frame_size = -1;
 
-	buf = ir_mem_malloc((consts_limit + insns_limit) * sizeof(ir_insn));
 	ctx->ir_base = buf + consts_limit;
 
 	MAKE_NOP(&ctx->ir_base[IR_UNUSED]);
@@ -418,10 +439,20 @@ void ir_init(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limi
 	ctx->ir_base[IR_TRUE].val.u64 = 1;
 }
 
-void ir_free(ir_ctx *ctx)
+void ir_init(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit)
+{
+	ir_insn *buf;
+
+	IR_ASSERT(consts_limit >= IR_CONSTS_LIMIT_MIN);
+	IR_ASSERT(insns_limit >= IR_INSNS_LIMIT_MIN);
+
+	buf = ir_mem_malloc((consts_limit + insns_limit) * sizeof(ir_insn));
+	ir_init_buf(ctx, flags, consts_limit, insns_limit, buf);
+}
+
+/* Free everything except of IR buffer and arenas */
+static void ir_free_data(ir_ctx *ctx)
 {
-	ir_insn *buf = ctx->ir_base - ctx->consts_limit;
-	ir_mem_free(buf);
 	if (ctx->value_params) {
 		ir_mem_free(ctx->value_params);
 	}
@@ -432,62 +463,324 @@ void ir_free(ir_ctx *ctx)
 		ir_hashtab_free(ctx->binding);
 		ir_mem_free(ctx->binding);
 	}
+	if (ctx->alias_classes) {
+		ir_mem_free(ctx->alias_classes);
+	}
+	if (!(ctx->flags & IR_ARENA_STORAGE)) {
+		if (ctx->use_lists) {
+			ir_mem_free(ctx->use_lists);
+		}
+		if (ctx->use_edges) {
+			ir_mem_free(ctx->use_edges);
+		}
+		if (ctx->cfg_blocks) {
+			ir_mem_free(ctx->cfg_blocks);
+		}
+		if (ctx->cfg_edges) {
+			ir_mem_free(ctx->cfg_edges);
+		}
+		if (ctx->cfg_map) {
+			ir_mem_free(ctx->cfg_map);
+		}
+		if (ctx->cfg_schedule) {
+			ir_mem_free(ctx->cfg_schedule);
+		}
+		if (ctx->rules) {
+			ir_mem_free(ctx->rules);
+		}
+		if (ctx->vregs) {
+			ir_mem_free(ctx->vregs);
+		}
+		if (ctx->live_intervals) {
+			ir_mem_free(ctx->live_intervals);
+		}
+		if (ctx->regs) {
+			ir_mem_free(ctx->regs);
+		}
+		if (ctx->prev_ref) {
+			ir_mem_free(ctx->prev_ref);
+		}
+	}
+	if (ctx->regs) {
+#if IR_X86_I64
+		if (ctx->tmp_regs) {
+			ir_mem_free(ctx->tmp_regs);
+		}
+#endif
+		if (ctx->fused_regs) {
+			ir_strtab_free(ctx->fused_regs);
+			ir_mem_free(ctx->fused_regs);
+		}
+	}
+	if (ctx->entries) {
+		ir_mem_free(ctx->entries);
+	}
+	if (ctx->osr_entry_loads) {
+		ir_list_free((ir_list*)ctx->osr_entry_loads);
+		ir_mem_free(ctx->osr_entry_loads);
+	}
+
+	if (ctx->const_hash_mask != IR_CONST_HASH_SIZE - 1) {
+		ir_mem_free(ctx->const_hash);
+	}
+}
+
+void ir_free(ir_ctx *ctx)
+{
+	ir_insn *buf = ctx->ir_base - ctx->consts_limit;
+
+	ir_mem_free(buf);
+	ir_free_data(ctx);
+	if (ctx->arena) {
+		ir_arena_free(ctx->arena);
+	}
+	if (ctx->storage) {
+		ir_arena_free(ctx->storage);
+	}
+}
+
+/* Prepare the context for construction of the next function.
+ * Unlike ir_free() + ir_init(), this keeps the IR buffer and rewinds the arenas (ctx->arena and
+ * ctx->storage), so the per-pass data of the next function doesn't need new heap blocks.
+ */
+void ir_reset(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit)
+{
+	ir_insn *buf = ctx->ir_base - ctx->consts_limit;
+	ir_ref buf_size = ctx->consts_limit + ctx->insns_limit;
+	ir_arena *arena = ctx->arena;
+	ir_arena *storage = ctx->storage;
+
+	IR_ASSERT(consts_limit >= IR_CONSTS_LIMIT_MIN);
+	IR_ASSERT(insns_limit >= IR_INSNS_LIMIT_MIN);
+
+	ir_free_data(ctx);
+	if (buf_size < consts_limit + insns_limit) {
+		ir_mem_free(buf);
+		buf = ir_mem_malloc((consts_limit + insns_limit) * sizeof(ir_insn));
+	} else {
+		insns_limit = buf_size - consts_limit;
+	}
+	if (arena) {
+		ir_arena_reset(&arena);
+	}
+	if (storage) {
+		ir_arena_reset(&storage);
+	}
+
+	ir_init_buf(ctx, flags, consts_limit, insns_limit, buf);
+	ctx->arena = arena;
+	ctx->storage = storage;
+}
+
+void *ir_ctx_storage_alloc(ir_ctx *ctx, size_t size)
+{
+	if (!ctx->storage) {
+		ctx->storage = ir_arena_create(IR_MAX(64 * 1024, size + IR_ALIGNED_SIZE(sizeof(ir_arena), 8)));
+	}
+	return ir_arena_alloc(&ctx->storage, size);
+}
+
+/* Context Pool */
+static void ir_ctx_move(ir_ctx *dst, ir_ctx *src)
+{
+	memcpy(dst, src, sizeof(ir_ctx));
+	if (src->const_hash == src->_const_hash) {
+		dst->const_hash = dst->_const_hash;
+	}
+	memset(src, 0, sizeof(ir_ctx));
+}
+
+void ir_ctx_pool_init(ir_ctx_pool *pool)
+{
+	pool->count = 0;
+}
+
+void ir_ctx_pool_acquire(ir_ctx_pool *pool, ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit)
+{
+	flags |= IR_ARENA_STORAGE;
+	if (pool->count) {
+		ir_ctx_move(ctx, &pool->ctxs[--pool->count]);
+		ir_reset(ctx, flags, consts_limit, insns_limit);
+	} else {
+		ir_init(ctx, flags, consts_limit, insns_limit);
+	}
+}
+
+void ir_ctx_pool_release(ir_ctx_pool *pool, ir_ctx *ctx)
+{
+	if (pool->count < IR_CTX_POOL_SIZE) {
+		ir_ctx_move(&pool->ctxs[pool->count++], ctx);
+	} else {
+		ir_free(ctx);
+		memset(ctx, 0, sizeof(ir_ctx));
+	}
+}
+
+void ir_ctx_pool_free(ir_ctx_pool *pool)
+{
+	while (pool->count) {
+		ir_free(&pool->ctxs[--pool->count]);
+	}
+}
+
+/* Compilation Statistics */
+#define IR_PASS_NAME(name, str) str,
+
+const char *ir_pass_name[IR_LAST_PASS] = {
+	IR_PASSES(IR_PASS_NAME)
+};
+
+static double ir_stats_time(void)
+{
+#ifndef _WIN32
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#else
+	LARGE_INTEGER counter, freq;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&freq);
+	return (double)counter.QuadPart / (double)freq.QuadPart;
+#endif
+}
+
+/* Estimation of the heap memory held by the context data structures.
+ * Temporary buffers allocated and freed inside a single pass are not visible here.
+ */
+static size_t ir_ctx_heap_size(const ir_ctx *ctx)
+{
+	size_t size = (size_t)(ctx->consts_limit + ctx->insns_limit) * sizeof(ir_insn);
+
+	if (ctx->strtab.buf) {
+		size += ctx->strtab.buf_size;
+	}
+	if (ctx->alias_classes) {
+		size += (size_t)ctx->insns_limit * sizeof(uint16_t);
+	}
+	if (ctx->flags & IR_ARENA_STORAGE) {
+		/* the rest is accounted as arena memory */
+		return size;
+	}
 	if (ctx->use_lists) {
-		ir_mem_free(ctx->use_lists);
+		size += (size_t)ctx->insns_limit * sizeof(ir_use_list);
 	}
 	if (ctx->use_edges) {
-		ir_mem_free(ctx->use_edges);
+		size += (size_t)ctx->use_edges_count * sizeof(ir_ref);
 	}
 	if (ctx->cfg_blocks) {
-		ir_mem_free(ctx->cfg_blocks);
+		size += (size_t)(ctx->cfg_blocks_count + 1) * sizeof(ir_block);
 	}
 	if (ctx->cfg_edges) {
-		ir_mem_free(ctx->cfg_edges);
+		size += (size_t)ctx->cfg_edges_count * sizeof(uint32_t);
 	}
 	if (ctx->cfg_map) {
-		ir_mem_free(ctx->cfg_map);
+		size += (size_t)ctx->insns_limit * sizeof(uint32_t);
 	}
 	if (ctx->cfg_schedule) {
-		ir_mem_free(ctx->cfg_schedule);
+		size += (size_t)(ctx->cfg_blocks_count + 2) * sizeof(uint32_t);
 	}
 	if (ctx->rules) {
-		ir_mem_free(ctx->rules);
+		size += (size_t)ctx->insns_count * sizeof(uint32_t);
 	}
 	if (ctx->vregs) {
-		ir_mem_free(ctx->vregs);
+		size += (size_t)ctx->insns_count * sizeof(uint32_t);
 	}
 	if (ctx->live_intervals) {
-		ir_mem_free(ctx->live_intervals);
-	}
-	if (ctx->arena) {
-		ir_arena_free(ctx->arena);
+		size += (size_t)(ctx->vregs_count + 1) * sizeof(ir_live_interval*);
 	}
 	if (ctx->regs) {
-		ir_mem_free(ctx->regs);
-#if IR_X86_I64
-		if (ctx->tmp_regs) {
-			ir_mem_free(ctx->tmp_regs);
-		}
-#endif
-		if (ctx->fused_regs) {
-			ir_strtab_free(ctx->fused_regs);
-			ir_mem_free(ctx->fused_regs);
-		}
+		size += (size_t)ctx->insns_count * sizeof(ir_regs);
 	}
 	if (ctx->prev_ref) {
-		ir_mem_free(ctx->prev_ref);
+		size += (size_t)ctx->insns_count * sizeof(ir_ref);
 	}
-	if (ctx->entries) {
-		ir_mem_free(ctx->entries);
+	return size;
+}
+
+static size_t ir_arena_size(const ir_arena *arena)
+{
+	size_t size = 0;
+
+	while (arena) {
+		size += arena->end - (const char*)arena;
+		arena = arena->prev;
 	}
-	if (ctx->osr_entry_loads) {
-		ir_list_free((ir_list*)ctx->osr_entry_loads);
-		ir_mem_free(ctx->osr_entry_loads);
+	return size;
+}
+
+static size_t ir_ctx_arena_size(const ir_ctx *ctx)
+{
+	return ir_arena_size(ctx->arena) + ir_arena_size(ctx->storage);
+}
+
+static uint32_t ir_arena_blocks(const ir_arena *arena)
+{
+	uint32_t count = 0;
+
+	while (arena) {
+		count++;
+		arena = arena->prev;
 	}
+	return count;
+}
 
-	if (ctx->const_hash_mask != IR_CONST_HASH_SIZE - 1) {
-		ir_mem_free(ctx->const_hash);
+static uint32_t ir_ctx_arena_blocks(const ir_ctx *ctx)
+{
+	return ir_arena_blocks(ctx->arena) + ir_arena_blocks(ctx->storage);
+}
+
+void ir_compile_stats_init(ir_compile_stats *stats)
+{
+	memset(stats, 0, sizeof(ir_compile_stats));
+}
+
+void ir_compile_stats_func(ir_ctx *ctx)
+{
+	IR_ASSERT(ctx->stats);
+	ctx->stats->funcs_count++;
+}
+
+void ir_pass_start(ir_ctx *ctx)
+{
+	IR_ASSERT(ctx->stats);
+	ctx->pass_start_insns = ctx->insns_count;
+	ctx->pass_start_heap = ir_ctx_heap_size(ctx);
+	ctx->pass_start_blocks = ir_ctx_arena_blocks(ctx);
+	ctx->pass_start_time = ir_stats_time();
+}
+
+int ir_pass_end(ir_ctx *ctx, ir_pass pass, int ret)
+{
+	ir_compile_stats *stats = ctx->stats;
+	ir_pass_stats *pass_stats;
+	double time = ir_stats_time();
+	size_t size;
+	uint32_t blocks;
+
+	IR_ASSERT(stats && pass < IR_LAST_PASS);
+	pass_stats = &stats->pass[pass];
+	pass_stats->count++;
+	pass_stats->time += time - ctx->pass_start_time;
+	pass_stats->insns_in += ctx->pass_start_insns;
+	pass_stats->insns_out += ctx->insns_count;
+	size = ir_ctx_heap_size(ctx);
+	if (size < ctx->pass_start_heap) {
+		size = ctx->pass_start_heap;
+	}
+	if (size > pass_stats->peak_heap) {
+		pass_stats->peak_heap = size;
+	}
+	size = ir_ctx_arena_size(ctx);
+	if (size > pass_stats->peak_arena) {
+		pass_stats->peak_arena = size;
 	}
+	blocks = ir_ctx_arena_blocks(ctx);
+	if (blocks > ctx->pass_start_blocks) {
+		pass_stats->arena_blocks += blocks - ctx->pass_start_blocks;
+	}
+	return ret;
 }
 
 ir_ref ir_unique_const_addr(ir_ctx *ctx, uintptr_t addr)
@@ -569,6 +862,10 @@ ir_ref ir_const_ex(ir_ctx *ctx, ir_val val, uint8_t type, uint32_t optx)
 
 ir_ref ir_const(ir_ctx *ctx, ir_val val, uint8_t type)
 {
+	if (UNEXPECTED(IR_IS_TYPE_VEC(type))) {
+		/* vector constants are splats, "val" keeps the lane value and "op" is the lane constant opcode */
+		return ir_const_ex(ctx, val, type, IR_OPT(ir_vec_lane_type(type), type));
+	}
 	return ir_const_ex(ctx, val, type, IR_OPT(type, type));
 }
 
@@ -835,6 +1132,95 @@ ir_str ir_proto(ir_ctx *ctx, uint8_t flags, ir_type ret_type, uint32_t params_co
 	return ir_stringl(ctx, (const char *)proto, offsetof(ir_proto_t, param_types) + params_count);
 }
 
+/* Incremental construction of def->use edges (see ir_init_use_lists()) */
+static ir_ref ir_use_edges_capacity(ir_ref count)
+{
+	ir_ref size = 1024;
+
+	while (size < count) {
+		size *= 2;
+	}
+	return size;
+}
+
+static void ir_use_list_insert(ir_ctx *ctx, ir_ref def, ir_ref use)
+{
+	ir_use_list *use_list = &ctx->use_lists[def];
+	ir_ref n = use_list->count;
+	ir_ref *p;
+
+	IR_ASSERT(def > 0);
+	if (use_list->refs + n >= ctx->use_edges_count
+	 || ctx->use_edges[use_list->refs + n] != IR_UNUSED) {
+		/* move the list to the end of the edges buffer and reserve space for the next uses */
+		ir_ref top = ctx->use_edges_count;
+		ir_ref size = n ? n * 2 : 2;
+		ir_ref old_capacity = ir_use_edges_capacity(top);
+
+		if (top + size > old_capacity) {
+			ir_ref capacity = ir_use_edges_capacity(top + size);
+
+			ctx->use_edges = ir_ctx_realloc(ctx, ctx->use_edges,
+				old_capacity * sizeof(ir_ref), capacity * sizeof(ir_ref));
+		}
+		p = &ctx->use_edges[top];
+		if (n) {
+			memcpy(p, &ctx->use_edges[use_list->refs], n * sizeof(ir_ref));
+			memset(&ctx->use_edges[use_list->refs], 0, n * sizeof(ir_ref));
+		}
+		memset(p + n, 0, (size - n) * sizeof(ir_ref));
+		use_list->refs = top;
+		ctx->use_edges_count = top + size;
+	}
+
+	/* keep the list sorted (the same order as ir_build_def_use_lists() produces) */
+	p = &ctx->use_edges[use_list->refs + n];
+	while (n > 0 && *(p - 1) > use) {
+		*p = *(p - 1);
+		p--;
+		n--;
+	}
+	*p = use;
+	use_list->count++;
+}
+
+static void ir_use_lists_add_inputs(ir_ctx *ctx, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref j, n = ir_input_edges_count(ctx, insn);
+	ir_ref *p;
+
+	IR_ASSERT(n <= 3);
+	for (j = n, p = insn->ops + 1; j > 0; j--, p++) {
+		if (*p > 0) {
+			ir_use_list_insert(ctx, *p, ref);
+		}
+	}
+}
+
+static void ir_use_lists_remove_inputs(ir_ctx *ctx, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref j, n = ir_input_edges_count(ctx, insn);
+	ir_ref *p;
+
+	for (j = n, p = insn->ops + 1; j > 0; j--, p++) {
+		if (*p > 0) {
+			ir_use_list_remove_one(ctx, *p, ref);
+		}
+	}
+}
+
+void ir_init_use_lists(ir_ctx *ctx)
+{
+	IR_ASSERT(ctx->insns_count == IR_UNUSED + 1);
+	IR_ASSERT(!ctx->use_lists && !ctx->use_edges);
+	ctx->use_lists = ir_ctx_calloc(ctx, ctx->insns_limit, sizeof(ir_use_list));
+	ctx->use_edges = ir_ctx_malloc(ctx, ir_use_edges_capacity(0) * sizeof(ir_ref));
+	ctx->use_edges_count = 0;
+	ctx->flags2 |= IR_INCREMENTAL_USE_LISTS;
+}
+
 /* IR construction */
 ir_ref ir_emit(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3)
 {
@@ -846,6 +1232,10 @@ ir_ref ir_emit(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3)
 	insn->op2 = op2;
 	insn->op3 = op3;
 
+	if (UNEXPECTED(ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+		ir_use_lists_add_inputs(ctx, ref);
+	}
+
 	return ref;
 }
 
@@ -962,6 +1352,71 @@ IR_ALWAYS_INLINE ir_ref _ir_fold_cast(ir_ctx *ctx, ir_ref ref, ir_type type)
 #define IR_FOLD_RULE(x) ((x) >> 21)
 #define IR_FOLD_KEY(x)  ((x) & 0x1fffff)
 
+#ifdef IR_FOLD_STATS
+/* The last rule that completed folding (for CSE performed by the caller) */
+static IR_THREAD_LOCAL uint32_t ir_fold_last_rule = _IR_RULE_LAST;
+
+# define IR_FOLD_STATS_MATCH(r) do { \
+		rule = (r); \
+		ir_atomic_inc_u64(&_ir_fold_stats[rule].matches); \
+	} while (0)
+# define IR_FOLD_STATS_NEXT() do { \
+		rule = _IR_RULE_LAST; \
+	} while (0)
+# define IR_FOLD_STATS_DONE() do { \
+		if (rule != _IR_RULE_LAST) { \
+			ir_atomic_inc_u64(&_ir_fold_stats[rule].successes); \
+		} \
+		ir_fold_last_rule = rule; \
+	} while (0)
+# define IR_FOLD_STATS_RESTART() do { \
+		ir_atomic_inc_u64(&_ir_fold_stats[rule].restarts); \
+		rule = _IR_RULE_LAST; \
+	} while (0)
+# define IR_FOLD_STATS_CSE() do { \
+		ir_atomic_inc_u64(&_ir_fold_stats[rule].cse_hits); \
+	} while (0)
+
+void ir_fold_stats_cse_hit(void)
+{
+	ir_atomic_inc_u64(&_ir_fold_stats[ir_fold_last_rule].cse_hits);
+}
+
+const ir_fold_stats *ir_fold_stats_get(uint32_t *count)
+{
+	*count = _IR_RULE_LAST + 1;
+	return _ir_fold_stats;
+}
+
+void ir_fold_stats_reset(void)
+{
+	uint32_t i;
+
+	for (i = 0; i <= _IR_RULE_LAST; i++) {
+		_ir_fold_stats[i].matches = 0;
+		_ir_fold_stats[i].successes = 0;
+		_ir_fold_stats[i].restarts = 0;
+		_ir_fold_stats[i].cse_hits = 0;
+	}
+}
+#else
+# define IR_FOLD_STATS_MATCH(r)
+# define IR_FOLD_STATS_NEXT()
+# define IR_FOLD_STATS_DONE()
+# define IR_FOLD_STATS_RESTART()
+# define IR_FOLD_STATS_CSE()
+
+const ir_fold_stats *ir_fold_stats_get(uint32_t *count)
+{
+	*count = 0;
+	return NULL;
+}
+
+void ir_fold_stats_reset(void)
+{
+}
+#endif
+
 /*
  * key = insn->op | (insn->op1->op << 7) | (insn->op2->op << 14)
  *
@@ -975,9 +1430,23 @@ ir_ref ir_folding(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3,
 	ir_ref ref;
 	ir_val val;
 	uint32_t key, any;
+#ifdef IR_FOLD_STATS
+	uint32_t rule = _IR_RULE_LAST;
+#endif
 	(void) op3_insn;
 
 restart:
+	if (UNEXPECTED(IR_IS_TYPE_VEC(IR_OPT_TYPE(opt)))) {
+		if ((opt & IR_OPT_OP_MASK) == IR_VSPLAT
+		 && IR_IS_CONST_OP(op1_insn->op)
+		 && !IR_IS_SYM_CONST(op1_insn->op)) {
+			/* splat(C) => vector constant */
+			val.u64 = op1_insn->val.u64;
+			goto ir_fold_const;
+		}
+		/* scalar folding rules are not applicable to vectors */
+		goto ir_fold_cse;
+	}
 	key = (opt & IR_OPT_OP_MASK) + ((uint32_t)op1_insn->op << 7) + ((uint32_t)op2_insn->op << 14);
 	any = 0x1fffff;
 	do {
@@ -989,11 +1458,13 @@ restart:
 		 || (fh = _ir_fold_hash[h+1], (fh & 0x1fffff) == k)
 #endif
 		) {
+			IR_FOLD_STATS_MATCH(IR_FOLD_RULE(fh));
 			switch (IR_FOLD_RULE(fh)) {
 #include "ir_fold.h"
 				default:
 					break;
 			}
+			IR_FOLD_STATS_NEXT();
 		}
 		if (any == 0x7f) {
 			/* All parrerns are checked. Pass on to CSE. */
@@ -1014,7 +1485,9 @@ restart:
 	} while (1);
 
 ir_fold_restart:
-	if (!ctx->use_lists) {
+	IR_FOLD_STATS_DONE();
+	IR_FOLD_STATS_RESTART();
+	if (!IR_FOLD_IN_OPT(ctx)) {
 		op1_insn = ctx->ir_base + op1;
 		op2_insn = ctx->ir_base + op2;
 		op3_insn = ctx->ir_base + op3;
@@ -1027,10 +1500,12 @@ ir_fold_restart:
 		return IR_FOLD_DO_RESTART;
 	}
 ir_fold_cse:
-	if (!ctx->use_lists) {
+	IR_FOLD_STATS_DONE();
+	if (!IR_FOLD_IN_OPT(ctx)) {
 		/* Local CSE */
 		ref = _ir_fold_cse(ctx, opt, op1, op2, op3);
 		if (ref) {
+			IR_FOLD_STATS_CSE();
 			return ref;
 		}
 
@@ -1057,7 +1532,8 @@ ir_fold_cse:
 		return IR_FOLD_DO_CSE;
 	}
 ir_fold_emit:
-	if (!ctx->use_lists) {
+	IR_FOLD_STATS_DONE();
+	if (!IR_FOLD_IN_OPT(ctx)) {
 		return ir_emit(ctx, opt, op1, op2, op3);
 	} else {
 		ctx->fold_insn.optx = opt;
@@ -1067,17 +1543,23 @@ ir_fold_emit:
 		return IR_FOLD_DO_EMIT;
 	}
 ir_fold_copy:
-	if (!ctx->use_lists) {
+	IR_FOLD_STATS_DONE();
+	if (!IR_FOLD_IN_OPT(ctx)) {
 		return ref;
 	} else {
 		ctx->fold_insn.op1 = ref;
 		return IR_FOLD_DO_COPY;
 	}
 ir_fold_const:
-	if (!ctx->use_lists) {
+	IR_FOLD_STATS_DONE();
+	if (!IR_FOLD_IN_OPT(ctx)) {
 		return ir_const(ctx, val, IR_OPT_TYPE(opt));
 	} else {
-		ctx->fold_insn.opt = IR_OPT(IR_OPT_TYPE(opt), IR_OPT_TYPE(opt));
+		if (UNEXPECTED(IR_IS_TYPE_VEC(IR_OPT_TYPE(opt)))) {
+			ctx->fold_insn.opt = IR_OPT(ir_vec_lane_type(IR_OPT_TYPE(opt)), IR_OPT_TYPE(opt));
+		} else {
+			ctx->fold_insn.opt = IR_OPT(IR_OPT_TYPE(opt), IR_OPT_TYPE(opt));
+		}
 		ctx->fold_insn.val.u64 = val.u64;
 		return IR_FOLD_DO_CONST;
 	}
@@ -1148,9 +1630,32 @@ void ir_set_op(ir_ctx *ctx, ir_ref ref, int32_t n, ir_ref val)
 		IR_ASSERT(n <= count);
 	}
 #endif
+	if (UNEXPECTED(ctx->flags2 & IR_INCREMENTAL_USE_LISTS)
+	 && n <= ir_input_edges_count(ctx, insn)) {
+		ir_ref old_val = ir_insn_op(insn, n);
+
+		if (old_val > 0) {
+			ir_use_list_remove_one(ctx, old_val, ref);
+		}
+		if (val > 0) {
+			ir_use_list_insert(ctx, val, ref);
+		}
+	}
 	ir_insn_set_op(insn, n, val);
 }
 
+void ir_set_alias_class(ir_ctx *ctx, ir_ref ref, uint16_t alias_class)
+{
+	IR_ASSERT(ref > 0 && ref < ctx->insns_limit);
+	if (!ctx->alias_classes) {
+		if (!alias_class) {
+			return;
+		}
+		ctx->alias_classes = ir_mem_calloc(ctx->insns_limit, sizeof(uint16_t));
+	}
+	ctx->alias_classes[ref] = alias_class;
+}
+
 ir_ref ir_get_op(const ir_ctx *ctx, ir_ref ref, int32_t n)
 {
 	const ir_insn *insn = &ctx->ir_base[ref];
@@ -1216,6 +1721,48 @@ ir_ref ir_binding_find(const ir_ctx *ctx, ir_ref ref)
 	return (var != (ir_ref)IR_INVALID_VAL) ? var : 0;
 }
 
+/* Complete incrementally constructed def->use edges (the same layout as the batch construction) */
+static void ir_finish_def_use_lists(ir_ctx *ctx)
+{
+	ir_ref n, i, edges_count = 0;
+	ir_insn *insn;
+	ir_ref *edges;
+	ir_use_list *use_list;
+
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
+		uint32_t flags = ir_op_flags[insn->op];
+
+		if (UNEXPECTED(IR_OP_HAS_VAR_INPUTS(flags))) {
+			n = insn->inputs_count;
+		} else {
+			/* overwrite local CSE chain links */
+			n = insn->inputs_count = IR_INPUT_EDGES_COUNT(flags);
+		}
+		edges_count += ctx->use_lists[i].count;
+		n = ir_insn_inputs_to_len(n);
+		i += n;
+		insn += n;
+	}
+
+	edges = ir_ctx_malloc(ctx, IR_ALIGNED_SIZE(edges_count * sizeof(ir_ref), 4096));
+	edges_count = 0;
+	for (i = IR_UNUSED + 1, use_list = &ctx->use_lists[i]; i < ctx->insns_count; i++, use_list++) {
+		n = use_list->count;
+		if (n) {
+			memcpy(edges + edges_count, ctx->use_edges + use_list->refs, n * sizeof(ir_ref));
+			use_list->refs = edges_count;
+			edges_count += n;
+		} else {
+			use_list->refs = 0;
+		}
+	}
+
+	ir_ctx_free(ctx, ctx->use_edges);
+	ctx->use_edges = edges;
+	ctx->use_edges_count = edges_count;
+	ctx->flags2 &= ~IR_INCREMENTAL_USE_LISTS;
+}
+
 /* Batch construction of def->use edges */
 #if 0
 void ir_build_def_use_lists(ir_ctx *ctx)
@@ -1223,7 +1770,7 @@ void ir_build_def_use_lists(ir_ctx *ctx)
 	ir_ref n, i, j, *p, def;
 	ir_insn *insn;
 	uint32_t edges_count;
-	ir_use_list *lists = ir_mem_calloc(ctx->insns_limit, sizeof(ir_use_list));
+	ir_use_list *lists = ir_ctx_calloc(ctx, ctx->insns_limit, sizeof(ir_use_list));
 	ir_ref *edges;
 	ir_use_list *use_list;
 
@@ -1253,7 +1800,7 @@ void ir_build_def_use_lists(ir_ctx *ctx)
 		use_list->count = 0;
 	}
 
-	edges = ir_mem_malloc(IR_ALIGNED_SIZE(edges_count * sizeof(ir_ref), 4096));
+	edges = ir_ctx_malloc(ctx, IR_ALIGNED_SIZE(edges_count * sizeof(ir_ref), 4096));
 	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
 		n = insn->inputs_count;
 		for (j = n, p = insn->ops + 1; j > 0; j--, p++) {
@@ -1278,11 +1825,17 @@ void ir_build_def_use_lists(ir_ctx *ctx)
 	ir_ref n, i, j, *p, def;
 	ir_insn *insn;
 	size_t linked_lists_size, linked_lists_top = 0, edges_count = 0;
-	ir_use_list *lists = ir_mem_calloc(ctx->insns_limit, sizeof(ir_use_list));
+	ir_use_list *lists;
 	ir_ref *edges;
 	ir_use_list *use_list;
 	ir_ref *linked_lists;
 
+	if (ctx->flags2 & IR_INCREMENTAL_USE_LISTS) {
+		ir_finish_def_use_lists(ctx);
+		return;
+	}
+
+	lists = ir_ctx_calloc(ctx, ctx->insns_limit, sizeof(ir_use_list));
 	linked_lists_size = IR_ALIGNED_SIZE(ctx->insns_count, 1024);
 	linked_lists = ir_mem_malloc(linked_lists_size * sizeof(ir_ref));
 	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
@@ -1323,7 +1876,7 @@ void ir_build_def_use_lists(ir_ctx *ctx)
 
 	IR_ASSERT(edges_count <= 0x7fffffff);
 	ctx->use_edges_count = (ir_ref)edges_count;
-	edges = ir_mem_malloc(IR_ALIGNED_SIZE(edges_count * sizeof(ir_ref), 4096));
+	edges = ir_ctx_malloc(ctx, IR_ALIGNED_SIZE(edges_count * sizeof(ir_ref), 4096));
 	for (use_list = lists + ctx->insns_count - 1; use_list != lists; use_list--) {
 		n = use_list->refs;
 		if (n) {
@@ -1446,7 +1999,7 @@ bool ir_use_list_add(ir_ctx *ctx, ir_ref to, ir_ref ref)
 
 		if (old_size < new_size) {
 			/* Reallocate the whole edges buffer (this is inefficient) */
-			ctx->use_edges = ir_mem_realloc(ctx->use_edges, new_size);
+			ctx->use_edges = ir_ctx_realloc(ctx, ctx->use_edges, old_size, new_size);
 			if (n == ctx->use_edges_count) {
 				ctx->use_edges[n] = ref;
 				use_list->count++;
@@ -1889,7 +2442,7 @@ int pkey_alloc(unsigned int, unsigned int) __attribute__((weak));
 int pkey_free(int) __attribute__((weak));
 int pkey_set(int, unsigned) __attribute__((weak));
 
-static int ir_pkey = 0;
+static volatile int ir_pkey = 0;
 #endif
 
 void *ir_mem_mmap(size_t size)
@@ -1897,8 +2450,9 @@ void *ir_mem_mmap(size_t size)
 #ifdef HAVE_PKEY_MPROTECT
 	if (!ir_pkey && pkey_mprotect) {
 		int key = pkey_alloc(0, PKEY_DISABLE_WRITE);
-		if (key > 0) {
-			ir_pkey = key;
+		if (key > 0 && !ir_atomic_cas_int(&ir_pkey, 0, key)) {
+			/* another thread was faster */
+			pkey_free(key);
 		}
 	}
 	if (ir_pkey > 0) {
@@ -1998,13 +2552,29 @@ int ir_mem_flush(void *ptr, size_t size)
 }
 #endif
 
-/* Alias Analyses */
-typedef enum _ir_alias {
-	IR_MAY_ALIAS  = -1,
-	IR_NO_ALIAS   =  0,
-	IR_MUST_ALIAS =  1,
-} ir_alias;
+/* Code buffer allocation (bump allocation, safe for concurrent use by several threads) */
+void *ir_code_buffer_alloc(ir_code_buffer *code_buffer, size_t size, size_t align)
+{
+	void *pos, *entry;
 
+	do {
+		pos = ir_atomic_load_ptr((void*volatile*)&code_buffer->pos);
+		entry = (void*)IR_ALIGNED_SIZE(((size_t)(pos)), align);
+		if ((char*)entry > (char*)code_buffer->end
+		 || size > (size_t)((char*)code_buffer->end - (char*)entry)) {
+			return NULL;
+		}
+	} while (!ir_atomic_cas_ptr((void*volatile*)&code_buffer->pos, pos, (char*)entry + size));
+	return entry;
+}
+
+void ir_code_buffer_release(ir_code_buffer *code_buffer, void *ptr, size_t size)
+{
+	/* rollback (only if nothing was allocated after this block) */
+	ir_atomic_cas_ptr((void*volatile*)&code_buffer->pos, (char*)ptr + size, ptr);
+}
+
+/* Alias Analyses */
 IR_ALWAYS_INLINE const ir_insn *ir_decompose_addr(const ir_ctx *ctx, ir_ref addr, ir_ref *base, ir_ref *index, intptr_t *offset)
 {
 	const ir_insn *insn = &ctx->ir_base[addr];
@@ -2105,7 +2675,7 @@ IR_ALWAYS_INLINE const ir_insn *ir_get_base_addr(const ir_ctx *ctx, const ir_ins
 	return insn;
 }
 
-static ir_alias ir_check_aliasing(const ir_ctx *ctx, ir_ref addr1, ir_ref addr2, ir_type type1, ir_type type2)
+ir_alias ir_check_aliasing(const ir_ctx *ctx, ir_ref addr1, ir_ref addr2, ir_type type1, ir_type type2)
 {
 	const ir_insn *insn1, *insn2;
 	ir_ref base1, base2, index1, index2;
@@ -2148,7 +2718,7 @@ static ir_alias ir_check_aliasing(const ir_ctx *ctx, ir_ref addr1, ir_ref addr2,
 	return IR_MAY_ALIAS;
 }
 
-IR_ALWAYS_INLINE ir_ref ir_find_aliasing_load_i(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr, ir_ref limit)
+IR_ALWAYS_INLINE ir_ref ir_find_aliasing_load_i(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr, uint16_t alias_class, ir_ref limit)
 {
 	const ir_insn *insn;
 	uint32_t modified_regset = 0;
@@ -2184,7 +2754,8 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_load_i(const ir_ctx *ctx, ir_ref ref, i
 				} else {
 					return IR_UNUSED;
 				}
-			} else if (ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
+			} else if (!ir_alias_class_disjoint(alias_class, ir_alias_class(ctx, ref))
+					&& ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
 				return IR_UNUSED;
 			}
 		} else if (insn->op == IR_RSTORE) {
@@ -2211,6 +2782,8 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_load_i(const ir_ctx *ctx, ir_ref ref, i
 		} else if (insn->op == IR_MERGE
 				|| insn->op == IR_LOOP_BEGIN
 				|| insn->op == IR_VSTORE
+				|| insn->op == IR_MEMCPY
+				|| insn->op == IR_MEMSET
 				|| (insn->op == IR_BEGIN && insn->op2)) {
 			return IR_UNUSED;
 		}
@@ -2220,9 +2793,9 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_load_i(const ir_ctx *ctx, ir_ref ref, i
 	return IR_UNUSED;
 }
 
-ir_ref ir_find_aliasing_load(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr)
+ir_ref ir_find_aliasing_load(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr, uint16_t alias_class)
 {
-	return ir_find_aliasing_load_i(ctx, ref, type, addr, (addr > 0 && addr < ref) ? addr : 1);
+	return ir_find_aliasing_load_i(ctx, ref, type, addr, alias_class, (addr > 0 && addr < ref) ? addr : 1);
 }
 
 IR_ALWAYS_INLINE ir_ref ir_find_aliasing_vload_i(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref var)
@@ -2279,6 +2852,8 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_vload_i(const ir_ctx *ctx, ir_ref ref,
 		} else if (insn->op == IR_MERGE
 				|| insn->op == IR_LOOP_BEGIN
 				|| insn->op == IR_STORE
+				|| insn->op == IR_MEMCPY
+				|| insn->op == IR_MEMSET
 				|| (insn->op == IR_BEGIN && insn->op2)) {
 			break;
 		}
@@ -2293,7 +2868,7 @@ ir_ref ir_find_aliasing_vload(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_re
 	return ir_find_aliasing_vload_i(ctx, ref, type, var);
 }
 
-IR_ALWAYS_INLINE ir_ref ir_find_aliasing_store_i(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val, ir_ref limit)
+IR_ALWAYS_INLINE ir_ref ir_find_aliasing_store_i(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val, uint16_t alias_class, ir_ref limit)
 {
 	ir_ref next = IR_UNUSED;
 	ir_insn *insn;
@@ -2322,12 +2897,15 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_store_i(ir_ctx *ctx, ir_ref ref, ir_ref
 					} else {
 						if (!guarded) {
 							/* the previous STORE is dead (there are no LOADs) */
-							if (!ctx->use_lists) {
+							if (!IR_FOLD_IN_OPT(ctx)) {
 								if (next) {
-									ctx->ir_base[next].op1 = insn->op1;
+									ir_set_op(ctx, next, 1, insn->op1);
 								} else {
 									ctx->control = insn->op1;
 								}
+								if (UNEXPECTED(ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+									ir_use_lists_remove_inputs(ctx, ref);
+								}
 							} else {
 								ir_ref prev = insn->op1;
 
@@ -2373,7 +2951,8 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_store_i(ir_ctx *ctx, ir_ref ref, ir_ref
 			}
 			type2 = insn->type;
 check_aliasing:
-			if (ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
+			if (!ir_alias_class_disjoint(alias_class, ir_alias_class(ctx, ref))
+			 && ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
 				break;
 			}
 		} else if (insn->op == IR_GUARD || insn->op == IR_GUARD_NOT) {
@@ -2386,7 +2965,7 @@ check_aliasing:
 			} else {
 				break;
 			}
-		} else if (insn->op == IR_CALL) {
+		} else if (insn->op == IR_CALL || insn->op == IR_MEMCPY || insn->op == IR_MEMSET) {
 			break;
 		}
 		next = ref;
@@ -2396,9 +2975,9 @@ check_aliasing:
 	return IR_UNUSED;
 }
 
-ir_ref ir_find_aliasing_store(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val)
+ir_ref ir_find_aliasing_store(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val, uint16_t alias_class)
 {
-	return ir_find_aliasing_store_i(ctx, ref, addr, val, (addr > 0 && addr < ref) ? addr : 1);
+	return ir_find_aliasing_store_i(ctx, ref, addr, val, alias_class, (addr > 0 && addr < ref) ? addr : 1);
 }
 
 IR_ALWAYS_INLINE ir_ref ir_find_aliasing_vstore_i(ir_ctx *ctx, ir_ref ref, ir_ref var, ir_ref val)
@@ -2428,12 +3007,15 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_vstore_i(ir_ctx *ctx, ir_ref ref, ir_re
 				} else {
 					if (!guarded) {
 						/* the previous VSTORE is dead (there are no VLOADs) */
-						if (!ctx->use_lists) {
+						if (!IR_FOLD_IN_OPT(ctx)) {
 							if (next) {
-								ctx->ir_base[next].op1 = insn->op1;
+								ir_set_op(ctx, next, 1, insn->op1);
 							} else {
 								ctx->control = insn->op1;
 							}
+							if (UNEXPECTED(ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+								ir_use_lists_remove_inputs(ctx, ref);
+							}
 						} else {
 							ir_ref prev = insn->op1;
 
@@ -2478,7 +3060,11 @@ IR_ALWAYS_INLINE ir_ref ir_find_aliasing_vstore_i(ir_ctx *ctx, ir_ref ref, ir_re
 			} else {
 				break;
 			}
-		} else if (insn->op == IR_CALL || insn->op == IR_LOAD || insn->op == IR_STORE) {
+		} else if (insn->op == IR_CALL
+				|| insn->op == IR_LOAD
+				|| insn->op == IR_STORE
+				|| insn->op == IR_MEMCPY
+				|| insn->op == IR_MEMSET) {
 			break;
 		}
 		next = ref;
@@ -2513,7 +3099,7 @@ static ir_ref ir_last_guard(ir_ctx *ctx)
 
 ir_ref _ir_DIV(ir_ctx *ctx, ir_type type, ir_ref op1, ir_ref op2)
 {
-	ir_ref guard = (IR_IS_TYPE_FP(type) || (IR_IS_CONST_REF(op2) && ctx->ir_base[op2].val.u64 != 0)) ?
+	ir_ref guard = (!IR_IS_TYPE_INT(type) || (IR_IS_CONST_REF(op2) && ctx->ir_base[op2].val.u64 != 0)) ?
 		IR_UNUSED : ir_last_guard(ctx);
 	return ir_fold3(ctx, IR_OPT(IR_DIV, type), op1, op2, guard);
 }
@@ -2598,14 +3184,15 @@ ir_ref _ir_PHI_N(ir_ctx *ctx, ir_type type, ir_ref n, ir_ref *inputs)
 
 void _ir_PHI_SET_OP(ir_ctx *ctx, ir_ref phi, ir_ref pos, ir_ref src)
 {
+#ifdef IR_DEBUG
 	ir_insn *insn = &ctx->ir_base[phi];
-	ir_ref *ops = insn->ops;
 
 	IR_ASSERT(insn->op == IR_PHI);
 	IR_ASSERT(ctx->ir_base[insn->op1].op == IR_MERGE || ctx->ir_base[insn->op1].op == IR_LOOP_BEGIN);
 	IR_ASSERT(pos > 0 && pos < insn->inputs_count);
+#endif
 	pos++; /* op1 is used for control */
-	ops[pos] = src;
+	ir_set_op(ctx, phi, pos, src);
 }
 
 void _ir_START(ir_ctx *ctx)
@@ -2634,6 +3221,9 @@ void _ir_BEGIN(ir_ctx *ctx, ir_ref src)
 	 && ctx->ir_base[src].op == IR_END) {
 		/* merge with the last END */
 		ctx->control = ctx->ir_base[src].op1;
+		if (UNEXPECTED(ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+			ir_use_list_remove_one(ctx, ctx->control, src);
+		}
 		ctx->insns_count--;
 	} else {
 		ctx->control = ir_emit1(ctx, IR_BEGIN, src);
@@ -2788,25 +3378,23 @@ void _ir_MERGE_N(ir_ctx *ctx, ir_ref n, ir_ref *inputs)
 	if (n == 1) {
 		_ir_BEGIN(ctx, inputs[0]);
 	} else {
-		ir_ref *ops;
-
 		ctx->control = ir_emit_N(ctx, IR_MERGE, n);
-		ops = ctx->ir_base[ctx->control].ops;
 		while (n) {
+			ir_set_op(ctx, ctx->control, n, inputs[n - 1]);
 			n--;
-			ops[n + 1] = inputs[n];
 		}
 	}
 }
 
 void _ir_MERGE_SET_OP(ir_ctx *ctx, ir_ref merge, ir_ref pos, ir_ref src)
 {
+#ifdef IR_DEBUG
 	ir_insn *insn = &ctx->ir_base[merge];
-	ir_ref *ops = insn->ops;
 
 	IR_ASSERT(insn->op == IR_MERGE || insn->op == IR_LOOP_BEGIN);
 	IR_ASSERT(pos > 0 && pos <= insn->inputs_count);
-	ops[pos] = src;
+#endif
+	ir_set_op(ctx, merge, pos, src);
 }
 
 ir_ref _ir_END_LIST(ir_ctx *ctx, ir_ref list)
@@ -3298,21 +3886,18 @@ ir_ref _ir_SNAPSHOT(ir_ctx *ctx, ir_ref n)
 
 	IR_ASSERT(ctx->control);
 	snapshot = ir_emit_N(ctx, IR_SNAPSHOT, 1 + n); /* op1 is used for control */
-	ctx->ir_base[snapshot].op1 = ctx->control;
+	ir_set_op(ctx, snapshot, 1, ctx->control);
 	ctx->control = snapshot;
 	return snapshot;
 }
 
 void _ir_SNAPSHOT_SET_OP(ir_ctx *ctx, ir_ref snapshot, ir_ref pos, ir_ref val)
 {
-	ir_insn *insn = &ctx->ir_base[snapshot];
-	ir_ref *ops = insn->ops;
-
 	IR_ASSERT(val < snapshot);
-	IR_ASSERT(insn->op == IR_SNAPSHOT);
+	IR_ASSERT(ctx->ir_base[snapshot].op == IR_SNAPSHOT);
 	pos++; /* op1 is used for control */
-	IR_ASSERT(pos > 1 && pos <= insn->inputs_count);
-	ops[pos] = val;
+	IR_ASSERT(pos > 1 && pos <= ctx->ir_base[snapshot].inputs_count);
+	ir_set_op(ctx, snapshot, pos, val);
 }
 
 ir_ref _ir_EXITCALL(ir_ctx *ctx, ir_ref func)
@@ -3397,7 +3982,7 @@ void _ir_RSTORE(ir_ctx *ctx, ir_ref reg, ir_ref val)
 	ctx->control = ir_emit3(ctx, IR_RSTORE, ctx->control, val, reg);
 }
 
-ir_ref _ir_LOAD(ir_ctx *ctx, ir_type type, ir_ref addr)
+ir_ref _ir_LOAD_ALIAS(ir_ctx *ctx, ir_type type, ir_ref addr, uint16_t alias_class)
 {
 	ir_ref ref;
 
@@ -3406,7 +3991,7 @@ ir_ref _ir_LOAD(ir_ctx *ctx, ir_type type, ir_ref addr)
 		if (ctx->ir_base[addr].op == IR_VADDR) {
 			return _ir_VLOAD(ctx, type, ctx->ir_base[addr].op1);
 		}
-		ref = ir_find_aliasing_load_i(ctx, ctx->control, type, addr, (addr > 0) ? addr : 1);
+		ref = ir_find_aliasing_load_i(ctx, ctx->control, type, addr, alias_class, (addr > 0) ? addr : 1);
 		if (ref) {
 			const ir_insn *insn = &ctx->ir_base[ref];
 
@@ -3419,10 +4004,12 @@ ir_ref _ir_LOAD(ir_ctx *ctx, ir_type type, ir_ref addr)
 			}
 		}
 	}
-	return ctx->control = ir_emit2(ctx, IR_OPT(IR_LOAD, type), ctx->control, addr);
+	ref = ctx->control = ir_emit2(ctx, IR_OPT(IR_LOAD, type), ctx->control, addr);
+	ir_set_alias_class(ctx, ref, alias_class);
+	return ref;
 }
 
-void _ir_STORE(ir_ctx *ctx, ir_ref addr, ir_ref val)
+void _ir_STORE_ALIAS(ir_ctx *ctx, ir_ref addr, ir_ref val, uint16_t alias_class)
 {
 	IR_ASSERT(ctx->control);
 	if (EXPECTED(ctx->flags & IR_OPT_FOLDING)) {
@@ -3430,12 +4017,23 @@ void _ir_STORE(ir_ctx *ctx, ir_ref addr, ir_ref val)
 			_ir_VSTORE(ctx, ctx->ir_base[addr].op1, val);
 			return;
 		}
-		if (ir_find_aliasing_store_i(ctx, ctx->control, addr, val, (addr > 0) ? addr : 1)) {
+		if (ir_find_aliasing_store_i(ctx, ctx->control, addr, val, alias_class, (addr > 0) ? addr : 1)) {
 			/* dead STORE */
 			return;
 		}
 	}
 	ctx->control = ir_emit3(ctx, IR_STORE, ctx->control, addr, val);
+	ir_set_alias_class(ctx, ctx->control, alias_class);
+}
+
+ir_ref _ir_LOAD(ir_ctx *ctx, ir_type type, ir_ref addr)
+{
+	return _ir_LOAD_ALIAS(ctx, type, addr, 0);
+}
+
+void _ir_STORE(ir_ctx *ctx, ir_ref addr, ir_ref val)
+{
+	_ir_STORE_ALIAS(ctx, addr, val, 0);
 }
 
 ir_ref _ir_LOAD_v(ir_ctx *ctx, ir_type type, ir_ref addr)
@@ -3450,6 +4048,32 @@ void _ir_STORE_v(ir_ctx *ctx, ir_ref addr, ir_ref val)
 	ctx->control = ir_emit3(ctx, IR_STORE_v, ctx->control, addr, val);
 }
 
+void _ir_MEMCPY(ir_ctx *ctx, ir_ref dst, ir_ref src, ir_ref size)
+{
+	ir_ref ref;
+
+	IR_ASSERT(ctx->control);
+	ref = ir_emit_N(ctx, IR_MEMCPY, 4);
+	ir_set_op(ctx, ref, 1, ctx->control);
+	ir_set_op(ctx, ref, 2, dst);
+	ir_set_op(ctx, ref, 3, src);
+	ir_set_op(ctx, ref, 4, size);
+	ctx->control = ref;
+}
+
+void _ir_MEMSET(ir_ctx *ctx, ir_ref dst, ir_ref val, ir_ref size)
+{
+	ir_ref ref;
+
+	IR_ASSERT(ctx->control);
+	ref = ir_emit_N(ctx, IR_MEMSET, 4);
+	ir_set_op(ctx, ref, 1, ctx->control);
+	ir_set_op(ctx, ref, 2, dst);
+	ir_set_op(ctx, ref, 3, val);
+	ir_set_op(ctx, ref, 4, size);
+	ctx->control = ref;
+}
+
 void _ir_VA_START(ir_ctx *ctx, ir_ref list)
 {
 	IR_ASSERT(ctx->control);
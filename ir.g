@@ -46,13 +46,17 @@
 
 #define IR_MAX_OPERANDS 512
 
-const unsigned char *yy_buf;
-const unsigned char *yy_end;
-const unsigned char *yy_pos;
-const unsigned char *yy_text;
-uint32_t yy_line;
+/* the parser state is thread local to allow loading of different files in parallel */
+static IR_THREAD_LOCAL const unsigned char *yy_buf;
+static IR_THREAD_LOCAL const unsigned char *yy_end;
+static IR_THREAD_LOCAL const unsigned char *yy_pos;
+static IR_THREAD_LOCAL const unsigned char *yy_text;
+static IR_THREAD_LOCAL uint32_t yy_line;
 
-static jmp_buf yy_jmp_buf;
+static IR_THREAD_LOCAL jmp_buf yy_jmp_buf;
+
+/* (insn, operand number) pairs of the forward references in IR_INCREMENTAL_USE_LISTS mode */
+static IR_THREAD_LOCAL ir_list yy_fwd_uses;
 
 typedef struct _ir_parser_ctx {
 	ir_ctx    *ctx;
@@ -63,8 +67,8 @@ typedef struct _ir_parser_ctx {
 	ir_strtab  var_tab;
 } ir_parser_ctx;
 
-static ir_parser_ctx *yy_ctx = NULL; /* we keep this global only to cleanum memory on syntax errors */
-static ir_strtab op_tab;
+static IR_THREAD_LOCAL ir_parser_ctx *yy_ctx = NULL; /* we keep this global only to cleanum memory on syntax errors */
+static IR_THREAD_LOCAL ir_strtab op_tab;
 
 #define IR_UNRESOLVED_MASK            0xc0000000
 #define IR_UNRESOLVED_LIST_END        ((ir_ref)IR_UNRESOLVED_MASK)
@@ -93,6 +97,11 @@ static ir_ref ir_use_var(ir_parser_ctx *p, uint32_t n, const char *str, size_t l
 		/* "ref" keeps the tail of the list */
 		ir_strtab_update(&p->var_tab, str, len32, IR_ENCODE_UNRESOLVED_REF(p->curr_ref, n));
 	}
+	if (IR_IS_UNRESOLVED(ref) && (p->ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+		/* the def->use edge is added when the whole function is loaded (see ir_add_fwd_uses()) */
+		ir_list_push(&yy_fwd_uses, p->curr_ref);
+		ir_list_push(&yy_fwd_uses, n);
+	}
 	return ref;
 }
 
@@ -124,6 +133,24 @@ static void ir_define_var(ir_parser_ctx *p, const char *str, size_t len, ir_ref
 	}
 }
 
+static void ir_add_fwd_uses(ir_parser_ctx *p)
+{
+	ir_ctx *ctx = p->ctx;
+	uint32_t i;
+
+	/* forward references were patched in place, so they are still missing in the use lists */
+	for (i = 0; i < ir_list_len(&yy_fwd_uses); i += 2) {
+		ir_ref ref = ir_list_at(&yy_fwd_uses, i);
+		int32_t n = ir_list_at(&yy_fwd_uses, i + 1);
+		ir_insn *insn = &ctx->ir_base[ref];
+		ir_ref val = ir_insn_op(insn, n);
+
+		ir_insn_set_op(insn, n, IR_UNUSED);
+		ir_set_op(ctx, ref, n, val);
+	}
+	ir_list_clear(&yy_fwd_uses);
+}
+
 static void report_undefined_var(const char *str, uint32_t len, ir_str val)
 {
 	if (IR_IS_UNRESOLVED(val)) {
@@ -486,6 +513,7 @@ ir_func(ir_parser_ctx *p):
 	{yy_ctx = p;}
 	"{" ( ("NOP" | ir_insn(p) ir_modifier(p)? ) ";" )* "}"
 	{if (p->undef_count) ir_check_indefined_vars(p);}
+	{if (p->ctx->flags2 & IR_INCREMENTAL_USE_LISTS) ir_add_fwd_uses(p);}
 	{if (p->bad_insns) p->ctx->flags |= IR_OPT_FOLDING;}
 	{yy_ctx = NULL;}
 	{ir_strtab_free(&p->var_tab);}
@@ -573,6 +601,7 @@ ir_insn(ir_parser_ctx *p):
 	{ir_ref op1 = IR_UNUSED;}
 	{ir_ref op2 = IR_UNUSED;}
 	{ir_ref op3 = IR_UNUSED;}
+	{ir_ref op4 = IR_UNUSED;}
 	{ir_ref ref = IR_UNUSED;}
 	{ir_ref ref2 = IR_UNUSED;}
 	{ir_val val;}
@@ -594,7 +623,7 @@ ir_insn(ir_parser_ctx *p):
 	)
 	"="
 	(	{val.u64 = 0;}
-		const(t, &val)
+		const(IR_IS_TYPE_VEC(t) ? ir_vec_lane_type(t) : t, &val)
 		{ref = ir_const(p->ctx, val, t);}
 	|	"func"
 		(	ID(&func, &func_len)
@@ -623,9 +652,16 @@ ir_insn(ir_parser_ctx *p):
 			DECNUMBER(IR_I32, &count)
 			{if (op == IR_PHI || op == IR_SNAPSHOT) count.i32++;}
 			{if (op == IR_CALL || op == IR_TAILCALL || op == IR_ASM) count.i32+=2;}
+			{if (op == IR_LOAD || op == IR_STORE) {
+				/* LOAD/n and STORE/n specify the alias class */
+				if (count.i32 < 0 || count.i32 > 0xffff) yy_error("alias class out of range");
+				val.i32 = count.i32;
+				count.i32 = IR_OPERANDS_COUNT(ir_op_flags[op]);
+			}}
 			{if (count.i32 < 0) yy_error("negative number of operands");}
 			{if (count.i32 > IR_MAX_OPERANDS) yy_error("too many operands");}
 			{ref = ref2 = ir_emit_N(p->ctx, IR_OPT(op, t), count.i32);}
+			{if (op == IR_LOAD || op == IR_STORE) ir_set_alias_class(p->ctx, ref, val.i32);}
 			(	"("
 				(
 					{p->curr_ref = ref;}
@@ -674,12 +710,19 @@ ir_insn(ir_parser_ctx *p):
 						(	","
 							val(p, op, 3, &op3)
 							{n = 3;}
+							(	","
+								val(p, op, 4, &op4)
+								{n = 4;}
+							)?
 						)?
 					)?
 				)?
 				")"
 			)?
 			{
+				if (n == 4 && op != IR_MEMCPY && op != IR_MEMSET) {
+					yy_error("too many operands");
+				}
 				if (IR_IS_FOLDABLE_OP(op)) {
 					if (IR_IS_UNRESOLVED(op1) || IR_IS_UNRESOLVED(op2) || IR_IS_UNRESOLVED(op3)) {
 						if (op == IR_PHI) {
@@ -777,12 +820,21 @@ fallback:
 						}
 					}
 emit:
-					if (!IR_OP_HAS_VAR_INPUTS(ir_op_flags[op])) {
-						opt = IR_OPT(op, t);
+					if (n == 4) {
+						/* MEMCPY and MEMSET */
+						ref = ref2 = ir_emit_N(p->ctx, IR_OPT(op, t), 4);
+						ir_set_op(p->ctx, ref, 1, op1);
+						ir_set_op(p->ctx, ref, 2, op2);
+						ir_set_op(p->ctx, ref, 3, op3);
+						ir_set_op(p->ctx, ref, 4, op4);
 					} else {
-						opt = IR_OPTX(op, t, n);
+						if (!IR_OP_HAS_VAR_INPUTS(ir_op_flags[op])) {
+							opt = IR_OPT(op, t);
+						} else {
+							opt = IR_OPTX(op, t, n);
+						}
+						ref = ref2 = ir_emit(p->ctx, opt, op1, op2, op3);
 					}
-					ref = ref2 = ir_emit(p->ctx, opt, op1, op2, op3);
 				}
 			}
 		)
@@ -827,6 +879,14 @@ type(uint8_t *t):
 	|	"int64_t"   {*t = IR_I64;}
 	|	"double"    {*t = IR_DOUBLE;}
 	|	"float"     {*t = IR_FLOAT;}
+	|	"i8x16_t"   {*t = IR_I8X16;}
+	|	"i32x4_t"   {*t = IR_I32X4;}
+	|	"f32x4_t"   {*t = IR_F32X4;}
+	|	"f64x2_t"   {*t = IR_F64X2;}
+	|	"i8x32_t"   {*t = IR_I8X32;}
+	|	"i32x8_t"   {*t = IR_I32X8;}
+	|	"f32x8_t"   {*t = IR_F32X8;}
+	|	"f64x4_t"   {*t = IR_F64X4;}
 	)
 ;
 
@@ -997,6 +1057,7 @@ int ir_load(ir_loader *loader, FILE *f) {
 	}
 
 	ir_mem_free((void*)yy_buf);
+	ir_list_free(&yy_fwd_uses);
 
 	return ret;
 }
@@ -123,7 +123,7 @@ extern "C" {
 # define IR_X86_I64 0
 #endif
 
-/* IR Type flags (low 4 bits are used for type size) */
+/* IR Type flags (low 4 bits are used for type size, 0 for vectors) */
 #define IR_TYPE_SIGNED     (1<<4)
 #define IR_TYPE_UNSIGNED   (1<<5)
 #define IR_TYPE_FP         (1<<6)
@@ -131,6 +131,7 @@ extern "C" {
 #define IR_TYPE_BOOL       (IR_TYPE_SPECIAL|IR_TYPE_UNSIGNED)
 #define IR_TYPE_ADDR       (IR_TYPE_SPECIAL|IR_TYPE_UNSIGNED)
 #define IR_TYPE_CHAR       (IR_TYPE_SPECIAL|IR_TYPE_SIGNED)
+#define IR_TYPE_VEC        (IR_TYPE_SPECIAL|IR_TYPE_FP)
 
 /* List of IR types */
 #define IR_TYPES(_) \
@@ -147,11 +148,20 @@ extern "C" {
 	_(I64,    int64_t,   i64,  IR_TYPE_SIGNED)   \
 	_(DOUBLE, double,    d,    IR_TYPE_FP)       \
 	_(FLOAT,  float,     f,    IR_TYPE_FP)       \
+	_(I8X16,  i8x16_t,   i8x16, IR_TYPE_VEC)     \
+	_(I32X4,  i32x4_t,   i32x4, IR_TYPE_VEC)     \
+	_(F32X4,  f32x4_t,   f32x4, IR_TYPE_VEC)     \
+	_(F64X2,  f64x2_t,   f64x2, IR_TYPE_VEC)     \
+	_(I8X32,  i8x32_t,   i8x32, IR_TYPE_VEC)     \
+	_(I32X8,  i32x8_t,   i32x8, IR_TYPE_VEC)     \
+	_(F32X8,  f32x8_t,   f32x8, IR_TYPE_VEC)     \
+	_(F64X4,  f64x4_t,   f64x4, IR_TYPE_VEC)     \
 
 #define IR_IS_TYPE_UNSIGNED(t) ((t) < IR_CHAR)
 #define IR_IS_TYPE_SIGNED(t)   ((t) >= IR_CHAR && (t) < IR_DOUBLE)
 #define IR_IS_TYPE_INT(t)      ((t) < IR_DOUBLE)
-#define IR_IS_TYPE_FP(t)       ((t) >= IR_DOUBLE)
+#define IR_IS_TYPE_FP(t)       ((t) >= IR_DOUBLE && (t) < IR_I8X16)
+#define IR_IS_TYPE_VEC(t)      ((t) >= IR_I8X16) /* 128- and 256-bit vectors (kept in FP registers) */
 
 #define IR_TYPE_ENUM(name, type, field, flags) IR_ ## name,
 
@@ -233,6 +243,9 @@ typedef enum _ir_type {
  * - CONST is the most often used instruction (encode with 1 bit)
  * - equality inversion:  EQ <-> NE                         => op =^ 1
  * - comparison inversion: [U]LT <-> [U]GT, [U]LE <-> [U]GE  => op =^ 3
+ *
+ * Opcode numbers are stored in binary IR modules and in the keys of the machine
+ * code cache. Bump IR_BIN_VERSION and IR_CODE_CACHE_VERSION when they change.
  */
 
 #define IR_OPS(_) \
@@ -316,12 +329,18 @@ typedef enum _ir_type {
 	_(MAX,	        d2C,  def, def, ___) /* max(op1, op2)               */ \
 	_(COND,	        d3,   def, def, def) /* op1 ? op2 : op3             */ \
 	\
+	/* vector ops (op2 of VEXTRACT and VSHUFFLE must be a constant)     */ \
+	_(VSPLAT,       d1,   def, ___, ___) /* copy scalar to all lanes    */ \
+	_(VEXTRACT,     d2,   def, def, ___) /* extract lane op2            */ \
+	_(VSHUFFLE,     d2,   def, def, ___) /* permute lanes (op2 - mask)  */ \
+	_(VMASK,        d1,   def, ___, ___) /* lane sign bits to integer   */ \
+	\
 	/* data-flow and miscellaneous ops                                  */ \
 	_(VADDR,        d1,   var, ___, ___) /* load address of local var   */ \
 	_(FRAME_ADDR,   d0,   ___, ___, ___) /* function frame address      */ \
 	_(PHI,          pN,   reg, def, def) /* SSA Phi function            */ \
 	_(COPY,         d1X1, def, opt, ___) /* COPY (last foldable op)     */ \
-	_(PI,           p2,   reg, def, ___) /* e-SSA Pi constraint ???     */ \
+	_(PI,           p2,   reg, def, ___) /* e-SSA Pi constraint         */ \
 	_(ARGVAL,       d1X2, def, num, num) /* pass struct arg by value    */ \
 	                                     /* (op2 - size, op3 - align)   */ \
 	/* (USE, RENAME)                                                    */ \
@@ -356,6 +375,8 @@ typedef enum _ir_type {
 	_(STORE_v,      s3,   src, ref, def) /* volatile variant of VSTORE  */ \
 	_(TLS,          l1X2, src, num, num) /* thread local variable       */ \
 	_(TRAP,         x1,   src, ___, ___) /* DebugBreak                  */ \
+	_(MEMCPY,       xN,   src, def, def) /* memcpy(dst, src, size)      */ \
+	_(MEMSET,       xN,   src, def, def) /* memset(dst, val, size)      */ \
 	/* memory reference ops (A, H, U, S, TMP, STR, NEW, X, V) ???       */ \
 	\
 	/* va_args                                                          */ \
@@ -594,14 +615,21 @@ void ir_strtab_free(ir_strtab *strtab);
 #define IR_OPT_CODEGEN         (1<<23)
 #define IR_OPT_TAILCALL        (1<<24)
 
-/* debug related */
+#define IR_ARENA_STORAGE       (1<<25) /* allocate per-pass data from ctx->storage arena (must be set in ir_init()) */
+
+#define IR_OPT_RANGES          (1<<26) /* value range inference in SCCP (-O2) */
+#define IR_OPT_GVN             (1<<27) /* GVN, load PRE and dead store elimination (-O2) */
+#define IR_OPT_LOOPS           (1<<28) /* loop rotation, LICM, versioning, unrolling and IV strength reduction (-O2) */
+#define IR_OPT_JUMP_THREAD     (1<<29) /* jump threading and tail duplication (-O2) */
+
+/* debug related (ir_ctx->flags2) */
 #ifdef IR_DEBUG
-# define IR_DEBUG_SCCP         (1<<26)
-# define IR_DEBUG_GCM          (1<<27)
-# define IR_DEBUG_GCM_SPLIT    (1<<28)
-# define IR_DEBUG_SCHEDULE     (1<<29)
-# define IR_DEBUG_RA           (1<<30)
-# define IR_DEBUG_BB_SCHEDULE  (1U<<31)
+# define IR_DEBUG_SCCP         (1<<16)
+# define IR_DEBUG_GCM          (1<<17)
+# define IR_DEBUG_GCM_SPLIT    (1<<18)
+# define IR_DEBUG_SCHEDULE     (1<<19)
+# define IR_DEBUG_RA           (1<<20)
+# define IR_DEBUG_BB_SCHEDULE  (1<<21)
 #endif
 
 /* Calling Conventions */
@@ -629,6 +657,7 @@ typedef struct _ir_arena         ir_arena;
 typedef struct _ir_live_interval ir_live_interval;
 typedef struct _ir_live_range    ir_live_range;
 typedef struct _ir_loader        ir_loader;
+typedef struct _ir_compile_stats ir_compile_stats;
 typedef int8_t ir_regs[4];
 
 typedef void (*ir_snapshot_create_t)(ir_ctx *ctx, ir_ref addr);
@@ -673,6 +702,7 @@ struct _ir_ctx {
 	ir_bitqueue       *iter_worklist;
 	ir_value_param    *value_params;            /* information about "by-val" struct parameters */
 	ir_hashtab        *binding;
+	uint16_t          *alias_classes;           /* alias classes of LOADs and STOREs (see ir_LOAD_ALIAS()) */
 	ir_use_list       *use_lists;               /* def->use lists for each instruction */
 	ir_ref            *use_edges;               /* the actual uses: use = ctx->use_edges[ctx->use_lists[def].refs + n] */
 	ir_ref             use_edges_count;         /* number of elements in use_edges[] array */
@@ -698,6 +728,7 @@ struct _ir_ctx {
 	int32_t            param_stack_size;
 	ir_live_interval **live_intervals;
 	ir_arena          *arena;
+	ir_arena          *storage;                 /* per-pass data storage (used with IR_ARENA_STORAGE) */
 	ir_live_range     *unused_ranges;
 	ir_regs           *regs;
 #if IR_X86_I64
@@ -732,6 +763,11 @@ struct _ir_ctx {
 	ir_set_veneer_t    set_veneer;
 #endif
 	ir_loader         *loader;
+	ir_compile_stats  *stats;                   /* optional per-pass compilation statistics (may be shared by the contexts of one thread) */
+	double             pass_start_time;         /* state of the running pass (used with "stats") */
+	ir_ref             pass_start_insns;
+	size_t             pass_start_heap;
+	uint32_t           pass_start_blocks;
 	ir_strtab          strtab;
 	ir_ref             prev_insn_chain[IR_LAST_FOLDABLE_OP + 1];
 	ir_ref             _const_hash[IR_CONST_HASH_SIZE];
@@ -741,6 +777,25 @@ struct _ir_ctx {
 void ir_init(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit);
 void ir_free(ir_ctx *ctx);
 void ir_truncate(ir_ctx *ctx);
+void ir_reset(ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit);
+
+/* Pool of reusable contexts (implementation in ir.c)
+ *
+ * ir_ctx_pool_acquire() initializes the context (like ir_init() with IR_ARENA_STORAGE), reusing the
+ * IR buffer and arenas of a context previously returned by ir_ctx_pool_release(). The released context
+ * is left empty (ir_free() on it does nothing). Pool is not thread-safe, use a separate pool for each thread.
+ */
+#define IR_CTX_POOL_SIZE 4
+
+typedef struct _ir_ctx_pool {
+	uint32_t  count;
+	ir_ctx    ctxs[IR_CTX_POOL_SIZE];
+} ir_ctx_pool;
+
+void ir_ctx_pool_init(ir_ctx_pool *pool);
+void ir_ctx_pool_acquire(ir_ctx_pool *pool, ir_ctx *ctx, uint32_t flags, ir_ref consts_limit, ir_ref insns_limit);
+void ir_ctx_pool_release(ir_ctx_pool *pool, ir_ctx *ctx);
+void ir_ctx_pool_free(ir_ctx_pool *pool);
 
 ir_ref ir_const(ir_ctx *ctx, ir_val val, uint8_t type);
 ir_ref ir_const_i8(ir_ctx *ctx, int8_t c);
@@ -860,6 +915,21 @@ ir_ref ir_binding_find(const ir_ctx *ctx, ir_ref ref);
 /* Def -> Use lists */
 void ir_build_def_use_lists(ir_ctx *ctx);
 
+/* Maintain Def -> Use lists during IR construction (must be called right after ir_init()).
+ * ir_build_def_use_lists() then only compacts them.
+ * ir_inline() can't be used with such functions.
+ */
+void ir_init_use_lists(ir_ctx *ctx);
+
+/* Function inlining (implementation in ir_inline.c)
+ * Must be called before ir_build_def_use_lists(). "lookup" returns the graph of the function
+ * referred by IR_FUNC constant "func", or NULL if it may not be inlined (unknown or recursive).
+ */
+typedef const ir_ctx *(*ir_inline_lookup_t)(const ir_ctx *ctx, ir_ref func, void *data);
+
+int32_t ir_inline_cost(const ir_ctx *callee);
+int ir_inline(ir_ctx *ctx, ir_inline_lookup_t lookup, void *data);
+
 /* SSA Construction */
 int ir_mem2ssa(ir_ctx *ctx);
 
@@ -873,7 +943,26 @@ void ir_reset_cfg(ir_ctx *ctx);
 /* SCCP - Sparse Conditional Constant Propagation (implementation in ir_sccp.c) */
 int ir_sccp(ir_ctx *ctx);
 
+/* GVN - Global Value Numbering and PRE (implementation in ir_gvn.c) */
+int ir_gvn(ir_ctx *ctx);
+
+/* DSE - Global Dead Store Elimination (implementation in ir_dse.c) */
+int ir_dse(ir_ctx *ctx);
+
+/* Loop optimizations (implementation in ir_loop.c) */
+int ir_rotate_loops(ir_ctx *ctx);
+int ir_version_loops(ir_ctx *ctx);
+int ir_unroll_loops(ir_ctx *ctx);
+int ir_reduce_induction_vars(ir_ctx *ctx);
+
+/* Tail duplication of dispatch blocks (implementation in ir_tail_dup.c) */
+int ir_tail_dup(ir_ctx *ctx);
+
+/* Jump threading (implementation in ir_jump_thread.c) */
+int ir_thread_jumps(ir_ctx *ctx);
+
 /* GCM - Global Code Motion and scheduling (implementation in ir_gcm.c) */
+int ir_licm(ir_ctx *ctx);
 int ir_gcm(ir_ctx *ctx);
 int ir_schedule(ir_ctx *ctx);
 
@@ -964,6 +1053,7 @@ struct _ir_loader {
 	const char * (*get_strl)  (ir_loader *loader, ir_str idx, size_t *len);
 };
 
+/* ir_loader_init() and ir_loader_free() should be called by each thread that uses ir_load() */
 void ir_loader_init(void);
 void ir_loader_free(void);
 int ir_load(ir_loader *loader, FILE *f);
@@ -985,6 +1075,30 @@ void ir_print_proto(const ir_ctx *ctx, ir_ref proto, FILE *f);
 void ir_print_proto_ex(uint8_t flags, ir_type ret_type, uint32_t params_count, const uint8_t *param_types, FILE *f);
 void ir_save(const ir_ctx *ctx, uint32_t save_flags, FILE *f);
 
+/* IR binary save/load API (implementation in ir_bin.c)
+ *
+ * Binary module starts with a header and consists of records that mirror ir_loader callbacks.
+ * Functions are stored in the native in-memory layout and loaded without parsing.
+ * The format is specific to the target and the IR version.
+ */
+bool ir_save_bin_header(FILE *f);
+bool ir_save_bin_external_sym_dcl(const char *name, uint32_t flags, FILE *f);
+bool ir_save_bin_external_func_dcl(const char *name, uint32_t flags, ir_type ret_type,
+                                   uint32_t params_count, const uint8_t *param_types, FILE *f);
+bool ir_save_bin_forward_func_dcl(const char *name, uint32_t flags, ir_type ret_type,
+                                  uint32_t params_count, const uint8_t *param_types, FILE *f);
+bool ir_save_bin_sym_dcl(const char *name, uint32_t flags, size_t size, FILE *f);
+bool ir_save_bin_sym_data(ir_type type, uint32_t count, const void *data, FILE *f);
+bool ir_save_bin_sym_data_str(const char *str, size_t len, FILE *f);
+bool ir_save_bin_sym_data_pad(size_t offset, FILE *f);
+bool ir_save_bin_sym_data_ref(ir_op op, const char *ref, uintptr_t offset, FILE *f);
+bool ir_save_bin_sym_data_end(uint32_t flags, FILE *f);
+bool ir_save_bin_func(const ir_ctx *ctx, const char *name, FILE *f);
+
+/* "buf" must be aligned to 8 bytes. ir_load_bin_file() maps the file into memory. */
+int ir_load_bin(ir_loader *loader, const void *buf, size_t size);
+int ir_load_bin_file(ir_loader *loader, const char *filename);
+
 /* IR debug dump API (implementation in ir_dump.c) */
 void ir_dump(const ir_ctx *ctx, FILE *f);
 void ir_dump_dot(const ir_ctx *ctx, const char *name, const char *comments, FILE *f);
@@ -994,6 +1108,89 @@ void ir_dump_cfg_map(const ir_ctx *ctx, FILE *f);
 void ir_dump_live_ranges(const ir_ctx *ctx, FILE *f);
 void ir_dump_codegen(const ir_ctx *ctx, FILE *f);
 
+/* IR compilation statistics (implementation in ir.c and ir_dump.c)
+ *
+ * The counters are not synchronized. Use a separate ir_compile_stats object for each thread.
+ */
+#define IR_PASSES(_) \
+	_(USE_LISTS,       "use-lists") \
+	_(MEM2SSA,         "mem2ssa") \
+	_(SCCP,            "sccp") \
+	_(CFG,             "cfg") \
+	_(DOM,             "dom") \
+	_(LOOPS,           "loops") \
+	_(JUMP_THREAD,     "jump-thread") \
+	_(ROTATE,          "rotate") \
+	_(GVN,             "gvn") \
+	_(DSE,             "dse") \
+	_(LICM,            "licm") \
+	_(VERSION,         "version") \
+	_(UNROLL,          "unroll") \
+	_(IVSR,            "ivsr") \
+	_(TAIL_DUP,        "tail-dup") \
+	_(GCM,             "gcm") \
+	_(SCHEDULE,        "schedule") \
+	_(MATCH,           "match") \
+	_(VREGS,           "vregs") \
+	_(LIVE_RANGES,     "live-ranges") \
+	_(COALESCE,        "coalesce") \
+	_(DESSA,           "dessa") \
+	_(REG_ALLOC,       "regalloc") \
+	_(SCHEDULE_BLOCKS, "bb-scheduling") \
+	_(EMIT_CODE,       "emit")
+
+#define IR_PASS_ENUM(name, str) IR_PASS_ ## name,
+
+typedef enum _ir_pass {
+	IR_PASSES(IR_PASS_ENUM)
+	IR_LAST_PASS
+} ir_pass;
+
+typedef struct _ir_pass_stats {
+	uint32_t count;                             /* number of pass invocations */
+	double   time;                              /* accumulated wall time (in seconds) */
+	uint64_t insns_in;                          /* accumulated number of instructions before the pass */
+	uint64_t insns_out;                         /* accumulated number of instructions after the pass */
+	size_t   peak_heap;                         /* max heap memory held by ir_ctx at pass boundaries */
+	size_t   peak_arena;                        /* max memory allocated in ctx->arena */
+	uint64_t arena_blocks;                      /* accumulated number of heap blocks added to ctx->arena and ctx->storage */
+} ir_pass_stats;
+
+struct _ir_compile_stats {
+	uint32_t      funcs_count;                  /* number of compiled functions (ir_compile_stats_func()) */
+	ir_pass_stats pass[IR_LAST_PASS];
+};
+
+extern const char *ir_pass_name[IR_LAST_PASS];
+
+void ir_compile_stats_init(ir_compile_stats *stats);
+void ir_compile_stats_func(ir_ctx *ctx);
+void ir_pass_start(ir_ctx *ctx);
+int  ir_pass_end(ir_ctx *ctx, ir_pass pass, int ret);
+void ir_dump_compile_stats(const ir_compile_stats *stats, FILE *f);
+
+/* Run a pass, collecting statistics if ctx->stats is set */
+#define IR_PASS_RUN(ctx, pass, call) \
+	((ctx)->stats ? (ir_pass_start(ctx), ir_pass_end(ctx, IR_PASS_ ## pass, (call))) : (call))
+
+/* Folding rule statistics (implementation in ir.c and ir_dump.c)
+ *
+ * Counters are collected only when libir is compiled with IR_FOLD_STATS (make FOLD_STATS=yes).
+ * They are global for all threads. ir_fold_stats_get() returns NULL otherwise.
+ */
+typedef struct _ir_fold_stats {
+	const char   *rule;                         /* rule pattern in ir_fold.h (NULL - no rule, CSE only) */
+	uint32_t      line;                         /* line in ir_fold.h */
+	uint64_t      matches;                      /* the pattern matched */
+	uint64_t      successes;                    /* the rule folded the instruction (didn't fall to the next one) */
+	uint64_t      restarts;                     /* the rule requested IR_FOLD_RESTART */
+	uint64_t      cse_hits;                     /* the result was replaced by an existing instruction */
+} ir_fold_stats;
+
+const ir_fold_stats *ir_fold_stats_get(uint32_t *count);
+void ir_fold_stats_reset(void);
+void ir_dump_fold_stats(FILE *f);
+
 /* IR to C conversion (implementation in ir_emit_c.c) */
 int ir_emit_c(ir_ctx *ctx, const char *name, FILE *f);
 void ir_emit_c_func_decl(const char *name, uint32_t flags, ir_type ret_type, uint32_t params_count, const uint8_t *param_types, FILE *f);
@@ -1008,6 +1205,20 @@ void ir_emit_llvm_sym_decl(const char *name, uint32_t flags, FILE *f);
 bool ir_check(const ir_ctx *ctx);
 void ir_consistency_check(void);
 
+/* IR structural hashing and comparison (implementation in ir_hash.c)
+ *
+ * The hash covers the graph structure, types, constant values, prototypes and symbol names,
+ * but doesn't depend on the node numbering, the order of constants or the string table layout.
+ * Compilation options (optimization flags, fixed registers, etc) are not included.
+ */
+typedef struct _ir_hash128 {
+	uint64_t lo;
+	uint64_t hi;
+} ir_hash128;
+
+void ir_ctx_hash(const ir_ctx *ctx, ir_hash128 *hash);
+bool ir_ctx_equal(const ir_ctx *ctx1, const ir_ctx *ctx2);
+
 /* Code patching (implementation in ir_patch.c) */
 int ir_patch(const void *code, size_t size, uint32_t jmp_table_size, const void *from_addr, const void *to_addr);
 
@@ -1030,8 +1241,25 @@ uint32_t ir_cpuinfo(void);
 const void *ir_emit_exitgroup(uint32_t first_exit_point, uint32_t exit_points_per_group, const void *exit_addr, ir_code_buffer *code_buffer, size_t *size_ptr);
 
 /* A reference IR JIT compiler */
+IR_ALWAYS_INLINE void *ir_jit_emit_code(ir_ctx *ctx, size_t *size)
+{
+	void *entry;
+
+	if (!ctx->stats) {
+		return ir_emit_code(ctx, size);
+	}
+	ir_pass_start(ctx);
+	entry = ir_emit_code(ctx, size);
+	ir_pass_end(ctx, IR_PASS_EMIT_CODE, entry != NULL);
+	return entry;
+}
+
 IR_ALWAYS_INLINE void *ir_jit_compile(ir_ctx *ctx, int opt_level, size_t *size)
 {
+	if (ctx->stats) {
+		ir_compile_stats_func(ctx);
+	}
+
 	if (opt_level == 0) {
 		if (ctx->flags & IR_OPT_FOLDING) {
 			// IR_ASSERT(0 && "IR_OPT_FOLDING is incompatible with -O0");
@@ -1039,16 +1267,16 @@ IR_ALWAYS_INLINE void *ir_jit_compile(ir_ctx *ctx, int opt_level, size_t *size)
 		}
 		ctx->flags &= ~(IR_OPT_CFG | IR_OPT_CODEGEN | IR_OPT_TAILCALL);
 
-		ir_build_def_use_lists(ctx);
+		(void)IR_PASS_RUN(ctx, USE_LISTS, (ir_build_def_use_lists(ctx), 1));
 
-		if (!ir_build_cfg(ctx)
-		 || !ir_match(ctx)
-		 || !ir_assign_virtual_registers(ctx)
-		 || !ir_compute_dessa_moves(ctx)) {
+		if (!IR_PASS_RUN(ctx, CFG, ir_build_cfg(ctx))
+		 || !IR_PASS_RUN(ctx, MATCH, ir_match(ctx))
+		 || !IR_PASS_RUN(ctx, VREGS, ir_assign_virtual_registers(ctx))
+		 || !IR_PASS_RUN(ctx, DESSA, ir_compute_dessa_moves(ctx))) {
 			return NULL;
 		}
 
-		return ir_emit_code(ctx, size);
+		return ir_jit_emit_code(ctx, size);
 	} else if (opt_level > 0) {
 		if (!(ctx->flags & IR_OPT_FOLDING)) {
 			// IR_ASSERT(0 && "IR_OPT_FOLDING must be set in ir_init() for -O1 and -O2");
@@ -1056,49 +1284,71 @@ IR_ALWAYS_INLINE void *ir_jit_compile(ir_ctx *ctx, int opt_level, size_t *size)
 		}
 		ctx->flags |= IR_OPT_CFG | IR_OPT_CODEGEN | IR_OPT_TAILCALL;
 
-		ir_build_def_use_lists(ctx);
+		(void)IR_PASS_RUN(ctx, USE_LISTS, (ir_build_def_use_lists(ctx), 1));
 
 		if (ctx->flags & IR_OPT_MEM2SSA) {
-			if (!ir_build_cfg(ctx)
-			 || !ir_build_dominators_tree(ctx)
-			 || !ir_mem2ssa(ctx)) {
+			if (!IR_PASS_RUN(ctx, CFG, ir_build_cfg(ctx))
+			 || !IR_PASS_RUN(ctx, DOM, ir_build_dominators_tree(ctx))
+			 || !IR_PASS_RUN(ctx, MEM2SSA, ir_mem2ssa(ctx))) {
 				return NULL;
 			}
 			ir_reset_cfg(ctx);
 		}
 
 		if (opt_level > 1) {
-			if (!ir_sccp(ctx)) {
+			if (!IR_PASS_RUN(ctx, SCCP, ir_sccp(ctx))) {
 				return NULL;
 			}
 		}
 
 		if (!ctx->cfg_blocks) {
-			if (!ir_build_cfg(ctx)
-			 || !ir_build_dominators_tree(ctx)) {
+			if (!IR_PASS_RUN(ctx, CFG, ir_build_cfg(ctx))
+			 || !IR_PASS_RUN(ctx, DOM, ir_build_dominators_tree(ctx))) {
 				return NULL;
 			}
 		}
 
-		if (!ir_find_loops(ctx)
-		 || !ir_gcm(ctx)
-		 || !ir_schedule(ctx)
-		 || !ir_match(ctx)
-		 || !ir_assign_virtual_registers(ctx)
-		 || !ir_compute_live_ranges(ctx)
-		 || !ir_coalesce(ctx)
-		 || !ir_reg_alloc(ctx)
-		 || !ir_schedule_blocks(ctx)) {
+		if (!IR_PASS_RUN(ctx, LOOPS, ir_find_loops(ctx))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_JUMP_THREAD) && !IR_PASS_RUN(ctx, JUMP_THREAD, ir_thread_jumps(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_LOOPS) && !IR_PASS_RUN(ctx, ROTATE, ir_rotate_loops(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_GVN) && !IR_PASS_RUN(ctx, GVN, ir_gvn(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_GVN) && !IR_PASS_RUN(ctx, DSE, ir_dse(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_LOOPS) && !IR_PASS_RUN(ctx, LICM, ir_licm(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_LOOPS) && !IR_PASS_RUN(ctx, VERSION, ir_version_loops(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_LOOPS) && !IR_PASS_RUN(ctx, UNROLL, ir_unroll_loops(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_LOOPS) && !IR_PASS_RUN(ctx, IVSR, ir_reduce_induction_vars(ctx)))
+		 || (opt_level > 1 && (ctx->flags & IR_OPT_JUMP_THREAD) && !IR_PASS_RUN(ctx, TAIL_DUP, ir_tail_dup(ctx)))
+		 || !IR_PASS_RUN(ctx, GCM, ir_gcm(ctx))
+		 || !IR_PASS_RUN(ctx, SCHEDULE, ir_schedule(ctx))
+		 || !IR_PASS_RUN(ctx, MATCH, ir_match(ctx))
+		 || !IR_PASS_RUN(ctx, VREGS, ir_assign_virtual_registers(ctx))
+		 || !IR_PASS_RUN(ctx, LIVE_RANGES, ir_compute_live_ranges(ctx))
+		 || !IR_PASS_RUN(ctx, COALESCE, ir_coalesce(ctx))
+		 || !IR_PASS_RUN(ctx, REG_ALLOC, ir_reg_alloc(ctx))
+		 || !IR_PASS_RUN(ctx, SCHEDULE_BLOCKS, ir_schedule_blocks(ctx))) {
 			return NULL;
 		}
 
-		return ir_emit_code(ctx, size);
+		return ir_jit_emit_code(ctx, size);
 	} else {
 		// IR_ASSERT(0 && "wrong optimization level");
 		return NULL;
 	}
 }
 
+/* IR machine code cache API (implementation in ir_code_cache.c)
+ *
+ * ir_code_cache_jit_compile() works like ir_jit_compile(), but keeps the generated code in the cache
+ * directory and reuses it for the same input IR, optimization level and target flags. Cached code
+ * is copied into ctx->code_buffer (if set) and relocated to the current symbol addresses resolved
+ * through ctx->loader. The cache is implemented only for x86_64 (other targets just compile).
+ */
+typedef struct _ir_code_cache ir_code_cache;
+
+ir_code_cache *ir_code_cache_open(const char *dir);
+void ir_code_cache_close(ir_code_cache *cache);
+void *ir_code_cache_jit_compile(ir_code_cache *cache, ir_ctx *ctx, int opt_level, size_t *size);
+
 #define IR_ERROR_CODE_MEM_OVERFLOW               1
 #define IR_ERROR_FIXED_STACK_FRAME_OVERFLOW      2
 #define IR_ERROR_UNSUPPORTED_CODE_RULE           3
@@ -1139,6 +1389,9 @@ int ir_mem_protect(void *ptr, size_t size);
 int ir_mem_unprotect(void *ptr, size_t size);
 int ir_mem_flush(void *ptr, size_t size);
 
+void *ir_code_buffer_alloc(ir_code_buffer *code_buffer, size_t size, size_t align);
+void ir_code_buffer_release(ir_code_buffer *code_buffer, void *ptr, size_t size);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
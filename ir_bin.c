@@ -0,0 +1,529 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (IR binary format saver and loader)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ *
+ * Binary module is a header followed by a sequence of records. Each record
+ * corresponds to a single ir_loader callback. Function records keep ir_base[]
+ * constants and instructions, the constants hash table, value parameters and
+ * the string table in the native in-memory layout. So they are loaded by
+ * copying memory, without tokenizing and parsing.
+ *
+ * The format is not portable. It depends on the target, the IR version and
+ * the endianness of the machine that produced it.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#else
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#endif
+
+#include "ir.h"
+#include "ir_private.h"
+
+#define IR_BIN_MAGIC   0x4e425249 /* "IRBN" in little-endian byte order */
+#define IR_BIN_VERSION 3
+
+#define IR_BIN_ALIGN(size) IR_ALIGNED_SIZE(size, 8)
+
+typedef enum _ir_bin_rec_kind {
+	IR_BIN_EXTERNAL_SYM_DCL = 1,
+	IR_BIN_EXTERNAL_FUNC_DCL,
+	IR_BIN_FORWARD_FUNC_DCL,
+	IR_BIN_SYM_DCL,
+	IR_BIN_SYM_DATA,
+	IR_BIN_SYM_DATA_STR,
+	IR_BIN_SYM_DATA_PAD,
+	IR_BIN_SYM_DATA_REF,
+	IR_BIN_SYM_DATA_END,
+	IR_BIN_FUNC,
+} ir_bin_rec_kind;
+
+typedef struct _ir_bin_header {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t  ptr_size;
+	uint8_t  insn_size;
+	uint16_t last_op;
+	uint16_t last_type;
+	uint32_t reserved;
+} ir_bin_header;
+
+/* Record header is followed by the name and the record specific data (both aligned to 8 bytes) */
+typedef struct _ir_bin_rec {
+	uint32_t kind;
+	uint32_t size;      /* size of the whole record */
+	uint32_t flags;
+	uint32_t name_len;  /* 0 for anonymous function */
+	uint32_t data_len;
+	uint32_t aux;       /* data type, return type or op */
+	uint64_t num;       /* symbol size, data offset or repeat count */
+} ir_bin_rec;
+
+/* Function record data:
+ *
+ * ir_bin_func
+ * ir_insn     insns[consts_count - 1 + insns_count]  (from ir_base[1 - consts_count] to ir_base[insns_count - 1])
+ * ir_ref      const_hash[const_hash_size]
+ * ir_value_param value_params[value_params_count]
+ * uint16_t    alias_classes[alias_classes_count]  (0 or insns_count, see ir_LOAD_ALIAS())
+ * uint32_t    strings_offsets[strings_count + 1]
+ * char        strings[strings_size]
+ */
+typedef struct _ir_bin_func {
+	int32_t  consts_count;
+	int32_t  insns_count;
+	uint32_t const_hash_size;
+	uint32_t value_params_count;
+	uint32_t strings_count;
+	uint32_t strings_size;
+	uint32_t alias_classes_count;
+	uint32_t reserved;
+} ir_bin_func;
+
+static const char ir_bin_zero[8];
+
+static bool ir_bin_write_pad(size_t len, FILE *f)
+{
+	return IR_BIN_ALIGN(len) == len || fwrite(ir_bin_zero, IR_BIN_ALIGN(len) - len, 1, f) == 1;
+}
+
+static bool ir_bin_write(const void *data, size_t len, FILE *f)
+{
+	if (len && fwrite(data, len, 1, f) != 1) {
+		return 0;
+	}
+	return ir_bin_write_pad(len, f);
+}
+
+static bool ir_bin_write_rec(FILE *f, ir_bin_rec_kind kind, uint32_t flags, const char *name,
+                             uint32_t aux, uint64_t num, const void *data, size_t data_len)
+{
+	ir_bin_rec rec;
+	size_t name_len = name ? strlen(name) : 0;
+
+	IR_ASSERT(name_len <= 0xffffffff && data_len <= 0xffffffff);
+	rec.kind = kind;
+	rec.size = (uint32_t)(sizeof(ir_bin_rec) + IR_BIN_ALIGN(name_len) + IR_BIN_ALIGN(data_len));
+	rec.flags = flags;
+	rec.name_len = (uint32_t)name_len;
+	rec.data_len = (uint32_t)data_len;
+	rec.aux = aux;
+	rec.num = num;
+	return ir_bin_write(&rec, sizeof(rec), f)
+		&& ir_bin_write(name, name_len, f)
+		&& ir_bin_write(data, data_len, f);
+}
+
+bool ir_save_bin_header(FILE *f)
+{
+	ir_bin_header header;
+
+	header.magic = IR_BIN_MAGIC;
+	header.version = IR_BIN_VERSION;
+	header.ptr_size = sizeof(void*);
+	header.insn_size = sizeof(ir_insn);
+	header.last_op = IR_LAST_OP;
+	header.last_type = IR_LAST_TYPE;
+	header.reserved = 0;
+	return ir_bin_write(&header, sizeof(header), f);
+}
+
+bool ir_save_bin_external_sym_dcl(const char *name, uint32_t flags, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_EXTERNAL_SYM_DCL, flags, name, 0, 0, NULL, 0);
+}
+
+bool ir_save_bin_external_func_dcl(const char *name, uint32_t flags, ir_type ret_type,
+                                   uint32_t params_count, const uint8_t *param_types, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_EXTERNAL_FUNC_DCL, flags, name, ret_type, 0, param_types, params_count);
+}
+
+bool ir_save_bin_forward_func_dcl(const char *name, uint32_t flags, ir_type ret_type,
+                                  uint32_t params_count, const uint8_t *param_types, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_FORWARD_FUNC_DCL, flags, name, ret_type, 0, param_types, params_count);
+}
+
+bool ir_save_bin_sym_dcl(const char *name, uint32_t flags, size_t size, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_SYM_DCL, flags, name, 0, size, NULL, 0);
+}
+
+bool ir_save_bin_sym_data(ir_type type, uint32_t count, const void *data, FILE *f)
+{
+	/* "data" points to a single element repeated "count" times */
+	return ir_bin_write_rec(f, IR_BIN_SYM_DATA, 0, NULL, type, count, data, ir_type_size[type]);
+}
+
+bool ir_save_bin_sym_data_str(const char *str, size_t len, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_SYM_DATA_STR, 0, NULL, 0, 0, str, len);
+}
+
+bool ir_save_bin_sym_data_pad(size_t offset, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_SYM_DATA_PAD, 0, NULL, 0, offset, NULL, 0);
+}
+
+bool ir_save_bin_sym_data_ref(ir_op op, const char *ref, uintptr_t offset, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_SYM_DATA_REF, 0, ref, op, offset, NULL, 0);
+}
+
+bool ir_save_bin_sym_data_end(uint32_t flags, FILE *f)
+{
+	return ir_bin_write_rec(f, IR_BIN_SYM_DATA_END, flags, NULL, 0, 0, NULL, 0);
+}
+
+bool ir_save_bin_func(const ir_ctx *ctx, const char *name, FILE *f)
+{
+	ir_bin_rec rec;
+	ir_bin_func func;
+	size_t name_len = name ? strlen(name) : 0;
+	size_t insns_size, hash_size, params_size, classes_size, offsets_size, data_len;
+	uint32_t i, *offsets = NULL;
+
+	func.consts_count = ctx->consts_count;
+	func.insns_count = ctx->insns_count;
+	func.const_hash_size = (uint32_t)(ctx->const_hash_mask + 1);
+	func.value_params_count = 0;
+	if (ctx->value_params) {
+		while (ctx->ir_base[func.value_params_count + 2].op == IR_PARAM) {
+			func.value_params_count++;
+		}
+	}
+	func.strings_count = ctx->strtab.data ? ir_strtab_count(&ctx->strtab) : 0;
+	func.strings_size = 0;
+	func.alias_classes_count = ctx->alias_classes ? ctx->insns_count : 0;
+	func.reserved = 0;
+
+	insns_size = (ctx->consts_count - 1 + ctx->insns_count) * sizeof(ir_insn);
+	hash_size = func.const_hash_size * sizeof(ir_ref);
+	params_size = func.value_params_count * sizeof(ir_value_param);
+	classes_size = func.alias_classes_count * sizeof(uint16_t);
+	offsets_size = 0;
+	if (func.strings_count) {
+		offsets_size = (func.strings_count + 1) * sizeof(uint32_t);
+		offsets = ir_mem_malloc(offsets_size);
+		for (i = 0; i < func.strings_count; i++) {
+			size_t len;
+
+			ir_strtab_strl(&ctx->strtab, i, &len);
+			offsets[i] = func.strings_size;
+			func.strings_size += (uint32_t)len;
+		}
+		offsets[i] = func.strings_size;
+	}
+	data_len = sizeof(ir_bin_func) + insns_size + IR_BIN_ALIGN(hash_size) + IR_BIN_ALIGN(params_size)
+		+ IR_BIN_ALIGN(classes_size) + IR_BIN_ALIGN(offsets_size) + func.strings_size;
+	IR_ASSERT(data_len <= 0xffffffff - 64);
+
+	rec.kind = IR_BIN_FUNC;
+	rec.size = (uint32_t)(sizeof(ir_bin_rec) + IR_BIN_ALIGN(name_len) + IR_BIN_ALIGN(data_len));
+	rec.flags = ctx->flags & (IR_PROTO_MASK | IR_STATIC);
+	rec.name_len = (uint32_t)name_len;
+	rec.data_len = (uint32_t)data_len;
+	rec.aux = ctx->ret_type;
+	rec.num = 0;
+
+	if (!ir_bin_write(&rec, sizeof(rec), f)
+	 || !ir_bin_write(name, name_len, f)
+	 || !ir_bin_write(&func, sizeof(func), f)
+	 || !ir_bin_write(ctx->ir_base + 1 - ctx->consts_count, insns_size, f)
+	 || !ir_bin_write(ctx->const_hash, hash_size, f)
+	 || !ir_bin_write(ctx->value_params, params_size, f)
+	 || !ir_bin_write(ctx->alias_classes, classes_size, f)
+	 || !ir_bin_write(offsets, offsets_size, f)) {
+		if (offsets) {
+			ir_mem_free(offsets);
+		}
+		return 0;
+	}
+	if (offsets) {
+		ir_mem_free(offsets);
+		for (i = 0; i < func.strings_count; i++) {
+			size_t len;
+			const char *str = ir_strtab_strl(&ctx->strtab, i, &len);
+
+			if (len && fwrite(str, len, 1, f) != 1) {
+				return 0;
+			}
+		}
+	}
+	return ir_bin_write_pad(func.strings_size, f);
+}
+
+static bool ir_bin_load_func(ir_ctx *ctx, const char *data, size_t len)
+{
+	const ir_bin_func *func = (const ir_bin_func*)data;
+	const uint32_t *offsets;
+	const char *strings;
+	size_t insns_size, hash_size, params_size, classes_size, offsets_size;
+	ir_ref consts_count, insns_count;
+	uint32_t i;
+
+	if (len < sizeof(ir_bin_func)
+	 || func->consts_count < -(IR_TRUE - 1)
+	 || func->insns_count < IR_UNUSED + 1
+	 || func->const_hash_size < IR_CONST_HASH_SIZE
+	 || !IR_IS_POWER_OF_TWO(func->const_hash_size)
+	 || (func->alias_classes_count && func->alias_classes_count != (uint32_t)func->insns_count)) {
+		return 0;
+	}
+	consts_count = func->consts_count;
+	insns_count = func->insns_count;
+	insns_size = ((size_t)consts_count - 1 + insns_count) * sizeof(ir_insn);
+	hash_size = func->const_hash_size * sizeof(ir_ref);
+	params_size = func->value_params_count * sizeof(ir_value_param);
+	classes_size = func->alias_classes_count * sizeof(uint16_t);
+	offsets_size = func->strings_count ? (func->strings_count + 1) * sizeof(uint32_t) : 0;
+	if (len < sizeof(ir_bin_func) + insns_size + IR_BIN_ALIGN(hash_size) + IR_BIN_ALIGN(params_size)
+			+ IR_BIN_ALIGN(classes_size) + IR_BIN_ALIGN(offsets_size) + func->strings_size) {
+		return 0;
+	}
+	data += sizeof(ir_bin_func);
+
+	/* IR buffer */
+	if (consts_count > ctx->consts_limit || insns_count > ctx->insns_limit) {
+		ir_insn *buf = ctx->ir_base - ctx->consts_limit;
+
+		if (consts_count > ctx->consts_limit) {
+			ctx->consts_limit = IR_ALIGNED_SIZE(consts_count, IR_CONSTS_LIMIT_MIN);
+		}
+		if (insns_count > ctx->insns_limit) {
+			ctx->insns_limit = IR_ALIGNED_SIZE(insns_count, IR_INSNS_LIMIT_MIN);
+		}
+		ir_mem_free(buf);
+		buf = ir_mem_malloc((ctx->consts_limit + ctx->insns_limit) * sizeof(ir_insn));
+		ctx->ir_base = buf + ctx->consts_limit;
+	}
+	memcpy(ctx->ir_base + 1 - consts_count, data, insns_size);
+	ctx->consts_count = consts_count;
+	ctx->insns_count = insns_count;
+	data += insns_size;
+
+	/* Constants hash table (constants keep references to the next entry of a hash chain) */
+	if (func->const_hash_size != IR_CONST_HASH_SIZE) {
+		if (ctx->const_hash_mask != IR_CONST_HASH_SIZE - 1) {
+			ir_mem_free(ctx->const_hash);
+		}
+		ctx->const_hash = ir_mem_malloc(hash_size);
+		ctx->const_hash_mask = func->const_hash_size - 1;
+	}
+	memcpy(ctx->const_hash, data, hash_size);
+	data += IR_BIN_ALIGN(hash_size);
+
+	if (func->value_params_count) {
+		ctx->value_params = ir_mem_malloc(params_size);
+		memcpy(ctx->value_params, data, params_size);
+	}
+	data += IR_BIN_ALIGN(params_size);
+
+	if (func->alias_classes_count) {
+		ctx->alias_classes = ir_mem_calloc(ctx->insns_limit, sizeof(uint16_t));
+		memcpy(ctx->alias_classes, data, classes_size);
+	}
+	data += IR_BIN_ALIGN(classes_size);
+
+	/* String table (strings must get the same indexes) */
+	if (func->strings_count) {
+		offsets = (const uint32_t*)data;
+		strings = data + IR_BIN_ALIGN(offsets_size);
+		ir_strtab_init(&ctx->strtab, func->strings_count, func->strings_size + func->strings_count);
+		for (i = 0; i < func->strings_count; i++) {
+			if (offsets[i] > offsets[i + 1]
+			 || offsets[i + 1] > func->strings_size
+			 || ir_strtab_lookup(&ctx->strtab, strings + offsets[i], offsets[i + 1] - offsets[i], i + 1) != (ir_str)(i + 1)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int ir_load_bin(ir_loader *loader, const void *buf, size_t size)
+{
+	const ir_bin_header *header = (const ir_bin_header*)buf;
+	const char *p, *end;
+	char name[256];
+
+	IR_ASSERT(((uintptr_t)buf & 7) == 0);
+	if (size < sizeof(ir_bin_header)
+	 || header->magic != IR_BIN_MAGIC
+	 || header->version != IR_BIN_VERSION
+	 || header->ptr_size != sizeof(void*)
+	 || header->insn_size != sizeof(ir_insn)
+	 || header->last_op != IR_LAST_OP
+	 || header->last_type != IR_LAST_TYPE) {
+		fprintf(stderr, "ir_load_bin: incompatible file format\n");
+		return 0;
+	}
+
+	p = (const char*)buf + sizeof(ir_bin_header);
+	end = (const char*)buf + size;
+	while (p < end) {
+		const ir_bin_rec *rec = (const ir_bin_rec*)p;
+		const char *data;
+
+		if ((size_t)(end - p) < sizeof(ir_bin_rec)
+		 || rec->size > (size_t)(end - p)
+		 || rec->size < sizeof(ir_bin_rec) + IR_BIN_ALIGN((size_t)rec->name_len) + IR_BIN_ALIGN((size_t)rec->data_len)
+		 || rec->name_len > 255) {
+			fprintf(stderr, "ir_load_bin: corrupted file\n");
+			return 0;
+		}
+		memcpy(name, p + sizeof(ir_bin_rec), rec->name_len);
+		name[rec->name_len] = 0;
+		data = p + sizeof(ir_bin_rec) + IR_BIN_ALIGN(rec->name_len);
+
+		switch (rec->kind) {
+			case IR_BIN_EXTERNAL_SYM_DCL:
+				if (loader->external_sym_dcl
+				 && !loader->external_sym_dcl(loader, name, rec->flags)) {
+					fprintf(stderr, "ir_load_bin: Unresolved extrnal symbol '%s'\n", name);
+					return 0;
+				}
+				break;
+			case IR_BIN_EXTERNAL_FUNC_DCL:
+				if (loader->external_func_dcl
+				 && !loader->external_func_dcl(loader, name, rec->flags, rec->aux, rec->data_len, (const uint8_t*)data)) {
+					fprintf(stderr, "ir_load_bin: Unresolved extrnal function '%s'\n", name);
+					return 0;
+				}
+				break;
+			case IR_BIN_FORWARD_FUNC_DCL:
+				if (loader->forward_func_dcl
+				 && !loader->forward_func_dcl(loader, name, rec->flags, rec->aux, rec->data_len, (const uint8_t*)data)) {
+					fprintf(stderr, "ir_load_bin: forward_func_decl error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DCL:
+				if (loader->sym_dcl && !loader->sym_dcl(loader, name, rec->flags, (size_t)rec->num)) {
+					fprintf(stderr, "ir_load_bin: sym_dcl error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DATA:
+				if (rec->aux >= IR_LAST_TYPE || rec->data_len != ir_type_size[rec->aux]) {
+					fprintf(stderr, "ir_load_bin: corrupted file\n");
+					return 0;
+				}
+				if (loader->sym_data && !loader->sym_data(loader, rec->aux, (uint32_t)rec->num, data)) {
+					fprintf(stderr, "ir_load_bin: sym_data error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DATA_STR:
+				if (loader->sym_data_str && !loader->sym_data_str(loader, data, rec->data_len)) {
+					fprintf(stderr, "ir_load_bin: sym_data_str error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DATA_PAD:
+				if (loader->sym_data_pad && !loader->sym_data_pad(loader, (size_t)rec->num)) {
+					fprintf(stderr, "ir_load_bin: sym_data_pad error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DATA_REF:
+				if (loader->sym_data_ref && !loader->sym_data_ref(loader, rec->aux, name, (uintptr_t)rec->num)) {
+					fprintf(stderr, "ir_load_bin: sym_data_ref error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_SYM_DATA_END:
+				if (loader->sym_data_end && !loader->sym_data_end(loader, rec->flags)) {
+					fprintf(stderr, "ir_load_bin: sym_data_end error\n");
+					return 0;
+				}
+				break;
+			case IR_BIN_FUNC:
+			{
+				ir_ctx ctx;
+				bool ok;
+
+				if (!loader->func_init(loader, &ctx, rec->name_len ? name : NULL)) {
+					fprintf(stderr, "ir_load_bin: init_func error\n");
+					return 0;
+				}
+				ctx.flags |= rec->flags;
+				ctx.ret_type = (ir_type)rec->aux;
+				if (!ir_bin_load_func(&ctx, data, rec->data_len)) {
+					ir_free(&ctx);
+					fprintf(stderr, "ir_load_bin: corrupted file\n");
+					return 0;
+				}
+				ok = loader->func_process(loader, &ctx, rec->name_len ? name : NULL);
+				ir_free(&ctx);
+				if (!ok) {
+					fprintf(stderr, "ir_load_bin: process_func error\n");
+					return 0;
+				}
+				break;
+			}
+			default:
+				fprintf(stderr, "ir_load_bin: corrupted file\n");
+				return 0;
+		}
+		p += rec->size;
+	}
+	return 1;
+}
+
+int ir_load_bin_file(ir_loader *loader, const char *filename)
+{
+	int ret = 0;
+#ifndef _WIN32
+	struct stat st;
+	void *buf;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		return 0;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			ret = ir_load_bin(loader, buf, st.st_size);
+			munmap(buf, st.st_size);
+		}
+	}
+	close(fd);
+#else
+	LARGE_INTEGER size;
+	HANDLE map;
+	void *buf;
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map) {
+			buf = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if (buf) {
+				ret = ir_load_bin(loader, buf, (size_t)size.QuadPart);
+				UnmapViewOfFile(buf);
+			}
+			CloseHandle(map);
+		}
+	}
+	CloseHandle(file);
+#endif
+	return ret;
+}
@@ -576,11 +576,19 @@ extern "C" {
 #define ir_LOAD_D(_addr)                  _ir_LOAD(_ir_CTX, IR_DOUBLE, (_addr))
 #define ir_LOAD_F(_addr)                  _ir_LOAD(_ir_CTX, IR_FLOAT, (_addr))
 #define ir_STORE(_addr, _val)             _ir_STORE(_ir_CTX, (_addr), (_val))
+
+/* LOAD and STORE with alias class (accesses of different non-zero classes never alias) */
+#define ir_LOAD_ALIAS(_type, _addr, _class) _ir_LOAD_ALIAS(_ir_CTX, (_type), (_addr), (_class))
+#define ir_STORE_ALIAS(_addr, _val, _class) _ir_STORE_ALIAS(_ir_CTX, (_addr), (_val), (_class))
+
 #define ir_LOAD_v(_type, _addr)           _ir_LOAD_v(_ir_CTX, (_type), (_addr))
 #define ir_STORE_v(_addr, _val)           _ir_STORE_v(_ir_CTX, (_addr), (_val))
 #define ir_TLS(_index, _offset)           _ir_TLS(_ir_CTX, (_index), (_offset))
 #define ir_TRAP()                         do {_ir_CTX->control = ir_emit1(_ir_CTX, IR_TRAP, _ir_CTX->control);} while (0)
 
+#define ir_MEMCPY(_dst, _src, _size)      _ir_MEMCPY(_ir_CTX, _dst, _src, _size)
+#define ir_MEMSET(_dst, _val, _size)      _ir_MEMSET(_ir_CTX, _dst, _val, _size)
+
 #define ir_FRAME_ADDR()                   ir_fold0(_ir_CTX, IR_OPT(IR_FRAME_ADDR, IR_ADDR))
 
 #define ir_BLOCK_BEGIN()                  _ir_BLOCK_BEGIN(_ir_CTX)
@@ -667,8 +675,12 @@ ir_ref _ir_RLOAD(ir_ctx *ctx, ir_type type, ir_ref reg);
 void   _ir_RSTORE(ir_ctx *ctx, ir_ref reg, ir_ref val);
 ir_ref _ir_LOAD(ir_ctx *ctx, ir_type type, ir_ref addr);
 void   _ir_STORE(ir_ctx *ctx, ir_ref addr, ir_ref val);
+ir_ref _ir_LOAD_ALIAS(ir_ctx *ctx, ir_type type, ir_ref addr, uint16_t alias_class);
+void   _ir_STORE_ALIAS(ir_ctx *ctx, ir_ref addr, ir_ref val, uint16_t alias_class);
 ir_ref _ir_LOAD_v(ir_ctx *ctx, ir_type type, ir_ref addr);
 void   _ir_STORE_v(ir_ctx *ctx, ir_ref addr, ir_ref val);
+void   _ir_MEMCPY(ir_ctx *ctx, ir_ref dst, ir_ref src, ir_ref size);
+void   _ir_MEMSET(ir_ctx *ctx, ir_ref dst, ir_ref val, ir_ref size);
 void   _ir_VA_START(ir_ctx *ctx, ir_ref list);
 void   _ir_VA_END(ir_ctx *ctx, ir_ref list);
 void   _ir_VA_COPY(ir_ctx *ctx, ir_ref dst, ir_ref src);
@@ -68,14 +68,14 @@ void ir_reset_cfg(ir_ctx *ctx)
 	ctx->cfg_blocks_count = 0;
 	ctx->cfg_edges_count = 0;
 	if (ctx->cfg_blocks) {
-		ir_mem_free(ctx->cfg_blocks);
+		ir_ctx_free(ctx, ctx->cfg_blocks);
 		ctx->cfg_blocks = NULL;
 		if (ctx->cfg_edges) {
-			ir_mem_free(ctx->cfg_edges);
+			ir_ctx_free(ctx, ctx->cfg_edges);
 			ctx->cfg_edges = NULL;
 		}
 		if (ctx->cfg_map) {
-			ir_mem_free(ctx->cfg_map);
+			ir_ctx_free(ctx, ctx->cfg_map);
 			ctx->cfg_map = NULL;
 		}
 	}
@@ -235,7 +235,7 @@ int ir_build_cfg(ir_ctx *ctx)
 	uint32_t len = ir_bitset_len(ctx->insns_count);
 	ir_bitset bb_starts = ir_mem_calloc(len * 2, IR_BITSET_BITS / 8);
 	ir_bitset bb_leaks = bb_starts + len;
-	_blocks = ir_mem_calloc(ctx->insns_limit, sizeof(uint32_t));
+	_blocks = ir_ctx_calloc(ctx, ctx->insns_limit, sizeof(uint32_t));
 	ir_worklist_init(&worklist, ctx->insns_count);
 
 	/* First try to perform backward DFS search starting from "stop" nodes */
@@ -326,7 +326,7 @@ int ir_build_cfg(ir_ctx *ctx)
 	IR_ASSERT(bb_count > 0);
 
 	/* Create array of basic blocks and count successor/predecessors edges for each BB */
-	blocks = ir_mem_malloc((bb_count + 1) * sizeof(ir_block));
+	blocks = ir_ctx_malloc(ctx, (bb_count + 1) * sizeof(ir_block));
 	b = 1;
 	bb = blocks + 1;
 	count = 0;
@@ -388,7 +388,7 @@ int ir_build_cfg(ir_ctx *ctx)
 	ir_mem_free(bb_starts);
 
 	/* Create an array of successor/predecessors control edges */
-	edges = ir_mem_malloc(edges_count * 2 * sizeof(uint32_t));
+	edges = ir_ctx_malloc(ctx, edges_count * 2 * sizeof(uint32_t));
 	bb = blocks + 1;
 	for (b = 1; b <= bb_count; b++, bb++) {
 		insn = &ctx->ir_base[bb->start];
@@ -471,7 +471,7 @@ static void ir_remove_predecessor(ir_ctx *ctx, ir_block *bb, uint32_t from)
 	bb->predecessors_count = n;
 }
 
-static void ir_remove_merge_input(ir_ctx *ctx, ir_ref merge, ir_ref from)
+void ir_remove_merge_input(ir_ctx *ctx, ir_ref merge, ir_ref from)
 {
 	ir_ref i, j, n;
 	ir_use_list *use_list;
@@ -805,7 +805,7 @@ slow_case:
 				if (idom < b) {
 					break;
 				}
-				if (UNEXPECTED(k == 0)) {
+				if (UNEXPECTED(k == 1)) {
 					// IR_ASSERT(0 && "Wrong blocks order: BB is before all its predecessors");
 					goto slow_case;
 				}
@@ -976,18 +976,6 @@ static int ir_build_dominators_tree_iterative(ir_ctx *ctx)
 	return 1;
 }
 
-static bool ir_dominates(const ir_block *blocks, uint32_t b1, uint32_t b2)
-{
-	uint32_t b1_depth = blocks[b1].dom_depth;
-	const ir_block *bb2 = &blocks[b2];
-
-	while (bb2->dom_depth > b1_depth) {
-		b2 = bb2->dom_parent;
-		bb2 = &blocks[b2];
-	}
-	return b1 == b2;
-}
-
 /* Identify loops. See Sreedhar et al, "Identifying Loops Using DJ Graphs" and
  * G. Ramalingam "Identifying Loops In Almost Linear Time". */
 
@@ -1532,7 +1520,7 @@ static int ir_schedule_blocks_bottom_up(ir_ctx *ctx)
 	ir_bitset visited;
 	uint32_t *schedule_end, count;
 
-	ctx->cfg_schedule = ir_mem_malloc(sizeof(uint32_t) * (ctx->cfg_blocks_count + 2));
+	ctx->cfg_schedule = ir_ctx_malloc(ctx, sizeof(uint32_t) * (ctx->cfg_blocks_count + 2));
 	schedule_end = ctx->cfg_schedule + ctx->cfg_blocks_count;
 
 	/* 1. Create initial chains for each BB */
@@ -1784,7 +1772,7 @@ restart:
 	qsort(edges, edges_count, sizeof(ir_edge_info), ir_edge_info_cmp);
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_BB_SCHEDULE) {
+	if (ctx->flags2 & IR_DEBUG_BB_SCHEDULE) {
 		ir_dump_edges(ctx, edges_count, edges);
 	}
 #endif
@@ -1833,7 +1821,7 @@ restart:
 	}
 
 #if IR_DEBUG_BB_SCHEDULE_GRAPH
-	if (ctx->flags & IR_DEBUG_BB_SCHEDULE) {
+	if (ctx->flags2 & IR_DEBUG_BB_SCHEDULE) {
 		ir_dump_cfg_freq_graph(ctx, bb_freq, edges_count, edges, chains);
 	}
 #endif
@@ -1841,7 +1829,7 @@ restart:
 	ir_mem_free(bb_freq);
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_BB_SCHEDULE) {
+	if (ctx->flags2 & IR_DEBUG_BB_SCHEDULE) {
 		ir_dump_chains(ctx, chains);
 	}
 #endif
@@ -1868,7 +1856,7 @@ restart:
 		}
 
 #ifdef IR_DEBUG
-		if (ctx->flags & IR_DEBUG_BB_SCHEDULE) {
+		if (ctx->flags2 & IR_DEBUG_BB_SCHEDULE) {
 			ir_dump_chains(ctx, chains);
 		}
 #endif
@@ -1904,7 +1892,7 @@ restart:
 	}
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_BB_SCHEDULE) {
+	if (ctx->flags2 & IR_DEBUG_BB_SCHEDULE) {
 		ir_dump_chains(ctx, chains);
 	}
 #endif
@@ -1947,7 +1935,7 @@ static int ir_schedule_blocks_top_down(ir_ctx *ctx)
 
 	ir_bitqueue_init(&blocks, ctx->cfg_blocks_count + 1);
 	blocks.pos = 0;
-	list = ir_mem_malloc(sizeof(uint32_t) * (ctx->cfg_blocks_count + 2));
+	list = ir_ctx_malloc(ctx, sizeof(uint32_t) * (ctx->cfg_blocks_count + 2));
 	list[ctx->cfg_blocks_count + 1] = 0;
 	schedule_end = list + ctx->cfg_blocks_count;
 	for (b = 1; b <= ctx->cfg_blocks_count; b++) {
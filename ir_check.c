@@ -139,6 +139,130 @@ static bool ir_check_domination(const ir_ctx *ctx, ir_ref def, ir_ref use)
 	return b1 == b2;
 }
 
+/* Vector values may be used only by vector instructions, VEXTRACT, VMASK, STORE, calls and RETURN */
+static bool ir_check_vector_use(const ir_insn *insn)
+{
+	switch (insn->op) {
+		case IR_VEXTRACT:
+		case IR_VMASK:
+		case IR_STORE:
+		case IR_CALL:
+		case IR_TAILCALL:
+		case IR_RETURN:
+			return 1;
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+		case IR_MIN:
+		case IR_MAX:
+		case IR_EQ:
+		case IR_LT:
+		case IR_GT:
+		case IR_BITCAST:
+		case IR_VSHUFFLE:
+		case IR_PHI:
+		case IR_COPY:
+		case IR_PI:
+			return IR_IS_TYPE_VEC(insn->type);
+		default:
+			return 0;
+	}
+}
+
+static bool ir_check_vector_insn(const ir_ctx *ctx, ir_ref ref, const ir_insn *insn)
+{
+	ir_type type = insn->type;
+	ir_type op1_type = ctx->ir_base[insn->op1].type;
+	ir_type lane_type;
+	const ir_insn *val;
+
+	switch (insn->op) {
+		case IR_ADD:
+		case IR_SUB:
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+		case IR_LOAD:
+		case IR_PHI:
+		case IR_COPY:
+		case IR_PI:
+		case IR_PARAM:
+		case IR_CALL:
+			/* operand types are already checked */
+			return 1;
+		case IR_MUL:
+			if (ir_vec_lane_type(type) != IR_I8) {
+				return 1;
+			}
+			break;
+		case IR_DIV:
+		case IR_MIN:
+		case IR_MAX:
+			if (!IR_IS_TYPE_INT(ir_vec_lane_type(type))) {
+				return 1;
+			}
+			break;
+		case IR_EQ:
+		case IR_LT:
+		case IR_GT:
+			/* lane-wise comparison produces a mask of the same type */
+			if (op1_type == type && ctx->ir_base[insn->op2].type == type) {
+				return 1;
+			}
+			break;
+		case IR_BITCAST:
+			if (IR_IS_TYPE_VEC(op1_type)) {
+				return 1;
+			}
+			break;
+		case IR_VSPLAT:
+			lane_type = ir_vec_lane_type(type);
+			if (ir_type_size[op1_type] == ir_type_size[lane_type]
+			 && IR_IS_TYPE_INT(op1_type) == IR_IS_TYPE_INT(lane_type)) {
+				return 1;
+			}
+			break;
+		case IR_VSHUFFLE:
+			if (op1_type == type
+			 && ir_vec_lane_type(type) != IR_I8
+			 && IR_IS_CONST_REF(insn->op2)
+			 && IR_IS_TYPE_INT(ctx->ir_base[insn->op2].type)
+			 && ctx->ir_base[insn->op2].val.u64 <= 0xff) {
+				return 1;
+			}
+			break;
+		case IR_VEXTRACT:
+			if (!IR_IS_TYPE_VEC(op1_type) || !IR_IS_CONST_REF(insn->op2)) {
+				break;
+			}
+			val = &ctx->ir_base[insn->op2];
+			lane_type = ir_vec_lane_type(op1_type);
+			if (IR_IS_TYPE_INT(val->type)
+			 && val->val.u64 < IR_VEC_LANES(op1_type)
+			 && ir_type_size[type] == ir_type_size[lane_type]
+			 && IR_IS_TYPE_INT(type) == IR_IS_TYPE_INT(lane_type)) {
+				return 1;
+			}
+			break;
+		case IR_VMASK:
+			if (IR_IS_TYPE_VEC(op1_type)
+			 && IR_IS_TYPE_INT(type)
+			 && ir_type_size[type] * 8 >= IR_VEC_LANES(op1_type)) {
+				return 1;
+			}
+			break;
+		default:
+			break;
+	}
+	fprintf(stderr, "ir_base[%d] unsupported vector operation %s (%s)\n",
+		ref, ir_op_name[insn->op], ir_type_name[type]);
+	return 0;
+}
+
 bool ir_check(const ir_ctx *ctx)
 {
 	ir_ref i, j, n, *p, use;
@@ -258,6 +382,11 @@ bool ir_check(const ir_ctx *ctx)
 										break;
 								}
 							}
+							if (IR_IS_TYPE_VEC(use_insn->type) && !ir_check_vector_use(insn)) {
+								fprintf(stderr, "ir_base[%d].ops[%d] vector reference (%d) is not supported by %s\n",
+									i, j, use, ir_op_name[insn->op]);
+								ok = 0;
+							}
 							if ((ctx->flags2 & IR_LINEAR)
 							 && ctx->cfg_map
 							 && insn->op != IR_PHI
@@ -356,6 +485,34 @@ bool ir_check(const ir_ctx *ctx)
 					ok = 0;
 				}
 				break;
+			case IR_MEMCPY:
+			case IR_MEMSET:
+				if (insn->inputs_count != 4) {
+					fprintf(stderr, "ir_base[%d] %s must have 4 inputs (%d)\n",
+						i, ir_op_name[insn->op], insn->inputs_count);
+					ok = 0;
+					break;
+				}
+				if (ctx->ir_base[insn->op2].type != IR_ADDR) {
+					fprintf(stderr, "ir_base[%d].op2 must have ADDR type (%s)\n",
+						i, ir_type_name[ctx->ir_base[insn->op2].type]);
+					ok = 0;
+				}
+				type = ctx->ir_base[insn->op3].type;
+				if (insn->op == IR_MEMCPY ? type != IR_ADDR : (!IR_IS_TYPE_INT(type) || type == IR_BOOL || ir_type_size[type] != 1)) {
+					fprintf(stderr, "ir_base[%d].op3 must have %s type (%s)\n",
+						i, insn->op == IR_MEMCPY ? "ADDR" : "8-bit integer", ir_type_name[type]);
+					ok = 0;
+				}
+				type = ctx->ir_base[ir_insn_op(insn, 4)].type;
+				if (!IR_IS_TYPE_INT(type)
+				 || type == IR_BOOL
+				 || ir_type_size[type] != ir_type_size[IR_ADDR]) {
+					fprintf(stderr, "ir_base[%d].op4 must have size_t compatible type (%s)\n",
+						i, ir_type_name[type]);
+					ok = 0;
+				}
+				break;
 			case IR_VLOAD:
 			case IR_VLOAD_v:
 			case IR_VSTORE:
@@ -386,6 +543,11 @@ bool ir_check(const ir_ctx *ctx)
 				break;
 		}
 
+		if ((IR_IS_TYPE_VEC(insn->type) || insn->op == IR_VEXTRACT || insn->op == IR_VMASK)
+		 && !ir_check_vector_insn(ctx, i, insn)) {
+			ok = 0;
+		}
+
 		if (ctx->use_lists) {
 			ir_use_list *use_list = &ctx->use_lists[i];
 			ir_ref count, n = use_list->count;
@@ -0,0 +1,729 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Persistent machine code cache)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ *
+ * The cache keeps the code generated by ir_jit_compile() in a directory
+ * (one file per function). Entries are keyed by a hash of the input IR, the
+ * optimization level and the target flags.
+ *
+ * To make the code relocatable, a cached function is compiled without code
+ * buffer (so no RIP-relative references to external addresses may be used)
+ * and with "placeholder" symbol addresses. Placeholders are non-canonical
+ * 64-bit addresses, so the back-end always materializes them with 64-bit
+ * immediates. Each symbol reference then appears either as an immediate of
+ * "mov64" or as a jump table slot, and it's easy to find it. Jump table slots
+ * that keep absolute addresses of the function labels are relocated as well.
+ * When the code can't be relocated safely, it's re-emitted without caching.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "ir.h"
+#include "ir_private.h"
+
+#include <sys/stat.h>
+#ifndef _WIN32
+# include <unistd.h>
+#else
+# include <direct.h>
+# include <process.h>
+# define getpid _getpid
+#endif
+
+/* The code may be cached only for x86_64 System V targets */
+#if defined(IR_TARGET_X64) && !defined(_WIN32) && !defined(IR_SNAPSHOT_HANDLER)
+# define IR_CODE_CACHE_ENABLED 1
+#endif
+
+#define IR_CODE_CACHE_MAGIC     0x43435249 /* "IRCC" in little-endian byte order */
+#define IR_CODE_CACHE_VERSION   3
+
+#define IR_CODE_CACHE_SYM_BASE  0x5ec0000000000000ULL
+#define IR_CODE_CACHE_SYM_BAND  0x0001000000000000ULL
+#define IR_CODE_CACHE_SYM_LIMIT 0xffff
+#define IR_CODE_CACHE_SELF      0xffffffff /* relocation against the start of the code itself */
+
+struct _ir_code_cache {
+	size_t dir_len;
+	char   dir[1];
+};
+
+typedef struct _ir_code_cache_key {
+	uint64_t h1;
+	uint64_t h2;
+} ir_code_cache_key;
+
+/* Entry file layout:
+ *
+ * ir_code_cache_header
+ * ir_code_cache_entry  entries[entries_count]
+ * ir_code_cache_reloc  relocs[relocs_count]
+ * uint8_t              sym_ops[syms_count]   (IR_FUNC or IR_SYM)
+ * char                 sym_names[syms_size]  (zero terminated names)
+ * uint8_t              code[code_size]       (aligned to 8 bytes)
+ */
+typedef struct _ir_code_cache_header {
+	uint32_t          magic;
+	uint32_t          version;
+	ir_code_cache_key key;
+	uint32_t          code_size;
+	uint32_t          rodata_offset;
+	uint32_t          jmp_table_offset;
+	uint32_t          entries_count;
+	uint32_t          relocs_count;
+	uint32_t          syms_count;
+	uint32_t          syms_size;
+	uint32_t          reserved;
+} ir_code_cache_header;
+
+typedef struct _ir_code_cache_entry {
+	uint32_t num;
+	uint32_t offset;
+} ir_code_cache_entry;
+
+typedef struct _ir_code_cache_reloc {
+	uint32_t offset;
+	uint32_t sym;                          /* index in symbol table or IR_CODE_CACHE_SELF */
+	int64_t  addend;
+} ir_code_cache_reloc;
+
+/* Relocatable code image (in memory) */
+typedef struct _ir_code_cache_image {
+	ir_code_cache_header  header;
+	ir_code_cache_entry  *entries;
+	ir_code_cache_reloc  *relocs;
+	const uint8_t        *sym_ops;
+	const char           *sym_names;
+	const uint8_t        *code;
+} ir_code_cache_image;
+
+/* Loader that substitutes symbol addresses by placeholders */
+typedef struct _ir_code_cache_loader {
+	ir_loader  loader;
+	ir_strtab  syms;
+	uint8_t   *sym_ops;
+	uint32_t   sym_ops_size;
+	bool       overflow;
+} ir_code_cache_loader;
+
+ir_code_cache *ir_code_cache_open(const char *dir)
+{
+	ir_code_cache *cache;
+	size_t len = strlen(dir);
+	struct stat st;
+
+	if (stat(dir, &st) != 0) {
+#ifndef _WIN32
+		if (mkdir(dir, 0777) != 0) {
+#else
+		if (_mkdir(dir) != 0) {
+#endif
+			return NULL;
+		}
+	} else if (!(st.st_mode & S_IFDIR)) {
+		return NULL;
+	}
+	while (len > 1 && (dir[len - 1] == '/' || dir[len - 1] == '\\')) {
+		len--;
+	}
+	cache = ir_mem_malloc(sizeof(ir_code_cache) + len);
+	cache->dir_len = len;
+	memcpy(cache->dir, dir, len);
+	cache->dir[len] = 0;
+	return cache;
+}
+
+void ir_code_cache_close(ir_code_cache *cache)
+{
+	ir_mem_free(cache);
+}
+
+#ifdef IR_CODE_CACHE_ENABLED
+
+/* Hashing */
+static uint64_t ir_code_cache_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void ir_code_cache_hash_u64(ir_code_cache_key *key, uint64_t val)
+{
+	key->h1 = ir_code_cache_mix(key->h1 ^ val) + 0x9e3779b97f4a7c15ULL;
+	key->h2 = ir_code_cache_mix((key->h2 + val) ^ 0xc2b2ae3d27d4eb4fULL) * 5 + 0x52dce729;
+}
+
+static bool ir_code_cache_is_placeholder(uint64_t val)
+{
+	return val - (IR_CODE_CACHE_SYM_BASE - 0x100000000ULL) <= IR_CODE_CACHE_SYM_BAND + 0x100000000ULL;
+}
+
+/* Returns 0 if the function can't be cached */
+static bool ir_code_cache_compute_key(const ir_ctx *ctx, int opt_level, ir_code_cache_key *key)
+{
+	ir_ref i, n;
+	ir_insn *insn;
+	ir_hash128 hash;
+	const char *version = IR_VERSION;
+
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base - i; i < ctx->consts_count; i++, insn--) {
+		if (!IR_IS_SYM_CONST(insn->op) && ir_code_cache_is_placeholder(insn->val.u64)) {
+			/* may be confused with a symbol reference */
+			return 0;
+		}
+	}
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
+		if ((insn->op == IR_GUARD || insn->op == IR_GUARD_NOT)
+		 && IR_IS_CONST_REF(insn->op3) && IR_IS_SYM_CONST(ctx->ir_base[insn->op3].op)) {
+			/* far side exits are emitted as indirect jumps through the target address */
+			return 0;
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+
+	key->h1 = IR_CODE_CACHE_MAGIC;
+	key->h2 = IR_CODE_CACHE_VERSION;
+	while (*version) {
+		ir_code_cache_hash_u64(key, (uint8_t)*version);
+		version++;
+	}
+	ir_code_cache_hash_u64(key, opt_level);
+	ir_code_cache_hash_u64(key, ctx->flags);
+	ir_code_cache_hash_u64(key, ctx->flags2);
+	ir_code_cache_hash_u64(key, ctx->mflags);
+	ir_code_cache_hash_u64(key, (uint32_t)ctx->spill_base);
+	ir_code_cache_hash_u64(key, ctx->fixed_regset);
+	ir_code_cache_hash_u64(key, (uint32_t)ctx->fixed_stack_red_zone);
+	ir_code_cache_hash_u64(key, (uint32_t)ctx->fixed_stack_frame_size);
+	ir_code_cache_hash_u64(key, (uint32_t)ctx->fixed_call_stack_size);
+	ir_code_cache_hash_u64(key, ctx->fixed_save_regset);
+
+	/* the structural hash covers the alias classes of LOADs and STOREs as well */
+	ir_ctx_hash(ctx, &hash);
+	ir_code_cache_hash_u64(key, hash.lo);
+	ir_code_cache_hash_u64(key, hash.hi);
+	return 1;
+}
+
+/* Placeholder symbols */
+static void* ir_code_cache_resolve_sym_name(ir_loader *loader, ir_ctx *ctx, ir_str name, uint32_t flags)
+{
+	ir_code_cache_loader *l = (ir_code_cache_loader*)loader;
+	size_t len;
+	const char *str = ir_get_strl(ctx, name, &len);
+	uint32_t count = ir_strtab_count(&l->syms);
+	ir_ref val = ir_strtab_lookup(&l->syms, str, (uint32_t)len, count + 1);
+
+	if (val > IR_CODE_CACHE_SYM_LIMIT) {
+		l->overflow = 1;
+		return (void*)(uintptr_t)IR_CODE_CACHE_SYM_BASE;
+	}
+	if ((uint32_t)val > l->sym_ops_size) {
+		l->sym_ops_size = l->sym_ops_size ? l->sym_ops_size * 2 : 16;
+		l->sym_ops = ir_mem_realloc(l->sym_ops, l->sym_ops_size);
+	}
+	if ((uint32_t)val == count + 1) {
+		l->sym_ops[val - 1] = IR_SYM;
+	}
+	if (flags & IR_RESOLVE_SYM_ADD_THUNK) {
+		l->sym_ops[val - 1] = IR_FUNC;
+	}
+	return (void*)(uintptr_t)(IR_CODE_CACHE_SYM_BASE + ((uint64_t)(val - 1) << 32));
+}
+
+static const char *ir_code_cache_loader_get_str(const ir_code_cache_loader *l, uint32_t sym)
+{
+	return ir_strtab_str(&l->syms, sym);
+}
+
+/* Finds references to placeholders and own labels in the code produced with ir_code_cache_loader */
+static bool ir_code_cache_scan(ir_ctx *ctx, ir_code_cache_loader *l, const uint8_t *code, size_t size,
+                               ir_code_cache_reloc **relocs_ptr, uint32_t *relocs_count_ptr)
+{
+	uint32_t syms_count = ir_strtab_count(&l->syms);
+	uint64_t start = (uintptr_t)code;
+	uint64_t sym_base = IR_CODE_CACHE_SYM_BASE - 0x80000000ULL;
+	uint64_t sym_limit = (uint64_t)syms_count << 32;
+	size_t code_end, p;
+	uint32_t relocs_count = 0, relocs_size = 16;
+	ir_code_cache_reloc *relocs = ir_mem_malloc(relocs_size * sizeof(ir_code_cache_reloc));
+	uint64_t val;
+
+	code_end = ctx->rodata_offset ? ctx->rodata_offset : (ctx->jmp_table_offset ? ctx->jmp_table_offset : size);
+
+	for (p = 0; p + 8 <= size; p++) {
+		if (p >= code_end && (!ctx->jmp_table_offset || p < ctx->jmp_table_offset)) {
+			/* skip read-only data */
+			continue;
+		}
+		memcpy(&val, code + p, 8);
+		if (p >= code_end) {
+			/* jump table slot */
+			if ((p - ctx->jmp_table_offset) % 8 != 0) {
+				continue;
+			}
+			if (val - start < size) {
+				if (relocs_count == relocs_size) {
+					relocs_size *= 2;
+					relocs = ir_mem_realloc(relocs, relocs_size * sizeof(ir_code_cache_reloc));
+				}
+				relocs[relocs_count].offset = (uint32_t)p;
+				relocs[relocs_count].sym = IR_CODE_CACHE_SELF;
+				relocs[relocs_count].addend = (int64_t)(val - start);
+				relocs_count++;
+				continue;
+			}
+		} else if (val - start < size) {
+			/* absolute reference to the code itself */
+			goto failure;
+		}
+		if (ir_code_cache_is_placeholder(val)) {
+			if (val - sym_base >= sym_limit) {
+				goto failure;
+			}
+			if (p < code_end) {
+				/* must be an immediate operand of "mov64 reg, imm64" (REX.W + B8+r) */
+				if (p < 2
+				 || (code[p - 2] != 0x48 && code[p - 2] != 0x49)
+				 || (code[p - 1] & 0xf8) != 0xb8) {
+					goto failure;
+				}
+			}
+			if (relocs_count == relocs_size) {
+				relocs_size *= 2;
+				relocs = ir_mem_realloc(relocs, relocs_size * sizeof(ir_code_cache_reloc));
+			}
+			relocs[relocs_count].offset = (uint32_t)p;
+			relocs[relocs_count].sym = (uint32_t)((val - sym_base) >> 32);
+			relocs[relocs_count].addend = (int64_t)(val - (IR_CODE_CACHE_SYM_BASE + ((uint64_t)relocs[relocs_count].sym << 32)));
+			relocs_count++;
+			p += 7;
+		}
+	}
+
+	*relocs_ptr = relocs;
+	*relocs_count_ptr = relocs_count;
+	return 1;
+
+failure:
+	ir_mem_free(relocs);
+	return 0;
+}
+
+/* Returns the name of symbol as it's referred from the IR */
+static ir_str ir_code_cache_sym_name(ir_ctx *ctx, const char *name)
+{
+	ir_ref i;
+	ir_insn *insn;
+
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base - i; i < ctx->consts_count; i++, insn--) {
+		if ((insn->op == IR_FUNC || insn->op == IR_SYM) && strcmp(ir_get_str(ctx, insn->val.name), name) == 0) {
+			return insn->val.name;
+		}
+	}
+	return ir_string(ctx, name);
+}
+
+/* Copies the code to the code buffer and fixes relocations */
+static void *ir_code_cache_install(ir_ctx *ctx, const ir_code_cache_image *image, size_t *size_ptr)
+{
+	uint32_t i, j;
+	size_t size = image->header.code_size;
+	const char *name;
+	void **addrs = NULL;
+	void *entry;
+	ir_insn *insn;
+
+	/* Resolve symbols */
+	if (image->header.syms_count) {
+		addrs = ir_mem_calloc(image->header.syms_count, sizeof(void*));
+		for (i = 0, name = image->sym_names; i < image->header.syms_count; i++, name += strlen(name) + 1) {
+			uint32_t flags = image->sym_ops[i] == IR_FUNC ? IR_RESOLVE_SYM_ADD_THUNK : 0;
+			bool used = 0;
+
+			for (j = 0; j < image->header.relocs_count; j++) {
+				if (image->relocs[j].sym == i) {
+					used = 1;
+					break;
+				}
+			}
+			if (!used) {
+				continue;
+			}
+			if (ctx->loader && ctx->loader->resolve_sym_name) {
+				addrs[i] = ctx->loader->resolve_sym_name(ctx->loader, ctx, ir_code_cache_sym_name(ctx, name), flags);
+			} else {
+				addrs[i] = ir_resolve_sym_name(name);
+			}
+			if (!addrs[i]) {
+				ir_mem_free(addrs);
+				ctx->status = IR_ERROR_LINK;
+				return NULL;
+			}
+		}
+	}
+
+	if (ctx->code_buffer) {
+		entry = ir_code_buffer_alloc(ctx->code_buffer, size, 16);
+	} else {
+		entry = ir_mem_mmap(size);
+		if (entry) {
+			ir_mem_unprotect(entry, size);
+		}
+	}
+	if (!entry) {
+		if (addrs) {
+			ir_mem_free(addrs);
+		}
+		ctx->status = IR_ERROR_CODE_MEM_OVERFLOW;
+		return NULL;
+	}
+
+	memcpy(entry, image->code, size);
+	for (i = 0; i < image->header.relocs_count; i++) {
+		const ir_code_cache_reloc *reloc = &image->relocs[i];
+		uintptr_t addr;
+
+		if (reloc->sym == IR_CODE_CACHE_SELF) {
+			addr = (uintptr_t)entry + (intptr_t)reloc->addend;
+		} else {
+			addr = (uintptr_t)addrs[reloc->sym] + (intptr_t)reloc->addend;
+		}
+		memcpy((char*)entry + reloc->offset, &addr, sizeof(addr));
+	}
+	if (addrs) {
+		ir_mem_free(addrs);
+	}
+
+	ir_mem_flush(entry, size);
+	if (!ctx->code_buffer) {
+		ir_mem_protect(entry, size);
+	}
+
+	ctx->rodata_offset = image->header.rodata_offset;
+	ctx->jmp_table_offset = image->header.jmp_table_offset;
+
+	if (image->header.entries_count && !ctx->entries) {
+		/* The function wasn't compiled. Bind ENTRY instructions of the source IR. */
+		ir_ref ref, n;
+
+		ctx->entries = ir_mem_malloc(image->header.entries_count * sizeof(ir_ref));
+		ctx->entries_count = 0;
+		for (ref = IR_UNUSED + 1, insn = ctx->ir_base + ref; ref < ctx->insns_count;) {
+			if (insn->op == IR_ENTRY) {
+				for (i = 0; i < image->header.entries_count; i++) {
+					if (image->entries[i].num == (uint32_t)insn->op2) {
+						insn->op3 = image->entries[i].offset;
+						ctx->entries[ctx->entries_count++] = ref;
+						break;
+					}
+				}
+			}
+			n = ir_insn_inputs_to_len(ir_operands_count(ctx, insn));
+			ref += n;
+			insn += n;
+		}
+	}
+
+	*size_ptr = size;
+	return entry;
+}
+
+/* Entry files */
+static char *ir_code_cache_file_name(const ir_code_cache *cache, const ir_code_cache_key *key, const char *suffix)
+{
+	size_t len = cache->dir_len + 1 + 32 + strlen(suffix) + 1;
+	char *name = ir_mem_malloc(len);
+
+	snprintf(name, len, "%s/%016llx%016llx%s", cache->dir,
+		(unsigned long long)key->h1, (unsigned long long)key->h2, suffix);
+	return name;
+}
+
+static void ir_code_cache_store(const ir_code_cache *cache, const ir_code_cache_image *image)
+{
+	char *name = ir_code_cache_file_name(cache, &image->header.key, ".irc");
+	size_t tmp_len = strlen(name) + 48;
+	char *tmp_name = ir_mem_malloc(tmp_len);
+	FILE *f;
+	bool ok;
+
+	/* write into a temporary file and rename it, so concurrent readers never see partial entries */
+	snprintf(tmp_name, tmp_len, "%s.%d.%p.tmp", name, (int)getpid(), (const void*)image);
+	f = fopen(tmp_name, "wb");
+	if (f) {
+		static const char zero[8];
+		size_t data_size = image->header.entries_count * sizeof(ir_code_cache_entry)
+			+ image->header.relocs_count * sizeof(ir_code_cache_reloc)
+			+ image->header.syms_count + image->header.syms_size;
+
+		ok = fwrite(&image->header, sizeof(ir_code_cache_header), 1, f) == 1
+			&& (!image->header.entries_count
+			 || fwrite(image->entries, sizeof(ir_code_cache_entry), image->header.entries_count, f) == image->header.entries_count)
+			&& (!image->header.relocs_count
+			 || fwrite(image->relocs, sizeof(ir_code_cache_reloc), image->header.relocs_count, f) == image->header.relocs_count)
+			&& (!image->header.syms_count
+			 || (fwrite(image->sym_ops, 1, image->header.syms_count, f) == image->header.syms_count
+			  && fwrite(image->sym_names, 1, image->header.syms_size, f) == image->header.syms_size))
+			&& (IR_ALIGNED_SIZE(data_size, 8) == data_size
+			 || fwrite(zero, IR_ALIGNED_SIZE(data_size, 8) - data_size, 1, f) == 1)
+			&& fwrite(image->code, 1, image->header.code_size, f) == image->header.code_size;
+		if (fclose(f) != 0) {
+			ok = 0;
+		}
+		if (!ok || rename(tmp_name, name) != 0) {
+			remove(tmp_name);
+		}
+	}
+	ir_mem_free(tmp_name);
+	ir_mem_free(name);
+}
+
+/* Returns the whole entry file and initializes "image" pointers into it */
+static void *ir_code_cache_fetch(const ir_code_cache *cache, const ir_code_cache_key *key, ir_code_cache_image *image)
+{
+	char *name = ir_code_cache_file_name(cache, key, ".irc");
+	FILE *f = fopen(name, "rb");
+	char *buf = NULL;
+	long file_size;
+	size_t data_size, sym_names_size;
+	const ir_code_cache_header *header;
+
+	ir_mem_free(name);
+	if (!f) {
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) != 0
+	 || (file_size = ftell(f)) < (long)sizeof(ir_code_cache_header)
+	 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	buf = ir_mem_malloc(file_size);
+	if (fread(buf, file_size, 1, f) != 1) {
+		fclose(f);
+		ir_mem_free(buf);
+		return NULL;
+	}
+	fclose(f);
+
+	header = (const ir_code_cache_header*)buf;
+	if (header->magic != IR_CODE_CACHE_MAGIC
+	 || header->version != IR_CODE_CACHE_VERSION
+	 || header->key.h1 != key->h1
+	 || header->key.h2 != key->h2
+	 || header->entries_count > 0xffff
+	 || header->relocs_count > header->code_size
+	 || header->syms_count > IR_CODE_CACHE_SYM_LIMIT) {
+		ir_mem_free(buf);
+		return NULL;
+	}
+	data_size = header->entries_count * sizeof(ir_code_cache_entry)
+		+ header->relocs_count * sizeof(ir_code_cache_reloc)
+		+ header->syms_count + header->syms_size;
+	if ((size_t)file_size != sizeof(ir_code_cache_header) + IR_ALIGNED_SIZE(data_size, 8) + header->code_size) {
+		ir_mem_free(buf);
+		return NULL;
+	}
+
+	image->header = *header;
+	image->entries = (ir_code_cache_entry*)(buf + sizeof(ir_code_cache_header));
+	image->relocs = (ir_code_cache_reloc*)(image->entries + header->entries_count);
+	image->sym_ops = (const uint8_t*)(image->relocs + header->relocs_count);
+	image->sym_names = (const char*)(image->sym_ops + header->syms_count);
+	image->code = (const uint8_t*)buf + sizeof(ir_code_cache_header) + IR_ALIGNED_SIZE(data_size, 8);
+
+	/* Validate symbol names and relocations */
+	sym_names_size = 0;
+	if (header->syms_count) {
+		uint32_t i;
+
+		if (header->syms_size == 0 || image->sym_names[header->syms_size - 1] != 0) {
+			ir_mem_free(buf);
+			return NULL;
+		}
+		for (i = 0; i < header->syms_count; i++) {
+			if (sym_names_size >= header->syms_size) {
+				ir_mem_free(buf);
+				return NULL;
+			}
+			sym_names_size += strlen(image->sym_names + sym_names_size) + 1;
+		}
+	}
+	if (sym_names_size != header->syms_size) {
+		ir_mem_free(buf);
+		return NULL;
+	} else {
+		uint32_t i;
+
+		for (i = 0; i < header->relocs_count; i++) {
+			if (image->relocs[i].offset > header->code_size - 8
+			 || header->code_size < 8
+			 || (image->relocs[i].sym != IR_CODE_CACHE_SELF && image->relocs[i].sym >= header->syms_count)) {
+				ir_mem_free(buf);
+				return NULL;
+			}
+		}
+	}
+	return buf;
+}
+
+/* Restores the state required by ir_emit_code() after failed attempt */
+static void ir_code_cache_reset_entries(ir_ctx *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->entries_count; i++) {
+		ctx->ir_base[ctx->entries[i]].op3 = i;
+	}
+}
+
+void *ir_code_cache_jit_compile(ir_code_cache *cache, ir_ctx *ctx, int opt_level, size_t *size)
+{
+	ir_code_cache_key key;
+	ir_code_cache_image image;
+	ir_code_cache_loader l;
+	ir_loader *saved_loader;
+	ir_code_buffer *saved_code_buffer;
+	void *buf, *code, *entry;
+	size_t code_size;
+	uint32_t i, syms_size;
+	char *sym_names;
+
+	if (!cache
+	 || ctx->snapshot_create
+	 || ctx->osr_entry_loads
+	 || !ir_code_cache_compute_key(ctx, opt_level, &key)) {
+		return ir_jit_compile(ctx, opt_level, size);
+	}
+
+	/* Lookup */
+	buf = ir_code_cache_fetch(cache, &key, &image);
+	if (buf) {
+		if (ctx->stats) {
+			ir_compile_stats_func(ctx);
+			ir_pass_start(ctx);
+		}
+		entry = ir_code_cache_install(ctx, &image, size);
+		if (ctx->stats) {
+			ir_pass_end(ctx, IR_PASS_EMIT_CODE, entry != NULL);
+		}
+		ir_mem_free(buf);
+		return entry;
+	}
+
+	/* Compile relocatable code */
+	memset(&l, 0, sizeof(l));
+	if (ctx->loader) {
+		l.loader = *ctx->loader;
+	}
+	l.loader.resolve_sym_name = ir_code_cache_resolve_sym_name;
+	l.loader.add_label = NULL;
+	ir_strtab_init(&l.syms, 16, 256);
+
+	saved_loader = ctx->loader;
+	saved_code_buffer = ctx->code_buffer;
+	ctx->loader = &l.loader;
+	ctx->code_buffer = NULL;
+	code = ir_jit_compile(ctx, opt_level, &code_size);
+	ctx->loader = saved_loader;
+	ctx->code_buffer = saved_code_buffer;
+	if (code && saved_code_buffer) {
+		/* ir_emit_code() protected the private code (protection keys may affect the whole code buffer) */
+		ir_mem_unprotect(saved_code_buffer->start, (char*)saved_code_buffer->end - (char*)saved_code_buffer->start);
+	}
+
+	if (!code) {
+		ir_strtab_free(&l.syms);
+		if (l.sym_ops) {
+			ir_mem_free(l.sym_ops);
+		}
+		return NULL;
+	}
+
+	memset(&image, 0, sizeof(image));
+	if (l.overflow
+	 || (ctx->flags2 & IR_HAS_BLOCK_ADDR)
+	 || code_size > 0x7fffffff
+	 || !ir_code_cache_scan(ctx, &l, code, code_size, &image.relocs, &image.header.relocs_count)) {
+		/* Can't relocate this code. Emit it again with the real symbols. */
+		ir_mem_unmap(code, code_size);
+		ir_strtab_free(&l.syms);
+		if (l.sym_ops) {
+			ir_mem_free(l.sym_ops);
+		}
+		ir_code_cache_reset_entries(ctx);
+		return ir_jit_emit_code(ctx, size);
+	}
+
+	image.header.magic = IR_CODE_CACHE_MAGIC;
+	image.header.version = IR_CODE_CACHE_VERSION;
+	image.header.key = key;
+	image.header.code_size = (uint32_t)code_size;
+	image.header.rodata_offset = ctx->rodata_offset;
+	image.header.jmp_table_offset = ctx->jmp_table_offset;
+	image.header.entries_count = ctx->entries_count;
+	if (ctx->entries_count) {
+		image.entries = ir_mem_malloc(ctx->entries_count * sizeof(ir_code_cache_entry));
+		for (i = 0; i < ctx->entries_count; i++) {
+			ir_insn *insn = &ctx->ir_base[ctx->entries[i]];
+
+			image.entries[i].num = insn->op2;
+			image.entries[i].offset = insn->op3;
+		}
+	}
+	image.header.syms_count = ir_strtab_count(&l.syms);
+	syms_size = 0;
+	for (i = 0; i < image.header.syms_count; i++) {
+		syms_size += (uint32_t)strlen(ir_code_cache_loader_get_str(&l, i)) + 1;
+	}
+	image.header.syms_size = syms_size;
+	sym_names = syms_size ? ir_mem_malloc(syms_size) : NULL;
+	syms_size = 0;
+	for (i = 0; i < image.header.syms_count; i++) {
+		const char *name = ir_code_cache_loader_get_str(&l, i);
+		size_t len = strlen(name) + 1;
+
+		memcpy(sym_names + syms_size, name, len);
+		syms_size += (uint32_t)len;
+	}
+	image.sym_ops = l.sym_ops;
+	image.sym_names = sym_names;
+	image.code = code;
+
+	ir_code_cache_store(cache, &image);
+	entry = ir_code_cache_install(ctx, &image, size);
+
+	ir_mem_unmap(code, code_size);
+	if (sym_names) {
+		ir_mem_free(sym_names);
+	}
+	if (image.entries) {
+		ir_mem_free(image.entries);
+	}
+	ir_mem_free(image.relocs);
+	ir_strtab_free(&l.syms);
+	if (l.sym_ops) {
+		ir_mem_free(l.sym_ops);
+	}
+	return entry;
+}
+
+#else /* IR_CODE_CACHE_ENABLED */
+
+void *ir_code_cache_jit_compile(ir_code_cache *cache, ir_ctx *ctx, int opt_level, size_t *size)
+{
+	return ir_jit_compile(ctx, opt_level, size);
+}
+
+#endif /* IR_CODE_CACHE_ENABLED */
@@ -43,6 +43,7 @@ typedef struct _ir_sym_node {
 } ir_sym_node;
 
 static ir_sym_node *_symbols = NULL;
+static ir_spinlock  _symbols_lock = 0;
 
 static void ir_syms_rotateleft(ir_sym_node *p)
 {
@@ -98,6 +99,7 @@ void ir_disasm_add_symbol(const char *name,
 	memcpy((char*)&sym->name, name, len + 1);
 	sym->parent = sym->child[0] = sym->child[1] = NULL;
 	sym->info = 1;
+	ir_spin_lock(&_symbols_lock);
 	if (_symbols) {
 		ir_sym_node *node = _symbols;
 
@@ -126,6 +128,7 @@ void ir_disasm_add_symbol(const char *name,
 					/* reduce size of the existing symbol */
 					node->end = sym->end;
 				}
+				ir_spin_unlock(&_symbols_lock);
 				ir_mem_pfree(sym);
 				return;
 			}
@@ -171,6 +174,7 @@ void ir_disasm_add_symbol(const char *name,
 		_symbols = sym;
 	}
 	_symbols->info = 0;
+	ir_spin_unlock(&_symbols_lock);
 }
 
 static void ir_disasm_destroy_symbols(ir_sym_node *n)
@@ -188,17 +192,22 @@ static void ir_disasm_destroy_symbols(ir_sym_node *n)
 
 const char* ir_disasm_find_symbol(uint64_t addr, int64_t *offset)
 {
-	ir_sym_node *node = _symbols;
+	ir_sym_node *node;
+
+	ir_spin_lock(&_symbols_lock);
+	node = _symbols;
 	while (node) {
 		if (addr < node->addr) {
 			node = node->child[0];
 		} else if (addr > node->end) {
 			node = node->child[1];
 		} else {
+			ir_spin_unlock(&_symbols_lock);
 			*offset = addr - node->addr;
 			return node->name;
 		}
 	}
+	ir_spin_unlock(&_symbols_lock);
 	return NULL;
 }
 
@@ -857,8 +866,10 @@ int ir_disasm_init(void)
 
 void ir_disasm_free(void)
 {
+	ir_spin_lock(&_symbols_lock);
 	if (_symbols) {
 		ir_disasm_destroy_symbols(_symbols);
 		_symbols = NULL;
 	}
+	ir_spin_unlock(&_symbols_lock);
 }
@@ -0,0 +1,299 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (DSE - Global Dead Store Elimination)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* ir_find_aliasing_store() removes a STORE (VSTORE) only when it is
+ * overwritten later in the same linear piece of the control chain.
+ * This pass finds the stores that are overwritten on every path leaving
+ * them, or that are never read before RETURN, over the whole CFG.
+ *
+ * Starting right after the STORE, we walk forward along all the paths.
+ * A path is closed by a STORE to the same address (of the same or bigger
+ * size), or by RETURN if the memory is local to the function (ALLOCA and
+ * VADDR). The STORE is alive if any path meets a node that may read the
+ * memory (aliasing LOAD, CALL, GUARD, etc.), or leaves the function in
+ * another way. Paths that come back to the STORE itself are closed by it.
+ */
+
+/* Limit for blocks visited by a single STORE check.
+ * When it's exhausted, the STORE is conservatively kept (see tests/dse_002.irt).
+ */
+#define IR_DSE_PATH_BUDGET  64
+
+typedef enum _ir_dse_effect {
+	IR_DSE_NONE,                   /* the node doesn't access the stored memory */
+	IR_DSE_KILL,                   /* the node overwrites the stored memory */
+	IR_DSE_READ,                   /* the node may read the stored memory */
+} ir_dse_effect;
+
+static bool ir_dse_is_const_call(const ir_ctx *ctx, const ir_insn *insn)
+{
+	const ir_insn *func = &ctx->ir_base[insn->op2];
+	ir_ref func_proto;
+	const ir_proto_t *proto;
+
+	if (func->op == IR_FUNC || func->op == IR_FUNC_ADDR) {
+		func_proto = func->proto;
+	} else if (func->op == IR_PROTO) {
+		func_proto = func->op2;
+	} else {
+		return 0;
+	}
+	if (!func_proto) {
+		return 0;
+	}
+	proto = (const ir_proto_t *)ir_get_str(ctx, func_proto);
+	return (proto->flags & IR_CONST_FUNC) != 0;
+}
+
+/* Check if the address points into the stack frame (it's dead after RETURN) */
+static bool ir_dse_is_local_addr(const ir_ctx *ctx, ir_ref addr)
+{
+	const ir_insn *insn;
+
+	while (addr > 0) {
+		insn = &ctx->ir_base[addr];
+		if (insn->op == IR_ALLOCA || insn->op == IR_VADDR) {
+			return 1;
+		} else if (insn->op == IR_ADD) {
+			if (insn->op2 > 0
+			 && (ctx->ir_base[insn->op2].op == IR_ALLOCA || ctx->ir_base[insn->op2].op == IR_VADDR)) {
+				addr = insn->op2;
+			} else if (insn->op2 > 0
+			 && ctx->ir_base[insn->op2].type == IR_ADDR
+			 && (insn->op1 < 0 || ctx->ir_base[insn->op1].type != IR_ADDR)) {
+				addr = insn->op2;
+			} else {
+				addr = insn->op1;
+			}
+		} else if (insn->op == IR_SUB) {
+			addr = insn->op1;
+		} else {
+			break;
+		}
+	}
+	return 0;
+}
+
+static ir_dse_effect ir_dse_store_effect(const ir_ctx *ctx, ir_ref store_ref, ir_ref ref)
+{
+	const ir_insn *store = &ctx->ir_base[store_ref];
+	const ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = ctx->ir_base[store->op3].type;
+
+	switch (insn->op) {
+		case IR_STORE:
+			if (insn->op2 == store->op2
+			 && ir_type_size[ctx->ir_base[insn->op3].type] >= ir_type_size[type]) {
+				return IR_DSE_KILL;
+			}
+			return IR_DSE_NONE;
+		case IR_LOAD:
+			if (insn->op2 == store->op2
+			 || (!ir_alias_class_disjoint(ir_alias_class(ctx, store_ref), ir_alias_class(ctx, ref))
+			  && ir_check_aliasing(ctx, store->op2, insn->op2, type, insn->type) != IR_NO_ALIAS)) {
+				return IR_DSE_READ;
+			}
+			return IR_DSE_NONE;
+		case IR_VLOAD:
+		case IR_VLOAD_v:
+		case IR_VSTORE:
+		case IR_VSTORE_v:
+		case IR_STORE_v:
+		case IR_RLOAD:
+		case IR_RSTORE:
+		case IR_TLS:
+			return IR_DSE_NONE;
+		case IR_CALL:
+			return ir_dse_is_const_call(ctx, insn) ? IR_DSE_NONE : IR_DSE_READ;
+		case IR_GUARD:
+		case IR_GUARD_NOT:
+			/* the deoptimization code may read the memory */
+			return IR_DSE_READ;
+		case IR_RETURN:
+			return ir_dse_is_local_addr(ctx, store->op2) ? IR_DSE_KILL : IR_DSE_READ;
+		default:
+			if ((ir_op_flags[insn->op] & (IR_OP_FLAG_MEM|IR_OP_FLAG_TERMINATOR))) {
+				return IR_DSE_READ;
+			}
+			return IR_DSE_NONE;
+	}
+}
+
+static ir_dse_effect ir_dse_vstore_effect(const ir_ctx *ctx, ir_ref store_ref, ir_ref ref)
+{
+	const ir_insn *store = &ctx->ir_base[store_ref];
+	const ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = ctx->ir_base[store->op3].type;
+
+	switch (insn->op) {
+		case IR_VSTORE:
+			if (insn->op2 == store->op2
+			 && ir_type_size[ctx->ir_base[insn->op3].type] >= ir_type_size[type]) {
+				return IR_DSE_KILL;
+			}
+			return IR_DSE_NONE;
+		case IR_VLOAD:
+		case IR_VLOAD_v:
+			return insn->op2 == store->op2 ? IR_DSE_READ : IR_DSE_NONE;
+		case IR_VSTORE_v:
+		case IR_STORE:
+		case IR_STORE_v:
+		case IR_RLOAD:
+		case IR_RSTORE:
+		case IR_TLS:
+			return IR_DSE_NONE;
+		case IR_CALL:
+			return ir_dse_is_const_call(ctx, insn) ? IR_DSE_NONE : IR_DSE_READ;
+		case IR_RETURN:
+			/* local variables are dead after RETURN */
+			return IR_DSE_KILL;
+		default:
+			/* LOAD may read the variable through VADDR */
+			if ((ir_op_flags[insn->op] & (IR_OP_FLAG_MEM|IR_OP_FLAG_TERMINATOR))
+			 || insn->op == IR_GUARD
+			 || insn->op == IR_GUARD_NOT) {
+				return IR_DSE_READ;
+			}
+			return IR_DSE_NONE;
+	}
+}
+
+static ir_dse_effect ir_dse_effect_of(const ir_ctx *ctx, ir_ref store_ref, ir_ref ref)
+{
+	if (ctx->ir_base[store_ref].op == IR_STORE) {
+		return ir_dse_store_effect(ctx, store_ref, ref);
+	} else {
+		IR_ASSERT(ctx->ir_base[store_ref].op == IR_VSTORE);
+		return ir_dse_vstore_effect(ctx, store_ref, ref);
+	}
+}
+
+/* Scan the block "b" starting from the control node "ref" (inclusive) */
+static ir_dse_effect ir_dse_scan_block(const ir_ctx *ctx, ir_ref store_ref, uint32_t b, ir_ref ref)
+{
+	const ir_block *bb = &ctx->cfg_blocks[b];
+	ir_dse_effect effect;
+
+	while (1) {
+		effect = ir_dse_effect_of(ctx, store_ref, ref);
+		if (effect != IR_DSE_NONE || ref == bb->end) {
+			return effect;
+		}
+		ref = ir_next_control(ctx, ref);
+	}
+}
+
+static bool ir_dse_is_dead(const ir_ctx *ctx, ir_worklist *path, ir_ref ref, uint32_t b)
+{
+	const ir_block *bb = &ctx->cfg_blocks[b];
+	uint32_t n, budget = IR_DSE_PATH_BUDGET;
+	const uint32_t *p;
+	ir_dse_effect effect;
+
+	effect = ir_dse_scan_block(ctx, ref, b, ir_next_control(ctx, ref));
+	if (effect != IR_DSE_NONE) {
+		return effect == IR_DSE_KILL;
+	}
+
+	ir_worklist_clear(path);
+	for (n = bb->successors_count, p = &ctx->cfg_edges[bb->successors]; n > 0; p++, n--) {
+		ir_worklist_push(path, *p);
+	}
+	while (ir_worklist_len(path)) {
+		b = ir_worklist_pop(path);
+		bb = &ctx->cfg_blocks[b];
+		if (!--budget) {
+			return 0;
+		}
+		effect = ir_dse_scan_block(ctx, ref, b, bb->start);
+		if (effect == IR_DSE_READ) {
+			return 0;
+		} else if (effect == IR_DSE_NONE) {
+			for (n = bb->successors_count, p = &ctx->cfg_edges[bb->successors]; n > 0; p++, n--) {
+				ir_worklist_push(path, *p);
+			}
+		}
+	}
+	return 1;
+}
+
+static void ir_dse_remove_insn(ir_ctx *ctx, ir_ref ref)
+{
+	ir_list stack;
+	ir_ref n, *p, input;
+	ir_insn *insn;
+
+	ir_list_init(&stack, 8);
+	ir_list_push(&stack, ref);
+	while (ir_list_len(&stack)) {
+		ref = ir_list_pop(&stack);
+		insn = &ctx->ir_base[ref];
+		IR_ASSERT(ctx->use_lists[ref].count == 0);
+		n = insn->inputs_count;
+		insn->opt = IR_NOP; /* keep "inputs_count" */
+		ctx->cfg_map[ref] = 0;
+		for (p = insn->ops + 1; n > 0; p++, n--) {
+			input = *p;
+			*p = IR_UNUSED;
+			if (input > 0) {
+				ir_use_list_remove_one(ctx, input, ref);
+				if (ctx->use_lists[input].count == 0
+				 && (ir_op_flags[ctx->ir_base[input].op] & IR_OP_FLAG_DATA)
+				 && !(ir_op_flags[ctx->ir_base[input].op] & IR_OP_FLAG_PINNED)) {
+					/* DCE */
+					ir_list_push(&stack, input);
+				}
+			}
+		}
+	}
+	ir_list_free(&stack);
+}
+
+static void ir_dse_remove_store(ir_ctx *ctx, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref prev = insn->op1;
+	ir_ref next = ir_next_control(ctx, ref);
+
+	/* remove STORE from double linked control list */
+	ctx->ir_base[next].op1 = prev;
+	ir_use_list_remove_one(ctx, ref, next);
+	ir_use_list_replace_one(ctx, prev, ref, next);
+	insn->op1 = IR_UNUSED;
+
+	ir_dse_remove_insn(ctx, ref);
+}
+
+int ir_dse(ir_ctx *ctx)
+{
+	ir_worklist path;
+	uint32_t b;
+	ir_ref ref, next;
+	ir_insn *insn;
+
+	IR_ASSERT(ctx->cfg_blocks && ctx->use_lists);
+
+	ir_worklist_init(&path, ctx->cfg_blocks_count + 1);
+	for (b = 1; b <= ctx->cfg_blocks_count; b++) {
+		ref = ctx->cfg_blocks[b].start;
+		while (ref != ctx->cfg_blocks[b].end) {
+			next = ir_next_control(ctx, ref);
+			insn = &ctx->ir_base[ref];
+			if ((insn->op == IR_STORE || insn->op == IR_VSTORE)
+			 && ir_dse_is_dead(ctx, &path, ref, b)) {
+				ir_dse_remove_store(ctx, ref);
+			}
+			ref = next;
+		}
+	}
+	ir_worklist_free(&path);
+
+	return 1;
+}
@@ -806,3 +806,88 @@ void ir_dump_codegen(const ir_ctx *ctx, FILE *f)
 	}
 	fprintf(f, "}\n");
 }
+
+void ir_dump_compile_stats(const ir_compile_stats *stats, FILE *f)
+{
+	uint32_t i;
+	double total = 0.0;
+	const ir_pass_stats *pass_stats;
+
+	for (i = 0; i < IR_LAST_PASS; i++) {
+		total += stats->pass[i].time;
+	}
+
+	fprintf(f, "{ # compilation statistics (%d functions)\n", stats->funcs_count);
+	fprintf(f, "\t%-16s %6s %10s %6s %12s %12s %10s %10s %7s\n",
+		"pass", "calls", "time(ms)", "%", "insns-in", "insns-out", "heap(KB)", "arena(KB)", "blocks");
+	for (i = 0; i < IR_LAST_PASS; i++) {
+		pass_stats = &stats->pass[i];
+		if (!pass_stats->count) {
+			continue;
+		}
+		fprintf(f, "\t%-16s %6d %10.3f %6.2f %12" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %7" PRIu64 "\n",
+			ir_pass_name[i],
+			pass_stats->count,
+			pass_stats->time * 1000.0,
+			total > 0.0 ? pass_stats->time * 100.0 / total : 0.0,
+			pass_stats->insns_in,
+			pass_stats->insns_out,
+			(uint64_t)(pass_stats->peak_heap + 1023) / 1024,
+			(uint64_t)(pass_stats->peak_arena + 1023) / 1024,
+			pass_stats->arena_blocks);
+	}
+	fprintf(f, "\t%-16s %6s %10.3f\n", "total", "", total * 1000.0);
+	fprintf(f, "}\n");
+}
+
+static int ir_fold_stats_cmp(const void *p1, const void *p2)
+{
+	const ir_fold_stats *s1 = (const ir_fold_stats*)p1;
+	const ir_fold_stats *s2 = (const ir_fold_stats*)p2;
+
+	if (s1->matches != s2->matches) {
+		return s1->matches > s2->matches ? -1 : 1;
+	} else if (s1->cse_hits != s2->cse_hits) {
+		return s1->cse_hits > s2->cse_hits ? -1 : 1;
+	}
+	return (int)s1->line - (int)s2->line;
+}
+
+void ir_dump_fold_stats(FILE *f)
+{
+	uint32_t i, count, unused = 0;
+	const ir_fold_stats *stats = ir_fold_stats_get(&count);
+	ir_fold_stats *sorted;
+
+	if (!stats) {
+		fprintf(f, "{ # folding statistics are not collected (compile with IR_FOLD_STATS) }\n");
+		return;
+	}
+
+	sorted = ir_mem_malloc(count * sizeof(ir_fold_stats));
+	memcpy(sorted, stats, count * sizeof(ir_fold_stats));
+	qsort(sorted, count, sizeof(ir_fold_stats), ir_fold_stats_cmp);
+
+	fprintf(f, "{ # folding rules statistics (sorted by matches)\n");
+	fprintf(f, "\t%12s %12s %12s %12s %6s  %s\n",
+		"matches", "successes", "restarts", "cse-hits", "line", "rule");
+	for (i = 0; i < count; i++) {
+		if (!sorted[i].matches && !sorted[i].cse_hits) {
+			unused += sorted[i].rule != NULL;
+			continue;
+		}
+		fprintf(f, "\t%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %6d  %s\n",
+			sorted[i].matches, sorted[i].successes, sorted[i].restarts, sorted[i].cse_hits,
+			sorted[i].line, sorted[i].rule ? sorted[i].rule : "(no rule)");
+	}
+	if (unused) {
+		fprintf(f, "\t# never matched rules (%d):\n", unused);
+		for (i = 0; i < count; i++) {
+			if (!stats[i].matches && !stats[i].cse_hits && stats[i].rule) {
+				fprintf(f, "\t%58d  %s\n", stats[i].line, stats[i].rule);
+			}
+		}
+	}
+	fprintf(f, "}\n");
+	ir_mem_free(sorted);
+}
@@ -63,6 +63,8 @@ typedef struct _ir_copy {
 
 #define IR_U32_HI IR_U64 /* type for dessa copy of the high 32-bit value of constant */
 
+#define IR_MEM_INLINE_MAX 128 /* max size of MEMCPY/MEMSET expanded into a sequence of moves */
+
 typedef struct _ir_dessa_copy {
 	ir_type type;
 	int32_t from; /* negative - constant ref, [0..IR_REG_NUM) - CPU reg, [IR_REG_NUM...) - memory slot */
@@ -143,7 +145,7 @@ static ir_reg ir_get_param_reg(const ir_ctx *ctx, ir_ref ref)
 				}
 #endif
 			} else {
-				IR_ASSERT(IR_IS_TYPE_FP(insn->type));
+				IR_ASSERT(IR_IS_TYPE_FP(insn->type) || IR_IS_TYPE_VEC(insn->type));
 				if (use == ref) {
 					if (fp_param < cc->fp_param_regs_count) {
 						return cc->fp_param_regs[fp_param];
@@ -197,7 +199,7 @@ static int ir_get_args_regs(const ir_ctx *ctx, const ir_insn *insn, const ir_cal
 				regs[j] = IR_REG_NONE;
 			}
 		} else {
-			IR_ASSERT(IR_IS_TYPE_FP(type));
+			IR_ASSERT(IR_IS_TYPE_FP(type) || IR_IS_TYPE_VEC(type));
 			if (fp_param < cc->fp_param_regs_count) {
 				regs[j] = cc->fp_param_regs[fp_param];
 				count = j + 1;
@@ -319,6 +321,509 @@ static void *ir_jmp_addr(ir_ctx *ctx, ir_insn *insn, ir_insn *addr_insn)
 	return addr;
 }
 
+/* Returns the size of MEMCPY/MEMSET that should be expanded inline or -1 */
+static int32_t ir_mem_inline_size(const ir_ctx *ctx, const ir_insn *insn)
+{
+	IR_ASSERT(insn->op == IR_MEMCPY || insn->op == IR_MEMSET);
+	if (IR_IS_CONST_REF(ir_insn_op(insn, 4))) {
+		const ir_insn *size = &ctx->ir_base[ir_insn_op(insn, 4)];
+
+		if (size->val.u64 <= IR_MEM_INLINE_MAX) {
+			return (int32_t)size->val.u64;
+		}
+	}
+	return -1;
+}
+
+/* Switch lowering
+ *
+ * The cases of SWITCH are sorted and partitioned into the minimal number of
+ * clusters (dynamic programming). A cluster is a single value (or a range)
+ * with a single target, a dense jump table, or a bit test (a few targets,
+ * all the values fit into a machine word). The clusters are dispatched by
+ * a binary search tree, balanced according to the CASE_VAL probabilities,
+ * with short linear sequences in its leaves.
+ *
+ * The result is a sequence of simple steps, emitted by the target specific
+ * ir_emit_switch().
+ */
+#define IR_SWITCH_MIN_TABLE_CASES  3     /* min number of cases in a jump table */
+#define IR_SWITCH_TABLE_DENSITY    8     /* at least 1/8 of the jump table entries must be used */
+#define IR_SWITCH_MAX_TABLE_SIZE   4096  /* max number of jump table entries */
+#define IR_SWITCH_MAX_BIT_TARGETS  3     /* max number of targets of a bit test cluster */
+#define IR_SWITCH_MAX_LINEAR       3     /* max number of clusters checked one by one */
+#define IR_SWITCH_BITS             (sizeof(void*) * 8)
+#define IR_SWITCH_MAX_TABLE_BASE   0x10000000 /* jump table is addressed using 32-bit displacement (value * 8) */
+
+#define IR_SWITCH_SIGN_BIT         0x8000000000000000
+
+typedef enum _ir_switch_kind {
+	IR_SWITCH_CASE,                /* single value or range */
+	IR_SWITCH_TABLE,               /* jump table */
+	IR_SWITCH_BIT_TEST,            /* bit tests */
+} ir_switch_kind;
+
+typedef enum _ir_switch_op {
+	IR_SWITCH_LABEL,               /* definition of a local label */
+	IR_SWITCH_JMP,                 /* jump to "label" */
+	IR_SWITCH_JEQ,                 /* jump to "label" if value == "val" */
+	IR_SWITCH_JLT,                 /* jump to "label" if value < "val" */
+	IR_SWITCH_JLE,                 /* jump to "label" if value <= "val" */
+	IR_SWITCH_JGT,                 /* jump to "label" if value > "val" */
+	IR_SWITCH_JGE,                 /* jump to "label" if value >= "val" */
+	IR_SWITCH_TABLE_JMP,           /* jump through the table for ["val", "val" + "mask"] ("label" - out of range target) */
+	IR_SWITCH_BIT_JMP,             /* jump to "label" if bit "value % IR_SWITCH_BITS" is set in "mask" */
+} ir_switch_op;
+
+typedef struct _ir_switch_case {
+	uint64_t           low, high;  /* keys (values biased to be compared as unsigned) */
+	int                label;      /* target block */
+	uint32_t           weight;
+} ir_switch_case;
+
+typedef struct _ir_switch_cluster {
+	ir_switch_kind     kind;
+	uint32_t           first, last;
+	uint64_t           low, high;
+	uint64_t           weight;
+} ir_switch_cluster;
+
+typedef struct _ir_switch_step {
+	ir_switch_op       op;
+	int                label;      /* >0 - target block, <0 - local label, 0 - none */
+	uint32_t           cluster;
+	int64_t            val;
+	uint64_t           mask;
+} ir_switch_step;
+
+typedef struct _ir_switch {
+	ir_type            type;
+	int                default_label;
+	uint32_t           cases_count;
+	uint32_t           clusters_count;
+	uint32_t           steps_count;
+	uint32_t           labels_count;
+	ir_switch_case    *cases;
+	ir_switch_cluster *clusters;
+	ir_switch_step    *steps;
+} ir_switch;
+
+static uint64_t ir_switch_key(const ir_switch *sw, int64_t val)
+{
+	return IR_IS_TYPE_SIGNED(sw->type) ? (uint64_t)val ^ IR_SWITCH_SIGN_BIT : (uint64_t)val;
+}
+
+static int64_t ir_switch_val(const ir_switch *sw, uint64_t key)
+{
+	return IR_IS_TYPE_SIGNED(sw->type) ? (int64_t)(key ^ IR_SWITCH_SIGN_BIT) : (int64_t)key;
+}
+
+static int ir_switch_case_cmp(const void *a, const void *b)
+{
+	uint64_t k1 = ((const ir_switch_case*)a)->low;
+	uint64_t k2 = ((const ir_switch_case*)b)->low;
+
+	return (k1 > k2) - (k1 < k2);
+}
+
+static void ir_switch_collect_cases(ir_ctx *ctx, uint32_t b, ir_switch *sw)
+{
+	ir_block *bb = &ctx->cfg_blocks[b];
+	uint32_t n, *p, i, j, known = 0, unknown = 0, weight;
+	ir_insn *insn;
+	ir_switch_case *c;
+
+	sw->cases = ir_mem_malloc(sizeof(ir_switch_case) * bb->successors_count);
+	sw->cases_count = 0;
+	sw->default_label = 0;
+	for (n = bb->successors_count, p = &ctx->cfg_edges[bb->successors]; n > 0; p++, n--) {
+		insn = &ctx->ir_base[ctx->cfg_blocks[*p].start];
+		if (insn->op == IR_CASE_DEFAULT) {
+			sw->default_label = ir_skip_empty_target_blocks(ctx, *p);
+			weight = insn->op2;
+		} else {
+			IR_ASSERT(!IR_IS_SYM_CONST(ctx->ir_base[insn->op2].op));
+			c = &sw->cases[sw->cases_count++];
+			c->low = ir_switch_key(sw, ctx->ir_base[insn->op2].val.i64);
+			if (insn->op == IR_CASE_VAL) {
+				c->high = c->low;
+				weight = insn->op3;
+			} else {
+				IR_ASSERT(insn->op == IR_CASE_RANGE);
+				IR_ASSERT(!IR_IS_SYM_CONST(ctx->ir_base[insn->op3].op));
+				c->high = ir_switch_key(sw, ctx->ir_base[insn->op3].val.i64);
+				weight = 0;
+			}
+			c->label = ir_skip_empty_target_blocks(ctx, *p);
+			c->weight = weight * 16;
+		}
+		if (weight) {
+			known += weight;
+		} else {
+			unknown++;
+		}
+	}
+
+	/* the cases without probability share the rest */
+	if (unknown) {
+		weight = IR_MAX(1, (100 - IR_MIN(known, 100)) * 16 / unknown);
+		for (i = 0; i < sw->cases_count; i++) {
+			if (!sw->cases[i].weight) {
+				sw->cases[i].weight = weight;
+			}
+		}
+	}
+
+	qsort(sw->cases, sw->cases_count, sizeof(ir_switch_case), ir_switch_case_cmp);
+
+	/* merge the adjacent cases with the same target */
+	for (i = 0, j = 0; i < sw->cases_count; i++) {
+		c = &sw->cases[i];
+		if (j
+		 && sw->cases[j - 1].label == c->label
+		 && sw->cases[j - 1].high + 1 == c->low) {
+			sw->cases[j - 1].high = c->high;
+			sw->cases[j - 1].weight += c->weight;
+		} else {
+			if (i != j) {
+				sw->cases[j] = *c;
+			}
+			j++;
+		}
+	}
+	sw->cases_count = j;
+}
+
+static void ir_switch_find_clusters(ir_switch *sw)
+{
+	static const uint32_t min_bit_test_cases[IR_SWITCH_MAX_BIT_TARGETS + 1] = {0, 3, 5, 6};
+	uint32_t n = sw->cases_count;
+	uint32_t i, j, k, count, labels_count;
+	uint32_t *cost, *start;
+	uint8_t *kind;
+	uint64_t span, values;
+	int labels[IR_SWITCH_MAX_BIT_TARGETS];
+	ir_switch_case *c;
+	ir_switch_cluster *cluster;
+
+	/* cost[i] - the minimal number of clusters for the first "i" cases */
+	cost = ir_mem_malloc(sizeof(uint32_t) * (n + 1));
+	start = ir_mem_malloc(sizeof(uint32_t) * (n + 1));
+	kind = ir_mem_malloc(n + 1);
+	cost[0] = 0;
+	for (i = 1; i <= n; i++) {
+		cost[i] = cost[i - 1] + 1;
+		start[i] = i - 1;
+		kind[i] = IR_SWITCH_CASE;
+		values = 0;
+		labels_count = 0;
+		for (j = i; j > 0; j--) {
+			c = &sw->cases[j - 1];
+			span = sw->cases[i - 1].high - c->low;
+			if (span >= IR_SWITCH_MAX_TABLE_SIZE) {
+				break;
+			}
+			values += c->high - c->low + 1;
+			count = i - j + 1;
+			if (labels_count <= IR_SWITCH_MAX_BIT_TARGETS) {
+				for (k = 0; k < labels_count && labels[k] != c->label; k++);
+				if (k == labels_count) {
+					if (labels_count < IR_SWITCH_MAX_BIT_TARGETS) {
+						labels[labels_count] = c->label;
+					}
+					labels_count++;
+				}
+			}
+			if (count >= IR_SWITCH_MIN_TABLE_CASES
+			 && span < values * IR_SWITCH_TABLE_DENSITY
+			 && ir_switch_val(sw, c->low) > -IR_SWITCH_MAX_TABLE_BASE
+			 && ir_switch_val(sw, c->low) < IR_SWITCH_MAX_TABLE_BASE
+			 && cost[j - 1] + 1 < cost[i]) {
+				cost[i] = cost[j - 1] + 1;
+				start[i] = j - 1;
+				kind[i] = IR_SWITCH_TABLE;
+			}
+			/* bit tests are preferred over a jump table of the same cost */
+			if (span < IR_SWITCH_BITS
+			 && labels_count <= IR_SWITCH_MAX_BIT_TARGETS
+			 && count >= min_bit_test_cases[labels_count]
+			 && cost[j - 1] + 1 <= cost[i]) {
+				cost[i] = cost[j - 1] + 1;
+				start[i] = j - 1;
+				kind[i] = IR_SWITCH_BIT_TEST;
+			}
+		}
+	}
+
+	sw->clusters_count = cost[n];
+	sw->clusters = ir_mem_malloc(sizeof(ir_switch_cluster) * (sw->clusters_count + 1));
+	for (i = n, k = sw->clusters_count; i > 0; i = start[i]) {
+		cluster = &sw->clusters[--k];
+		cluster->kind = kind[i];
+		cluster->first = start[i];
+		cluster->last = i - 1;
+		cluster->low = sw->cases[cluster->first].low;
+		cluster->high = sw->cases[cluster->last].high;
+		cluster->weight = 0;
+		for (j = cluster->first; j <= cluster->last; j++) {
+			cluster->weight += sw->cases[j].weight;
+		}
+	}
+	IR_ASSERT(k == 0);
+
+	ir_mem_free(kind);
+	ir_mem_free(start);
+	ir_mem_free(cost);
+}
+
+static ir_switch_step *ir_switch_add_step(ir_switch *sw, ir_switch_op op, int label, uint64_t key)
+{
+	ir_switch_step *step = &sw->steps[sw->steps_count++];
+
+	step->op = op;
+	step->label = label;
+	step->cluster = 0;
+	step->val = ir_switch_val(sw, key);
+	step->mask = 0;
+	return step;
+}
+
+static int ir_switch_new_label(ir_switch *sw)
+{
+	return -(int)(++sw->labels_count);
+}
+
+/* Emits the checks of the cluster for value in [lo, hi], "fail" is a target for the values out of the cluster.
+ * Returns true if the code may fall through (the value is out of the cluster) */
+static bool ir_switch_gen_cluster(ir_switch *sw, uint32_t n, uint64_t lo, uint64_t hi, int fail)
+{
+	ir_switch_cluster *cluster = &sw->clusters[n];
+	ir_switch_step *step;
+	ir_switch_case *c;
+	uint64_t masks[IR_SWITCH_MAX_BIT_TARGETS], weights[IR_SWITCH_MAX_BIT_TARGETS], mask, bit, rot;
+	int labels[IR_SWITCH_MAX_BIT_TARGETS];
+	uint32_t i, j, k, count;
+	int label;
+
+	switch (cluster->kind) {
+		case IR_SWITCH_CASE:
+			label = sw->cases[cluster->first].label;
+			if (cluster->low <= lo && cluster->high >= hi) {
+				ir_switch_add_step(sw, IR_SWITCH_JMP, label, 0);
+				return 0;
+			} else if (cluster->low == cluster->high) {
+				ir_switch_add_step(sw, IR_SWITCH_JEQ, label, cluster->low);
+			} else if (cluster->low <= lo) {
+				ir_switch_add_step(sw, IR_SWITCH_JLE, label, cluster->high);
+			} else if (cluster->high >= hi) {
+				ir_switch_add_step(sw, IR_SWITCH_JGE, label, cluster->low);
+			} else {
+				IR_ASSERT(fail);
+				ir_switch_add_step(sw, IR_SWITCH_JLT, fail, cluster->low);
+				ir_switch_add_step(sw, IR_SWITCH_JLE, label, cluster->high);
+			}
+			return 1;
+		case IR_SWITCH_TABLE:
+			if (cluster->low > lo || cluster->high < hi) {
+				IR_ASSERT(fail);
+				label = fail;
+			} else {
+				label = 0;
+			}
+			step = ir_switch_add_step(sw, IR_SWITCH_TABLE_JMP, label, cluster->low);
+			step->cluster = n;
+			step->mask = cluster->high - cluster->low;
+			return 0;
+		case IR_SWITCH_BIT_TEST:
+			if (cluster->low > lo) {
+				IR_ASSERT(fail);
+				ir_switch_add_step(sw, IR_SWITCH_JLT, fail, cluster->low);
+			}
+			if (cluster->high < hi) {
+				IR_ASSERT(fail);
+				ir_switch_add_step(sw, IR_SWITCH_JGT, fail, cluster->high);
+			}
+
+			/* build masks ordered by weight */
+			count = 0;
+			for (i = cluster->first; i <= cluster->last; i++) {
+				c = &sw->cases[i];
+				for (j = 0; j < count && labels[j] != c->label; j++);
+				if (j == count) {
+					IR_ASSERT(count < IR_SWITCH_MAX_BIT_TARGETS);
+					labels[count] = c->label;
+					masks[count] = 0;
+					weights[count] = 0;
+					count++;
+				}
+				for (bit = c->low - cluster->low; bit <= c->high - cluster->low; bit++) {
+					masks[j] |= (uint64_t)1 << bit;
+				}
+				weights[j] += c->weight;
+			}
+
+			/* the value is used as a bit number modulo IR_SWITCH_BITS, so the masks are rotated */
+			rot = (uint64_t)ir_switch_val(sw, cluster->low) & (IR_SWITCH_BITS - 1);
+			for (i = 0; i < count; i++) {
+				k = i;
+				for (j = i + 1; j < count; j++) {
+					if (weights[j] > weights[k]) {
+						k = j;
+					}
+				}
+				mask = masks[k];
+				label = labels[k];
+				masks[k] = masks[i];
+				labels[k] = labels[i];
+				weights[k] = weights[i];
+				if (rot) {
+					mask = ((mask << rot) | (mask >> (IR_SWITCH_BITS - rot))) & ((uint64_t)-1 >> (64 - IR_SWITCH_BITS));
+				}
+				step = ir_switch_add_step(sw, IR_SWITCH_BIT_JMP, label, 0);
+				step->mask = mask;
+			}
+			if (sw->default_label) {
+				ir_switch_add_step(sw, IR_SWITCH_JMP, sw->default_label, 0);
+			}
+			return 0;
+	}
+	IR_ASSERT(0);
+	return 0;
+}
+
+/* Check the clusters one by one, starting from the most probable */
+static void ir_switch_gen_linear(ir_switch *sw, uint32_t first, uint32_t last, uint64_t lo, uint64_t hi)
+{
+	uint32_t order[IR_SWITCH_MAX_LINEAR];
+	uint32_t i, j, count = 0;
+	int fail;
+
+	for (i = first; i <= last; i++) {
+		for (j = count++; j > 0 && sw->clusters[order[j - 1]].weight < sw->clusters[i].weight; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+	for (i = 0; i < count; i++) {
+		if (i != count - 1) {
+			fail = ir_switch_new_label(sw);
+			ir_switch_gen_cluster(sw, order[i], lo, hi, fail);
+			ir_switch_add_step(sw, IR_SWITCH_LABEL, fail, 0);
+		} else if (sw->default_label) {
+			if (ir_switch_gen_cluster(sw, order[i], lo, hi, sw->default_label)) {
+				ir_switch_add_step(sw, IR_SWITCH_JMP, sw->default_label, 0);
+			}
+		} else {
+			/* without CASE_DEFAULT the value must match the last cluster */
+			ir_switch_gen_cluster(sw, order[i], sw->clusters[order[i]].low, sw->clusters[order[i]].high, 0);
+		}
+	}
+}
+
+/* Binary search tree for the clusters [first, last] and value in [lo, hi] */
+static void ir_switch_gen_tree(ir_switch *sw, uint32_t first, uint32_t last, uint64_t lo, uint64_t hi)
+{
+	uint64_t total = 0, left = 0, diff, best_diff = (uint64_t)-1;
+	uint32_t i, pivot = first + 1;
+	int label;
+
+	if (last - first < IR_SWITCH_MAX_LINEAR) {
+		ir_switch_gen_linear(sw, first, last, lo, hi);
+		return;
+	}
+
+	/* split the clusters into two parts of (almost) the same weight */
+	for (i = first; i <= last; i++) {
+		total += sw->clusters[i].weight;
+	}
+	for (i = first + 1; i <= last; i++) {
+		left += sw->clusters[i - 1].weight;
+		diff = (left * 2 > total) ? left * 2 - total : total - left * 2;
+		if (diff < best_diff) {
+			best_diff = diff;
+			pivot = i;
+		}
+	}
+
+	label = ir_switch_new_label(sw);
+	ir_switch_add_step(sw, IR_SWITCH_JLT, label, sw->clusters[pivot].low);
+	ir_switch_gen_tree(sw, pivot, last, sw->clusters[pivot].low, hi);
+	ir_switch_add_step(sw, IR_SWITCH_LABEL, label, 0);
+	ir_switch_gen_tree(sw, first, pivot - 1, lo, sw->clusters[pivot].low - 1);
+}
+
+static void ir_switch_init(ir_ctx *ctx, uint32_t b, ir_type type, ir_switch *sw)
+{
+	uint32_t bits = ir_type_size[type] * 8;
+	uint64_t lo, hi;
+
+	sw->type = type;
+	ir_switch_collect_cases(ctx, b, sw);
+	ir_switch_find_clusters(sw);
+
+	sw->steps = ir_mem_malloc(sizeof(ir_switch_step) * (sw->clusters_count * 10 + 2));
+	sw->steps_count = 0;
+	sw->labels_count = 0;
+	if (!sw->clusters_count) {
+		if (sw->default_label) {
+			ir_switch_add_step(sw, IR_SWITCH_JMP, sw->default_label, 0);
+		}
+		return;
+	}
+
+	/* the range of the type */
+	if (bits == 64) {
+		lo = 0;
+		hi = (uint64_t)-1;
+	} else if (IR_IS_TYPE_SIGNED(type)) {
+		lo = ir_switch_key(sw, -((int64_t)1 << (bits - 1)));
+		hi = ir_switch_key(sw, ((int64_t)1 << (bits - 1)) - 1);
+	} else {
+		lo = 0;
+		hi = ((uint64_t)1 << bits) - 1;
+	}
+	ir_switch_gen_tree(sw, 0, sw->clusters_count - 1, lo, hi);
+}
+
+/* Fill the targets of the jump table */
+static void ir_switch_table_labels(const ir_switch *sw, const ir_switch_step *step, int *labels)
+{
+	const ir_switch_cluster *cluster = &sw->clusters[step->cluster];
+	const ir_switch_case *c;
+	uint64_t i;
+	uint32_t j;
+
+	for (i = 0; i <= cluster->high - cluster->low; i++) {
+		labels[i] = sw->default_label;
+	}
+	for (j = cluster->first; j <= cluster->last; j++) {
+		c = &sw->cases[j];
+		for (i = c->low - cluster->low; i <= c->high - cluster->low; i++) {
+			labels[i] = c->label;
+		}
+	}
+}
+
+/* Checks if the block is a target of a direct jump (not only of jump table entries) */
+static bool ir_switch_is_jump_target(const ir_switch *sw, int label)
+{
+	uint32_t i;
+
+	for (i = 0; i < sw->steps_count; i++) {
+		if (sw->steps[i].label == label && sw->steps[i].op != IR_SWITCH_TABLE_JMP) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void ir_switch_free(ir_switch *sw)
+{
+	ir_mem_free(sw->steps);
+	ir_mem_free(sw->clusters);
+	ir_mem_free(sw->cases);
+}
+
 static int8_t ir_get_fused_reg(ir_ctx *ctx, ir_ref root, ir_ref ref_and_op)
 {
 	if (ctx->fused_regs) {
@@ -1269,7 +1774,7 @@ int ir_match(ir_ctx *ctx)
 	ir_insn *insn;
 	uint32_t entries_count = 0;
 
-	ctx->rules = ir_mem_calloc(ctx->insns_count, sizeof(uint32_t));
+	ctx->rules = ir_ctx_calloc(ctx, ctx->insns_count, sizeof(uint32_t));
 
 	prev_ref = ctx->prev_ref;
 	if (!prev_ref) {
@@ -1345,6 +1850,10 @@ int ir_match(ir_ctx *ctx)
 		}
 	}
 
+	if (ctx->status) {
+		/* the target can't generate code for some instruction */
+		return 0;
+	}
 	return 1;
 }
 
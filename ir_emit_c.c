@@ -55,6 +55,18 @@ static void ir_emit_c_const(ir_ctx *ctx, ir_insn *insn, FILE *f)
 			ir_resolve_label_syms(ctx);
 		}
 		fprintf(f, "&&bb%d", insn->val.u32_hi);
+	} else if (IR_IS_TYPE_VEC(insn->type)) {
+		uint32_t i, lanes = IR_VEC_LANES(insn->type);
+
+		/* vector constants are splats of the lane value */
+		fprintf(f, "((%s){", ir_type_cname[insn->type]);
+		for (i = 0; i < lanes; i++) {
+			if (i) {
+				fprintf(f, ", ");
+			}
+			ir_print_const(ctx, insn, f, true);
+		}
+		fprintf(f, "})");
 	} else {
 		if (insn->op == IR_SYM) {
 			fprintf(f, "&");
@@ -134,8 +146,152 @@ static void ir_emit_unary_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn, const
 	fprintf(f, ";\n");
 }
 
+static void ir_emit_vec_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
+{
+	ir_type type = insn->type;
+	const char *name = ir_type_cname[type];
+	const char *bytes = (ir_type_size[type] == 32) ? "i8x32_t" : "i8x16_t";
+	uint32_t i, lanes, mask;
+
+	switch (insn->op) {
+		default:
+			IR_ASSERT(0 && "NIY vector op");
+			break;
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+			ir_emit_def_ref(ctx, f, def);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, " %c ", (insn->op == IR_ADD) ? '+' : (insn->op == IR_SUB) ? '-' : (insn->op == IR_MUL) ? '*' : '/');
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, ";\n");
+			break;
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+			/* bitwise operations are not defined for FP vectors */
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "(%s)((%s)", name, bytes);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, " %c (%s)", (insn->op == IR_AND) ? '&' : (insn->op == IR_OR) ? '|' : '^', bytes);
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, ");\n");
+			break;
+		case IR_EQ:
+		case IR_LT:
+		case IR_GT:
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "(%s)(", name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, " %s ", (insn->op == IR_EQ) ? "==" : (insn->op == IR_LT) ? "<" : ">");
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, ");\n");
+			break;
+		case IR_MIN:
+		case IR_MAX:
+			fprintf(f, "\t{%s _m = (%s)(", bytes, bytes);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, " %c ", (insn->op == IR_MIN) ? '<' : '>');
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, "); ");
+			ir_emit_ref(ctx, f, def);
+			fprintf(f, " = (%s)(((%s)", name, bytes);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, " & _m) | ((%s)", bytes);
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, " & ~_m));}\n");
+			break;
+		case IR_VSPLAT:
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "(%s){", name);
+			for (i = 0, lanes = IR_VEC_LANES(type); i < lanes; i++) {
+				if (i) {
+					fprintf(f, ", ");
+				}
+				ir_emit_ref(ctx, f, insn->op1);
+			}
+			fprintf(f, "};\n");
+			break;
+		case IR_VEXTRACT:
+			ir_emit_def_ref(ctx, f, def);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, "[%d];\n", ctx->ir_base[insn->op2].val.i32);
+			break;
+		case IR_VSHUFFLE:
+			mask = ctx->ir_base[insn->op2].val.u32;
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "(%s){", name);
+			for (i = 0, lanes = IR_VEC_LANES(type); i < lanes; i++) {
+				if (i) {
+					fprintf(f, ", ");
+				}
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, "[%d]", ir_vshuffle_lane(mask, lanes, i));
+			}
+			fprintf(f, "};\n");
+			break;
+		case IR_VMASK:
+			/* collect the sign bits of the lanes (the most significant bytes on little-endian targets) */
+			type = ctx->ir_base[insn->op1].type;
+			bytes = (ir_type_size[type] == 32) ? "i8x32_t" : "i8x16_t";
+			ir_emit_def_ref(ctx, f, def);
+			for (i = 0, lanes = IR_VEC_LANES(type); i < lanes; i++) {
+				if (i) {
+					fprintf(f, " | ");
+				}
+				fprintf(f, "((%s)(((%s)", ir_type_cname[insn->type], bytes);
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, ")[%d] < 0) << %d)", (i + 1) * (ir_type_size[type] / lanes) - 1, i);
+			}
+			fprintf(f, ";\n");
+			break;
+	}
+}
+
+static void ir_emit_vec_typedefs(FILE *f)
+{
+	fprintf(f, "#ifndef IR_VECTOR_TYPES\n");
+	fprintf(f, "# define IR_VECTOR_TYPES\n");
+	fprintf(f, "typedef int8_t i8x16_t __attribute__((vector_size(16)));\n");
+	fprintf(f, "typedef int32_t i32x4_t __attribute__((vector_size(16)));\n");
+	fprintf(f, "typedef float f32x4_t __attribute__((vector_size(16)));\n");
+	fprintf(f, "typedef double f64x2_t __attribute__((vector_size(16)));\n");
+	fprintf(f, "typedef int8_t i8x32_t __attribute__((vector_size(32)));\n");
+	fprintf(f, "typedef int32_t i32x8_t __attribute__((vector_size(32)));\n");
+	fprintf(f, "typedef float f32x8_t __attribute__((vector_size(32)));\n");
+	fprintf(f, "typedef double f64x4_t __attribute__((vector_size(32)));\n");
+	fprintf(f, "#endif\n");
+}
+
+static void ir_emit_vec_types(ir_ctx *ctx, FILE *f)
+{
+	ir_ref i, n;
+	ir_insn *insn;
+
+	for (i = IR_TRUE - 1; i > -ctx->consts_count; i--) {
+		if (IR_IS_TYPE_VEC(ctx->ir_base[i].type)) {
+			ir_emit_vec_typedefs(f);
+			return;
+		}
+	}
+	for (i = 1, insn = ctx->ir_base + 1; i < ctx->insns_count;) {
+		if (IR_IS_TYPE_VEC(insn->type)) {
+			ir_emit_vec_typedefs(f);
+			return;
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+}
+
 static void ir_emit_binary_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn, const char *op)
 {
+	if (IR_IS_TYPE_VEC(insn->type)) {
+		ir_emit_vec_op(ctx, f, def, insn);
+		return;
+	}
 	ir_emit_def_ref(ctx, f, def);
 	ir_emit_ref(ctx, f, insn->op1);
 	fprintf(f, " %s ", op);
@@ -428,7 +584,12 @@ static void ir_emit_trunc(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
 static void ir_emit_bitcast(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
 {
 	IR_ASSERT(ir_type_size[insn->type] == ir_type_size[ctx->ir_base[insn->op1].type]);
-	if (IR_IS_TYPE_INT(insn->type)) {
+	if (IR_IS_TYPE_VEC(insn->type)) {
+		ir_emit_def_ref(ctx, f, def);
+		fprintf(f, "(%s)", ir_type_cname[insn->type]);
+		ir_emit_ref(ctx, f, insn->op1);
+		fprintf(f, ";\n");
+	} else if (IR_IS_TYPE_INT(insn->type)) {
 		if (IR_IS_TYPE_INT(ctx->ir_base[insn->op1].type)) {
 			ir_emit_def_ref(ctx, f, def);
 			ir_emit_ref(ctx, f, insn->op1);
@@ -476,6 +637,10 @@ static void ir_emit_conv(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
 
 static void ir_emit_minmax_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
 {
+	if (IR_IS_TYPE_VEC(insn->type)) {
+		ir_emit_vec_op(ctx, f, def, insn);
+		return;
+	}
 //	fprintf(f, "\td_%d = ", ctx->vregs[def]);
 	ir_emit_def_ref(ctx, f, def);
 	ir_emit_ref(ctx, f, insn->op1);
@@ -826,6 +991,8 @@ static int ir_emit_func(ir_ctx *ctx, const char *name, FILE *f)
 	data.resolved_label_syms = 0;
 	ctx->data = &data;
 
+	ir_emit_vec_types(ctx, f);
+
 	/* Emit function prototype */
 	if (ctx->flags & IR_STATIC) {
 		fprintf(f, "static ");
@@ -1032,6 +1199,12 @@ static int ir_emit_func(ir_ctx *ctx, const char *name, FILE *f)
 				case IR_COND:
 					ir_emit_conditional_op(ctx, f, i, insn);
 					break;
+				case IR_VSPLAT:
+				case IR_VEXTRACT:
+				case IR_VSHUFFLE:
+				case IR_VMASK:
+					ir_emit_vec_op(ctx, f, i, insn);
+					break;
 				case IR_ABS:
 					ir_emit_abs(ctx, f, i, insn);
 					break;
@@ -1177,6 +1350,16 @@ static int ir_emit_func(ir_ctx *ctx, const char *name, FILE *f)
 					ir_emit_ref(ctx, f, insn->op3);
 					fprintf(f, ");\n");
 					break;
+				case IR_MEMCPY:
+				case IR_MEMSET:
+					fprintf(f, "\t%s(", insn->op == IR_MEMCPY ? "memcpy" : "memset");
+					ir_emit_ref(ctx, f, insn->op2);
+					fprintf(f, ", ");
+					ir_emit_ref(ctx, f, insn->op3);
+					fprintf(f, ", (size_t)");
+					ir_emit_ref(ctx, f, ir_insn_op(insn, 4));
+					fprintf(f, ");\n");
+					break;
 				case IR_VA_ARG:
 					ir_emit_def_ref(ctx, f, i);
 					fprintf(f, "va_arg(");
@@ -1225,6 +1408,16 @@ int ir_emit_c(ir_ctx *ctx, const char *name, FILE *f)
 
 void ir_emit_c_func_decl(const char *name, uint32_t flags, ir_type ret_type, uint32_t params_count, const uint8_t *param_types, FILE *f)
 {
+	uint32_t i;
+
+	for (i = 0; i < params_count; i++) {
+		if (IR_IS_TYPE_VEC(param_types[i])) {
+			break;
+		}
+	}
+	if (IR_IS_TYPE_VEC(ret_type) || i < params_count) {
+		ir_emit_vec_typedefs(f);
+	}
 	if (flags & IR_EXTERN) {
 		fprintf(f, "extern ");
 	} else if (flags & IR_STATIC) {
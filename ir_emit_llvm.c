@@ -39,6 +39,14 @@ static const char *ir_type_llvm_name[IR_LAST_LLVM_TYPE] = {
 	"i64",    // IR_I64
 	"double", // IR_DOUBLE
 	"float",  // IR_FLOAT
+	"<16 x i8>",    // IR_I8X16
+	"<4 x i32>",    // IR_I32X4
+	"<4 x float>",  // IR_F32X4
+	"<2 x double>", // IR_F64X2
+	"<32 x i8>",    // IR_I8X32
+	"<8 x i32>",    // IR_I32X8
+	"<8 x float>",  // IR_F32X8
+	"<4 x double>", // IR_F64X4
 
 	"{i8, i1}",      // IR_I8B
 	"{i16, i1}",     // IR_I16B
@@ -272,6 +280,27 @@ static void ir_resolve_label_syms(ir_ctx *ctx)
 	}
 }
 
+static void ir_emit_fp_const(FILE *f, ir_type type, ir_val val)
+{
+	double d = (type == IR_DOUBLE) ? val.d : val.f;
+
+	IR_ASSERT(type == IR_DOUBLE || type == IR_FLOAT);
+	if (isnan(d)) {
+		fprintf(f, "nan");
+	} else if (d == 0.0) {
+		fprintf(f, "0.0");
+	} else {
+		double e = log10(d);
+		if (e < -4 || e >= 6) {
+			fprintf(f, "%e", d);
+		} else if (round(d) == d) {
+			fprintf(f, "%.0f.0", d);
+		} else {
+			fprintf(f, "%g", d);
+		}
+	}
+}
+
 static void ir_emit_ref(ir_ctx *ctx, FILE *f, ir_ref ref)
 {
 	if (IR_IS_CONST_REF(ref)) {
@@ -288,40 +317,22 @@ static void ir_emit_ref(ir_ctx *ctx, FILE *f, ir_ref ref)
 //				fprintf(f, "inttoptr(i64 u0x%" PRIxPTR " to ptr)", insn->val.addr);
 			}
 		} else if (IR_IS_TYPE_FP(insn->type)) {
-			if (insn->type == IR_DOUBLE) {
-				double d = insn->val.d;
-				if (isnan(d)) {
-					fprintf(f, "nan");
-				} else if (d == 0.0) {
-					fprintf(f, "0.0");
+			ir_emit_fp_const(f, insn->type, insn->val);
+		} else if (IR_IS_TYPE_VEC(insn->type)) {
+			ir_type lane_type = ir_vec_lane_type(insn->type);
+			uint32_t i, lanes = IR_VEC_LANES(insn->type);
+
+			/* vector constants are splats of the lane value */
+			fprintf(f, "<");
+			for (i = 0; i < lanes; i++) {
+				fprintf(f, "%s%s ", i ? ", " : "", ir_type_llvm_name[lane_type]);
+				if (IR_IS_TYPE_FP(lane_type)) {
+					ir_emit_fp_const(f, lane_type, insn->val);
 				} else {
-					double e = log10(d);
-					if (e < -4 || e >= 6) {
-						fprintf(f, "%e", d);
-					} else if (round(d) == d) {
-						fprintf(f, "%.0f.0", d);
-					} else {
-						fprintf(f, "%g", d);
-					}
-				}
-			} else {
-				IR_ASSERT(insn->type == IR_FLOAT);
-				double d = insn->val.f;
-				if (isnan(d)) {
-					fprintf(f, "nan");
-				} else if (d == 0.0) {
-					fprintf(f, "0.0");
-				} else {
-					double e = log10(d);
-					if (e < -4 || e >= 6) {
-						fprintf(f, "%e", d);
-					} else if (round(d) == d) {
-						fprintf(f, "%.0f.0", d);
-					} else {
-						fprintf(f, "%g", d);
-					}
+					fprintf(f, "%d", (lane_type == IR_I8) ? insn->val.i8 : insn->val.i32);
 				}
 			}
+			fprintf(f, ">");
 		} else if (insn->op == IR_LABEL) {
 			ir_llvm_backend_data *data = ctx->data;
 
@@ -404,10 +415,156 @@ static void ir_emit_unary_not(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
 	}
 }
 
+static void ir_emit_vec_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn)
+{
+	ir_type type = insn->type;
+	const char *name = ir_type_llvm_name[type];
+	const char *int_name = name;
+	const char *op = NULL;
+	uint32_t i, lanes, mask;
+
+	if (insn->op == IR_VEXTRACT || insn->op == IR_VMASK) {
+		type = ctx->ir_base[insn->op1].type;
+		name = int_name = ir_type_llvm_name[type];
+	}
+	if (type == IR_F32X4) {
+		int_name = "<4 x i32>";
+	} else if (type == IR_F64X2) {
+		int_name = "<2 x i64>";
+	} else if (type == IR_F32X8) {
+		int_name = "<8 x i32>";
+	} else if (type == IR_F64X4) {
+		int_name = "<4 x i64>";
+	}
+	lanes = IR_VEC_LANES(type);
+	switch (insn->op) {
+		default:
+			IR_ASSERT(0 && "NIY vector op");
+			break;
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+			op = (insn->op == IR_ADD) ? "add" : (insn->op == IR_SUB) ? "sub" : (insn->op == IR_MUL) ? "mul" : "div";
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "%s%s %s ", (name != int_name) ? "f" : "", op, name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", ");
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, "\n");
+			break;
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+			op = (insn->op == IR_AND) ? "and" : (insn->op == IR_OR) ? "or" : "xor";
+			if (name == int_name) {
+				ir_emit_def_ref(ctx, f, def);
+				fprintf(f, "%s %s ", op, name);
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, ", ");
+				ir_emit_ref(ctx, f, insn->op2);
+				fprintf(f, "\n");
+			} else {
+				/* bitwise operations are not defined for FP vectors */
+				fprintf(f, "\t%%t%d_1 = bitcast %s ", def, name);
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, " to %s\n", int_name);
+				fprintf(f, "\t%%t%d_2 = bitcast %s ", def, name);
+				ir_emit_ref(ctx, f, insn->op2);
+				fprintf(f, " to %s\n", int_name);
+				fprintf(f, "\t%%t%d = %s %s %%t%d_1, %%t%d_2\n", def, op, int_name, def, def);
+				fprintf(f, "\t%%d%d = bitcast %s %%t%d to %s\n", def, int_name, def, name);
+			}
+			break;
+		case IR_EQ:
+		case IR_LT:
+		case IR_GT:
+			if (name == int_name) {
+				op = (insn->op == IR_EQ) ? "icmp eq" : (insn->op == IR_LT) ? "icmp slt" : "icmp sgt";
+			} else {
+				op = (insn->op == IR_EQ) ? "fcmp oeq" : (insn->op == IR_LT) ? "fcmp olt" : "fcmp ogt";
+			}
+			fprintf(f, "\t%%t%d = %s %s ", def, op, name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", ");
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, "\n");
+			/* lanes of the result are filled by all ones or zeros */
+			if (name == int_name) {
+				fprintf(f, "\t%%d%d = sext <%d x i1> %%t%d to %s\n", def, lanes, def, name);
+			} else {
+				fprintf(f, "\t%%t%d_1 = sext <%d x i1> %%t%d to %s\n", def, lanes, def, int_name);
+				fprintf(f, "\t%%d%d = bitcast %s %%t%d_1 to %s\n", def, int_name, def, name);
+			}
+			break;
+		case IR_MIN:
+		case IR_MAX:
+			/* the second operand is selected for unordered lanes (like SSE does) */
+			fprintf(f, "\t%%t%d = fcmp %s %s ", def, (insn->op == IR_MIN) ? "olt" : "ogt", name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", ");
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, "\n");
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "select <%d x i1> %%t%d, %s ", lanes, def, name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", %s ", name);
+			ir_emit_ref(ctx, f, insn->op2);
+			fprintf(f, "\n");
+			break;
+		case IR_VSPLAT:
+			fprintf(f, "\t%%t%d = insertelement %s poison, %s ", def, name,
+				ir_type_llvm_name[ctx->ir_base[insn->op1].type]);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", i32 0\n");
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "shufflevector %s %%t%d, %s poison, <%d x i32> zeroinitializer\n",
+				name, def, name, lanes);
+			break;
+		case IR_VEXTRACT:
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "extractelement %s ", name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", i32 %d\n", ctx->ir_base[insn->op2].val.i32);
+			break;
+		case IR_VSHUFFLE:
+			mask = ctx->ir_base[insn->op2].val.u32;
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "shufflevector %s ", name);
+			ir_emit_ref(ctx, f, insn->op1);
+			fprintf(f, ", %s poison, <%d x i32> <", name, lanes);
+			for (i = 0; i < lanes; i++) {
+				fprintf(f, "%si32 %d", i ? ", " : "", ir_vshuffle_lane(mask, lanes, i));
+			}
+			fprintf(f, ">\n");
+			break;
+		case IR_VMASK:
+			if (name != int_name) {
+				fprintf(f, "\t%%t%d_1 = bitcast %s ", def, name);
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, " to %s\n", int_name);
+				fprintf(f, "\t%%t%d_2 = icmp slt %s %%t%d_1, zeroinitializer\n", def, int_name, def);
+			} else {
+				fprintf(f, "\t%%t%d_2 = icmp slt %s ", def, name);
+				ir_emit_ref(ctx, f, insn->op1);
+				fprintf(f, ", zeroinitializer\n");
+			}
+			fprintf(f, "\t%%t%d = bitcast <%d x i1> %%t%d_2 to i%d\n", def, lanes, def, lanes);
+			ir_emit_def_ref(ctx, f, def);
+			fprintf(f, "%s i%d %%t%d to %s\n", (ir_type_size[insn->type] * 8 == lanes) ? "bitcast" : "zext",
+				lanes, def, ir_type_llvm_name[insn->type]);
+			break;
+	}
+}
+
 static void ir_emit_binary_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn, const char *op, const char *uop, const char *fop)
 {
 	ir_type type = ctx->ir_base[insn->op1].type;
 
+	if (IR_IS_TYPE_VEC(insn->type)) {
+		ir_emit_vec_op(ctx, f, def, insn);
+		return;
+	}
 	if (insn->type == IR_ADDR) {
 		type = sizeof(void*) == 8 ? IR_U64 : IR_U32;
 		if (!IR_IS_CONST_REF(insn->op1) && ctx->ir_base[insn->op1].type != IR_I64 && ctx->ir_base[insn->op1].type != IR_U64) {
@@ -542,6 +699,10 @@ static void ir_emit_minmax_op(ir_ctx *ctx, FILE *f, int def, ir_insn *insn,
 {
 	ir_type type = insn->type;
 
+	if (IR_IS_TYPE_VEC(type)) {
+		ir_emit_vec_op(ctx, f, def, insn);
+		return;
+	}
 	if (IR_IS_TYPE_FP(type)) {
 		id += (type == IR_DOUBLE) ? 8 : 9;
 	} else {
@@ -889,6 +1050,32 @@ static void ir_emit_ijmp(ir_ctx *ctx, FILE *f, uint32_t b, ir_insn *insn)
 	}
 }
 
+static void ir_emit_memcpy_memset(ir_ctx *ctx, FILE *f, ir_ref def, ir_insn *insn, ir_bitset used_intrinsics)
+{
+	ir_llvm_intrinsic_id id = (insn->op == IR_MEMCPY) ? IR_LLVM_INTR_MEMCPY : IR_LLVM_INTR_MEMSET;
+	ir_ref size = ir_insn_op(insn, 4);
+
+	if (!IR_IS_CONST_REF(size) && ctx->ir_base[size].type == IR_ADDR) {
+		fprintf(f, "\t%%t%d = ptrtoint ptr ", def);
+		ir_emit_ref(ctx, f, size);
+		fprintf(f, " to %s\n", ir_type_llvm_name[IR_UINTPTR_T]);
+	}
+	ir_bitset_incl(used_intrinsics, id);
+	fprintf(f, "\tcall void @%s(ptr ", ir_llvm_intrinsic_desc[id].name);
+	ir_emit_ref(ctx, f, insn->op2);
+	fprintf(f, (insn->op == IR_MEMCPY) ? ", ptr " : ", i8 ");
+	ir_emit_ref(ctx, f, insn->op3);
+	fprintf(f, ", %s ", ir_type_llvm_name[IR_UINTPTR_T]);
+	if (IR_IS_CONST_REF(size)) {
+		fprintf(f, "%" PRIu64, ctx->ir_base[size].val.u64);
+	} else if (ctx->ir_base[size].type == IR_ADDR) {
+		fprintf(f, "%%t%d", def);
+	} else {
+		ir_emit_ref(ctx, f, size);
+	}
+	fprintf(f, ", i1 false)\n");
+}
+
 static void ir_emit_alloca(ir_ctx *ctx, FILE *f, ir_ref def, ir_insn *insn)
 {
 	ir_emit_def_ref(ctx, f, def);
@@ -1116,6 +1303,12 @@ static int ir_emit_func(ir_ctx *ctx, const char *name, FILE *f)
 				case IR_COND:
 					ir_emit_conditional_op(ctx, f, i, insn);
 					break;
+				case IR_VSPLAT:
+				case IR_VEXTRACT:
+				case IR_VSHUFFLE:
+				case IR_VMASK:
+					ir_emit_vec_op(ctx, f, i, insn);
+					break;
 				case IR_ABS:
 					ir_emit_abs(ctx, f, i, insn, used_intrinsics);
 					break;
@@ -1299,6 +1492,10 @@ static int ir_emit_func(ir_ctx *ctx, const char *name, FILE *f)
 					ir_emit_ref(ctx, f, insn->op3);
 					fprintf(f, ")\n");
 					break;
+				case IR_MEMCPY:
+				case IR_MEMSET:
+					ir_emit_memcpy_memset(ctx, f, i, insn, used_intrinsics);
+					break;
 				case IR_VA_ARG:
 					ir_emit_def_ref(ctx, f, i);
 					fprintf(f, "va_arg ptr ");
@@ -706,12 +706,43 @@ IR_FOLD(MOD(C_ADDR, C_ADDR))
 }
 
 IR_FOLD(MOD(C_I8, C_I8))
+{
+	IR_ASSERT(IR_OPT_TYPE(opt) == op1_insn->type);
+	if (op2_insn->val.i64 == 0
+	 || (op2_insn->val.i64 == -1 && op1_insn->val.u8 == 0x80)) {
+		/* division by zero */
+		IR_FOLD_EMIT;
+	}
+	IR_FOLD_CONST_I(op1_insn->val.i8 % op2_insn->val.i8);
+}
+
 IR_FOLD(MOD(C_I16, C_I16))
+{
+	IR_ASSERT(IR_OPT_TYPE(opt) == op1_insn->type);
+	if (op2_insn->val.i64 == 0
+	 || (op2_insn->val.i64 == -1 && op1_insn->val.u16 == 0x8000)) {
+		/* division by zero */
+		IR_FOLD_EMIT;
+	}
+	IR_FOLD_CONST_I(op1_insn->val.i16 % op2_insn->val.i16);
+}
+
 IR_FOLD(MOD(C_I32, C_I32))
+{
+	IR_ASSERT(IR_OPT_TYPE(opt) == op1_insn->type);
+	if (op2_insn->val.i64 == 0
+	 || (op2_insn->val.i64 == -1 && op1_insn->val.u32 == 0x80000000)) {
+		/* division by zero */
+		IR_FOLD_EMIT;
+	}
+	IR_FOLD_CONST_I(op1_insn->val.i32 % op2_insn->val.i32);
+}
+
 IR_FOLD(MOD(C_I64, C_I64))
 {
 	IR_ASSERT(IR_OPT_TYPE(opt) == op1_insn->type);
-	if (op2_insn->val.i64 == 0) {
+	if (op2_insn->val.i64 == 0
+	 || (op2_insn->val.i64 == -1 && op1_insn->val.u64 == 0x8000000000000000)) {
 		/* division by zero */
 		IR_FOLD_EMIT;
 	}
@@ -1643,6 +1674,15 @@ IR_FOLD(BSWAP(BSWAP))
 	IR_FOLD_COPY(op1_insn->op1);
 }
 
+IR_FOLD(VEXTRACT(VSPLAT, _))
+{
+	/* extract(splat(x), n) => x */
+	if (ctx->ir_base[op1_insn->op1].type == IR_OPT_TYPE(opt)) {
+		IR_FOLD_COPY(op1_insn->op1);
+	}
+	IR_FOLD_NEXT;
+}
+
 IR_FOLD(EQ(_, C_BOOL))
 {
 	if (op2 == IR_TRUE) {
@@ -1806,7 +1846,7 @@ IR_FOLD(GT(SEXT, C_I32))
 IR_FOLD(GT(SEXT, C_I64))
 IR_FOLD(GT(SEXT, C_ADDR))
 {
-	if (ctx->use_lists && ctx->use_lists[op1].count != 1) {
+	if (IR_FOLD_IN_OPT(ctx) && ctx->use_lists[op1].count != 1) {
 		/* pass */
 	} else {
 		ir_type type = ctx->ir_base[op1_insn->op1].type;
@@ -1876,7 +1916,7 @@ IR_FOLD(LE(SEXT, SEXT))
 IR_FOLD(GT(SEXT, SEXT))
 {
 	if (ctx->ir_base[op1_insn->op1].type == ctx->ir_base[op2_insn->op1].type
-	 && (!ctx->use_lists || (ctx->use_lists[op1].count == 1 && ctx->use_lists[op2].count == 1))) {
+	 && (!IR_FOLD_IN_OPT(ctx) || (ctx->use_lists[op1].count == 1 && ctx->use_lists[op2].count == 1))) {
 		op1 = op1_insn->op1;
 		op2 = op2_insn->op1;
 		IR_FOLD_RESTART;
@@ -1890,7 +1930,7 @@ IR_FOLD(LE(ZEXT, ZEXT))
 IR_FOLD(GT(ZEXT, ZEXT))
 {
 	if (ctx->ir_base[op1_insn->op1].type == ctx->ir_base[op2_insn->op1].type
-	 && (!ctx->use_lists || (ctx->use_lists[op1].count == 1 && ctx->use_lists[op2].count == 1))) {
+	 && (!IR_FOLD_IN_OPT(ctx) || (ctx->use_lists[op1].count == 1 && ctx->use_lists[op2].count == 1))) {
 		op1 = op1_insn->op1;
 		op2 = op2_insn->op1;
 		opt += 4; /* LT -> ULT, ... */
@@ -1941,7 +1981,7 @@ IR_FOLD(NE(SUB, C_I64))
 IR_FOLD(NE(SUB, C_ADDR))
 {
 	/* (a - b) == 0 => a == b */
-	if (ctx->use_lists && ctx->use_lists[op1].count == 1 && op2_insn->val.u64 == 0) {
+	if (IR_FOLD_IN_OPT(ctx) && ctx->use_lists[op1].count == 1 && op2_insn->val.u64 == 0) {
 		op1 = op1_insn->op1;
 		op2 = op1_insn->op2;
 		IR_FOLD_RESTART;
@@ -3556,7 +3596,8 @@ IR_FOLD(MIN(MIN, _))
 IR_FOLD(MAX(MAX, _))
 {
 	if (op1_insn->op1 == op2 || op1_insn->op2 == op2) {
-		IR_FOLD_COPY(op2);
+		/* (a & b) & a => a & b */
+		IR_FOLD_COPY(op1);
 	}
 	IR_FOLD_NEXT;
 }
@@ -246,7 +246,7 @@ static bool ir_split_partially_dead_node(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	}
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM_SPLIT) {
+	if (ctx->flags2 & IR_DEBUG_GCM_SPLIT) {
 		bool first = 1;
 		fprintf(stderr, "*** Split partially dead node d_%d scheduled to BB%d\n", ref, b);
 		IR_SPARSE_SET_FOREACH(&data->totally_useful, i) {
@@ -288,7 +288,7 @@ static bool ir_split_partially_dead_node(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	IR_ASSERT(!ir_sparse_set_in(&data->totally_useful, b));
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM_SPLIT) {
+	if (ctx->flags2 & IR_DEBUG_GCM_SPLIT) {
 		bool first = 1;
 		IR_SPARSE_SET_FOREACH(&data->totally_useful, i) {
 			if (first) {
@@ -422,7 +422,7 @@ static bool ir_split_partially_dead_node(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	//       (similar to SSAPRE)
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM_SPLIT) {
+	if (ctx->flags2 & IR_DEBUG_GCM_SPLIT) {
 		for (i = 0; i < clones_count; i++) {
 			uint32_t u = clones[i].use;
 
@@ -514,7 +514,7 @@ static bool ir_split_partially_dead_node(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	ir_hashtab_free(&hash);
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM_SPLIT) {
+	if (ctx->flags2 & IR_DEBUG_GCM_SPLIT) {
 		ir_check(ctx);
 	}
 #endif
@@ -578,16 +578,17 @@ static void ir_gcm_schedule_late(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	IR_ASSERT(lca != 0 && "No Common Ancestor");
 	IR_ASSERT(ir_gcm_dominates(ctx, ctx->cfg_map[ref], lca) && "Early placement doesn't dominate the late");
 
+	b = (lca != ctx->cfg_map[ref]) ? ir_gcm_select_best_block(ctx, ref, lca) : lca;
+
 #if IR_GCM_SPLIT
 	if (ctx->use_lists[ref].count > 1
+	 && ctx->cfg_blocks[b].loop_depth == ctx->cfg_blocks[lca].loop_depth /* don't split loop invariant node */
 	 && ir_split_partially_dead_node(ctx, ref, lca)) {
 		return;
 	}
 #endif
 
 	if (lca != ctx->cfg_map[ref]) {
-		b = ir_gcm_select_best_block(ctx, ref, lca);
-
 		ctx->cfg_map[ref] = b;
 
 		/* OVERFLOW is a projection of ADD/SUB/MUL_OV and must be scheduled into the same block */
@@ -606,6 +607,395 @@ static void ir_gcm_schedule_late(ir_ctx *ctx, ir_ref ref, uint32_t b)
 	}
 }
 
+/* LICM - Loop Invariant Code Motion
+ *
+ * GCM moves only floating data nodes. LOADs and CALLs are pinned to the
+ * control chain and stay in the loop, even if they produce the same value
+ * on each iteration. This pass moves such nodes from the loop header into
+ * the loop preheader (right before its END). GCM then may hoist their users.
+ *
+ * Only the nodes that precede the first GUARD of the header are moved, so the
+ * hoisted node is executed only if the original one was executed at least once.
+ * LOADs must not be clobbered by any store of the loop (see ir_check_aliasing()).
+ *
+ * GUARDs with loop invariant conditions are moved as well, if they are not
+ * preceded by nodes with side effects. Such GUARD fails on the first iteration
+ * or never, so the early deoptimization leads to the same state. The SNAPSHOT
+ * of the GUARD is moved together with it, and the header PHIs it refers to are
+ * replaced by their initial values.
+ */
+#define IR_LICM_CLOBBER_ALL  (1<<0) /* CALL, ALLOCA or other memory write with unknown address */
+
+#define IR_LICM_MAX_DEPTH    32     /* limit for the recursive invariance check of data nodes */
+
+typedef struct _ir_licm_loop {
+	uint32_t flags;
+	ir_list  stores;                /* STORE and VSTORE nodes of the loop and its inner loops */
+} ir_licm_loop;
+
+typedef struct _ir_licm_ctx {
+	ir_licm_loop *loops;            /* indexed by loop header block */
+	uint32_t     *marks;            /* cached invariance: (epoch << 1) | invariant */
+	uint32_t      epoch;
+} ir_licm_ctx;
+
+static bool ir_licm_in_loop(const ir_ctx *ctx, uint32_t b, uint32_t hdr)
+{
+	while (b != hdr) {
+		b = ctx->cfg_blocks[b].loop_header;
+		if (!b) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint32_t ir_licm_call_flags(const ir_ctx *ctx, const ir_insn *insn)
+{
+	const ir_insn *func = &ctx->ir_base[insn->op2];
+	ir_ref func_proto;
+
+	if (func->op == IR_FUNC || func->op == IR_FUNC_ADDR) {
+		func_proto = func->proto;
+	} else if (func->op == IR_PROTO) {
+		func_proto = func->op2;
+	} else {
+		return 0;
+	}
+	if (!func_proto) {
+		return 0;
+	}
+	return ((const ir_proto_t *)ir_get_str(ctx, func_proto))->flags;
+}
+
+static void ir_licm_collect_clobbers(ir_ctx *ctx, ir_licm_ctx *data)
+{
+	uint32_t b, hdr;
+	ir_ref ref;
+	ir_block *bb;
+	ir_insn *insn;
+
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		hdr = (bb->flags & IR_BB_LOOP_HEADER) ? b : bb->loop_header;
+		ref = ctx->ir_base[bb->end].op1;
+		while (ref != bb->start) {
+			insn = &ctx->ir_base[ref];
+			/* pin the node to its block (GCM recomputes this anyway) */
+			ctx->cfg_map[ref] = b;
+			if (hdr) {
+				uint32_t h;
+
+				if (insn->op == IR_STORE || insn->op == IR_STORE_v
+				 || insn->op == IR_VSTORE || insn->op == IR_VSTORE_v) {
+					for (h = hdr; h; h = ctx->cfg_blocks[h].loop_header) {
+						ir_licm_loop *loop = &data->loops[h];
+
+						if (!ir_list_capasity(&loop->stores)) {
+							ir_list_init(&loop->stores, 8);
+						}
+						ir_list_push(&loop->stores, ref);
+					}
+				} else if (insn->op == IR_CALL
+						&& (ir_licm_call_flags(ctx, insn) & (IR_CONST_FUNC|IR_PURE_FUNC))) {
+					/* pure CALL doesn't write memory */
+				} else if (insn->op != IR_RSTORE
+						&& (ir_op_flags[insn->op] & IR_OP_FLAG_MEM)
+						&& (ir_op_flags[insn->op] & IR_OP_FLAG_MEM_MASK) != IR_OP_FLAG_MEM_LOAD) {
+					for (h = hdr; h; h = ctx->cfg_blocks[h].loop_header) {
+						data->loops[h].flags |= IR_LICM_CLOBBER_ALL;
+					}
+				}
+			}
+			ref = insn->op1;
+		}
+	}
+}
+
+static bool ir_licm_is_invariant(ir_ctx *ctx, ir_licm_ctx *data, ir_ref ref, uint32_t hdr, uint32_t depth)
+{
+	ir_insn *insn;
+	ir_ref n, *p;
+	uint32_t b;
+	bool ret;
+
+	if (IR_IS_CONST_REF(ref)) {
+		return 1;
+	} else if ((data->marks[ref] >> 1) == data->epoch) {
+		return data->marks[ref] & 1;
+	}
+
+	insn = &ctx->ir_base[ref];
+	b = ctx->cfg_map[ref];
+	if (b) {
+		/* control node */
+		ret = !ir_licm_in_loop(ctx, b, hdr);
+	} else if (insn->op == IR_PHI || insn->op == IR_PI) {
+		ret = !ir_licm_in_loop(ctx, ctx->cfg_map[insn->op1], hdr);
+	} else if (insn->op == IR_PARAM || insn->op == IR_VAR) {
+		ret = 1;
+	} else if (depth >= IR_LICM_MAX_DEPTH) {
+		return 0;
+	} else {
+		ret = 1;
+		for (n = insn->inputs_count, p = insn->ops + 1; n > 0; p++, n--) {
+			if (*p > 0 && !ir_licm_is_invariant(ctx, data, *p, hdr, depth + 1)) {
+				ret = 0;
+				break;
+			}
+		}
+	}
+	data->marks[ref] = (data->epoch << 1) | ret;
+	return ret;
+}
+
+static bool ir_licm_can_hoist(ir_ctx *ctx, ir_licm_ctx *data, ir_ref ref, ir_insn *insn, uint32_t hdr)
+{
+	ir_licm_loop *loop = &data->loops[hdr];
+	uint32_t i, len = ir_list_len(&loop->stores);
+	ir_ref store_ref;
+	ir_insn *store;
+
+	if (insn->op == IR_LOAD) {
+		if ((loop->flags & IR_LICM_CLOBBER_ALL)
+		 || !ir_licm_is_invariant(ctx, data, insn->op2, hdr, 0)) {
+			return 0;
+		}
+		for (i = 0; i < len; i++) {
+			store_ref = ir_list_at(&loop->stores, i);
+			store = &ctx->ir_base[store_ref];
+			if (store->op == IR_VSTORE || store->op == IR_VSTORE_v
+			 || store->op2 == insn->op2
+			 || (!ir_alias_class_disjoint(ir_alias_class(ctx, ref), ir_alias_class(ctx, store_ref))
+			  && ir_check_aliasing(ctx, insn->op2, store->op2, insn->type, ctx->ir_base[store->op3].type) != IR_NO_ALIAS)) {
+				return 0;
+			}
+		}
+		return 1;
+	} else if (insn->op == IR_VLOAD) {
+		if (loop->flags & IR_LICM_CLOBBER_ALL) {
+			return 0;
+		}
+		for (i = 0; i < len; i++) {
+			store = &ctx->ir_base[ir_list_at(&loop->stores, i)];
+			if (store->op == IR_STORE || store->op == IR_STORE_v || store->op2 == insn->op2) {
+				return 0;
+			}
+		}
+		return 1;
+	} else if (insn->op == IR_CALL) {
+		uint32_t flags = ir_licm_call_flags(ctx, insn);
+		ir_ref n, *p;
+
+		if (flags & IR_CONST_FUNC) {
+			/* doesn't read memory */
+		} else if (!(flags & IR_PURE_FUNC)
+				|| (loop->flags & IR_LICM_CLOBBER_ALL)
+				|| len) {
+			return 0;
+		}
+		for (n = insn->inputs_count - 1, p = insn->ops + 2; n > 0; p++, n--) {
+			if (*p > 0 && !ir_licm_is_invariant(ctx, data, *p, hdr, 0)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Nodes that don't change the state and may be skipped by a hoisted GUARD */
+static bool ir_licm_no_side_effects(const ir_ctx *ctx, const ir_insn *insn)
+{
+	switch (insn->op) {
+		case IR_LOAD:
+		case IR_VLOAD:
+		case IR_RLOAD:
+		case IR_SNAPSHOT:
+			return 1;
+		case IR_CALL:
+			return (ir_licm_call_flags(ctx, insn) & (IR_CONST_FUNC|IR_PURE_FUNC)) != 0;
+		default:
+			return 0;
+	}
+}
+
+static bool ir_licm_can_hoist_guard(ir_ctx *ctx, ir_licm_ctx *data, ir_insn *insn, uint32_t hdr)
+{
+	ir_ref header = ctx->cfg_blocks[hdr].start;
+	ir_insn *snapshot, *phi;
+	ir_ref n, *p;
+
+	if (!ir_licm_is_invariant(ctx, data, insn->op2, hdr, 0)
+	 || !ir_licm_is_invariant(ctx, data, insn->op3, hdr, 0)) {
+		return 0;
+	}
+	if (insn->op1 != header && ctx->ir_base[insn->op1].op == IR_SNAPSHOT) {
+		if (ctx->use_lists[insn->op1].count != 1) {
+			return 0;
+		}
+		snapshot = &ctx->ir_base[insn->op1];
+		for (n = snapshot->inputs_count - 1, p = snapshot->ops + 2; n > 0; p++, n--) {
+			if (*p > 0 && !ir_licm_is_invariant(ctx, data, *p, hdr, 0)) {
+				phi = &ctx->ir_base[*p];
+				if (phi->op != IR_PHI || phi->op1 != header) {
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/* Replace the header PHIs used by the hoisted SNAPSHOT by their initial values */
+static void ir_licm_fix_snapshot(ir_ctx *ctx, ir_ref ref, ir_ref header, uint32_t pre)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_insn *phi, *loop = &ctx->ir_base[header];
+	ir_ref end = ctx->cfg_blocks[pre].end;
+	ir_ref j, k, val;
+
+	for (k = 1; k <= loop->inputs_count; k++) {
+		if (ir_insn_op(loop, k) == end) {
+			break;
+		}
+	}
+	IR_ASSERT(k <= loop->inputs_count);
+	for (j = 2; j <= insn->inputs_count; j++) {
+		val = ir_insn_op(insn, j);
+		if (val > 0) {
+			phi = &ctx->ir_base[val];
+			if (phi->op == IR_PHI && phi->op1 == header) {
+				ir_use_list_remove_one(ctx, val, ref);
+				val = ir_insn_op(phi, k + 1);
+				ir_insn_set_op(insn, j, val);
+				if (val > 0) {
+					ir_use_list_add(ctx, val, ref);
+				}
+			}
+		}
+	}
+}
+
+static void ir_licm_move(ir_ctx *ctx, ir_ref ref, ir_ref next, uint32_t pre)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref prev = insn->op1;
+	ir_ref end = ctx->cfg_blocks[pre].end;
+	ir_ref last = ctx->ir_base[end].op1;
+
+	IR_ASSERT(ctx->ir_base[next].op1 == ref);
+
+	/* unlink from the loop header */
+	ctx->ir_base[next].op1 = prev;
+	ir_use_list_replace_one(ctx, prev, ref, next);
+
+	/* link before the END of the preheader */
+	insn->op1 = last;
+	ir_use_list_replace_one(ctx, last, end, ref);
+	ctx->ir_base[end].op1 = ref;
+	ir_use_list_replace_one(ctx, ref, next, end);
+
+	ctx->cfg_map[ref] = pre;
+}
+
+static void ir_licm_hoist(ir_ctx *ctx, ir_licm_ctx *data, uint32_t hdr)
+{
+	ir_block *bb = &ctx->cfg_blocks[hdr];
+	uint32_t n, *p, pre = 0;
+	ir_ref ref, next, prev;
+	ir_insn *insn;
+	bool changed, no_side_effects;
+
+	/* find the single preheader */
+	for (n = bb->predecessors_count, p = &ctx->cfg_edges[bb->predecessors]; n > 0; p++, n--) {
+		if (!ir_licm_in_loop(ctx, *p, hdr)) {
+			if (pre) {
+				return;
+			}
+			pre = *p;
+		}
+	}
+	if (!pre
+	 || ctx->cfg_blocks[pre].successors_count != 1
+	 || ctx->ir_base[ctx->cfg_blocks[pre].end].op != IR_END) {
+		return;
+	}
+
+	do {
+		changed = 0;
+		data->epoch++;
+		no_side_effects = 1;
+		ref = ir_next_control(ctx, bb->start);
+		while (ref != bb->end) {
+			insn = &ctx->ir_base[ref];
+			next = ir_next_control(ctx, ref);
+			if (insn->op == IR_GUARD || insn->op == IR_GUARD_NOT) {
+				if (!no_side_effects || !ir_licm_can_hoist_guard(ctx, data, insn, hdr)) {
+					break;
+				}
+				prev = insn->op1;
+				if (prev != bb->start && ctx->ir_base[prev].op == IR_SNAPSHOT) {
+					ir_licm_move(ctx, prev, ref, pre);
+					ir_licm_fix_snapshot(ctx, prev, bb->start, pre);
+				}
+				ir_licm_move(ctx, ref, next, pre);
+				changed = 1;
+			} else if (ir_licm_can_hoist(ctx, data, ref, insn, hdr)) {
+				ir_licm_move(ctx, ref, next, pre);
+				changed = 1;
+			} else if (!ir_licm_no_side_effects(ctx, insn)) {
+				no_side_effects = 0;
+			}
+			ref = next;
+		}
+	} while (changed);
+}
+
+int ir_licm(ir_ctx *ctx)
+{
+	ir_licm_ctx data;
+	uint32_t b, depth, max_depth = 0;
+	ir_block *bb;
+
+	if (!(ctx->flags2 & IR_CFG_HAS_LOOPS)
+	 || (ctx->flags2 & IR_IRREDUCIBLE_CFG)
+	 || (ctx->flags2 & IR_NO_LOOPS)) {
+		return 1;
+	}
+
+	data.loops = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_licm_loop));
+	data.marks = ir_mem_calloc(ctx->insns_count, sizeof(uint32_t));
+	data.epoch = 0;
+
+	ir_licm_collect_clobbers(ctx, &data);
+
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		if ((bb->flags & IR_BB_LOOP_HEADER) && bb->loop_depth > max_depth) {
+			max_depth = bb->loop_depth;
+		}
+	}
+
+	/* process inner loops first, so the hoisted nodes may be moved out of the outer loops as well */
+	for (depth = max_depth; depth > 0; depth--) {
+		for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+			if ((bb->flags & (IR_BB_LOOP_HEADER|IR_BB_LOOP_WITH_ENTRY)) == IR_BB_LOOP_HEADER
+			 && bb->loop_depth == depth) {
+				ir_licm_hoist(ctx, &data, b);
+			}
+		}
+	}
+
+	for (b = 1; b <= ctx->cfg_blocks_count; b++) {
+		if (ir_list_capasity(&data.loops[b].stores)) {
+			ir_list_free(&data.loops[b].stores);
+		}
+	}
+	ir_mem_free(data.marks);
+	ir_mem_free(data.loops);
+
+	return 1;
+}
+
 int ir_gcm(ir_ctx *ctx)
 {
 	ir_ref k, n, *p, ref;
@@ -735,7 +1125,7 @@ int ir_gcm(ir_ctx *ctx)
 	}
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM) {
+	if (ctx->flags2 & IR_DEBUG_GCM) {
 		fprintf(stderr, "GCM Schedule Early\n");
 		for (n = 1; n < ctx->insns_count; n++) {
 			fprintf(stderr, "%d -> %d\n", n, ctx->cfg_map[n]);
@@ -771,7 +1161,7 @@ int ir_gcm(ir_ctx *ctx)
 	ir_list_free(&queue_late);
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_GCM) {
+	if (ctx->flags2 & IR_DEBUG_GCM) {
 		fprintf(stderr, "GCM Schedule Late\n");
 		for (n = 1; n < ctx->insns_count; n++) {
 			fprintf(stderr, "%d -> %d\n", n, ctx->cfg_map[n]);
@@ -882,7 +1272,7 @@ static IR_NEVER_INLINE void ir_fix_bb_order(ir_ctx *ctx, ir_ref *_prev, ir_ref *
 fix:
 #endif
 	count = ctx->cfg_blocks_count + 1;
-	new_blocks = ir_mem_malloc(count * sizeof(ir_block));
+	new_blocks = ir_ctx_malloc(ctx, count * sizeof(ir_block));
 	xlat = ir_mem_malloc(count * sizeof(uint32_t));
 	ir_worklist_init(&worklist, count);
 	ir_worklist_push(&worklist, 1);
@@ -973,7 +1363,7 @@ next:
 	}
 	ir_mem_free(xlat);
 
-	ir_mem_free(ctx->cfg_blocks);
+	ir_ctx_free(ctx, ctx->cfg_blocks);
 	ctx->cfg_blocks = new_blocks;
 }
 
@@ -1046,7 +1436,7 @@ restart:
 					if (ctx->cfg_map[input] == b) {
 						/* "input" should be before "i" to satisfy dependency */
 #ifdef IR_DEBUG
-						if (ctx->flags & IR_DEBUG_SCHEDULE) {
+						if (ctx->flags2 & IR_DEBUG_SCHEDULE) {
 							fprintf(stderr, "Wrong dependency %d:%d -> %d\n", b, input, i);
 						}
 #endif
@@ -1083,7 +1473,7 @@ int ir_schedule(ir_ctx *ctx)
 	ir_ref prev_b_end;
 	uint32_t b;
 	ir_ref *_next = ir_mem_malloc(ctx->insns_count * sizeof(ir_ref));
-	ir_ref *_prev = ir_mem_malloc(ctx->insns_count * sizeof(ir_ref));
+	ir_ref *_prev = ir_ctx_malloc(ctx, ctx->insns_count * sizeof(ir_ref));
 	ir_block *bb;
 	ir_insn *insn, *new_insn, *base;
 	ir_use_list *lists, *use_list, *new_list;
@@ -1147,7 +1537,7 @@ int ir_schedule(ir_ctx *ctx)
 		ir_ref start;
 
 #ifdef IR_DEBUG
-		if (ctx->flags & IR_DEBUG_SCHEDULE) {
+		if (ctx->flags2 & IR_DEBUG_SCHEDULE) {
 			fprintf(stderr, "BB%d\n", b);
 			ir_schedule_print_list(ctx, b, _next, bb->start, bb->end, "INITIAL");
 		}
@@ -1256,7 +1646,7 @@ int ir_schedule(ir_ctx *ctx)
 		}
 
 #ifdef IR_DEBUG
-		if (ctx->flags & IR_DEBUG_SCHEDULE) {
+		if (ctx->flags2 & IR_DEBUG_SCHEDULE) {
 			ir_schedule_print_list(ctx, b, _next, start, bb->end, "  FINAL");
 		}
 #endif
@@ -1298,12 +1688,13 @@ int ir_schedule(ir_ctx *ctx)
 	}
 #endif
 
-	ir_mem_free(_prev);
+	ir_ctx_free(ctx, _prev);
 
-	uint32_t *map = ir_mem_calloc(insns_count, sizeof(uint32_t));
-	_prev = ir_mem_malloc(insns_count * sizeof(ir_ref));
-	lists = ir_mem_malloc(insns_count * sizeof(ir_use_list));
-	ir_ref *use_edges = edges = ir_mem_malloc(use_edges_count * sizeof(ir_ref));
+	uint32_t *map = ir_ctx_calloc(ctx, insns_count, sizeof(uint32_t));
+	uint16_t *alias_classes = ctx->alias_classes ? ir_mem_calloc(insns_count, sizeof(uint16_t)) : NULL;
+	_prev = ir_ctx_malloc(ctx, insns_count * sizeof(ir_ref));
+	lists = ir_ctx_malloc(ctx, insns_count * sizeof(ir_use_list));
+	ir_ref *use_edges = edges = ir_ctx_malloc(ctx, use_edges_count * sizeof(ir_ref));
 	base = ir_mem_malloc((consts_count + insns_count) * sizeof(ir_insn));
 	base += consts_count;
 
@@ -1349,6 +1740,9 @@ int ir_schedule(ir_ctx *ctx)
 	for (i = 1; i != 0; i = _next[i]) {
 		new_ref = _xlat[i];
 		map[new_ref] = ctx->cfg_map[i];
+		if (alias_classes) {
+			alias_classes[new_ref] = ctx->alias_classes[i];
+		}
 		_prev[new_ref] = prev_ref;
 		prev_ref = new_ref;
 
@@ -1479,16 +1873,21 @@ int ir_schedule(ir_ctx *ctx)
 	ctx->insns_count = ctx->insns_limit = insns_count;
 	ctx->consts_count = ctx->consts_limit = consts_count;
 
-	ir_mem_free(ctx->use_lists);
-	ir_mem_free(ctx->use_edges);
+	ir_ctx_free(ctx, ctx->use_lists);
+	ir_ctx_free(ctx, ctx->use_edges);
 	IR_ASSERT(orig_use_edges_count >= use_edges_count);
 	ctx->use_lists = lists;
 	ctx->use_edges = use_edges;
 	ctx->use_edges_count = use_edges_count;
 
-	ir_mem_free(ctx->cfg_map);
+	ir_ctx_free(ctx, ctx->cfg_map);
 	ctx->cfg_map = map;
 
+	if (alias_classes) {
+		ir_mem_free(ctx->alias_classes);
+		ctx->alias_classes = alias_classes;
+	}
+
 	ctx->prev_ref = _prev;
 
 	ctx->flags2 |= IR_LINEAR;
@@ -1503,7 +1902,7 @@ void ir_build_prev_refs(ir_ctx *ctx)
 	ir_ref i, n, prev;
 	ir_insn *insn;
 
-	ctx->prev_ref = ir_mem_malloc(ctx->insns_count * sizeof(ir_ref));
+	ctx->prev_ref = ir_ctx_malloc(ctx, ctx->insns_count * sizeof(ir_ref));
 	prev = 0;
 	for (b = 1, bb = ctx->cfg_blocks + b; b <= ctx->cfg_blocks_count; b++, bb++) {
 		IR_ASSERT(!(bb->flags & IR_BB_UNREACHABLE));
@@ -526,6 +526,8 @@ IR_NEVER_INLINE void __jit_debug_register_code(void)
 }
 #endif
 
+static ir_spinlock ir_gdb_lock = 0;
+
 static bool ir_gdb_register_code(const void *object, size_t size)
 {
 	ir_gdbjit_code_entry *entry;
@@ -553,6 +555,7 @@ static bool ir_gdb_register_code(const void *object, size_t size)
 		elf_section = (ir_elf_sectheader*)((char*)elf_section + elf_header->shentsize);
 	}
 
+	ir_spin_lock(&ir_gdb_lock);
 	entry->prev_entry = NULL;
 	entry->next_entry = __jit_debug_descriptor.first_entry;
 
@@ -565,6 +568,7 @@ static bool ir_gdb_register_code(const void *object, size_t size)
 	__jit_debug_descriptor.relevant_entry = entry;
 	__jit_debug_descriptor.action_flag = IR_GDBJIT_REGISTER;
 	__jit_debug_register_code();
+	ir_spin_unlock(&ir_gdb_lock);
 
 	return 1;
 }
@@ -573,6 +577,7 @@ void ir_gdb_unregister_all(void)
 {
 	ir_gdbjit_code_entry *entry;
 
+	ir_spin_lock(&ir_gdb_lock);
 	__jit_debug_descriptor.action_flag = IR_GDBJIT_UNREGISTER;
 	while ((entry = __jit_debug_descriptor.first_entry)) {
 		__jit_debug_descriptor.first_entry = entry->next_entry;
@@ -585,6 +590,7 @@ void ir_gdb_unregister_all(void)
 
 		free(entry);
 	}
+	ir_spin_unlock(&ir_gdb_lock);
 }
 
 #if defined(__FreeBSD__)
@@ -0,0 +1,853 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (GVN - Global Value Numbering and Partial Redundancy Elimination)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* Data nodes are not bound to basic blocks before GCM, so congruent nodes
+ * may be merged over the whole function. GCM then places the survivor into
+ * the common dominator of all the uses.
+ *
+ * LOADs are bound to the control chain. A LOAD is redundant if the same
+ * address was loaded or stored before (walking up through the dominators
+ * tree), and there are no aliasing stores on the paths in between.
+ * A LOAD at MERGE is partially redundant if its value is available only at
+ * some predecessors. In this case we insert LOADs at the ends of the other
+ * predecessors and join the values with a PHI.
+ *
+ * Values stored or loaded on different paths are forwarded through the
+ * Memory SSA form of the loaded location, built on demand for each LOAD.
+ * The state of the location at the start of MERGE and LOOP_BEGIN is a
+ * memory PHI of the states at the ends of the predecessors. It becomes
+ * a real PHI only if the incoming values differ. The location must be
+ * loop invariant to be followed through the back-edges of a loop.
+ */
+
+#define IR_GVN_CLOBBER_ALL  (1<<0) /* block contains CALL, VSTORE or other memory write */
+
+#define IR_GVN_ADDR_BUDGET  64     /* limit for nodes visited by a single address dependency check */
+#define IR_GVN_LOAD_BUDGET  256    /* limit for control nodes visited by a single LOAD search */
+#define IR_GVN_PATH_BUDGET  64     /* limit for blocks visited by a single path check */
+#define IR_GVN_MSSA_BUDGET  64     /* limit for blocks visited by a single Memory SSA query */
+
+typedef struct _ir_gvn_block {
+	uint32_t flags;
+	uint32_t stores;               /* index of the first STORE in ir_gvn_ctx.stores */
+	uint32_t stores_count;
+} ir_gvn_block;
+
+typedef struct _ir_gvn_ctx {
+	ir_gvn_block *blocks;
+	ir_list       stores;
+	ir_worklist   path;
+	ir_bitqueue   worklist;
+	ir_ref       *hash;
+	uint32_t      hash_mask;
+	uint32_t      hash_count;
+	ir_ref       *mem_state;         /* state of the location at the start of the block */
+	uint32_t     *mem_epoch;         /* the query that computed "mem_state" */
+	uint32_t      epoch;
+	uint32_t      mem_budget;
+	ir_list       mem_phis;          /* PHIs created by the current query */
+} ir_gvn_ctx;
+
+static bool ir_gvn_is_pure_call(const ir_ctx *ctx, const ir_insn *insn)
+{
+	const ir_insn *func = &ctx->ir_base[insn->op2];
+	ir_ref func_proto;
+	const ir_proto_t *proto;
+
+	if (func->op == IR_FUNC || func->op == IR_FUNC_ADDR) {
+		func_proto = func->proto;
+	} else if (func->op == IR_PROTO) {
+		func_proto = func->op2;
+	} else {
+		return 0;
+	}
+	if (!func_proto) {
+		return 0;
+	}
+	proto = (const ir_proto_t *)ir_get_str(ctx, func_proto);
+	return (proto->flags & (IR_CONST_FUNC|IR_PURE_FUNC)) != 0;
+}
+
+static void ir_gvn_collect_stores(ir_ctx *ctx, ir_gvn_ctx *data)
+{
+	uint32_t b;
+	ir_ref ref;
+	ir_block *bb;
+	ir_insn *insn;
+	ir_gvn_block *gb;
+
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		gb = &data->blocks[b];
+		gb->stores = ir_list_len(&data->stores);
+		ref = ctx->ir_base[bb->end].op1;
+		while (ref != bb->start) {
+			insn = &ctx->ir_base[ref];
+			/* pin the node to its block (GCM recomputes this anyway) */
+			ctx->cfg_map[ref] = b;
+			if (insn->op == IR_STORE) {
+				ir_list_push(&data->stores, ref);
+			} else if (insn->op == IR_CALL && ir_gvn_is_pure_call(ctx, insn)) {
+				/* pure CALL doesn't write memory */
+			} else if ((ir_op_flags[insn->op] & IR_OP_FLAG_MEM)
+					&& (ir_op_flags[insn->op] & IR_OP_FLAG_MEM_MASK) != IR_OP_FLAG_MEM_LOAD) {
+				gb->flags |= IR_GVN_CLOBBER_ALL;
+			}
+			ref = insn->op1;
+		}
+		gb->stores_count = ir_list_len(&data->stores) - gb->stores;
+	}
+}
+
+/*** Value Numbering of data nodes ***/
+
+static bool ir_gvn_is_candidate(const ir_insn *insn)
+{
+	uint32_t flags = ir_op_flags[insn->op];
+
+	return (flags & IR_OP_FLAG_DATA)
+		&& !(flags & IR_OP_FLAG_PINNED)
+		&& !IR_OP_HAS_VAR_INPUTS(flags)
+		&& insn->op != IR_COPY
+		&& insn->op != IR_ARGVAL;
+}
+
+static uint32_t ir_gvn_hash(const ir_insn *insn)
+{
+	uint32_t op1 = insn->op1;
+	uint32_t op2 = insn->op2;
+	uint32_t h;
+
+	if ((ir_op_flags[insn->op] & IR_OP_FLAG_COMMUTATIVE) && op1 > op2) {
+		op1 = insn->op2;
+		op2 = insn->op1;
+	}
+	h = insn->opt;
+	h = h * 0x9e3779b1 + op1;
+	h = h * 0x9e3779b1 + op2;
+	h = h * 0x9e3779b1 + (uint32_t)insn->op3;
+	return h ^ (h >> 16);
+}
+
+static bool ir_gvn_equal(const ir_insn *insn1, const ir_insn *insn2)
+{
+	if (insn1->opt != insn2->opt || insn1->op3 != insn2->op3) {
+		return 0;
+	} else if (insn1->op1 == insn2->op1 && insn1->op2 == insn2->op2) {
+		return 1;
+	}
+	return (ir_op_flags[insn1->op] & IR_OP_FLAG_COMMUTATIVE)
+		&& insn1->op1 == insn2->op2
+		&& insn1->op2 == insn2->op1;
+}
+
+static void ir_gvn_hash_insert(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref)
+{
+	uint32_t h = ir_gvn_hash(&ctx->ir_base[ref]) & data->hash_mask;
+
+	while (data->hash[h]) {
+		h = (h + 1) & data->hash_mask;
+	}
+	data->hash[h] = ref;
+	data->hash_count++;
+}
+
+static void ir_gvn_hash_grow(ir_ctx *ctx, ir_gvn_ctx *data)
+{
+	ir_ref *old_hash = data->hash;
+	uint32_t i, old_size = data->hash_mask + 1;
+
+	data->hash_mask = old_size * 2 - 1;
+	data->hash = ir_mem_calloc(old_size * 2, sizeof(ir_ref));
+	data->hash_count = 0;
+	for (i = 0; i < old_size; i++) {
+		ir_ref ref = old_hash[i];
+
+		/* skip removed nodes */
+		if (ref && ir_gvn_is_candidate(&ctx->ir_base[ref])) {
+			ir_gvn_hash_insert(ctx, data, ref);
+		}
+	}
+	ir_mem_free(old_hash);
+}
+
+/* Find a node congruent to "ref" or remember "ref" for further lookups.
+ * The table keeps stale entries of the nodes modified after insertion.
+ * They are harmless, because the lookup compares the current contents.
+ */
+static ir_ref ir_gvn_hash_lookup(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	uint32_t h = ir_gvn_hash(insn) & data->hash_mask;
+	ir_ref other;
+
+	while ((other = data->hash[h])) {
+		if (other != ref && ir_gvn_equal(insn, &ctx->ir_base[other])) {
+			return other;
+		}
+		h = (h + 1) & data->hash_mask;
+	}
+
+	if (data->hash_count * 2 >= data->hash_mask) {
+		ir_gvn_hash_grow(ctx, data);
+	}
+	ir_gvn_hash_insert(ctx, data, ref);
+	return IR_UNUSED;
+}
+
+static void ir_gvn_remove_insn(ir_ctx *ctx, ir_ref ref)
+{
+	ir_list stack;
+	ir_ref n, *p, input;
+	ir_insn *insn;
+
+	ir_list_init(&stack, 8);
+	ir_list_push(&stack, ref);
+	while (ir_list_len(&stack)) {
+		ref = ir_list_pop(&stack);
+		insn = &ctx->ir_base[ref];
+		IR_ASSERT(ctx->use_lists[ref].count == 0);
+		n = insn->inputs_count;
+		insn->opt = IR_NOP; /* keep "inputs_count" */
+		ctx->cfg_map[ref] = 0;
+		for (p = insn->ops + 1; n > 0; p++, n--) {
+			input = *p;
+			*p = IR_UNUSED;
+			if (input > 0) {
+				ir_use_list_remove_one(ctx, input, ref);
+				if (ctx->use_lists[input].count == 0
+				 && ir_gvn_is_candidate(&ctx->ir_base[input])) {
+					/* DCE */
+					ir_list_push(&stack, input);
+				}
+			}
+		}
+	}
+	ir_list_free(&stack);
+}
+
+static void ir_gvn_replace(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref, ir_ref new_ref)
+{
+	ir_use_list *use_list = &ctx->use_lists[ref];
+	ir_ref n, *p;
+
+	/* the uses may become congruent to other nodes */
+	for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+		ir_bitqueue_add(&data->worklist, *p);
+	}
+	ir_replace(ctx, ref, new_ref);
+	CLEAR_USES(ref);
+	ir_gvn_remove_insn(ctx, ref);
+}
+
+static void ir_gvn_values(ir_ctx *ctx, ir_gvn_ctx *data)
+{
+	ir_ref ref, other;
+	int i;
+
+	while ((i = ir_bitqueue_pop(&data->worklist)) >= 0) {
+		ref = i;
+		if (ir_gvn_is_candidate(&ctx->ir_base[ref])
+		 && ctx->use_lists[ref].count) {
+			other = ir_gvn_hash_lookup(ctx, data, ref);
+			if (other) {
+				ir_gvn_replace(ctx, data, ref, other);
+			}
+		}
+	}
+}
+
+/*** Redundant LOAD Elimination ***/
+
+static bool ir_gvn_block_is_clean(ir_ctx *ctx, ir_gvn_ctx *data, uint32_t b, ir_type type, ir_ref addr, uint16_t alias_class)
+{
+	const ir_gvn_block *gb = &data->blocks[b];
+	const ir_insn *store;
+	ir_ref ref;
+	uint32_t i;
+
+	if (gb->flags & IR_GVN_CLOBBER_ALL) {
+		return 0;
+	}
+	for (i = 0; i < gb->stores_count; i++) {
+		ref = ir_list_at(&data->stores, gb->stores + i);
+		store = &ctx->ir_base[ref];
+		if (store->op2 == addr
+		 || (!ir_alias_class_disjoint(alias_class, ir_alias_class(ctx, ref))
+		  && ir_check_aliasing(ctx, addr, store->op2, type, ctx->ir_base[store->op3].type) != IR_NO_ALIAS)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Check all the paths from the end of "dom" to the start of "b" */
+static bool ir_gvn_path_is_clean(ir_ctx *ctx, ir_gvn_ctx *data, uint32_t b, uint32_t dom, ir_type type, ir_ref addr, uint16_t alias_class)
+{
+	ir_worklist *path = &data->path;
+	uint32_t n, *p, budget = IR_GVN_PATH_BUDGET;
+	ir_block *bb = &ctx->cfg_blocks[b];
+
+	ir_worklist_clear(path);
+	ir_bitset_incl(path->visited, dom);
+	for (n = bb->predecessors_count, p = &ctx->cfg_edges[bb->predecessors]; n > 0; p++, n--) {
+		ir_worklist_push(path, *p);
+	}
+	while (ir_worklist_len(path)) {
+		b = ir_worklist_pop(path);
+		bb = &ctx->cfg_blocks[b];
+		if (!--budget
+		 || (bb->flags & (IR_BB_START|IR_BB_ENTRY))
+		 || !ir_gvn_block_is_clean(ctx, data, b, type, addr, alias_class)) {
+			return 0;
+		}
+		for (n = bb->predecessors_count, p = &ctx->cfg_edges[bb->predecessors]; n > 0; p++, n--) {
+			ir_worklist_push(path, *p);
+		}
+	}
+	return 1;
+}
+
+/* Find the value of "type" at "addr", available right after the control node "ref".
+ * If "merge" is not NULL, stop at the first MERGE and return it there.
+ */
+static ir_ref ir_gvn_find_load(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref, ir_type type, ir_ref addr, uint16_t alias_class, ir_ref *merge)
+{
+	uint32_t b, modified_regset = 0;
+	uint32_t budget = IR_GVN_LOAD_BUDGET;
+	const ir_insn *insn;
+
+	while (--budget) {
+		if (ref == addr) {
+			/* the address is not defined yet */
+			break;
+		}
+		insn = &ctx->ir_base[ref];
+		if (insn->op == IR_LOAD) {
+			if (insn->op2 == addr) {
+				return insn->type == type ? ref : IR_UNUSED;
+			}
+		} else if (insn->op == IR_STORE) {
+			ir_type type2 = ctx->ir_base[insn->op3].type;
+
+			if (insn->op2 == addr) {
+				if (ctx->ir_base[insn->op3].op == IR_RLOAD
+				 && (modified_regset & (1 << ctx->ir_base[insn->op3].op2))) {
+					/* anti-dependency */
+					break;
+				}
+				return type2 == type ? insn->op3 : IR_UNUSED;
+			} else if (!ir_alias_class_disjoint(alias_class, ir_alias_class(ctx, ref))
+					&& ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
+				break;
+			}
+		} else if (insn->op == IR_RSTORE) {
+			modified_regset |= (1 << insn->op3);
+		} else if (insn->op == IR_CALL) {
+			if (!ir_gvn_is_pure_call(ctx, insn)) {
+				break;
+			}
+		} else if (insn->op == IR_MEMCPY || insn->op == IR_MEMSET) {
+			break;
+		} else if (insn->op == IR_MERGE || insn->op == IR_LOOP_BEGIN) {
+			if (merge && insn->op == IR_MERGE) {
+				*merge = ref;
+				break;
+			}
+			/* continue from the immediate dominator */
+			b = ctx->cfg_map[ref];
+			IR_ASSERT(b && ctx->cfg_blocks[b].start == ref);
+			if (!ir_gvn_path_is_clean(ctx, data, b, ctx->cfg_blocks[b].idom, type, addr, alias_class)) {
+				break;
+			}
+			ref = ctx->cfg_blocks[ctx->cfg_blocks[b].idom].end;
+			continue;
+		} else if (insn->op == IR_START
+				|| insn->op == IR_ENTRY
+				|| (insn->op == IR_BEGIN && insn->op2)) {
+			break;
+		} else if ((ir_op_flags[insn->op] & IR_OP_FLAG_MEM)
+				&& (ir_op_flags[insn->op] & IR_OP_FLAG_MEM_MASK) != IR_OP_FLAG_MEM_LOAD) {
+			break;
+		}
+		ref = insn->op1;
+	}
+	return IR_UNUSED;
+}
+
+/*** Memory SSA ***/
+
+/* Check if "ref" is defined outside of the loop with header "hdr" */
+static bool ir_gvn_is_invariant(ir_ctx *ctx, ir_ref ref, uint32_t hdr, uint32_t *budget)
+{
+	const ir_insn *insn;
+	ir_ref n;
+	const ir_ref *p;
+	uint32_t b;
+
+	if (IR_IS_CONST_REF(ref)) {
+		return 1;
+	}
+	insn = &ctx->ir_base[ref];
+	if (ctx->cfg_map[ref]) {
+		/* control node */
+		b = ctx->cfg_map[ref];
+	} else if (insn->op == IR_PHI || insn->op == IR_PI) {
+		b = ctx->cfg_map[insn->op1];
+	} else if (insn->op == IR_PARAM || insn->op == IR_VAR) {
+		return 1;
+	} else if (!*budget) {
+		return 0;
+	} else {
+		(*budget)--;
+		for (n = insn->inputs_count, p = insn->ops + 1; n > 0; p++, n--) {
+			if (*p > 0 && !ir_gvn_is_invariant(ctx, *p, hdr, budget)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	return b && b != hdr && ir_dominates(ctx->cfg_blocks, b, hdr);
+}
+
+static ir_ref ir_gvn_mem_state(ir_ctx *ctx, ir_gvn_ctx *data, uint32_t b, ir_type type, ir_ref addr, uint16_t alias_class);
+
+/* Find the value of "type" at "addr", available right after the control node "ref",
+ * following all the paths through MERGEs and LOOP_BEGINs.
+ */
+static ir_ref ir_gvn_mem_find(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref, ir_type type, ir_ref addr, uint16_t alias_class)
+{
+	uint32_t budget = IR_GVN_LOAD_BUDGET;
+	const ir_insn *insn;
+
+	while (--budget) {
+		if (ref == addr) {
+			/* the address is not defined yet */
+			break;
+		}
+		insn = &ctx->ir_base[ref];
+		if (insn->op == IR_LOAD) {
+			if (insn->op2 == addr) {
+				return insn->type == type ? ref : IR_UNUSED;
+			}
+		} else if (insn->op == IR_STORE) {
+			ir_type type2 = ctx->ir_base[insn->op3].type;
+
+			if (insn->op2 == addr) {
+				if (type2 != type
+				 || (insn->op3 > 0 && ctx->ir_base[insn->op3].op == IR_RLOAD)) {
+					/* RLOAD might be clobbered by RSTORE on the other paths */
+					break;
+				}
+				return insn->op3;
+			} else if (!ir_alias_class_disjoint(alias_class, ir_alias_class(ctx, ref))
+					&& ir_check_aliasing(ctx, addr, insn->op2, type, type2) != IR_NO_ALIAS) {
+				break;
+			}
+		} else if (insn->op == IR_CALL) {
+			if (!ir_gvn_is_pure_call(ctx, insn)) {
+				break;
+			}
+		} else if (insn->op == IR_MEMCPY || insn->op == IR_MEMSET) {
+			break;
+		} else if (insn->op == IR_MERGE || insn->op == IR_LOOP_BEGIN) {
+			return ir_gvn_mem_state(ctx, data, ctx->cfg_map[ref], type, addr, alias_class);
+		} else if (insn->op == IR_START
+				|| insn->op == IR_ENTRY
+				|| (insn->op == IR_BEGIN && insn->op2)) {
+			break;
+		} else if ((ir_op_flags[insn->op] & IR_OP_FLAG_MEM)
+				&& (ir_op_flags[insn->op] & IR_OP_FLAG_MEM_MASK) != IR_OP_FLAG_MEM_LOAD) {
+			break;
+		}
+		ref = insn->op1;
+	}
+	return IR_UNUSED;
+}
+
+static ir_ref ir_gvn_mem_phi(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref merge, ir_type type)
+{
+	ir_ref phi = ir_emit_N(ctx, IR_OPT(IR_PHI, type), ctx->ir_base[merge].inputs_count + 1);
+
+	ir_set_op(ctx, phi, 1, merge);
+	ir_use_list_add(ctx, merge, phi);
+	ir_list_push(&data->mem_phis, phi);
+	return phi;
+}
+
+/* Returns the state of the location at the start of MERGE or LOOP_BEGIN block (memory PHI) */
+static ir_ref ir_gvn_mem_state(ir_ctx *ctx, ir_gvn_ctx *data, uint32_t b, ir_type type, ir_ref addr, uint16_t alias_class)
+{
+	ir_ref merge = ctx->cfg_blocks[b].start;
+	ir_ref i, n, end, phi, same = IR_UNUSED, *vals;
+	uint32_t budget = IR_GVN_ADDR_BUDGET;
+
+	IR_ASSERT(b && merge);
+	if (data->mem_epoch[b] == data->epoch) {
+		if (!data->mem_state[b]) {
+			/* we came back through a loop back-edge */
+			data->mem_state[b] = ir_gvn_mem_phi(ctx, data, merge, type);
+		}
+		return data->mem_state[b];
+	}
+	if (!data->mem_budget
+	 || (ctx->ir_base[merge].op == IR_LOOP_BEGIN
+	  && !ir_gvn_is_invariant(ctx, addr, b, &budget))) {
+		return IR_UNUSED;
+	}
+	data->mem_budget--;
+	data->mem_epoch[b] = data->epoch;
+	data->mem_state[b] = IR_UNUSED;
+
+	n = ctx->ir_base[merge].inputs_count;
+	vals = ir_mem_malloc(n * sizeof(ir_ref));
+	for (i = 0; i < n; i++) {
+		end = ir_insn_op(&ctx->ir_base[merge], i + 1);
+		vals[i] = ir_gvn_mem_find(ctx, data, ctx->ir_base[end].op1, type, addr, alias_class);
+		if (!vals[i]) {
+			ir_mem_free(vals);
+			return IR_UNUSED;
+		}
+		if (!same) {
+			same = vals[i];
+		} else if (vals[i] != same) {
+			same = -1;
+		}
+	}
+
+	phi = data->mem_state[b];
+	if (!phi) {
+		if (same != -1) {
+			ir_mem_free(vals);
+			data->mem_state[b] = same;
+			return same;
+		}
+		phi = ir_gvn_mem_phi(ctx, data, merge, type);
+		data->mem_state[b] = phi;
+	}
+	for (i = 0; i < n; i++) {
+		ir_set_op(ctx, phi, i + 2, vals[i]);
+		if (vals[i] > 0) {
+			ir_use_list_add(ctx, vals[i], phi);
+		}
+	}
+	ir_mem_free(vals);
+	return phi;
+}
+
+/* Find the value of the LOAD coming from all the paths reaching it */
+static ir_ref ir_gvn_mem_load(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref i, j, val, phi, input;
+
+	data->epoch++;
+	data->mem_budget = IR_GVN_MSSA_BUDGET;
+	ir_list_clear(&data->mem_phis);
+	val = ir_gvn_mem_find(ctx, data, insn->op1, insn->type, insn->op2, ir_alias_class(ctx, ref));
+	if (!val) {
+		/* remove the incomplete PHIs */
+		for (i = 0; i < (ir_ref)ir_list_len(&data->mem_phis); i++) {
+			phi = ir_list_at(&data->mem_phis, i);
+			insn = &ctx->ir_base[phi];
+			for (j = 1; j <= insn->inputs_count; j++) {
+				input = ir_insn_op(insn, j);
+				if (input > 0) {
+					ir_use_list_remove_one(ctx, input, phi);
+				}
+			}
+		}
+		for (i = 0; i < (ir_ref)ir_list_len(&data->mem_phis); i++) {
+			phi = ir_list_at(&data->mem_phis, i);
+			CLEAR_USES(phi);
+			MAKE_NOP(&ctx->ir_base[phi]);
+		}
+	}
+	return val;
+}
+
+/* Replace the PHIs that merge a single value, like PHI(v, phi) at a loop header */
+static void ir_gvn_mem_remove_trivial_phis(ir_ctx *ctx, ir_gvn_ctx *data)
+{
+	ir_ref i, j, phi, input, same;
+	ir_insn *insn;
+	bool changed;
+
+	do {
+		changed = 0;
+		for (i = 0; i < (ir_ref)ir_list_len(&data->mem_phis); i++) {
+			phi = ir_list_at(&data->mem_phis, i);
+			insn = &ctx->ir_base[phi];
+			if (insn->op != IR_PHI) {
+				continue;
+			}
+			if (!ctx->use_lists[phi].count) {
+				ir_gvn_remove_insn(ctx, phi);
+				changed = 1;
+				continue;
+			}
+			same = IR_UNUSED;
+			for (j = 2; j <= insn->inputs_count; j++) {
+				input = ir_insn_op(insn, j);
+				if (input != phi) {
+					if (!same) {
+						same = input;
+					} else if (input != same) {
+						same = -1;
+						break;
+					}
+				}
+			}
+			if (same != -1) {
+				IR_ASSERT(same);
+				for (j = 2; j <= insn->inputs_count; j++) {
+					if (ir_insn_op(insn, j) == phi) {
+						ir_insn_set_op(insn, j, IR_UNUSED);
+						ir_use_list_remove_one(ctx, phi, phi);
+					}
+				}
+				ir_gvn_replace(ctx, data, phi, same);
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+/* Check if "ref" may be computed at the predecessors of the block "b" */
+static bool ir_gvn_is_available(ir_ctx *ctx, ir_ref ref, uint32_t b, uint32_t *budget)
+{
+	const ir_insn *insn;
+	ir_ref n;
+	const ir_ref *p;
+
+	if (IR_IS_CONST_REF(ref)) {
+		return 1;
+	} else if (ctx->cfg_map[ref]) {
+		/* control node */
+		return ctx->cfg_map[ref] != b;
+	}
+	insn = &ctx->ir_base[ref];
+	if (insn->op == IR_PHI || insn->op == IR_PI) {
+		return ctx->cfg_map[insn->op1] != b;
+	} else if (insn->op == IR_PARAM || insn->op == IR_VAR) {
+		return 1;
+	} else if (!*budget) {
+		return 0;
+	}
+	(*budget)--;
+	for (n = insn->inputs_count, p = insn->ops + 1; n > 0; p++, n--) {
+		if (*p > 0 && !ir_gvn_is_available(ctx, *p, b, budget)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void ir_gvn_replace_load(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref, ir_ref val)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref prev = insn->op1;
+	ir_ref next = ir_next_control(ctx, ref);
+
+	/* remove LOAD from double linked control list */
+	ctx->ir_base[next].op1 = prev;
+	ir_use_list_remove_one(ctx, ref, next);
+	ir_use_list_replace_one(ctx, prev, ref, next);
+	insn->op1 = IR_UNUSED;
+
+	ir_gvn_replace(ctx, data, ref, val);
+}
+
+static bool ir_gvn_pre_load(ir_ctx *ctx, ir_gvn_ctx *data, ir_ref ref, ir_ref merge)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = insn->type;
+	ir_ref addr = insn->op2;
+	uint16_t alias_class = ir_alias_class(ctx, ref);
+	uint32_t b = ctx->cfg_map[merge];
+	ir_ref i, n, end, phi, *vals;
+	ir_ref available = 0, same = IR_UNUSED;
+	uint32_t budget = IR_GVN_ADDR_BUDGET;
+	bool redundant = 1;
+
+	if (ctx->cfg_blocks[b].flags & IR_BB_LOOP_HEADER) {
+		return 0;
+	}
+
+	n = ctx->ir_base[merge].inputs_count;
+	vals = ir_mem_malloc(n * sizeof(ir_ref));
+	for (i = 0; i < n; i++) {
+		end = ir_insn_op(&ctx->ir_base[merge], i + 1);
+		vals[i] = ir_gvn_find_load(ctx, data, ctx->ir_base[end].op1, type, addr, alias_class, NULL);
+		if (vals[i]) {
+			available++;
+			if (!same) {
+				same = vals[i];
+			} else if (vals[i] != same) {
+				redundant = 0;
+			}
+		} else {
+			redundant = 0;
+		}
+	}
+
+	if (!available) {
+		ir_mem_free(vals);
+		return 0;
+	} else if (redundant) {
+		ir_mem_free(vals);
+		ir_gvn_replace_load(ctx, data, ref, same);
+		return 1;
+	}
+
+	if (available < n) {
+		ir_ref ctrl;
+
+		/* LOAD must be executed after each entry into the MERGE (it must be
+		 * anticipated at the ends of all the predecessors). A LOAD under
+		 * IF/SWITCH below the MERGE may fault on the other paths.
+		 */
+		for (ctrl = insn->op1; ctrl != merge; ctrl = ctx->ir_base[ctrl].op1) {
+			if (ctx->ir_base[ctrl].op == IR_GUARD
+			 || ctx->ir_base[ctrl].op == IR_GUARD_NOT
+			 || (ir_op_flags[ctx->ir_base[ctrl].op] & IR_OP_FLAG_BB_START)) {
+				ir_mem_free(vals);
+				return 0;
+			}
+		}
+		if (!ir_gvn_is_available(ctx, addr, b, &budget)) {
+			ir_mem_free(vals);
+			return 0;
+		}
+
+		/* insert the missing LOADs right before the ENDs of predecessors */
+		for (i = 0; i < n; i++) {
+			if (!vals[i]) {
+				ir_ref prev, load;
+
+				end = ir_insn_op(&ctx->ir_base[merge], i + 1);
+				prev = ctx->ir_base[end].op1;
+				load = ir_emit2(ctx, IR_OPTX(IR_LOAD, type, 2), prev, addr);
+				ir_set_alias_class(ctx, load, alias_class);
+				ir_use_list_replace_one(ctx, prev, end, load);
+				ctx->ir_base[end].op1 = load;
+				ir_use_list_add(ctx, load, end);
+				if (addr > 0) {
+					ir_use_list_add(ctx, addr, load);
+				}
+				ctx->cfg_map[load] = ctx->cfg_map[end];
+				vals[i] = load;
+			}
+		}
+	}
+
+	phi = ir_emit_N(ctx, IR_OPT(IR_PHI, type), n + 1);
+	ir_set_op(ctx, phi, 1, merge);
+	ir_use_list_add(ctx, merge, phi);
+	for (i = 0; i < n; i++) {
+		ir_set_op(ctx, phi, i + 2, vals[i]);
+		if (vals[i] > 0) {
+			ir_use_list_add(ctx, vals[i], phi);
+		}
+	}
+	ir_mem_free(vals);
+	ir_bitqueue_grow(&data->worklist, ctx->insns_count);
+
+	ir_gvn_replace_load(ctx, data, ref, phi);
+	return 1;
+}
+
+static void ir_gvn_loads(ir_ctx *ctx, ir_gvn_ctx *data)
+{
+	uint32_t b;
+	ir_ref ref, next, val, merge;
+	ir_insn *insn;
+
+	for (b = 1; b <= ctx->cfg_blocks_count; b++) {
+		ref = ctx->cfg_blocks[b].start;
+		while (ref != ctx->cfg_blocks[b].end) {
+			next = ir_next_control(ctx, ref);
+			insn = &ctx->ir_base[ref];
+			if (insn->op == IR_LOAD) {
+				merge = IR_UNUSED;
+				val = ir_gvn_find_load(ctx, data, insn->op1, insn->type, insn->op2, ir_alias_class(ctx, ref), &merge);
+				if (val) {
+					ir_gvn_replace_load(ctx, data, ref, val);
+				} else if (data->mem_state
+				 && (val = ir_gvn_mem_load(ctx, data, ref))) {
+					ir_bitqueue_grow(&data->worklist, ctx->insns_count);
+					ir_gvn_replace_load(ctx, data, ref, val);
+					ir_gvn_mem_remove_trivial_phis(ctx, data);
+				} else if (merge) {
+					ir_gvn_pre_load(ctx, data, ref, merge);
+				}
+			}
+			ref = next;
+		}
+	}
+}
+
+int ir_gvn(ir_ctx *ctx)
+{
+	ir_gvn_ctx data;
+	uint32_t size;
+	ir_ref ref;
+	ir_insn *insn;
+
+	IR_ASSERT(ctx->cfg_blocks && ctx->use_lists);
+
+	data.blocks = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_gvn_block));
+	ir_list_init(&data.stores, 16);
+	ir_gvn_collect_stores(ctx, &data);
+
+	size = 64;
+	while (size < (uint32_t)ctx->insns_count) {
+		size *= 2;
+	}
+	data.hash = ir_mem_calloc(size, sizeof(ir_ref));
+	data.hash_mask = size - 1;
+	data.hash_count = 0;
+
+	ir_bitqueue_init(&data.worklist, ctx->insns_count);
+	for (ref = 1; ref < ctx->insns_count;) {
+		insn = &ctx->ir_base[ref];
+		if (ir_gvn_is_candidate(insn)) {
+			ir_bitqueue_add(&data.worklist, ref);
+		}
+		ref += ir_insn_len(insn);
+	}
+	ir_gvn_values(ctx, &data);
+
+	ir_worklist_init(&data.path, ctx->cfg_blocks_count + 1);
+	if (!(ctx->flags2 & IR_IRREDUCIBLE_CFG)) {
+		data.mem_state = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_ref));
+		data.mem_epoch = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(uint32_t));
+		data.epoch = 0;
+		ir_list_init(&data.mem_phis, 8);
+	} else {
+		data.mem_state = NULL;
+	}
+	ir_gvn_loads(ctx, &data);
+	if (data.mem_state) {
+		ir_list_free(&data.mem_phis);
+		ir_mem_free(data.mem_epoch);
+		ir_mem_free(data.mem_state);
+	}
+	ir_worklist_free(&data.path);
+
+	/* the uses of the eliminated LOADs */
+	ir_gvn_values(ctx, &data);
+
+	ir_bitqueue_free(&data.worklist);
+	ir_mem_free(data.hash);
+	ir_list_free(&data.stores);
+	ir_mem_free(data.blocks);
+
+	return 1;
+}
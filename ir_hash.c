@@ -0,0 +1,345 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Structural IR hashing and comparison)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ *
+ * The function graph is serialized into a stream of 64-bit tokens in a canonical order.
+ * The walk starts from the terminators and follows the input edges in the operand order.
+ * Instructions are identified by the order of the first visit, constants by their values
+ * and strings by their content, so the stream doesn't depend on the node numbering, on
+ * the order of constants, or on the string table layout. The serialization is reversible,
+ * so two functions are equal if and only if their streams are equal.
+ *
+ * Terminators are linked into a list in the order of their construction. This list is
+ * ignored; instead, terminators are ordered by a "signature" (a hash of the nearest part
+ * of their sub-graph). Nodes unreachable from terminators (e.g. unused PARAMs) are walked
+ * after all terminators, ordered in the same way.
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+#define IR_HASH_SIG_LIMIT  32
+
+#define IR_HASH_TAG_NONE   0x01
+#define IR_HASH_TAG_CONST  0x02
+#define IR_HASH_TAG_BACK   0x03
+#define IR_HASH_TAG_NEW    0x04
+#define IR_HASH_TAG_LIMIT  0x05
+#define IR_HASH_TAG_ROOT   0x06
+#define IR_HASH_TAG_STR    0x07
+
+typedef struct _ir_hash_sink {
+	ir_hash128  hash;
+	uint64_t   *buf;     /* serialized graph (only for comparison) */
+	size_t      len;
+	size_t      size;
+} ir_hash_sink;
+
+typedef struct _ir_hash_root {
+	ir_hash128  sig;
+	ir_ref      ref;
+} ir_hash_root;
+
+typedef struct _ir_hash_walker {
+	const ir_ctx *ctx;
+	ir_ref       *ids;     /* visit number of each instruction (0 - not visited yet) */
+	ir_ref       *order;   /* instructions in the visit order */
+	ir_ref       *stack;   /* pairs of (instruction, next operand) */
+	ir_ref        count;
+} ir_hash_walker;
+
+static uint64_t ir_hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void ir_hash_emit(ir_hash_sink *sink, uint64_t val)
+{
+	if (sink->buf) {
+		if (sink->len == sink->size) {
+			sink->size *= 2;
+			sink->buf = ir_mem_realloc(sink->buf, sink->size * sizeof(uint64_t));
+		}
+		sink->buf[sink->len++] = val;
+	} else {
+		sink->hash.lo = ir_hash_mix(sink->hash.lo ^ val) + 0x9e3779b97f4a7c15ULL;
+		sink->hash.hi = ir_hash_mix((sink->hash.hi + val) ^ 0xc2b2ae3d27d4eb4fULL) * 5 + 0x52dce729;
+	}
+}
+
+static void ir_hash_emit_str(ir_hash_sink *sink, const ir_ctx *ctx, ir_ref str)
+{
+	size_t len, i;
+	const char *s;
+	uint64_t val;
+
+	if (!str) {
+		ir_hash_emit(sink, IR_HASH_TAG_NONE);
+		return;
+	}
+	s = ir_get_strl(ctx, str, &len);
+	ir_hash_emit(sink, IR_HASH_TAG_STR);
+	ir_hash_emit(sink, len);
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&val, s + i, 8);
+		ir_hash_emit(sink, val);
+	}
+	if (i < len) {
+		val = 0;
+		memcpy(&val, s + i, len - i);
+		ir_hash_emit(sink, val);
+	}
+}
+
+static void ir_hash_emit_const(ir_hash_sink *sink, const ir_ctx *ctx, ir_ref ref)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	uint64_t val;
+	size_t size;
+
+	ir_hash_emit(sink, IR_HASH_TAG_CONST);
+	ir_hash_emit(sink, insn->op | (insn->type << 8));
+	if (IR_IS_SYM_CONST(insn->op)) {
+		ir_hash_emit_str(sink, ctx, insn->val.name);
+	} else {
+		val = insn->val.u64;
+		size = ir_type_size[insn->type];
+		if (size < 8) {
+			/* ignore garbage in the unused bytes */
+			val &= (1ULL << (size * 8)) - 1;
+		}
+		ir_hash_emit(sink, val);
+	}
+	if (insn->op == IR_FUNC || insn->op == IR_FUNC_ADDR) {
+		ir_hash_emit_str(sink, ctx, insn->proto);
+	}
+}
+
+static void ir_hash_visit(ir_hash_walker *w, ir_hash_sink *sink, ir_ref ref)
+{
+	const ir_insn *insn = &w->ctx->ir_base[ref];
+	uint64_t header = insn->op | (insn->type << 8);
+
+	/* insn->prev_insn_offset is a CSE link and must not be hashed */
+	if (IR_OP_HAS_VAR_INPUTS(ir_op_flags[insn->op])) {
+		header |= (uint64_t)insn->inputs_count << 16;
+	} else if (insn->op == IR_LOAD || insn->op == IR_STORE) {
+		header |= (uint64_t)ir_alias_class(w->ctx, ref) << 16;
+	}
+	ir_hash_emit(sink, header);
+	w->order[w->count] = ref;
+	w->ids[ref] = ++w->count;
+}
+
+/* Serialize the sub-graph of "root". No more than "limit" new instructions are visited. */
+static void ir_hash_walk(ir_hash_walker *w, ir_hash_sink *sink, ir_ref root, ir_ref limit)
+{
+	const ir_ctx *ctx = w->ctx;
+	ir_ref *stack = w->stack;
+	ir_ref sp, ref, op, j, n, base = w->count;
+	const ir_insn *insn;
+	uint32_t flags;
+
+	ir_hash_emit(sink, IR_HASH_TAG_ROOT);
+	if (w->ids[root]) {
+		ir_hash_emit(sink, IR_HASH_TAG_BACK);
+		ir_hash_emit(sink, w->ids[root]);
+		return;
+	}
+	ir_hash_visit(w, sink, root);
+	stack[0] = root;
+	stack[1] = 1;
+	sp = 2;
+	while (sp) {
+		ref = stack[sp - 2];
+		j = stack[sp - 1];
+		insn = &ctx->ir_base[ref];
+		n = ir_operands_count(ctx, insn);
+		if (j > n) {
+			sp -= 2;
+			continue;
+		}
+		stack[sp - 1] = j + 1;
+		flags = ir_op_flags[insn->op];
+		op = ir_insn_op(insn, j);
+		switch (IR_OPND_KIND(flags, j)) {
+			case IR_OPND_UNUSED:
+			case IR_OPND_CONTROL_REF:
+				/* list of terminators */
+				break;
+			case IR_OPND_STR:
+			case IR_OPND_PROTO:
+				ir_hash_emit_str(sink, ctx, op);
+				break;
+			case IR_OPND_NUM:
+			case IR_OPND_PROB:
+				ir_hash_emit(sink, (uint32_t)op);
+				break;
+			default:
+				if (op == IR_UNUSED) {
+					ir_hash_emit(sink, IR_HASH_TAG_NONE);
+				} else if (IR_IS_CONST_REF(op)) {
+					ir_hash_emit_const(sink, ctx, op);
+				} else if (w->ids[op]) {
+					ir_hash_emit(sink, IR_HASH_TAG_BACK);
+					ir_hash_emit(sink, w->ids[op]);
+				} else if (w->count - base >= limit) {
+					ir_hash_emit(sink, IR_HASH_TAG_LIMIT);
+					ir_hash_emit(sink, ctx->ir_base[op].op | (ctx->ir_base[op].type << 8));
+				} else {
+					ir_hash_emit(sink, IR_HASH_TAG_NEW);
+					ir_hash_visit(w, sink, op);
+					stack[sp] = op;
+					stack[sp + 1] = 1;
+					sp += 2;
+				}
+				break;
+		}
+	}
+}
+
+static ir_hash128 ir_hash_signature(ir_hash_walker *w, ir_ref root)
+{
+	ir_hash_sink sink;
+	ir_ref i, base = w->count;
+
+	sink.hash.lo = 0;
+	sink.hash.hi = 0;
+	sink.buf = NULL;
+	ir_hash_walk(w, &sink, root, IR_HASH_SIG_LIMIT);
+
+	/* forget the instructions visited by the bounded walk */
+	for (i = base; i < w->count; i++) {
+		w->ids[w->order[i]] = 0;
+	}
+	w->count = base;
+	return sink.hash;
+}
+
+static int ir_hash_root_cmp(const void *r1, const void *r2)
+{
+	const ir_hash_root *root1 = (const ir_hash_root*)r1;
+	const ir_hash_root *root2 = (const ir_hash_root*)r2;
+
+	if (root1->sig.lo != root2->sig.lo) {
+		return root1->sig.lo < root2->sig.lo ? -1 : 1;
+	} else if (root1->sig.hi != root2->sig.hi) {
+		return root1->sig.hi < root2->sig.hi ? -1 : 1;
+	}
+	return root1->ref - root2->ref;
+}
+
+static void ir_hash_walk_roots(ir_hash_walker *w, ir_hash_sink *sink, ir_hash_root *roots, ir_ref count)
+{
+	ir_ref i;
+
+	for (i = 0; i < count; i++) {
+		roots[i].sig = ir_hash_signature(w, roots[i].ref);
+	}
+	if (count > 1) {
+		qsort(roots, count, sizeof(ir_hash_root), ir_hash_root_cmp);
+	}
+	ir_hash_emit(sink, count);
+	for (i = 0; i < count; i++) {
+		ir_hash_walk(w, sink, roots[i].ref, w->ctx->insns_count);
+	}
+}
+
+static void ir_hash_serialize(const ir_ctx *ctx, ir_hash_sink *sink)
+{
+	ir_hash_walker w;
+	ir_hash_root *roots;
+	ir_ref i, n, count, params_count = 0;
+	const ir_insn *insn;
+
+	ir_hash_emit(sink, ctx->flags & (IR_PROTO_MASK|IR_FUNCTION|IR_STATIC|IR_EXTERN));
+	ir_hash_emit(sink, ctx->ret_type);
+
+	w.ctx = ctx;
+	w.ids = ir_mem_calloc(ctx->insns_count, sizeof(ir_ref));
+	w.order = ir_mem_malloc(ctx->insns_count * sizeof(ir_ref));
+	w.stack = ir_mem_malloc(ctx->insns_count * 2 * sizeof(ir_ref));
+	w.count = 0;
+	roots = ir_mem_malloc(ctx->insns_count * sizeof(ir_hash_root));
+
+	/* Terminators */
+	count = 0;
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
+		if (ir_op_flags[insn->op] & IR_OP_FLAG_TERMINATOR) {
+			roots[count++].ref = i;
+		} else if (insn->op == IR_PARAM) {
+			params_count++;
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+	ir_hash_walk_roots(&w, sink, roots, count);
+
+	/* Unreachable instructions */
+	count = 0;
+	for (i = IR_UNUSED + 1, insn = ctx->ir_base + i; i < ctx->insns_count;) {
+		if (!w.ids[i] && insn->op != IR_NOP) {
+			roots[count++].ref = i;
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+	ir_hash_walk_roots(&w, sink, roots, count);
+
+	if (ctx->value_params) {
+		for (i = 0; i < params_count; i++) {
+			ir_hash_emit(sink, ((uint64_t)ctx->value_params[i].size << 32) | ctx->value_params[i].align);
+		}
+	}
+
+	ir_mem_free(roots);
+	ir_mem_free(w.stack);
+	ir_mem_free(w.order);
+	ir_mem_free(w.ids);
+}
+
+void ir_ctx_hash(const ir_ctx *ctx, ir_hash128 *hash)
+{
+	ir_hash_sink sink;
+
+	sink.hash.lo = 0x6a09e667f3bcc908ULL;
+	sink.hash.hi = 0xbb67ae8584caa73bULL;
+	sink.buf = NULL;
+	ir_hash_serialize(ctx, &sink);
+	hash->lo = ir_hash_mix(sink.hash.lo ^ sink.hash.hi);
+	hash->hi = ir_hash_mix(sink.hash.hi + sink.hash.lo * 0x9e3779b97f4a7c15ULL);
+}
+
+bool ir_ctx_equal(const ir_ctx *ctx1, const ir_ctx *ctx2)
+{
+	ir_hash_sink sink1, sink2;
+	bool ret;
+
+	if (ctx1 == ctx2) {
+		return 1;
+	}
+	sink1.size = ctx1->insns_count * 4 + 16;
+	sink1.buf = ir_mem_malloc(sink1.size * sizeof(uint64_t));
+	sink1.len = 0;
+	ir_hash_serialize(ctx1, &sink1);
+
+	sink2.size = sink1.len + 1;
+	sink2.buf = ir_mem_malloc(sink2.size * sizeof(uint64_t));
+	sink2.len = 0;
+	ir_hash_serialize(ctx2, &sink2);
+
+	ret = sink1.len == sink2.len && memcmp(sink1.buf, sink2.buf, sink1.len * sizeof(uint64_t)) == 0;
+
+	ir_mem_free(sink2.buf);
+	ir_mem_free(sink1.buf);
+	return ret;
+}
@@ -0,0 +1,492 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Function Inlining)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* The inliner works on the graphs of a module before ir_build_def_use_lists().
+ * The module (call graph, function contexts, processing order) is kept by the
+ * loader. ir_inline() scans the CALLs of a single function, asks the loader
+ * for the callee graphs and clones them in place of the CALLs. PARAMs are
+ * replaced by the CALL arguments, START by the CALL control input, and RETURNs
+ * are joined with MERGE and PHI.
+ *
+ * The instructions of the caller are re-emitted in their original order and
+ * the clones are emitted right at the place of the CALL. Data nodes are passed
+ * through ir_fold() (SCCP relies on the graph folded at construction time, and
+ * the arguments of the CALL are often constants), so the following passes see
+ * the same graph as the loader would build for the inlined code. Operands that
+ * refer forward (PHI and LOOP_BEGIN inputs) are filled in at the end.
+ *
+ * The callee should be processed before the caller (bottom-up order of the
+ * call graph). Recursive calls are never inlined, because the loader doesn't
+ * provide the graph of a function that is still in progress.
+ */
+
+#define IR_INLINE_MAX_INSNS       24   /* callee size limit */
+#define IR_INLINE_MAX_PURE_INSNS  64   /* callee size limit for IR_CONST_FUNC and IR_PURE_FUNC */
+#define IR_INLINE_MAX_GROWTH      1024 /* limit for instructions added to a single caller */
+
+typedef struct _ir_inline_site {
+	ir_ref        call;                /* CALL (in the original numbering of the caller) */
+	const ir_ctx *callee;
+	ir_ref       *_map;                /* callee ref -> caller ref */
+	ir_ref       *_const_map;          /* callee const -> caller const */
+	ir_ref        rets_count;
+	ir_ref        ret;                 /* the single RETURN of the callee */
+	ir_ref        merge;               /* MERGE of multiple RETURNs */
+	ir_ref        phi;
+	ir_ref        exit;                /* replacement of the CALL for control uses */
+	ir_ref        val;                 /* replacement of the CALL for data uses */
+	bool          resolved;
+} ir_inline_site;
+
+typedef struct _ir_inline_ctx {
+	ir_ctx         *ctx;
+	ir_insn        *old_base;          /* copy of the original caller instructions */
+	ir_ref         *_xlat;             /* original caller ref -> new ref (or site number for inlined CALLs) */
+	ir_bitset       calls;             /* inlined CALLs */
+	ir_inline_site *sites;
+	ir_list         fixups;            /* pairs of (site number + 1 or 0 for the caller, ref) to fill later */
+} ir_inline_ctx;
+
+/* Before ir_build_def_use_lists() "inputs_count" of the nodes with fixed number of inputs
+ * keeps the links of local CSE chains */
+static ir_ref ir_inline_insn_len(const ir_insn *insn)
+{
+	return IR_OP_HAS_VAR_INPUTS(ir_op_flags[insn->op]) ? (ir_ref)ir_insn_len(insn) : 1;
+}
+
+int32_t ir_inline_cost(const ir_ctx *callee)
+{
+	ir_ref i, n;
+	const ir_insn *insn;
+	int32_t cost = 0;
+	bool has_return = 0;
+
+	if (callee->insns_count <= 1
+	 || callee->ir_base[1].op != IR_START
+	 || (callee->flags & IR_VARARG_FUNC)
+	 || callee->use_lists) {
+		return -1;
+	}
+	for (i = 2; i < callee->insns_count; i += n) {
+		insn = &callee->ir_base[i];
+		n = ir_inline_insn_len(insn);
+		switch (insn->op) {
+			case IR_NOP:
+			case IR_PARAM:
+				break;
+			case IR_RETURN:
+				has_return = 1;
+				break;
+			case IR_ENTRY:
+			case IR_TAILCALL:
+			case IR_UNREACHABLE:
+			case IR_IJMP:
+			case IR_ALLOCA:
+			case IR_AFREE:
+			case IR_VA_START:
+			case IR_FRAME_ADDR:
+			case IR_RLOAD:
+			case IR_RSTORE:
+			case IR_ASM:
+			case IR_ASM_GOTO:
+			case IR_EXITCALL:
+			case IR_GUARD:
+			case IR_GUARD_NOT:
+			case IR_SNAPSHOT:
+				/* the node depends on the function frame or leaves the function in another way */
+				return -1;
+			default:
+				cost++;
+				break;
+		}
+	}
+	return has_return ? cost : -1;
+}
+
+static bool ir_inline_check_call(const ir_ctx *ctx, ir_ref ref, const ir_ctx *callee)
+{
+	ir_ref i, n, arg;
+	const ir_insn *insn, *call = &ctx->ir_base[ref];
+
+	if ((call->type != IR_VOID && callee->ret_type != call->type)
+	 || call->op1 >= ref) {
+		return 0;
+	}
+	for (i = 2; i < callee->insns_count; i += n) {
+		insn = &callee->ir_base[i];
+		n = ir_inline_insn_len(insn);
+		if (insn->op == IR_PARAM) {
+			if (insn->op3 < 1 || insn->op3 > call->inputs_count - 2) {
+				return 0;
+			}
+			arg = ir_insn_op(call, insn->op3 + 2);
+			if (!arg
+			 || arg >= ref
+			 || ctx->ir_base[arg].type != insn->type
+			 || (arg > 0 && ctx->ir_base[arg].op == IR_ARGVAL)) {
+				/* the callee may modify a copy of the argument passed by value,
+				 * the clones may use only the arguments defined before the CALL */
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static ir_str ir_inline_str(ir_ctx *ctx, const ir_ctx *callee, ir_str str)
+{
+	const char *s;
+	size_t len;
+
+	if (!str || IR_IS_EXT_STR(str)) {
+		/* external strings are shared through the loader */
+		return str;
+	}
+	s = ir_get_strl(callee, str, &len);
+	return ir_stringl(ctx, s, len);
+}
+
+static ir_ref ir_inline_const(ir_ctx *ctx, const ir_ctx *callee, ir_ref ref, ir_ref *_const_map)
+{
+	const ir_insn *insn;
+	ir_val val;
+	ir_str proto = 0;
+
+	if (ref >= IR_TRUE) {
+		/* IR_NULL, IR_FALSE and IR_TRUE are the same in all contexts */
+		return ref;
+	} else if (_const_map[-ref]) {
+		return _const_map[-ref];
+	}
+
+	insn = &callee->ir_base[ref];
+	val = insn->val;
+	switch (insn->op) {
+		case IR_FUNC:
+			val.u64 = ir_inline_str(ctx, callee, insn->val.name);
+			IR_FALLTHROUGH;
+		case IR_FUNC_ADDR:
+			proto = ir_inline_str(ctx, callee, insn->proto);
+			break;
+		case IR_SYM:
+		case IR_STR:
+		case IR_LABEL:
+			val.u64 = ir_inline_str(ctx, callee, insn->val.name);
+			break;
+		default:
+			break;
+	}
+	_const_map[-ref] = ir_const_ex(ctx, val, insn->type, IR_OPTX(insn->op, insn->type, proto));
+	return _const_map[-ref];
+}
+
+static void ir_inline_resolve_site(ir_inline_ctx *data, ir_inline_site *site);
+
+/* Translate the operand of the original caller instruction */
+static ir_ref ir_inline_xlat(ir_inline_ctx *data, ir_ref ref, bool is_data)
+{
+	ir_inline_site *site;
+
+	if (ref <= 0) {
+		return ref;
+	} else if (ir_bitset_in(data->calls, ref)) {
+		site = &data->sites[data->_xlat[ref]];
+		ir_inline_resolve_site(data, site);
+		return is_data ? site->val : site->exit;
+	}
+	return data->_xlat[ref];
+}
+
+/* Translate the operand of the callee instruction */
+static ir_ref ir_inline_callee_ref(ir_inline_ctx *data, ir_inline_site *site, ir_ref ref, ir_op op)
+{
+	const ir_insn *insn;
+
+	if (ref < 0) {
+		return ir_inline_const(data->ctx, site->callee, ref, site->_const_map);
+	} else if (ref == 1) {
+		/* local variables belong to the caller frame */
+		return (op == IR_VAR) ? 1 : ir_inline_xlat(data, data->old_base[site->call].op1, 0);
+	} else if (ref > 0) {
+		insn = &site->callee->ir_base[ref];
+		if (insn->op == IR_PARAM) {
+			return ir_inline_xlat(data, ir_insn_op(&data->old_base[site->call], insn->op3 + 2), 1);
+		}
+		IR_ASSERT(site->_map[ref]);
+		return site->_map[ref];
+	}
+	return IR_UNUSED;
+}
+
+static void ir_inline_resolve_site(ir_inline_ctx *data, ir_inline_site *site)
+{
+	const ir_insn *insn;
+
+	if (!site->resolved) {
+		site->resolved = 1;
+		if (site->rets_count == 1) {
+			insn = &site->callee->ir_base[site->ret];
+			site->exit = ir_inline_callee_ref(data, site, insn->op1, IR_RETURN);
+			site->val = ir_inline_callee_ref(data, site, insn->op2, IR_RETURN);
+		} else {
+			site->exit = site->merge;
+			site->val = site->phi;
+		}
+	}
+}
+
+/* Check if all the operands of the instruction "ref" are already emitted.
+ * "ref" is the caller ref if "site" is NULL, or the callee ref otherwise. */
+static bool ir_inline_ready(const ir_inline_ctx *data, const ir_inline_site *site, ir_ref ref, const ir_insn *insn)
+{
+	const ir_ctx *ctx = site ? site->callee : data->ctx;
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref j, n, val;
+
+	n = ir_operands_count(ctx, insn);
+	for (j = 1; j <= n; j++) {
+		val = ir_insn_op(insn, j);
+		if (val > 0 && IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j))) {
+			if (!site) {
+				if (val >= ref) {
+					return 0;
+				}
+			} else if (val != 1 && val >= ref && site->callee->ir_base[val].op != IR_PARAM) {
+				/* START and PARAMs are replaced by the caller refs defined before the CALL */
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static ir_ref ir_inline_opnd(ir_inline_ctx *data, ir_inline_site *site, const ir_insn *insn, ir_ref j)
+{
+	ir_ref val = ir_insn_op(insn, j);
+	uint32_t kind = IR_OPND_KIND(ir_op_flags[insn->op], j);
+
+	if (IR_IS_REF_OPND_KIND(kind)) {
+		if (!site) {
+			return ir_inline_xlat(data, val, kind == IR_OPND_DATA);
+		}
+		return ir_inline_callee_ref(data, site, val, insn->op);
+	} else if (site && (kind == IR_OPND_STR || kind == IR_OPND_PROTO)) {
+		return ir_inline_str(data->ctx, site->callee, val);
+	}
+	return val;
+}
+
+static void ir_inline_fill_insn(ir_inline_ctx *data, ir_inline_site *site, const ir_insn *insn, ir_ref new_ref)
+{
+	ir_ref j, n = ir_operands_count(site ? site->callee : data->ctx, insn);
+
+	for (j = 1; j <= n; j++) {
+		ir_insn_set_op(&data->ctx->ir_base[new_ref], j, ir_inline_opnd(data, site, insn, j));
+	}
+}
+
+static ir_ref ir_inline_emit_insn(ir_inline_ctx *data, ir_inline_site *site, ir_ref ref, const ir_insn *insn)
+{
+	ir_ctx *ctx = data->ctx;
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref new_ref;
+
+	if (!ir_inline_ready(data, site, ref, insn)) {
+		new_ref = ir_emit_N(ctx, insn->opt, IR_OP_HAS_VAR_INPUTS(flags) ? insn->inputs_count : 0);
+		ir_list_push(&data->fixups, site ? (ir_ref)(site - data->sites) + 1 : 0);
+		ir_list_push(&data->fixups, ref);
+	} else if (IR_IS_FOLDABLE_OP(insn->op) && !IR_OP_HAS_VAR_INPUTS(flags)) {
+		new_ref = ir_fold(ctx, insn->opt,
+			ir_inline_opnd(data, site, insn, 1),
+			ir_inline_opnd(data, site, insn, 2),
+			ir_inline_opnd(data, site, insn, 3));
+	} else {
+		new_ref = ir_emit_N(ctx, insn->opt, IR_OP_HAS_VAR_INPUTS(flags) ? insn->inputs_count : 0);
+		ir_inline_fill_insn(data, site, insn, new_ref);
+	}
+	return new_ref;
+}
+
+static void ir_inline_emit_site(ir_inline_ctx *data, ir_inline_site *site, ir_type type)
+{
+	ir_ctx *ctx = data->ctx;
+	const ir_ctx *callee = site->callee;
+	const ir_insn *insn;
+	ir_ref i, n, k;
+
+	site->_map = ir_mem_calloc(callee->insns_count, sizeof(ir_ref));
+	site->_const_map = ir_mem_calloc(callee->consts_count, sizeof(ir_ref));
+
+	for (i = 2; i < callee->insns_count; i += n) {
+		insn = &callee->ir_base[i];
+		n = ir_inline_insn_len(insn);
+		if (insn->op == IR_NOP || insn->op == IR_PARAM) {
+			continue;
+		} else if (insn->op == IR_RETURN) {
+			site->rets_count++;
+			site->ret = i;
+		} else {
+			site->_map[i] = ir_inline_emit_insn(data, site, i, insn);
+			if (ir_alias_class(callee, i)) {
+				ir_set_alias_class(ctx, site->_map[i], ir_alias_class(callee, i));
+			}
+		}
+	}
+
+	if (site->rets_count > 1) {
+		/* RETURN -> END */
+		for (i = 2; i < callee->insns_count; i += n) {
+			insn = &callee->ir_base[i];
+			n = ir_inline_insn_len(insn);
+			if (insn->op == IR_RETURN) {
+				site->_map[i] = ir_emit1(ctx, IR_END, ir_inline_callee_ref(data, site, insn->op1, IR_END));
+			}
+		}
+		site->merge = ir_emit_N(ctx, IR_MERGE, site->rets_count);
+		if (type != IR_VOID) {
+			site->phi = ir_emit_N(ctx, IR_OPT(IR_PHI, type), site->rets_count + 1);
+			ir_set_op(ctx, site->phi, 1, site->merge);
+		}
+		for (i = 2, k = 0; i < callee->insns_count; i += n) {
+			insn = &callee->ir_base[i];
+			n = ir_inline_insn_len(insn);
+			if (insn->op == IR_RETURN) {
+				k++;
+				ir_set_op(ctx, site->merge, k, site->_map[i]);
+				if (site->phi) {
+					ir_set_op(ctx, site->phi, k + 1, ir_inline_callee_ref(data, site, insn->op2, IR_PHI));
+				}
+			}
+		}
+	}
+}
+
+int ir_inline(ir_ctx *ctx, ir_inline_lookup_t lookup, void *data)
+{
+	ir_ref i, n, ref, insns_count = ctx->insns_count;
+	int32_t cost, limit, growth = 0;
+	uint32_t hints, sites_count = 0;
+	const ir_ctx *callee;
+	const ir_insn *insn, *func;
+	uint16_t *old_alias_classes = NULL;
+	ir_inline_ctx inl;
+	ir_inline_site *site;
+
+	IR_ASSERT(!ctx->use_lists);
+
+	/* select the call sites */
+	inl.ctx = ctx;
+	inl.sites = NULL;
+	inl.calls = ir_bitset_malloc(insns_count);
+	for (i = 1; i < insns_count; i += n) {
+		insn = &ctx->ir_base[i];
+		n = ir_inline_insn_len(insn);
+		if (insn->op != IR_CALL || !IR_IS_CONST_REF(insn->op2)) {
+			continue;
+		}
+		func = &ctx->ir_base[insn->op2];
+		if (func->op != IR_FUNC) {
+			continue;
+		}
+		callee = lookup(ctx, insn->op2, data);
+		if (!callee || callee == ctx) {
+			continue;
+		}
+		cost = ir_inline_cost(callee);
+		if (cost < 0) {
+			continue;
+		}
+
+		/* calls of functions without side effects are inlined more aggressively */
+		hints = callee->flags;
+		if (func->proto) {
+			hints |= ((const ir_proto_t *)ir_get_str(ctx, func->proto))->flags;
+		}
+		limit = (hints & (IR_CONST_FUNC|IR_PURE_FUNC)) ? IR_INLINE_MAX_PURE_INSNS : IR_INLINE_MAX_INSNS;
+		if (cost > limit
+		 || growth + cost > IR_INLINE_MAX_GROWTH
+		 || !ir_inline_check_call(ctx, i, callee)) {
+			continue;
+		}
+		growth += cost;
+		if (!inl.sites) {
+			inl.sites = ir_mem_calloc(insns_count, sizeof(ir_inline_site));
+		}
+		inl.sites[sites_count].call = i;
+		inl.sites[sites_count].callee = callee;
+		sites_count++;
+		ir_bitset_incl(inl.calls, i);
+	}
+
+	if (!sites_count) {
+		ir_mem_free(inl.calls);
+		return 1;
+	}
+
+	inl.old_base = ir_mem_malloc(insns_count * sizeof(ir_insn));
+	memcpy(inl.old_base, ctx->ir_base, insns_count * sizeof(ir_insn));
+	inl._xlat = ir_mem_calloc(insns_count, sizeof(ir_ref));
+	ir_list_init(&inl.fixups, 16);
+	if (ctx->alias_classes) {
+		old_alias_classes = ir_mem_malloc(insns_count * sizeof(uint16_t));
+		memcpy(old_alias_classes, ctx->alias_classes, insns_count * sizeof(uint16_t));
+		memset(ctx->alias_classes, 0, insns_count * sizeof(uint16_t));
+	}
+
+	/* re-emit the caller instructions and the clones of the callees */
+	ctx->insns_count = 1;
+	memset(ctx->prev_insn_chain, 0, sizeof(ctx->prev_insn_chain));
+	ctx->fold_cse_limit = IR_UNUSED + 1;
+	site = inl.sites;
+	for (i = 1; i < insns_count; i += n) {
+		insn = &inl.old_base[i];
+		n = ir_inline_insn_len(insn);
+		if (insn->op == IR_NOP) {
+			continue;
+		} else if (ir_bitset_in(inl.calls, i)) {
+			IR_ASSERT(site->call == i);
+			inl._xlat[i] = site - inl.sites;
+			ir_inline_emit_site(&inl, site, insn->type);
+			site++;
+		} else {
+			ref = inl._xlat[i] = ir_inline_emit_insn(&inl, NULL, i, insn);
+			if (old_alias_classes && old_alias_classes[i]) {
+				ir_set_alias_class(ctx, ref, old_alias_classes[i]);
+			}
+		}
+	}
+
+	/* fill in the forward references */
+	for (i = 0; i < (ir_ref)ir_list_len(&inl.fixups); i += 2) {
+		n = ir_list_at(&inl.fixups, i);
+		ref = ir_list_at(&inl.fixups, i + 1);
+		if (!n) {
+			ir_inline_fill_insn(&inl, NULL, &inl.old_base[ref], inl._xlat[ref]);
+		} else {
+			site = &inl.sites[n - 1];
+			ir_inline_fill_insn(&inl, site, &site->callee->ir_base[ref], site->_map[ref]);
+		}
+	}
+
+	for (i = 0; i < (ir_ref)sites_count; i++) {
+		ir_mem_free(inl.sites[i]._const_map);
+		ir_mem_free(inl.sites[i]._map);
+	}
+	if (old_alias_classes) {
+		ir_mem_free(old_alias_classes);
+	}
+	ir_list_free(&inl.fixups);
+	ir_mem_free(inl._xlat);
+	ir_mem_free(inl.old_base);
+	ir_mem_free(inl.sites);
+	ir_mem_free(inl.calls);
+
+	return 1;
+}
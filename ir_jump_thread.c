@@ -0,0 +1,1041 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Jump Threading)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* ir_try_split_if() and ir_try_split_if_cmp() (see ir_sccp.c) thread an IF
+ * only through the immediately preceding MERGE, when the IF condition is a
+ * PHI (or a comparison of a PHI with a constant) of this MERGE. This pass
+ * looks for IFs, whose outcome is known along an incoming path that starts
+ * a few blocks back:
+ *
+ *    P -> B1 -> ... -> Bk
+ *
+ * B1 is a MERGE, Bk ends with IF and P is one of the B1 predecessors.
+ * The outcome is known if the condition, evaluated with PHIs replaced by
+ * the inputs coming along the path, folds into a constant, or if the same
+ * condition is already checked on the path (by IF or GUARD in B1 ... Bk,
+ * or by a predicate dominating P).
+ *
+ * Blocks B1 ... Bk are duplicated for the edge P -> B1 and the copy of Bk
+ * jumps directly to the known IF successor. The other exits of the copies
+ * are merged with the corresponding exits of the original blocks. The uses
+ * of the values defined in B1 ... Bk are updated to the values reaching
+ * them, creating new PHIs on demand (SSA update).
+ *
+ * IFs, whose outcome is known in all the paths (because of a dominating
+ * predicate), are removed in place.
+ */
+
+#define IR_JUMP_THREAD_MAX_BLOCKS   4      /* max number of duplicated blocks on a single path */
+#define IR_JUMP_THREAD_MAX_INSNS    32     /* max number of duplicated nodes on a single path */
+#define IR_JUMP_THREAD_MAX_PREDS    16     /* max number of checked predecessors of a single MERGE */
+#define IR_JUMP_THREAD_MAX_DEPTH    4      /* max depth of the condition evaluation */
+#define IR_JUMP_THREAD_DOM_BUDGET   64     /* max number of nodes checked for dominating predicates */
+#define IR_JUMP_THREAD_MIN_GROWTH   256    /* number of nodes that may be added to small functions */
+
+typedef struct _ir_jump_thread_ctx {
+	ir_ref     size;            /* ctx->insns_count before the transformation */
+	ir_ref     *idx;            /* node -> index in "nodes" + 1 */
+	uint32_t   *early;          /* node -> block (control nodes) or earliest block (data nodes) */
+	uint32_t   *path_idx;       /* block -> index in "path" + 1 */
+	uint32_t   path[IR_JUMP_THREAD_MAX_BLOCKS];
+	uint32_t   path_len;
+	uint32_t   pred;            /* predecessor of path[0] (0 - for an IF removed in place) */
+	uint32_t   count;           /* number of duplicated nodes */
+	ir_list    nodes;           /* values defined in the path blocks */
+	ir_list    def;             /* [k] - index of the block of "nodes[k]" in "path" */
+	ir_list    uses;            /* uses of the values (user, operand, value, control node of the user block) */
+	ir_ref     *copies;         /* [k] - copy of "nodes[k]" */
+	ir_ref     orig_ends[IR_JUMP_THREAD_MAX_BLOCKS];
+	ir_ref     copy_ends[IR_JUMP_THREAD_MAX_BLOCKS];
+	ir_ref     **memo;          /* [k][b] - value of "nodes[k]" at the end of block "b" */
+	ir_list    phis;            /* created PHIs */
+	ir_list    pending;         /* created PHIs without inputs (PHI, k) */
+} ir_jump_thread_ctx;
+
+static bool ir_jump_thread_is_chain_op(ir_op op)
+{
+	switch (op) {
+		case IR_LOAD:
+		case IR_STORE:
+		case IR_VLOAD:
+		case IR_VSTORE:
+		case IR_RLOAD:
+		case IR_RSTORE:
+		case IR_TLS:
+		case IR_CALL:
+		case IR_GUARD:
+		case IR_GUARD_NOT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Pure data node with fixed inputs (it may be cloned) */
+static bool ir_jump_thread_is_pure(const ir_ctx *ctx, ir_ref ref)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref j, n;
+
+	if (!(flags & IR_OP_FLAG_DATA)
+	 || (flags & IR_OP_FLAG_PINNED)
+	 || IR_OP_HAS_VAR_INPUTS(flags)) {
+		return 0;
+	}
+	n = IR_INPUT_EDGES_COUNT(flags);
+	for (j = 1; j <= n; j++) {
+		if (IR_OPND_KIND(flags, j) != IR_OPND_DATA && ir_insn_op(insn, j)) {
+			return 0; /* control dependent node (e.g. PI) */
+		}
+	}
+	return 1;
+}
+
+static uint32_t ir_jump_thread_early(const ir_ctx *ctx, uint32_t *early, ir_ref ref)
+{
+	const ir_insn *insn;
+	const ir_ref *p;
+	ir_ref n, input;
+	uint32_t b, result, dom_depth;
+
+	if (early[ref]) {
+		return early[ref];
+	}
+	insn = &ctx->ir_base[ref];
+	if (ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) {
+		return 0; /* unreachable control node */
+	} else if (insn->op == IR_PHI) {
+		result = early[insn->op1];
+	} else {
+		result = 1;
+		dom_depth = 0;
+		n = insn->inputs_count;
+		for (p = insn->ops + 1; n > 0; p++, n--) {
+			input = *p;
+			if (input > 0) {
+				b = ir_jump_thread_early(ctx, early, input);
+				if (b && dom_depth < ctx->cfg_blocks[b].dom_depth) {
+					dom_depth = ctx->cfg_blocks[b].dom_depth;
+					result = b;
+				}
+			}
+		}
+	}
+	early[ref] = result;
+	return result;
+}
+
+/* Index of the MERGE input coming from block "pred" */
+static ir_ref ir_jump_thread_input(const ir_ctx *ctx, const ir_jump_thread_ctx *data, ir_ref merge, uint32_t pred)
+{
+	const ir_insn *insn = &ctx->ir_base[merge];
+	ir_ref j, n = insn->inputs_count;
+
+	for (j = 1; j <= n; j++) {
+		if (data->early[ir_insn_op(insn, j)] == pred) {
+			return j;
+		}
+	}
+	IR_ASSERT(0);
+	return 0;
+}
+
+static ir_ref ir_jump_thread_eval(ir_ctx *ctx, ir_jump_thread_ctx *data, ir_ref ref, int depth)
+{
+	ir_insn *insn;
+	uint32_t flags, i, opt;
+	ir_ref j, n, ops[4];
+	bool changed = 0, consts = 1;
+
+	while (ref > 0 && ctx->ir_base[ref].op == IR_COPY) {
+		/* left after removing of MERGE inputs */
+		ref = ctx->ir_base[ref].op1;
+	}
+	if (ref <= 0) {
+		return ref;
+	}
+	insn = &ctx->ir_base[ref];
+	flags = ir_op_flags[insn->op];
+	if (flags & IR_OP_FLAG_CONTROL) {
+		return ref;
+	}
+	i = data->path_idx[ir_jump_thread_early(ctx, data->early, ref)];
+	if (insn->op == IR_PHI) {
+		if (!i || (i == 1 && !data->pred)) {
+			return ref;
+		}
+		i--;
+		j = ir_jump_thread_input(ctx, data, insn->op1, i ? data->path[i - 1] : data->pred);
+		return ir_jump_thread_eval(ctx, data, ir_insn_op(insn, j + 1), depth);
+	} else if (depth <= 0 || !ir_jump_thread_is_pure(ctx, ref)) {
+		return ref;
+	}
+
+	n = IR_INPUT_EDGES_COUNT(flags);
+	ops[1] = insn->op1;
+	ops[2] = insn->op2;
+	ops[3] = insn->op3;
+	for (j = 1; j <= n; j++) {
+		if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			if (i) {
+				/* the node is computed on the path */
+				ops[j] = ir_jump_thread_eval(ctx, data, ops[j], depth - 1);
+				if (!ops[j]) {
+					return IR_UNUSED;
+				} else if (ops[j] != ir_insn_op(insn, j)) {
+					changed = 1;
+				}
+			}
+			if (!IR_IS_CONST_REF(ops[j]) || IR_IS_SYM_CONST(ctx->ir_base[ops[j]].op)) {
+				consts = 0;
+			}
+		}
+	}
+	if (!changed && !consts) {
+		return ref;
+	}
+
+	opt = insn->opt;
+restart:
+	switch (ir_folding(ctx, opt, ops[1], ops[2], ops[3], ctx->ir_base + ops[1], ctx->ir_base + ops[2], ctx->ir_base + ops[3])) {
+		case IR_FOLD_DO_RESTART:
+			opt = ctx->fold_insn.optx;
+			ops[1] = ctx->fold_insn.op1;
+			ops[2] = ctx->fold_insn.op2;
+			ops[3] = ctx->fold_insn.op3;
+			goto restart;
+		case IR_FOLD_DO_COPY:
+			return ctx->fold_insn.op1;
+		case IR_FOLD_DO_CONST:
+			return ir_const(ctx, ctx->fold_insn.val, ctx->fold_insn.type);
+		default:
+			/* the value can't be represented by an existing node */
+			return changed ? IR_UNUSED : ref;
+	}
+}
+
+/* Check GUARDs of the block and the IF that leads to it */
+static int ir_jump_thread_block_predicate(ir_ctx *ctx, ir_jump_thread_ctx *data, uint32_t b, ir_ref cond, bool eval, int *budget)
+{
+	ir_block *bb = &ctx->cfg_blocks[b];
+	ir_ref ref = bb->end;
+	ir_insn *insn;
+
+	if (ctx->ir_base[ref].op == IR_IF) {
+		ref = ctx->ir_base[ref].op1;
+	}
+	while (1) {
+		insn = &ctx->ir_base[ref];
+		if (--(*budget) < 0) {
+			return -1;
+		}
+		if (insn->op == IR_GUARD || insn->op == IR_GUARD_NOT) {
+			if (insn->op2 == cond
+			 || (eval && ir_jump_thread_eval(ctx, data, insn->op2, IR_JUMP_THREAD_MAX_DEPTH) == cond)) {
+				return insn->op == IR_GUARD;
+			}
+		} else if (insn->op == IR_IF_TRUE || insn->op == IR_IF_FALSE) {
+			IR_ASSERT(ref == bb->start);
+			if (ctx->ir_base[insn->op1].op2 == cond
+			 || (eval && ir_jump_thread_eval(ctx, data, ctx->ir_base[insn->op1].op2, IR_JUMP_THREAD_MAX_DEPTH) == cond)) {
+				return insn->op == IR_IF_TRUE;
+			}
+		}
+		if (ref == bb->start) {
+			break;
+		}
+		ref = insn->op1;
+	}
+	return -1;
+}
+
+/* Returns the outcome of the IF condition along the path (1 - true, 0 - false, -1 - unknown) */
+static int ir_jump_thread_outcome(ir_ctx *ctx, ir_jump_thread_ctx *data, ir_ref cond)
+{
+	int ret, budget = IR_JUMP_THREAD_DOM_BUDGET;
+	uint32_t i, b;
+
+	cond = ir_jump_thread_eval(ctx, data, cond, IR_JUMP_THREAD_MAX_DEPTH);
+	if (!cond) {
+		return -1;
+	} else if (IR_IS_CONST_REF(cond)) {
+		return IR_IS_SYM_CONST(ctx->ir_base[cond].op) ? -1 : ir_const_is_true(&ctx->ir_base[cond]);
+	}
+
+	/* predicates on the path */
+	for (i = 0; i < data->path_len; i++) {
+		ret = ir_jump_thread_block_predicate(ctx, data, data->path[i], cond, 1, &budget);
+		if (ret >= 0) {
+			return ret;
+		}
+	}
+
+	/* dominating predicates */
+	b = data->pred ? data->pred : ctx->cfg_blocks[data->path[0]].dom_parent;
+	while (b && budget > 0) {
+		ret = ir_jump_thread_block_predicate(ctx, data, b, cond, 0, &budget);
+		if (ret >= 0) {
+			return ret;
+		}
+		b = ctx->cfg_blocks[b].dom_parent;
+	}
+	return -1;
+}
+
+static void ir_jump_thread_add_node(ir_jump_thread_ctx *data, ir_ref ref, uint32_t i)
+{
+	ir_list_push(&data->nodes, ref);
+	ir_list_push(&data->def, i);
+	data->idx[ref] = ir_list_len(&data->nodes);
+}
+
+static void ir_jump_thread_add_use(ir_jump_thread_ctx *data, ir_ref use, ir_ref j, ir_ref val, ir_ref pos)
+{
+	ir_list_push(&data->uses, use);
+	ir_list_push(&data->uses, j);
+	ir_list_push(&data->uses, val);
+	ir_list_push(&data->uses, pos);
+}
+
+/* Block of a control node (cfg_map keeps only the starts and the ends of the blocks) */
+static uint32_t ir_jump_thread_block(const ir_ctx *ctx, ir_ref ref)
+{
+	while (ref > 0 && !ctx->cfg_map[ref]) {
+		ref = ctx->ir_base[ref].op1;
+	}
+	return ref > 0 ? ctx->cfg_map[ref] : 0;
+}
+
+static void ir_jump_thread_reset(ir_jump_thread_ctx *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < ir_list_len(&data->nodes); i++) {
+		data->idx[ir_list_at(&data->nodes, i)] = 0;
+	}
+	ir_list_clear(&data->nodes);
+	ir_list_clear(&data->def);
+	ir_list_clear(&data->uses);
+}
+
+/* Collect the values defined in the path blocks and their uses */
+static bool ir_jump_thread_collect(ir_ctx *ctx, ir_jump_thread_ctx *data)
+{
+	uint32_t i, k, b, e;
+	ir_ref ref, use, pos, j, n, *p;
+	ir_block *bb;
+	ir_insn *insn;
+
+	for (i = 0; i < data->path_len; i++) {
+		bb = &ctx->cfg_blocks[data->path[i]];
+		n = ctx->use_lists[bb->start].count;
+		for (p = &ctx->use_edges[ctx->use_lists[bb->start].refs]; n > 0; p++, n--) {
+			if (ctx->ir_base[*p].op == IR_PHI) {
+				ir_jump_thread_add_node(data, *p, i);
+			}
+		}
+		for (ref = ir_next_control(ctx, bb->start); ref != bb->end; ref = ir_next_control(ctx, ref)) {
+			ir_jump_thread_add_node(data, ref, i);
+		}
+	}
+
+	for (k = 0; k < ir_list_len(&data->nodes); k++) {
+		ref = ir_list_at(&data->nodes, k);
+		b = data->path[ir_list_at(&data->def, k)];
+		n = ctx->use_lists[ref].count;
+		for (p = &ctx->use_edges[ctx->use_lists[ref].refs]; n > 0; p++, n--) {
+			use = *p;
+			insn = &ctx->ir_base[use];
+			if (insn->op == IR_PHI) {
+				/* the value is used at the end of the MERGE predecessor */
+				const ir_insn *merge = &ctx->ir_base[insn->op1];
+
+				for (j = 2; j <= insn->inputs_count; j++) {
+					if (ir_insn_op(insn, j) == ref && data->early[ir_insn_op(merge, j - 1)]) {
+						ir_jump_thread_add_use(data, use, j, ref, ir_insn_op(merge, j - 1));
+					}
+				}
+				continue;
+			} else if (ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) {
+				e = data->early[use];
+				if (!e || e == b) {
+					continue;
+				}
+				pos = use;
+			} else if (!ir_jump_thread_is_pure(ctx, use)) {
+				return 0;
+			} else {
+				e = ir_jump_thread_early(ctx, data->early, use);
+				if (!data->idx[use] && data->path_idx[e]) {
+					/* the data node is computed on the path */
+					if (++data->count > IR_JUMP_THREAD_MAX_INSNS) {
+						return 0;
+					}
+					ir_jump_thread_add_node(data, use, data->path_idx[e] - 1);
+				}
+				if (e == b) {
+					continue;
+				}
+				pos = ctx->cfg_blocks[e].end;
+			}
+			for (j = 1; j <= insn->inputs_count; j++) {
+				if (ir_insn_op(insn, j) == ref) {
+					ir_jump_thread_add_use(data, use, j, ref, pos);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/* Block, that may be duplicated */
+static bool ir_jump_thread_check_block(ir_ctx *ctx, ir_jump_thread_ctx *data, uint32_t b)
+{
+	ir_block *bb = &ctx->cfg_blocks[b];
+	ir_insn *insn;
+	ir_ref ref, n, *p;
+
+	if (bb->flags & (IR_BB_START|IR_BB_ENTRY|IR_BB_LOOP_HEADER|IR_BB_UNREACHABLE)) {
+		return 0;
+	}
+	insn = &ctx->ir_base[bb->start];
+	if (insn->op != IR_BEGIN && insn->op != IR_MERGE && insn->op != IR_IF_TRUE && insn->op != IR_IF_FALSE) {
+		return 0;
+	}
+	insn = &ctx->ir_base[bb->end];
+	if (insn->op != IR_END && insn->op != IR_IF) {
+		return 0;
+	}
+
+	/* only PHIs may depend on the block start */
+	n = ctx->use_lists[bb->start].count;
+	for (p = &ctx->use_edges[ctx->use_lists[bb->start].refs]; n > 0; p++, n--) {
+		insn = &ctx->ir_base[*p];
+		if (!(ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) && insn->op != IR_PHI) {
+			return 0;
+		}
+	}
+
+	for (ref = ir_next_control(ctx, bb->start); ref != bb->end; ref = ir_next_control(ctx, ref)) {
+		if (!ir_jump_thread_is_chain_op(ctx->ir_base[ref].op)
+		 || ++data->count > IR_JUMP_THREAD_MAX_INSNS) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Try to find a predecessor of path[0], that determines the IF outcome */
+static int ir_jump_thread_find_pred(ir_ctx *ctx, ir_jump_thread_ctx *data, ir_ref cond)
+{
+	ir_block *bb = &ctx->cfg_blocks[data->path[0]];
+	uint32_t n, *p, pred, count = data->count;
+	int ret;
+
+	if (ctx->ir_base[bb->start].op != IR_MERGE || bb->predecessors_count > IR_JUMP_THREAD_MAX_PREDS) {
+		return -1;
+	}
+	for (n = bb->predecessors_count, p = &ctx->cfg_edges[bb->predecessors]; n > 0; p++, n--) {
+		pred = *p;
+		if (data->path_idx[pred]
+		 || ctx->ir_base[ctx->cfg_blocks[pred].end].op != IR_END
+		 || (ctx->cfg_blocks[pred].flags & IR_BB_UNREACHABLE)) {
+			continue;
+		}
+		data->pred = pred;
+		ret = ir_jump_thread_outcome(ctx, data, cond);
+		if (ret >= 0) {
+			data->count = count;
+			if (ir_jump_thread_collect(ctx, data)) {
+				return ret;
+			}
+			ir_jump_thread_reset(data);
+		}
+	}
+	data->pred = 0;
+	return -1;
+}
+
+/* Extend the path backward, "pos" is the index of the first block already in the path */
+static int ir_jump_thread_find_path(ir_ctx *ctx, ir_jump_thread_ctx *data, uint32_t pos, ir_ref cond)
+{
+	ir_block *bb = &ctx->cfg_blocks[data->path[pos]];
+	uint32_t n, *p, b, i, count = data->count;
+	int ret;
+
+	if (pos == 0) {
+		for (i = 0; i < data->path_len; i++) {
+			data->path_idx[data->path[i]] = i + 1;
+		}
+		ret = ir_jump_thread_find_pred(ctx, data, cond);
+		for (i = 0; i < data->path_len; i++) {
+			data->path_idx[data->path[i]] = 0;
+		}
+		return ret;
+	}
+
+	if (bb->predecessors_count > IR_JUMP_THREAD_MAX_PREDS) {
+		return -1;
+	}
+	for (n = bb->predecessors_count, p = &ctx->cfg_edges[bb->predecessors]; n > 0; p++, n--) {
+		b = *p;
+		for (i = pos; i < data->path_len; i++) {
+			if (data->path[i] == b) {
+				break;
+			}
+		}
+		if (i < data->path_len) {
+			continue;
+		}
+		data->count = count;
+		if (ir_jump_thread_check_block(ctx, data, b)) {
+			data->path[pos - 1] = b;
+			ret = ir_jump_thread_find_path(ctx, data, pos - 1, cond);
+			if (ret >= 0) {
+				return ret;
+			}
+		}
+	}
+	data->count = count;
+	return -1;
+}
+
+static void ir_jump_thread_get_true_false_refs(const ir_ctx *ctx, ir_ref if_ref, ir_ref *if_true_ref, ir_ref *if_false_ref)
+{
+	ir_use_list *use_list = &ctx->use_lists[if_ref];
+	ir_ref *p = &ctx->use_edges[use_list->refs];
+
+	IR_ASSERT(use_list->count == 2);
+	if (ctx->ir_base[*p].op == IR_IF_TRUE) {
+		*if_true_ref = *p;
+		*if_false_ref = *(p + 1);
+	} else {
+		*if_false_ref = *p;
+		*if_true_ref = *(p + 1);
+	}
+}
+
+/* Replace IF with known outcome by END (see ir_iter_optimize_if() in ir_sccp.c) */
+static void ir_jump_thread_remove_if(ir_ctx *ctx, ir_ref ref, bool val)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref if_true_ref, if_false_ref;
+	ir_insn *if_true, *if_false;
+
+	ir_jump_thread_get_true_false_refs(ctx, ref, &if_true_ref, &if_false_ref);
+
+	insn->optx = IR_OPTX(IR_END, IR_VOID, 1);
+	if (insn->op2 > 0) {
+		ir_use_list_remove_one(ctx, insn->op2, ref);
+	}
+	insn->op2 = IR_UNUSED;
+
+	if_true = &ctx->ir_base[if_true_ref];
+	if_false = &ctx->ir_base[if_false_ref];
+	if_true->op = IR_BEGIN;
+	if_false->op = IR_BEGIN;
+	if (val) {
+		if_false->op1 = IR_UNUSED;
+		ir_use_list_remove_one(ctx, ref, if_false_ref);
+	} else {
+		if_true->op1 = IR_UNUSED;
+		ir_use_list_remove_one(ctx, ref, if_true_ref);
+	}
+	ctx->flags2 &= ~IR_CFG_REACHABLE;
+}
+
+/* Emit a data node through the folding engine */
+static ir_ref ir_jump_thread_fold(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3)
+{
+	ir_ref ref;
+
+restart:
+	switch (ir_folding(ctx, opt, op1, op2, op3, ctx->ir_base + op1, ctx->ir_base + op2, ctx->ir_base + op3)) {
+		case IR_FOLD_DO_RESTART:
+			opt = ctx->fold_insn.optx;
+			op1 = ctx->fold_insn.op1;
+			op2 = ctx->fold_insn.op2;
+			op3 = ctx->fold_insn.op3;
+			goto restart;
+		case IR_FOLD_DO_CSE:
+		case IR_FOLD_DO_EMIT:
+			opt = ctx->fold_insn.opt;
+			ref = ir_emit(ctx, opt, ctx->fold_insn.op1, ctx->fold_insn.op2, ctx->fold_insn.op3);
+			ctx->ir_base[ref].inputs_count = IR_INPUT_EDGES_COUNT(ir_op_flags[opt & IR_OPT_OP_MASK]);
+			if (ctx->fold_insn.op1 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op1, ref);
+			}
+			if (ctx->fold_insn.op2 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op2, ref);
+			}
+			if (ctx->fold_insn.op3 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op3, ref);
+			}
+			return ref;
+		case IR_FOLD_DO_COPY:
+			return ctx->fold_insn.op1;
+		case IR_FOLD_DO_CONST:
+			return ir_const(ctx, ctx->fold_insn.val, ctx->fold_insn.type);
+		default:
+			IR_ASSERT(0);
+			return IR_UNUSED;
+	}
+}
+
+/* Copy of the value in the duplicated blocks */
+static ir_ref ir_jump_thread_map(ir_ctx *ctx, ir_jump_thread_ctx *data, ir_ref ref)
+{
+	uint32_t k, flags;
+	ir_ref j, ops[4];
+	ir_insn *insn;
+
+	if (ref <= 0 || ref >= data->size || !data->idx[ref]) {
+		return ref;
+	}
+	k = data->idx[ref] - 1;
+	if (!data->copies[k]) {
+		insn = &ctx->ir_base[ref];
+		flags = ir_op_flags[insn->op];
+		IR_ASSERT(ir_jump_thread_is_pure(ctx, ref));
+		ops[1] = insn->op1;
+		ops[2] = insn->op2;
+		ops[3] = insn->op3;
+		for (j = 1; j <= 3; j++) {
+			if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+				ops[j] = ir_jump_thread_map(ctx, data, ops[j]);
+			}
+		}
+		data->copies[k] = ir_jump_thread_fold(ctx, ctx->ir_base[ref].opt, ops[1], ops[2], ops[3]);
+	}
+	return data->copies[k];
+}
+
+/* Copy a control node with mapped data operands */
+static ir_ref ir_jump_thread_clone(ir_ctx *ctx, ir_jump_thread_ctx *data, ir_ref ref, ir_ref control)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref j, n = insn->inputs_count;
+	ir_ref new_ref, input;
+
+	new_ref = ir_emit_N(ctx, insn->opt, n);
+	insn = &ctx->ir_base[ref];
+	memcpy(ctx->ir_base[new_ref].ops + 1, insn->ops + 1, sizeof(ir_ref) * IR_MAX(n, 3));
+	for (j = 1; j <= n; j++) {
+		input = ir_insn_op(&ctx->ir_base[new_ref], j);
+		if (j == 1) {
+			input = control;
+		} else if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			input = ir_jump_thread_map(ctx, data, input);
+		}
+		ir_insn_set_op(&ctx->ir_base[new_ref], j, input);
+		if (input > 0) {
+			ir_use_list_add(ctx, input, new_ref);
+		}
+	}
+	return new_ref;
+}
+
+/* Add a new predecessor (END) to the block started by IF_TRUE/IF_FALSE */
+static void ir_jump_thread_join(ir_ctx *ctx, ir_ref start, ir_ref end)
+{
+	ir_ref merge = ir_emit_N(ctx, IR_MERGE, 2);
+	ir_ref end1;
+
+	ir_replace(ctx, start, merge);
+	CLEAR_USES(start);
+	end1 = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), start);
+	ir_use_list_add(ctx, start, end1);
+	ir_set_op(ctx, merge, 1, end1);
+	ir_set_op(ctx, merge, 2, end);
+	ir_use_list_add(ctx, end1, merge);
+	ir_use_list_add(ctx, end, merge);
+}
+
+/* Value of "nodes[k]" at the end of block "b" */
+static ir_ref ir_jump_thread_value_at(ir_ctx *ctx, ir_jump_thread_ctx *data, uint32_t k, uint32_t b)
+{
+	ir_ref *memo = data->memo[k];
+	ir_ref val, ref = ir_list_at(&data->nodes, k);
+	uint32_t i = ir_list_at(&data->def, k);
+	uint32_t def_block = ctx->cfg_map[data->orig_ends[i]];
+	uint32_t copy_block = ctx->cfg_map[data->copy_ends[i]];
+	ir_block *bb;
+	uint32_t b0 = b;
+
+	if (!memo) {
+		memo = data->memo[k] = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_ref));
+	}
+	while (1) {
+		if (memo[b]) {
+			val = memo[b];
+			break;
+		} else if (b == def_block) {
+			val = ref;
+			break;
+		} else if (b == copy_block) {
+			val = ir_jump_thread_map(ctx, data, ref);
+			break;
+		}
+		bb = &ctx->cfg_blocks[b];
+		if (bb->predecessors_count == 0) {
+			/* the value is not available */
+			ir_val c;
+
+			c.i64 = 0;
+			val = ir_const(ctx, c, ctx->ir_base[ref].type);
+			break;
+		} else if (bb->predecessors_count > 1) {
+			val = ir_emit_N(ctx, IR_OPT(IR_PHI, ctx->ir_base[ref].type),
+				ctx->ir_base[bb->start].inputs_count + 1);
+			ir_set_op(ctx, val, 1, bb->start);
+			ir_use_list_add(ctx, bb->start, val);
+			ir_list_push(&data->phis, val);
+			ir_list_push(&data->pending, val);
+			ir_list_push(&data->pending, k);
+			break;
+		}
+		b = ctx->cfg_edges[bb->predecessors];
+	}
+
+	/* remember the value for all the blocks of the path */
+	while (1) {
+		memo[b0] = val;
+		if (b0 == b) {
+			break;
+		}
+		b0 = ctx->cfg_edges[ctx->cfg_blocks[b0].predecessors];
+	}
+	return val;
+}
+
+static void ir_jump_thread_fill_phis(ir_ctx *ctx, ir_jump_thread_ctx *data)
+{
+	ir_ref phi, merge, j, n, val;
+	uint32_t k;
+
+	while (ir_list_len(&data->pending)) {
+		k = ir_list_pop(&data->pending);
+		phi = ir_list_pop(&data->pending);
+		merge = ctx->ir_base[phi].op1;
+		n = ctx->ir_base[merge].inputs_count;
+		for (j = 1; j <= n; j++) {
+			val = ir_jump_thread_value_at(ctx, data, k, ctx->cfg_map[ir_insn_op(&ctx->ir_base[merge], j)]);
+			ir_set_op(ctx, phi, j + 1, val);
+			if (val > 0) {
+				ir_use_list_add(ctx, val, phi);
+			}
+		}
+	}
+}
+
+/* Remove the PHIs with the same inputs */
+static void ir_jump_thread_remove_redundant_phis(ir_ctx *ctx, ir_jump_thread_ctx *data)
+{
+	ir_ref phi, same, val, j, n;
+	uint32_t i;
+	bool changed;
+
+	do {
+		changed = 0;
+		for (i = 0; i < ir_list_len(&data->phis); i++) {
+			phi = ir_list_at(&data->phis, i);
+			if (ctx->ir_base[phi].op != IR_PHI) {
+				continue;
+			}
+			n = ctx->ir_base[phi].inputs_count;
+			same = IR_UNUSED;
+			for (j = 2; j <= n; j++) {
+				val = ir_insn_op(&ctx->ir_base[phi], j);
+				if (val == phi || val == same) {
+					continue;
+				} else if (same) {
+					break;
+				}
+				same = val;
+			}
+			if (j <= n || !same) {
+				continue;
+			}
+			ir_use_list_remove_all(ctx, phi, phi);
+			ir_replace(ctx, phi, same);
+			CLEAR_USES(phi);
+			ir_use_list_remove_one(ctx, ctx->ir_base[phi].op1, phi);
+			if (same > 0) {
+				ir_use_list_remove_all(ctx, same, phi);
+			}
+			MAKE_NOP(&ctx->ir_base[phi]);
+			ctx->ir_base[phi].inputs_count = n;
+			for (j = 4; j <= n; j++) {
+				ir_insn_set_op(&ctx->ir_base[phi], j, IR_UNUSED);
+			}
+			changed = 1;
+		}
+	} while (changed);
+}
+
+static bool ir_jump_thread_path(ir_ctx *ctx, ir_jump_thread_ctx *data, bool val)
+{
+	uint32_t i, k;
+	ir_ref j, n, ref, end, control, merge, next, if_true_ref, if_false_ref, *p;
+	ir_block *bb;
+	ir_insn *insn;
+
+	data->copies = ir_mem_calloc(ir_list_len(&data->nodes), sizeof(ir_ref));
+	for (i = 0; i < data->path_len; i++) {
+		data->orig_ends[i] = ctx->cfg_blocks[data->path[i]].end;
+	}
+
+	/* disconnect the first block from the predecessor */
+	end = ctx->cfg_blocks[data->pred].end;
+	merge = ctx->cfg_blocks[data->path[0]].start;
+	j = ir_insn_find_op(&ctx->ir_base[merge], end);
+	for (k = 0; k < ir_list_len(&data->nodes); k++) {
+		ref = ir_list_at(&data->nodes, k);
+		if (ctx->ir_base[ref].op == IR_PHI && ctx->ir_base[ref].op1 == merge) {
+			data->copies[k] = ir_insn_op(&ctx->ir_base[ref], j + 1);
+		}
+	}
+	ir_remove_merge_input(ctx, merge, end);
+	control = ir_emit1(ctx, IR_OPTX(IR_BEGIN, IR_VOID, 1), end);
+	ir_use_list_add(ctx, end, control);
+
+	/* duplicate the blocks */
+	for (i = 0; i < data->path_len; i++) {
+		bb = &ctx->cfg_blocks[data->path[i]];
+		if (i > 0 && ctx->ir_base[bb->start].op == IR_MERGE) {
+			j = ir_jump_thread_input(ctx, data, bb->start, data->path[i - 1]);
+			n = ctx->use_lists[bb->start].count;
+			for (p = &ctx->use_edges[ctx->use_lists[bb->start].refs]; n > 0; p++, n--) {
+				if (ctx->ir_base[*p].op == IR_PHI) {
+					data->copies[data->idx[*p] - 1] =
+						ir_jump_thread_map(ctx, data, ir_insn_op(&ctx->ir_base[*p], j + 1));
+				}
+			}
+		}
+		for (ref = ir_next_control(ctx, bb->start); ref != bb->end; ref = ir_next_control(ctx, ref)) {
+			control = ir_jump_thread_clone(ctx, data, ref, control);
+			data->copies[data->idx[ref] - 1] = control;
+		}
+
+		insn = &ctx->ir_base[bb->end];
+		if (i == data->path_len - 1) {
+			/* jump to the known IF successor */
+			IR_ASSERT(insn->op == IR_IF);
+			end = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), control);
+			ir_use_list_add(ctx, control, end);
+			data->copy_ends[i] = end;
+			ir_jump_thread_get_true_false_refs(ctx, bb->end, &if_true_ref, &if_false_ref);
+			ir_jump_thread_join(ctx, val ? if_true_ref : if_false_ref, end);
+		} else if (insn->op == IR_END) {
+			end = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), control);
+			ir_use_list_add(ctx, control, end);
+			data->copy_ends[i] = end;
+			control = ir_emit1(ctx, IR_OPTX(IR_BEGIN, IR_VOID, 1), end);
+			ir_use_list_add(ctx, end, control);
+		} else {
+			/* the other IF successor is merged with the original one */
+			IR_ASSERT(insn->op == IR_IF);
+			end = ir_jump_thread_clone(ctx, data, bb->end, control);
+			data->copy_ends[i] = end;
+			ir_jump_thread_get_true_false_refs(ctx, bb->end, &if_true_ref, &if_false_ref);
+			if (ctx->cfg_blocks[data->path[i + 1]].start == if_true_ref) {
+				control = ir_emit1(ctx, IR_OPTX(IR_IF_TRUE, IR_VOID, 1), end);
+				ref = ir_emit1(ctx, IR_OPTX(IR_IF_FALSE, IR_VOID, 1), end);
+				next = if_false_ref;
+			} else {
+				control = ir_emit1(ctx, IR_OPTX(IR_IF_FALSE, IR_VOID, 1), end);
+				ref = ir_emit1(ctx, IR_OPTX(IR_IF_TRUE, IR_VOID, 1), end);
+				next = if_true_ref;
+			}
+			ir_use_list_add(ctx, end, control);
+			ir_use_list_add(ctx, end, ref);
+			end = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), ref);
+			ir_use_list_add(ctx, ref, end);
+			ir_jump_thread_join(ctx, next, end);
+		}
+	}
+
+	ir_reset_cfg(ctx);
+	if (!ir_build_cfg(ctx)) {
+		return 0;
+	}
+
+	/* SSA update for the uses of the duplicated values */
+	data->memo = ir_mem_calloc(ir_list_len(&data->nodes), sizeof(ir_ref*));
+	ir_list_clear(&data->phis);
+	ir_list_clear(&data->pending);
+	for (j = 0; j < (ir_ref)ir_list_len(&data->uses); j += 4) {
+		ir_ref use = ir_list_at(&data->uses, j);
+		ir_ref op_num = ir_list_at(&data->uses, j + 1);
+		ir_ref old_val = ir_list_at(&data->uses, j + 2);
+		uint32_t b = ir_jump_thread_block(ctx, ir_list_at(&data->uses, j + 3));
+		ir_ref new_val;
+
+		if (b && ir_insn_op(&ctx->ir_base[use], op_num) == old_val) {
+			new_val = ir_jump_thread_value_at(ctx, data, data->idx[old_val] - 1, b);
+			if (new_val != old_val) {
+				ir_insn_set_op(&ctx->ir_base[use], op_num, new_val);
+				ir_use_list_remove_one(ctx, old_val, use);
+				if (new_val > 0) {
+					ir_use_list_add(ctx, new_val, use);
+				}
+			}
+			ir_jump_thread_fill_phis(ctx, data);
+		}
+	}
+	ir_jump_thread_remove_redundant_phis(ctx, data);
+
+	for (k = 0; k < ir_list_len(&data->nodes); k++) {
+		if (data->memo[k]) {
+			ir_mem_free(data->memo[k]);
+		}
+	}
+	ir_mem_free(data->memo);
+	ir_mem_free(data->copies);
+
+	return ir_build_dominators_tree(ctx);
+}
+
+/* PHIs of the MERGEs, that lost inputs, are converted into COPYs */
+static void ir_jump_thread_remove_copies(ir_ctx *ctx)
+{
+	ir_ref ref, input, n;
+	ir_insn *insn;
+
+	for (ref = 1, insn = ctx->ir_base + 1; ref < ctx->insns_count; ref += n, insn += n) {
+		n = ir_insn_len(insn);
+		if (insn->op == IR_COPY && !insn->op2) {
+			input = insn->op1;
+			if (input > 0) {
+				ir_use_list_remove_one(ctx, input, ref);
+			}
+			ir_replace(ctx, ref, input);
+			CLEAR_USES(ref);
+			MAKE_NOP(insn);
+		}
+	}
+}
+
+int ir_thread_jumps(ir_ctx *ctx)
+{
+	ir_jump_thread_ctx data;
+	uint32_t b, len;
+	ir_ref ref, limit;
+	ir_block *bb;
+	bool changed = 0, rescan = 0, ret = 1;
+	int val;
+
+	IR_ASSERT(ctx->cfg_blocks && ctx->use_lists);
+
+	if (ctx->entries_count) {
+		return 1;
+	}
+
+	limit = ctx->insns_count + IR_MAX(ctx->insns_count, IR_JUMP_THREAD_MIN_GROWTH);
+	ir_list_init(&data.nodes, 16);
+	ir_list_init(&data.def, 16);
+	ir_list_init(&data.uses, 16);
+	ir_list_init(&data.phis, 16);
+	ir_list_init(&data.pending, 16);
+
+	b = 1;
+	while (ret) {
+		data.size = ctx->insns_count;
+		data.idx = ir_mem_calloc(data.size, sizeof(ir_ref));
+		data.early = ir_mem_calloc(data.size, sizeof(uint32_t));
+		data.path_idx = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(uint32_t));
+
+		/* map control nodes to blocks */
+		for (bb = ctx->cfg_blocks + 1, len = 1; len <= ctx->cfg_blocks_count; len++, bb++) {
+			ref = bb->start;
+			while (1) {
+				data.early[ref] = len;
+				if (ref == bb->end) {
+					break;
+				}
+				ref = ir_next_control(ctx, ref);
+			}
+		}
+
+		val = -1;
+		for (; b <= ctx->cfg_blocks_count; b++) {
+			bb = &ctx->cfg_blocks[b];
+			if (ctx->ir_base[bb->end].op != IR_IF
+			 || IR_IS_CONST_REF(ctx->ir_base[bb->end].op2)
+			 || (bb->flags & IR_BB_UNREACHABLE)) {
+				continue;
+			}
+
+			/* the outcome is known in place */
+			data.path[0] = b;
+			data.path_len = 1;
+			data.pred = 0;
+			data.path_idx[b] = 1;
+			val = ir_jump_thread_outcome(ctx, &data, ctx->ir_base[bb->end].op2);
+			data.path_idx[b] = 0;
+			if (val >= 0) {
+				ir_jump_thread_remove_if(ctx, bb->end, val);
+				ir_reset_cfg(ctx);
+				ret = ir_build_cfg(ctx) && ir_build_dominators_tree(ctx);
+				ctx->flags2 |= IR_CFG_REACHABLE;
+				break;
+			}
+
+			if (ctx->insns_count >= limit) {
+				continue;
+			}
+
+			/* the outcome is known along a path */
+			for (len = 1; len <= IR_JUMP_THREAD_MAX_BLOCKS; len++) {
+				data.path[len - 1] = b;
+				data.path_len = len;
+				data.count = 0;
+				if (ir_jump_thread_check_block(ctx, &data, b)) {
+					val = ir_jump_thread_find_path(ctx, &data, len - 1, ctx->ir_base[bb->end].op2);
+					if (val >= 0) {
+						break;
+					}
+				}
+			}
+			if (val >= 0) {
+				ret = ir_jump_thread_path(ctx, &data, val);
+				ir_jump_thread_reset(&data);
+				break;
+			}
+		}
+
+		ir_mem_free(data.path_idx);
+		ir_mem_free(data.early);
+		ir_mem_free(data.idx);
+		if (val >= 0) {
+			changed = rescan = 1;
+		} else if (rescan) {
+			/* block numbers are changed, check the previous blocks once again */
+			rescan = 0;
+			b = 1;
+		} else {
+			break;
+		}
+	}
+
+	ir_list_free(&data.pending);
+	ir_list_free(&data.phis);
+	ir_list_free(&data.uses);
+	ir_list_free(&data.def);
+	ir_list_free(&data.nodes);
+
+	if (changed && ret) {
+		ir_jump_thread_remove_copies(ctx);
+		ret = ir_find_loops(ctx);
+	}
+	return ret;
+}
@@ -28,13 +28,17 @@
 
 #define IR_MAX_OPERANDS 512
 
-const unsigned char *yy_buf;
-const unsigned char *yy_end;
-const unsigned char *yy_pos;
-const unsigned char *yy_text;
-uint32_t yy_line;
+/* the parser state is thread local to allow loading of different files in parallel */
+static IR_THREAD_LOCAL const unsigned char *yy_buf;
+static IR_THREAD_LOCAL const unsigned char *yy_end;
+static IR_THREAD_LOCAL const unsigned char *yy_pos;
+static IR_THREAD_LOCAL const unsigned char *yy_text;
+static IR_THREAD_LOCAL uint32_t yy_line;
 
-static jmp_buf yy_jmp_buf;
+static IR_THREAD_LOCAL jmp_buf yy_jmp_buf;
+
+/* (insn, operand number) pairs of the forward references in IR_INCREMENTAL_USE_LISTS mode */
+static IR_THREAD_LOCAL ir_list yy_fwd_uses;
 
 typedef struct _ir_parser_ctx {
 	ir_ctx    *ctx;
@@ -45,8 +49,8 @@ typedef struct _ir_parser_ctx {
 	ir_strtab  var_tab;
 } ir_parser_ctx;
 
-static ir_parser_ctx *yy_ctx = NULL; /* we keep this global only to cleanum memory on syntax errors */
-static ir_strtab op_tab;
+static IR_THREAD_LOCAL ir_parser_ctx *yy_ctx = NULL; /* we keep this global only to cleanum memory on syntax errors */
+static IR_THREAD_LOCAL ir_strtab op_tab;
 
 #define IR_UNRESOLVED_MASK            0xc0000000
 #define IR_UNRESOLVED_LIST_END        ((ir_ref)IR_UNRESOLVED_MASK)
@@ -75,6 +79,11 @@ static ir_ref ir_use_var(ir_parser_ctx *p, uint32_t n, const char *str, size_t l
 		/* "ref" keeps the tail of the list */
 		ir_strtab_update(&p->var_tab, str, len32, IR_ENCODE_UNRESOLVED_REF(p->curr_ref, n));
 	}
+	if (IR_IS_UNRESOLVED(ref) && (p->ctx->flags2 & IR_INCREMENTAL_USE_LISTS)) {
+		/* the def->use edge is added when the whole function is loaded (see ir_add_fwd_uses()) */
+		ir_list_push(&yy_fwd_uses, p->curr_ref);
+		ir_list_push(&yy_fwd_uses, n);
+	}
 	return ref;
 }
 
@@ -106,6 +115,24 @@ static void ir_define_var(ir_parser_ctx *p, const char *str, size_t len, ir_ref
 	}
 }
 
+static void ir_add_fwd_uses(ir_parser_ctx *p)
+{
+	ir_ctx *ctx = p->ctx;
+	uint32_t i;
+
+	/* forward references were patched in place, so they are still missing in the use lists */
+	for (i = 0; i < ir_list_len(&yy_fwd_uses); i += 2) {
+		ir_ref ref = ir_list_at(&yy_fwd_uses, i);
+		int32_t n = ir_list_at(&yy_fwd_uses, i + 1);
+		ir_insn *insn = &ctx->ir_base[ref];
+		ir_ref val = ir_insn_op(insn, n);
+
+		ir_insn_set_op(insn, n, IR_UNUSED);
+		ir_set_op(ctx, ref, n, val);
+	}
+	ir_list_clear(&yy_fwd_uses);
+}
+
 static void report_undefined_var(const char *str, uint32_t len, ir_str val)
 {
 	if (IR_IS_UNRESOLVED(val)) {
@@ -313,20 +340,28 @@ static uint64_t read_hex(const char *p, const char *e)
 #define YY_INT64_T 40
 #define YY_DOUBLE 41
 #define YY_FLOAT 42
-#define YY_NULL 43
-#define YY_INF 44
-#define YY_NAN 45
-#define YY__MINUS 46
-#define YY_ID 47
-#define YY_DECNUMBER 48
-#define YY_HEXNUMBER 49
-#define YY_FLOATNUMBER 50
-#define YY_CHARACTER 51
-#define YY_STRING 52
-#define YY_EOL 53
-#define YY_WS 54
-#define YY_ONE_LINE_COMMENT 55
-#define YY_COMMENT 56
+#define YY_I8X16_T 43
+#define YY_I32X4_T 44
+#define YY_F32X4_T 45
+#define YY_F64X2_T 46
+#define YY_I8X32_T 47
+#define YY_I32X8_T 48
+#define YY_F32X8_T 49
+#define YY_F64X4_T 50
+#define YY_NULL 51
+#define YY_INF 52
+#define YY_NAN 53
+#define YY__MINUS 54
+#define YY_ID 55
+#define YY_DECNUMBER 56
+#define YY_HEXNUMBER 57
+#define YY_FLOATNUMBER 58
+#define YY_CHARACTER 59
+#define YY_STRING 60
+#define YY_EOL 61
+#define YY_WS 62
+#define YY_ONE_LINE_COMMENT 63
+#define YY_COMMENT 64
 
 static const char * sym_name[] = {
 	"<EOF>",
@@ -372,6 +407,14 @@ static const char * sym_name[] = {
 	"int64_t",
 	"double",
 	"float",
+	"i8x16_t",
+	"i32x4_t",
+	"f32x4_t",
+	"f64x2_t",
+	"i8x32_t",
+	"i32x8_t",
+	"f32x8_t",
+	"f64x4_t",
 	"null",
 	"inf",
 	"nan",
@@ -639,51 +682,148 @@ _yy_state_start:
 				if (ch != 'c') goto _yy_tunnel_5;
 				ret = YY_FUNC;
 				goto _yy_state_209;
+			} else if (ch == '3') {
+				ch = *++YYPOS;
+				if (ch != '2') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch != 'x') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch == '4') {
+					ch = *++YYPOS;
+					if (ch != '_') goto _yy_tunnel_5;
+					ch = *++YYPOS;
+					if (ch != 't') goto _yy_tunnel_5;
+					ret = YY_F32X4_T;
+					goto _yy_state_209;
+				} else if (ch == '8') {
+					ch = *++YYPOS;
+					if (ch != '_') goto _yy_tunnel_5;
+					ch = *++YYPOS;
+					if (ch != 't') goto _yy_tunnel_5;
+					ret = YY_F32X8_T;
+					goto _yy_state_209;
+				} else {
+					goto _yy_tunnel_5;
+				}
+			} else if (ch == '6') {
+				ch = *++YYPOS;
+				if (ch != '4') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch != 'x') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch == '2') {
+					ch = *++YYPOS;
+					if (ch != '_') goto _yy_tunnel_5;
+					ch = *++YYPOS;
+					if (ch != 't') goto _yy_tunnel_5;
+					ret = YY_F64X2_T;
+					goto _yy_state_209;
+				} else if (ch == '4') {
+					ch = *++YYPOS;
+					if (ch != '_') goto _yy_tunnel_5;
+					ch = *++YYPOS;
+					if (ch != 't') goto _yy_tunnel_5;
+					ret = YY_F64X4_T;
+					goto _yy_state_209;
+				} else {
+					goto _yy_tunnel_5;
+				}
 			} else {
 				goto _yy_tunnel_5;
 			}
 		case 'i':
 			ch = *++YYPOS;
-			if (ch != 'n') goto _yy_tunnel_5;
-			ch = *++YYPOS;
-			if (ch == 'f') {
-				ret = YY_INF;
-				goto _yy_state_209;
-			} else if (ch == 't') {
+			if (ch == 'n') {
 				ch = *++YYPOS;
-				if (ch == '1') {
+				if (ch == 'f') {
+					ret = YY_INF;
+					goto _yy_state_209;
+				} else if (ch == 't') {
 					ch = *++YYPOS;
-					if (ch != '6') goto _yy_tunnel_5;
+					if (ch == '1') {
+						ch = *++YYPOS;
+						if (ch != '6') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != '_') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != 't') goto _yy_tunnel_5;
+						ret = YY_INT16_T;
+						goto _yy_state_209;
+					} else if (ch == '3') {
+						ch = *++YYPOS;
+						if (ch != '2') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != '_') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != 't') goto _yy_tunnel_5;
+						ret = YY_INT32_T;
+						goto _yy_state_209;
+					} else if (ch == '6') {
+						ch = *++YYPOS;
+						if (ch != '4') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != '_') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != 't') goto _yy_tunnel_5;
+						ret = YY_INT64_T;
+						goto _yy_state_209;
+					} else if (ch == '8') {
+						ch = *++YYPOS;
+						if (ch != '_') goto _yy_tunnel_5;
+						ch = *++YYPOS;
+						if (ch != 't') goto _yy_tunnel_5;
+						ret = YY_INT8_T;
+						goto _yy_state_209;
+					} else {
+						goto _yy_tunnel_5;
+					}
+				} else {
+					goto _yy_tunnel_5;
+				}
+			} else if (ch == '3') {
+				ch = *++YYPOS;
+				if (ch != '2') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch != 'x') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch == '4') {
 					ch = *++YYPOS;
 					if (ch != '_') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != 't') goto _yy_tunnel_5;
-					ret = YY_INT16_T;
+					ret = YY_I32X4_T;
 					goto _yy_state_209;
-				} else if (ch == '3') {
-					ch = *++YYPOS;
-					if (ch != '2') goto _yy_tunnel_5;
+				} else if (ch == '8') {
 					ch = *++YYPOS;
 					if (ch != '_') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != 't') goto _yy_tunnel_5;
-					ret = YY_INT32_T;
+					ret = YY_I32X8_T;
 					goto _yy_state_209;
-				} else if (ch == '6') {
+				} else {
+					goto _yy_tunnel_5;
+				}
+			} else if (ch == '8') {
+				ch = *++YYPOS;
+				if (ch != 'x') goto _yy_tunnel_5;
+				ch = *++YYPOS;
+				if (ch == '1') {
 					ch = *++YYPOS;
-					if (ch != '4') goto _yy_tunnel_5;
+					if (ch != '6') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != '_') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != 't') goto _yy_tunnel_5;
-					ret = YY_INT64_T;
+					ret = YY_I8X16_T;
 					goto _yy_state_209;
-				} else if (ch == '8') {
+				} else if (ch == '3') {
+					ch = *++YYPOS;
+					if (ch != '2') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != '_') goto _yy_tunnel_5;
 					ch = *++YYPOS;
 					if (ch != 't') goto _yy_tunnel_5;
-					ret = YY_INT8_T;
+					ret = YY_I8X32_T;
 					goto _yy_state_209;
 				} else {
 					goto _yy_tunnel_5;
@@ -1229,7 +1369,7 @@ static int parse_ir(int sym, ir_loader *loader) {
 	p.ctx = &ctx;
 	const char *str;
 	size_t len;
-	if (YY_IN_SET(sym, (YY_EXTERN,YY_STATIC,YY_VAR,YY_CONST,YY_FUNC), "\012\003\001\000\000\000\000\000")) {
+	if (YY_IN_SET(sym, (YY_EXTERN,YY_STATIC,YY_VAR,YY_CONST,YY_FUNC), "\012\003\001\000\000\000\000\000\000")) {
 		do {
 			if (sym == YY_EXTERN) {
 				sym = get_sym();
@@ -1311,7 +1451,7 @@ _yy_state_9:
 							yy_error_sym("'{' expected, got", sym);
 						}
 						sym = get_sym();
-						if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\000\300\377\007\000\000")) {
+						if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\000\300\377\377\007\000\000")) {
 							sym = parse_ir_sym_data(sym, loader);
 							while (1) {
 								save_pos  = yy_pos;
@@ -1329,7 +1469,7 @@ _yy_state_9:
 									yy_error_sym("unexpected", sym2);
 								}
 _yy_state_13_1:
-								if (YY_IN_SET(sym2, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\000\300\377\007\000\000")) {
+								if (YY_IN_SET(sym2, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\000\300\377\377\007\000\000")) {
 									alt13 = 14;
 									goto _yy_state_13;
 								} else if (sym2 == YY__RBRACE) {
@@ -1409,7 +1549,7 @@ _yy_state_13:
 			} else {
 				yy_error_sym("unexpected", sym);
 			}
-		} while (YY_IN_SET(sym, (YY_EXTERN,YY_STATIC,YY_VAR,YY_CONST,YY_FUNC), "\012\003\001\000\000\000\000\000"));
+		} while (YY_IN_SET(sym, (YY_EXTERN,YY_STATIC,YY_VAR,YY_CONST,YY_FUNC), "\012\003\001\000\000\000\000\000\000"));
 	} else if (sym == YY__LBRACE) {
 		if (!loader->func_init(loader, &ctx, NULL)) yy_error("ini_func error");
 		ctx.ret_type = -1;
@@ -1508,7 +1648,7 @@ static int parse_ir_sym_data(int sym, ir_loader *loader) {
 				yy_error("sym_data_ref error");
 			}
 		}
-	} else if (YY_IN_SET(sym, (YY_DECNUMBER,YY_HEXNUMBER,YY_FLOATNUMBER,YY_CHARACTER,YY_INF,YY_NAN,YY__MINUS), "\000\000\000\000\000\160\017\000")) {
+	} else if (YY_IN_SET(sym, (YY_DECNUMBER,YY_HEXNUMBER,YY_FLOATNUMBER,YY_CHARACTER,YY_INF,YY_NAN,YY__MINUS), "\000\000\000\000\000\000\160\017\000")) {
 		sym = parse_const(sym, t, &val);
 		if (loader->sym_data) {
 			switch (ir_type_size[t]) {
@@ -1539,7 +1679,7 @@ static int parse_ir_func(int sym, ir_parser_ctx *p) {
 		yy_error_sym("'{' expected, got", sym);
 	}
 	sym = get_sym();
-	while (YY_IN_SET(sym, (YY_NOP,YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_ID), "\000\000\002\300\377\207\000\000")) {
+	while (YY_IN_SET(sym, (YY_NOP,YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T,YY_ID), "\000\000\002\300\377\377\207\000\000")) {
 		if (sym == YY_NOP) {
 			sym = get_sym();
 		} else {
@@ -1558,6 +1698,7 @@ static int parse_ir_func(int sym, ir_parser_ctx *p) {
 	}
 	sym = get_sym();
 	if (p->undef_count) ir_check_indefined_vars(p);
+	if (p->ctx->flags2 & IR_INCREMENTAL_USE_LISTS) ir_add_fwd_uses(p);
 	if (p->bad_insns) p->ctx->flags |= IR_OPT_FOLDING;
 	yy_ctx = NULL;
 	ir_strtab_free(&p->var_tab);
@@ -1599,7 +1740,7 @@ static int parse_ir_func_proto(int sym, ir_parser_ctx *p, uint32_t *flags, uint8
 		yy_error_sym("'(' expected, got", sym);
 	}
 	sym = get_sym();
-	if (YY_IN_SET(sym, (YY_VOID,YY__POINT_POINT_POINT,YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\014\300\377\007\000\000")) {
+	if (YY_IN_SET(sym, (YY_VOID,YY__POINT_POINT_POINT,YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\014\300\377\377\007\000\000")) {
 		if (sym == YY_VOID) {
 			sym = get_sym();
 		} else if (sym == YY__POINT_POINT_POINT) {
@@ -1624,7 +1765,7 @@ static int parse_ir_func_proto(int sym, ir_parser_ctx *p, uint32_t *flags, uint8
 					yy_error_sym("unexpected", sym2);
 				}
 _yy_state_87_1:
-				if (YY_IN_SET(sym2, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\000\300\377\007\000\000")) {
+				if (YY_IN_SET(sym2, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\000\300\377\377\007\000\000")) {
 					alt87 = 88;
 					goto _yy_state_87;
 				} else if (sym2 == YY__POINT_POINT_POINT) {
@@ -1663,7 +1804,7 @@ _yy_state_87:
 		yy_error_sym("':' expected, got", sym);
 	}
 	sym = get_sym();
-	if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\000\300\377\007\000\000")) {
+	if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\000\300\377\377\007\000\000")) {
 		sym = parse_type(sym, ret_type);
 	} else if (sym == YY_VOID) {
 		sym = get_sym();
@@ -1704,6 +1845,7 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 	ir_ref op1 = IR_UNUSED;
 	ir_ref op2 = IR_UNUSED;
 	ir_ref op3 = IR_UNUSED;
+	ir_ref op4 = IR_UNUSED;
 	ir_ref ref = IR_UNUSED;
 	ir_ref ref2 = IR_UNUSED;
 	ir_val val;
@@ -1713,7 +1855,7 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 	uint32_t flags;
 	uint32_t params_count;
 	uint8_t param_types[IR_MAX_OPERANDS + 1];
-	if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT), "\000\000\000\300\377\007\000\000")) {
+	if (YY_IN_SET(sym, (YY_BOOL,YY_UINT8_T,YY_UINT16_T,YY_UINT32_T,YY_UINT64_T,YY_UINTPTR_T,YY_CHAR,YY_INT8_T,YY_INT16_T,YY_INT32_T,YY_INT64_T,YY_DOUBLE,YY_FLOAT,YY_I8X16_T,YY_I32X4_T,YY_F32X4_T,YY_F64X2_T,YY_I8X32_T,YY_I32X8_T,YY_F32X8_T,YY_F64X4_T), "\000\000\000\300\377\377\007\000\000")) {
 		sym = parse_type(sym, &t);
 		sym = parse_ID(sym, &str, &len);
 		if (sym == YY__COMMA) {
@@ -1738,7 +1880,7 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 		case YY_NAN:
 		case YY__MINUS:
 			val.u64 = 0;
-			sym = parse_const(sym, t, &val);
+			sym = parse_const(sym, IR_IS_TYPE_VEC(t) ? ir_vec_lane_type(t) : t, &val);
 			ref = ir_const(p->ctx, val, t);
 			break;
 		case YY_FUNC:
@@ -1803,12 +1945,19 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 				sym = parse_DECNUMBER(sym, IR_I32, &count);
 				if (op == IR_PHI || op == IR_SNAPSHOT) count.i32++;
 				if (op == IR_CALL || op == IR_TAILCALL || op == IR_ASM) count.i32+=2;
+				if (op == IR_LOAD || op == IR_STORE) {
+					/* LOAD/n and STORE/n specify the alias class */
+					if (count.i32 < 0 || count.i32 > 0xffff) yy_error("alias class out of range");
+					val.i32 = count.i32;
+					count.i32 = IR_OPERANDS_COUNT(ir_op_flags[op]);
+				}
 				if (count.i32 < 0) yy_error("negative number of operands");
 				if (count.i32 > IR_MAX_OPERANDS) yy_error("too many operands");
 				ref = ref2 = ir_emit_N(p->ctx, IR_OPT(op, t), count.i32);
+				if (op == IR_LOAD || op == IR_STORE) ir_set_alias_class(p->ctx, ref, val.i32);
 				if (sym == YY__LPAREN) {
 					sym = get_sym();
-					if (YY_IN_SET(sym, (YY_ID,YY_STRING,YY_DECNUMBER,YY_NULL,YY_FUNC), "\000\000\001\000\000\210\021\000")) {
+					if (YY_IN_SET(sym, (YY_ID,YY_STRING,YY_DECNUMBER,YY_NULL,YY_FUNC), "\000\000\001\000\000\000\210\021\000")) {
 						p->curr_ref = ref;
 						sym = parse_val(sym, p, op, 1, &op1);
 						n = 1;
@@ -1846,7 +1995,7 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 				n = 0;
 				if (sym == YY__LPAREN) {
 					sym = get_sym();
-					if (YY_IN_SET(sym, (YY_ID,YY_STRING,YY_DECNUMBER,YY_NULL,YY_FUNC), "\000\000\001\000\000\210\021\000")) {
+					if (YY_IN_SET(sym, (YY_ID,YY_STRING,YY_DECNUMBER,YY_NULL,YY_FUNC), "\000\000\001\000\000\000\210\021\000")) {
 						p->curr_ref = p->ctx->insns_count;
 						sym = parse_val(sym, p, op, 1, &op1);
 						n = 1;
@@ -1858,6 +2007,11 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 								sym = get_sym();
 								sym = parse_val(sym, p, op, 3, &op3);
 								n = 3;
+								if (sym == YY__COMMA) {
+									sym = get_sym();
+									sym = parse_val(sym, p, op, 4, &op4);
+									n = 4;
+								}
 							}
 						}
 					}
@@ -1866,6 +2020,9 @@ static int parse_ir_insn(int sym, ir_parser_ctx *p) {
 					}
 					sym = get_sym();
 				}
+				if (n == 4 && op != IR_MEMCPY && op != IR_MEMSET) {
+					yy_error("too many operands");
+				}
 				if (IR_IS_FOLDABLE_OP(op)) {
 					if (IR_IS_UNRESOLVED(op1) || IR_IS_UNRESOLVED(op2) || IR_IS_UNRESOLVED(op3)) {
 						if (op == IR_PHI) {
@@ -1963,12 +2120,21 @@ fallback:
 						}
 					}
 emit:
-					if (!IR_OP_HAS_VAR_INPUTS(ir_op_flags[op])) {
-						opt = IR_OPT(op, t);
+					if (n == 4) {
+						/* MEMCPY and MEMSET */
+						ref = ref2 = ir_emit_N(p->ctx, IR_OPT(op, t), 4);
+						ir_set_op(p->ctx, ref, 1, op1);
+						ir_set_op(p->ctx, ref, 2, op2);
+						ir_set_op(p->ctx, ref, 3, op3);
+						ir_set_op(p->ctx, ref, 4, op4);
 					} else {
-						opt = IR_OPTX(op, t, n);
+						if (!IR_OP_HAS_VAR_INPUTS(ir_op_flags[op])) {
+							opt = IR_OPT(op, t);
+						} else {
+							opt = IR_OPTX(op, t, n);
+						}
+						ref = ref2 = ir_emit(p->ctx, opt, op1, op2, op3);
 					}
-					ref = ref2 = ir_emit(p->ctx, opt, op1, op2, op3);
 				}
 			} else {
 				yy_error_sym("unexpected", sym);
@@ -2074,6 +2240,38 @@ static int parse_type(int sym, uint8_t *t) {
 			sym = get_sym();
 			*t = IR_FLOAT;
 			break;
+		case YY_I8X16_T:
+			sym = get_sym();
+			*t = IR_I8X16;
+			break;
+		case YY_I32X4_T:
+			sym = get_sym();
+			*t = IR_I32X4;
+			break;
+		case YY_F32X4_T:
+			sym = get_sym();
+			*t = IR_F32X4;
+			break;
+		case YY_F64X2_T:
+			sym = get_sym();
+			*t = IR_F64X2;
+			break;
+		case YY_I8X32_T:
+			sym = get_sym();
+			*t = IR_I8X32;
+			break;
+		case YY_I32X8_T:
+			sym = get_sym();
+			*t = IR_I32X8;
+			break;
+		case YY_F32X8_T:
+			sym = get_sym();
+			*t = IR_F32X8;
+			break;
+		case YY_F64X4_T:
+			sym = get_sym();
+			*t = IR_F64X4;
+			break;
 		default:
 			yy_error_sym("unexpected", sym);
 	}
@@ -2308,6 +2506,7 @@ int ir_load(ir_loader *loader, FILE *f) {
 	}
 
 	ir_mem_free((void*)yy_buf);
+	ir_list_free(&yy_fwd_uses);
 
 	return ret;
 }
@@ -0,0 +1,2338 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Loop Optimizations)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* Loop Unrolling
+ *
+ * Unrolls small inner loops controlled by a simple induction variable
+ *
+ *   x2 = PHI(loop, x1, x3); x3 = ADD(x2, step); ... IF(CMP(x2 or x3, limit))
+ *
+ * where "step" is a constant and "limit" is loop invariant. The IF must be
+ * executed on each iteration.
+ *
+ * The loop is cloned into a new "main" loop that executes several copies of
+ * the body per iteration. The header of the main loop checks that all these
+ * copies keep the induction variable within the "limit", so the copies don't
+ * need their own checks. The original loop follows the main one and performs
+ * the remaining iterations. Other exits are kept in each copy; their targets
+ * get a new MERGE, and the values used after the loop get PHIs.
+ */
+#define IR_UNROLL_FACTOR    4    /* max number of the loop body copies */
+#define IR_UNROLL_MAX_INSNS 256  /* max number of nodes in all the copies */
+#define IR_UNROLL_MAX_NODES 1024 /* max number of nodes that depend on the loop */
+
+typedef struct _ir_unroll_ctx {
+	ir_ref     header;   /* LOOP_BEGIN of the original loop */
+	ir_ref     latch;    /* the last control node of the loop body */
+	ir_ref     entry;    /* replacement of LOOP_BEGIN in the first copy */
+	ir_ref     test;     /* IF that checks the induction variable */
+	ir_ref     stay;     /* projection of "test" that continues the loop */
+	ir_ref     exit;     /* projection of "test" that leaves the loop */
+	ir_ref     iv;       /* PHI of the induction variable */
+	ir_ref     limit;
+	int64_t    step;
+	uint64_t   delta;    /* the distance between the checked and the last value */
+	ir_op      op;       /* LT, GT, ULT or UGT - condition of staying in the loop */
+	ir_type    type;     /* type of the limit arithmetic (unsigned for ULT and UGT) */
+	int32_t    adjust;   /* constant added to "limit" to make the condition strict */
+	uint32_t   offset;   /* 1 if "test" checks the next value of the induction variable */
+	uint32_t   count;    /* number of copies */
+	ir_bitset  loop;     /* the loop nodes and the nodes that depend on them */
+	ir_list    nodes;    /* the same nodes */
+	ir_list    phis;     /* PHIs of the loop header */
+	ir_list    exits;    /* projections of the other IFs that leave the loop */
+	ir_list    uses;     /* out of loop uses (user, operand number, exit number) */
+	ir_list    skip;     /* control nodes that are not cloned (GUARDs removed by versioning) */
+	ir_ref    *map;      /* clones of the nodes: map[copy * map_size + ref] */
+	ir_ref     map_size;
+} ir_unroll_ctx;
+
+static bool ir_unroll_in_loop(const ir_ctx *ctx, uint32_t b, uint32_t hdr)
+{
+	return b == hdr || ctx->cfg_blocks[b].loop_header == hdr;
+}
+
+/* Returns 0 for a node of a disconnected (unreachable) control chain */
+static uint32_t ir_unroll_control_block(const ir_ctx *ctx, ir_ref ref)
+{
+	while (ref > 0 && !ctx->cfg_map[ref]) {
+		ref = ctx->ir_base[ref].op1;
+	}
+	return ref > 0 ? ctx->cfg_map[ref] : 0;
+}
+
+/* Constants and limits are kept sign or zero extended to 64 bits */
+static uint64_t ir_unroll_ext(uint64_t val, ir_type type)
+{
+	uint32_t bits = ir_type_size[type] * 8;
+
+	if (bits < 64) {
+		if (IR_IS_TYPE_SIGNED(type)) {
+			val = (uint64_t)(((int64_t)(val << (64 - bits))) >> (64 - bits));
+		} else {
+			val &= ((uint64_t)1 << bits) - 1;
+		}
+	}
+	return val;
+}
+
+static uint64_t ir_unroll_min(ir_type type)
+{
+	return IR_IS_TYPE_SIGNED(type) ? ir_unroll_ext((uint64_t)1 << (ir_type_size[type] * 8 - 1), type) : 0;
+}
+
+static uint64_t ir_unroll_max(ir_type type)
+{
+	return IR_IS_TYPE_SIGNED(type) ?
+		((uint64_t)1 << (ir_type_size[type] * 8 - 1)) - 1 : ir_unroll_ext((uint64_t)-1, type);
+}
+
+static bool ir_unroll_less(uint64_t a, uint64_t b, ir_type type)
+{
+	return IR_IS_TYPE_SIGNED(type) ? (int64_t)a < (int64_t)b : a < b;
+}
+
+/* Unsigned comparison of signed values is performed in the unsigned type of the same size */
+static ir_type ir_unroll_cmp_type(ir_type type, ir_op op)
+{
+	if (op >= IR_ULT && IR_IS_TYPE_SIGNED(type)) {
+		type = (type == IR_CHAR) ? IR_U8 : (ir_type)(type - IR_I8 + IR_U8);
+	}
+	return type;
+}
+
+static bool ir_unroll_is_const(const ir_ctx *ctx, ir_ref ref)
+{
+	return IR_IS_CONST_REF(ref) && !IR_IS_SYM_CONST(ctx->ir_base[ref].op);
+}
+
+/* Match x3 = ADD(x2, step) or SUB(x2, step), where x2 = PHI(loop, x1, x3) */
+static bool ir_unroll_match_iv(const ir_ctx *ctx, ir_unroll_ctx *data, ir_ref ref, uint32_t offset)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	const ir_insn *phi, *next;
+	ir_ref phi_ref, next_ref, step_ref;
+	ir_type type;
+
+	if (offset) {
+		if (insn->op != IR_ADD && insn->op != IR_SUB) {
+			return 0;
+		}
+		next_ref = ref;
+		phi_ref = insn->op1;
+		if (insn->op == IR_ADD && ir_unroll_is_const(ctx, phi_ref)) {
+			phi_ref = insn->op2;
+		}
+		if (IR_IS_CONST_REF(phi_ref)) {
+			return 0;
+		}
+	} else {
+		phi_ref = ref;
+		next_ref = insn->op3;
+		if (insn->op != IR_PHI || IR_IS_CONST_REF(next_ref)) {
+			return 0;
+		}
+	}
+
+	phi = &ctx->ir_base[phi_ref];
+	next = &ctx->ir_base[next_ref];
+	type = phi->type;
+	if (phi->op != IR_PHI
+	 || phi->op1 != data->header
+	 || phi->inputs_count != 3
+	 || phi->op3 != next_ref
+	 || next->type != type
+	 || !IR_IS_TYPE_INT(type)
+	 || ir_type_size[type] < 4) {
+		return 0;
+	}
+
+	if (next->op == IR_ADD && next->op1 == phi_ref) {
+		step_ref = next->op2;
+	} else if (next->op == IR_ADD && next->op2 == phi_ref) {
+		step_ref = next->op1;
+	} else if (next->op == IR_SUB && next->op1 == phi_ref) {
+		step_ref = next->op2;
+	} else {
+		return 0;
+	}
+	if (!ir_unroll_is_const(ctx, step_ref)) {
+		return 0;
+	}
+
+	/* the step is signed even for unsigned variables */
+	data->step = (int64_t)ir_unroll_ext(ctx->ir_base[step_ref].val.u64,
+		IR_IS_TYPE_SIGNED(type) ? type : (ir_type_size[type] == 8 ? IR_I64 : IR_I32));
+	if (next->op == IR_SUB) {
+		data->step = -data->step;
+	}
+	if (data->step == 0 || data->step == INT64_MIN) {
+		return 0;
+	}
+	data->iv = phi_ref;
+	data->offset = offset;
+	return 1;
+}
+
+static bool ir_unroll_match_test(const ir_ctx *ctx, ir_unroll_ctx *data, ir_ref exit)
+{
+	ir_ref if_ref = ctx->ir_base[exit].op1;
+	ir_ref cond = ctx->ir_base[if_ref].op2;
+	const ir_insn *insn;
+	ir_ref limit;
+	ir_op op;
+	ir_type type;
+	uint64_t val;
+
+	if (IR_IS_CONST_REF(cond)) {
+		return 0;
+	}
+	insn = &ctx->ir_base[cond];
+	op = insn->op;
+	if (op < IR_LT || op > IR_UGT) {
+		return 0;
+	}
+	if (!IR_IS_CONST_REF(insn->op1)
+	 && (ir_unroll_match_iv(ctx, data, insn->op1, 0) || ir_unroll_match_iv(ctx, data, insn->op1, 1))) {
+		limit = insn->op2;
+	} else if (!IR_IS_CONST_REF(insn->op2)
+	 && (ir_unroll_match_iv(ctx, data, insn->op2, 0) || ir_unroll_match_iv(ctx, data, insn->op2, 1))) {
+		limit = insn->op1;
+		op ^= 3; /* swap operands */
+	} else {
+		return 0;
+	}
+	if (limit > 0 && ir_bitset_in(data->loop, limit)) {
+		return 0;
+	}
+	if (ctx->ir_base[exit].op == IR_IF_TRUE) {
+		op ^= 1; /* negate */
+	}
+
+	type = ir_unroll_cmp_type(ctx->ir_base[data->iv].type, op);
+
+	/* make the condition strict */
+	data->adjust = 0;
+	if (op == IR_LE || op == IR_ULE || op == IR_GE || op == IR_UGE) {
+		if (!ir_unroll_is_const(ctx, limit)) {
+			return 0;
+		}
+		val = ir_unroll_ext(ctx->ir_base[limit].val.u64, type);
+		if (op == IR_LE || op == IR_ULE) {
+			if (val == ir_unroll_max(type)) {
+				return 0;
+			}
+			data->adjust = 1;
+			op -= 2; /* LT or ULT */
+		} else {
+			if (val == ir_unroll_min(type)) {
+				return 0;
+			}
+			data->adjust = -1;
+			op += 2; /* GT or UGT */
+		}
+	}
+
+	if ((op == IR_LT || op == IR_ULT) ? data->step < 0 : data->step > 0) {
+		return 0;
+	}
+
+	data->test = if_ref;
+	data->exit = exit;
+	data->stay = ctx->use_edges[ctx->use_lists[if_ref].refs];
+	if (data->stay == exit) {
+		data->stay = ctx->use_edges[ctx->use_lists[if_ref].refs + 1];
+	}
+	data->limit = limit;
+	data->op = op;
+	data->type = type;
+	return 1;
+}
+
+/* Compute the constant limit for the main loop, if possible */
+static bool ir_unroll_const_limit(const ir_ctx *ctx, ir_unroll_ctx *data, uint64_t *val)
+{
+	ir_type type = data->type;
+	uint64_t v, bound;
+
+	if (!ir_unroll_is_const(ctx, data->limit)) {
+		return 0;
+	}
+	v = ir_unroll_ext(ctx->ir_base[data->limit].val.u64 + data->adjust, type);
+	if (data->op == IR_LT || data->op == IR_ULT) {
+		bound = ir_unroll_min(type) + data->delta;
+		if (ir_unroll_less(v, bound, type)) {
+			v = bound;
+		}
+		v -= data->delta;
+	} else {
+		bound = ir_unroll_max(type) - data->delta;
+		if (ir_unroll_less(bound, v, type)) {
+			v = bound;
+		}
+		v += data->delta;
+	}
+	*val = ir_unroll_ext(v, type);
+	return 1;
+}
+
+static ir_ref ir_unroll_emit2(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2)
+{
+	ir_ref ref = ir_emit2(ctx, opt, op1, op2);
+
+	if (op1 > 0) {
+		ir_use_list_add(ctx, op1, ref);
+	}
+	if (op2 > 0) {
+		ir_use_list_add(ctx, op2, ref);
+	}
+	return ref;
+}
+
+/* Emit MIN or MAX of values of the given "type", compared as values of "cmp_type" */
+static ir_ref ir_unroll_emit_minmax(ir_ctx *ctx, ir_op op, ir_type type, ir_type cmp_type, ir_ref op1, ir_ref op2)
+{
+	ir_ref cond, ref;
+
+	if (type == cmp_type) {
+		return ir_unroll_emit2(ctx, IR_OPTX(op, type, 2), op1, op2);
+	}
+	IR_ASSERT(IR_IS_TYPE_UNSIGNED(cmp_type));
+	cond = ir_unroll_emit2(ctx, IR_OPTX(op == IR_MIN ? IR_ULT : IR_UGT, IR_BOOL, 2), op1, op2);
+	ref = ir_emit3(ctx, IR_OPTX(IR_COND, type, 3), cond, op1, op2);
+	ir_use_list_add(ctx, cond, ref);
+	if (op1 > 0) {
+		ir_use_list_add(ctx, op1, ref);
+	}
+	if (op2 > 0) {
+		ir_use_list_add(ctx, op2, ref);
+	}
+	return ref;
+}
+
+/* Emit the limit of the main loop: limit -/+ delta, saturated to avoid overflow */
+static ir_ref ir_unroll_emit_limit(ir_ctx *ctx, ir_unroll_ctx *data, ir_type type)
+{
+	ir_val val;
+	ir_ref ref;
+
+	if (ir_unroll_const_limit(ctx, data, &val.u64)) {
+		val.u64 = ir_unroll_ext(val.u64, type);
+		return ir_const(ctx, val, type);
+	}
+	IR_ASSERT(!data->adjust);
+	if (!data->delta) {
+		return data->limit;
+	} else if (data->op == IR_LT || data->op == IR_ULT) {
+		val.u64 = ir_unroll_ext(ir_unroll_min(data->type) + data->delta, type);
+		ref = ir_unroll_emit_minmax(ctx, IR_MAX, type, data->type, data->limit, ir_const(ctx, val, type));
+		val.u64 = data->delta;
+		return ir_unroll_emit2(ctx, IR_OPTX(IR_SUB, type, 2), ref, ir_const(ctx, val, type));
+	} else {
+		val.u64 = ir_unroll_ext(ir_unroll_max(data->type) - data->delta, type);
+		ref = ir_unroll_emit_minmax(ctx, IR_MIN, type, data->type, data->limit, ir_const(ctx, val, type));
+		val.u64 = data->delta;
+		return ir_unroll_emit2(ctx, IR_OPTX(IR_ADD, type, 2), ref, ir_const(ctx, val, type));
+	}
+}
+
+static bool ir_unroll_add_node(ir_unroll_ctx *data, ir_ref ref)
+{
+	if (!ir_bitset_in(data->loop, ref)) {
+		if (ir_list_len(&data->nodes) >= IR_UNROLL_MAX_NODES) {
+			return 0;
+		}
+		ir_bitset_incl(data->loop, ref);
+		ir_list_push(&data->nodes, ref);
+	}
+	return 1;
+}
+
+/* Collect the loop nodes, the exits, and check if the loop may be unrolled */
+static bool ir_unroll_collect(ir_ctx *ctx, ir_unroll_ctx *data, uint32_t hdr)
+{
+	ir_block *bb;
+	ir_insn *insn;
+	ir_use_list *use_list;
+	ir_ref ref, n, *p;
+	uint32_t b, i, *q;
+
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		if (!ir_unroll_in_loop(ctx, b, hdr)) {
+			continue;
+		} else if (b != hdr && (bb->flags & IR_BB_LOOP_HEADER)) {
+			return 0; /* not an inner loop */
+		}
+
+		/* control nodes */
+		ref = bb->end;
+		while (1) {
+			insn = &ctx->ir_base[ref];
+			switch (insn->op) {
+				case IR_SWITCH:
+				case IR_IJMP:
+				case IR_ENTRY:
+				case IR_TAILCALL:
+				case IR_ALLOCA:
+				case IR_AFREE:
+				case IR_BLOCK_BEGIN:
+				case IR_BLOCK_END:
+				case IR_VA_START:
+				case IR_VA_END:
+				case IR_VA_COPY:
+				case IR_VA_ARG:
+					return 0;
+				case IR_BEGIN:
+					if (insn->op2) {
+						return 0; /* label */
+					}
+					break;
+				default:
+					break;
+			}
+			if (!ir_unroll_add_node(data, ref)) {
+				return 0;
+			}
+			if (ref == bb->start) {
+				break;
+			}
+			ref = insn->op1;
+		}
+
+		/* PHIs */
+		if (insn->op == IR_MERGE || insn->op == IR_LOOP_BEGIN) {
+			use_list = &ctx->use_lists[ref];
+			for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+				if (ctx->ir_base[*p].op == IR_PHI) {
+					if (!ir_unroll_add_node(data, *p)) {
+						return 0;
+					}
+					if (b == hdr) {
+						ir_list_push(&data->phis, *p);
+					}
+				}
+			}
+		}
+
+		/* exits */
+		for (i = bb->successors_count, q = &ctx->cfg_edges[bb->successors]; i > 0; q++, i--) {
+			if (!ir_unroll_in_loop(ctx, *q, hdr)) {
+				ref = ctx->cfg_blocks[*q].start;
+				insn = &ctx->ir_base[ref];
+				if ((insn->op != IR_IF_TRUE && insn->op != IR_IF_FALSE)
+				 || ctx->use_lists[ref].count != 1) {
+					return 0;
+				}
+				ir_list_push(&data->exits, ref);
+			}
+		}
+	}
+
+	/* data nodes that depend on the loop */
+	for (i = 0; i < ir_list_len(&data->nodes); i++) {
+		use_list = &ctx->use_lists[ir_list_at(&data->nodes, i)];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			insn = &ctx->ir_base[*p];
+			if (insn->op != IR_PHI
+			 && !(ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL)
+			 && !ir_unroll_add_node(data, *p)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/* Find the out of loop uses and the exits they are reachable from */
+static bool ir_unroll_collect_uses(ir_ctx *ctx, ir_unroll_ctx *data)
+{
+	ir_worklist users;
+	ir_use_list *use_list;
+	ir_insn *insn;
+	ir_ref ref, use, n, j, *p;
+	uint32_t i, b, flags, exit_b;
+	bool ret = 1;
+
+	ir_worklist_init(&users, ctx->insns_count);
+	for (i = 0; i < ir_list_len(&data->nodes); i++) {
+		use_list = &ctx->use_lists[ir_list_at(&data->nodes, i)];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			if (!ir_bitset_in(data->loop, *p)) {
+				ir_worklist_push(&users, *p);
+			}
+		}
+	}
+
+	exit_b = ctx->cfg_map[data->exit];
+
+	while (ret && ir_worklist_len(&users)) {
+		use = ir_worklist_pop(&users);
+		insn = &ctx->ir_base[use];
+		flags = ir_op_flags[insn->op];
+		n = ir_input_edges_count(ctx, insn);
+		for (j = 1; j <= n; j++) {
+			ref = ir_insn_op(insn, j);
+			if (ref <= 0 || !ir_bitset_in(data->loop, ref)) {
+				continue;
+			}
+			if (insn->op == IR_PHI) {
+				if (j == 1) {
+					continue;
+				}
+				b = ctx->cfg_map[ir_insn_op(&ctx->ir_base[insn->op1], j - 1)];
+			} else if (IR_OPND_KIND(flags, j) != IR_OPND_DATA) {
+				continue; /* projection of a loop IF */
+			} else {
+				IR_ASSERT(flags & IR_OP_FLAG_CONTROL);
+				b = ir_unroll_control_block(ctx, use);
+			}
+			if (!b) {
+				continue; /* unreachable user */
+			}
+			if (!ir_dominates(ctx->cfg_blocks, exit_b, b)) {
+				uint32_t k;
+
+				/* the value must come through one of the other exits */
+				for (k = 0; k < ir_list_len(&data->exits); k++) {
+					if (ir_dominates(ctx->cfg_blocks, ctx->cfg_map[ir_list_at(&data->exits, k)], b)) {
+						ir_list_push(&data->uses, use);
+						ir_list_push(&data->uses, j);
+						ir_list_push(&data->uses, k);
+						break;
+					}
+				}
+				if (k == ir_list_len(&data->exits)) {
+					ret = 0;
+					break;
+				}
+			}
+		}
+	}
+	ir_worklist_free(&users);
+	return ret;
+}
+
+/* Number of nodes that have to be cloned */
+static uint32_t ir_unroll_body_size(ir_ctx *ctx, ir_unroll_ctx *data)
+{
+	ir_worklist worklist;
+	ir_insn *insn;
+	ir_ref ref, j, n;
+	uint32_t i, size = 0;
+
+	ir_worklist_init(&worklist, ctx->insns_count);
+	for (i = 0; i < ir_list_len(&data->nodes); i++) {
+		ref = ir_list_at(&data->nodes, i);
+		if (ir_op_flags[ctx->ir_base[ref].op] & IR_OP_FLAG_CONTROL) {
+			ir_worklist_push(&worklist, ref);
+		}
+	}
+	while (ir_worklist_len(&worklist)) {
+		ref = ir_worklist_pop(&worklist);
+		insn = &ctx->ir_base[ref];
+		size++;
+		n = ir_input_edges_count(ctx, insn);
+		for (j = 1; j <= n; j++) {
+			ref = ir_insn_op(insn, j);
+			if (ref > 0 && ir_bitset_in(data->loop, ref)) {
+				ir_worklist_push(&worklist, ref);
+			}
+		}
+	}
+	ir_worklist_free(&worklist);
+	return size;
+}
+
+static ir_ref ir_unroll_clone(ir_ctx *ctx, ir_unroll_ctx *data, ir_ref ref, uint32_t copy)
+{
+	ir_ref *map = data->map + copy * data->map_size;
+	ir_ref new_ref, input, j, n;
+	ir_insn *insn;
+	uint32_t flags;
+
+	if (ref <= 0 || !ir_bitset_in(data->loop, ref)) {
+		return ref;
+	} else if (map[ref]) {
+		return map[ref];
+	}
+
+	insn = &ctx->ir_base[ref];
+	if (ref == data->header) {
+		new_ref = copy ? ir_unroll_clone(ctx, data, data->latch, copy - 1) : data->entry;
+	} else if (insn->op == IR_PHI && insn->op1 == data->header) {
+		/* PHIs of the first copy are created in advance */
+		IR_ASSERT(copy > 0);
+		new_ref = ir_unroll_clone(ctx, data, insn->op3, copy - 1);
+	} else if (ref == data->test || ref == data->stay) {
+		/* the check is performed in the header of the main loop */
+		new_ref = ir_unroll_clone(ctx, data, ctx->ir_base[data->test].op1, copy);
+	} else if (ir_list_contains(&data->skip, ref)) {
+		new_ref = ir_unroll_clone(ctx, data, insn->op1, copy);
+	} else {
+		flags = ir_op_flags[insn->op];
+		n = IR_OP_HAS_VAR_INPUTS(flags) ? insn->inputs_count : 3;
+		for (j = 1; j <= n; j++) {
+			input = ir_insn_op(&ctx->ir_base[ref], j);
+			if (IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j))) {
+				ir_unroll_clone(ctx, data, input, copy);
+			}
+		}
+		new_ref = ir_emit_N(ctx, ctx->ir_base[ref].opt, ctx->ir_base[ref].inputs_count);
+		ir_set_alias_class(ctx, new_ref, ir_alias_class(ctx, ref));
+		for (j = 1; j <= n; j++) {
+			input = ir_insn_op(&ctx->ir_base[ref], j);
+			if (IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j))) {
+				input = ir_unroll_clone(ctx, data, input, copy);
+				if (input > 0) {
+					ir_use_list_add(ctx, input, new_ref);
+				}
+			}
+			ir_set_op(ctx, new_ref, j, input);
+		}
+	}
+	map[ref] = new_ref;
+	return new_ref;
+}
+
+static ir_ref ir_unroll(ir_ctx *ctx, ir_unroll_ctx *data, ir_op op, ir_ref limit)
+{
+	ir_ref header = data->header;
+	ir_ref entry_end = ctx->ir_base[header].op1;
+	ir_ref new_header, cond, if_ref, if_false, end, merge, proj, next, phi, ref, val, user;
+	ir_ref *map = data->map;
+	ir_list exit_phis;
+	uint32_t i, j, k, copy;
+
+	/* the main loop header */
+	new_header = ir_emit_N(ctx, IR_OPT(IR_LOOP_BEGIN, IR_VOID), 2);
+	ir_set_op(ctx, new_header, 1, entry_end);
+	ir_use_list_replace_one(ctx, entry_end, header, new_header);
+
+	for (i = 0; i < ir_list_len(&data->phis); i++) {
+		ref = ir_list_at(&data->phis, i);
+		phi = ir_emit_N(ctx, IR_OPT(IR_PHI, ctx->ir_base[ref].type), 3);
+		ir_set_op(ctx, phi, 1, new_header);
+		ir_use_list_add(ctx, new_header, phi);
+		val = ctx->ir_base[ref].op2;
+		ir_set_op(ctx, phi, 2, val);
+		if (val > 0) {
+			ir_use_list_add(ctx, val, phi);
+		}
+		map[ref] = phi;
+	}
+
+	/* if (iv + delta < limit) execute all the copies, otherwise go to the original loop */
+	cond = ir_unroll_emit2(ctx, IR_OPTX(op, IR_BOOL, 2), map[data->iv], limit);
+	if_ref = ir_unroll_emit2(ctx, IR_OPTX(IR_IF, IR_VOID, 2), new_header, cond);
+	data->entry = ir_unroll_emit2(ctx, IR_OPTX(IR_IF_TRUE, IR_VOID, 1), if_ref, IR_UNUSED);
+	if_false = ir_unroll_emit2(ctx, IR_OPTX(IR_IF_FALSE, IR_VOID, 1), if_ref, IR_UNUSED);
+	end = ir_unroll_emit2(ctx, IR_OPTX(IR_END, IR_VOID, 1), if_false, IR_UNUSED);
+
+	for (copy = 0; copy < data->count; copy++) {
+		ir_unroll_clone(ctx, data, data->latch, copy);
+		for (i = 0; i < ir_list_len(&data->exits); i++) {
+			ir_unroll_clone(ctx, data, ctx->ir_base[ir_list_at(&data->exits, i)].op1, copy);
+		}
+	}
+
+	/* back-edge of the main loop */
+	ref = ir_unroll_emit2(ctx, IR_OPTX(IR_LOOP_END, IR_VOID, 1),
+		ir_unroll_clone(ctx, data, data->latch, data->count - 1), IR_UNUSED);
+	ir_set_op(ctx, new_header, 2, ref);
+	ir_use_list_add(ctx, ref, new_header);
+	for (i = 0; i < ir_list_len(&data->phis); i++) {
+		ref = ir_list_at(&data->phis, i);
+		phi = map[ref];
+		val = ir_unroll_clone(ctx, data, ctx->ir_base[ref].op3, data->count - 1);
+		ir_set_op(ctx, phi, 3, val);
+		if (val > 0) {
+			ir_use_list_add(ctx, val, phi);
+		}
+	}
+
+	/* the original loop performs the remaining iterations */
+	ctx->ir_base[header].op1 = end;
+	ir_use_list_add(ctx, end, header);
+	for (i = 0; i < ir_list_len(&data->phis); i++) {
+		ref = ir_list_at(&data->phis, i);
+		val = ctx->ir_base[ref].op2;
+		if (val > 0) {
+			ir_use_list_remove_one(ctx, val, ref);
+		}
+		ctx->ir_base[ref].op2 = map[ref];
+		ir_use_list_add(ctx, map[ref], ref);
+	}
+
+	/* join the other exits of the copies with the original ones */
+	ir_list_init(&exit_phis, 8);
+	for (i = 0; i < ir_list_len(&data->exits); i++) {
+		proj = ir_list_at(&data->exits, i);
+		next = ctx->use_edges[ctx->use_lists[proj].refs];
+		merge = ir_emit_N(ctx, IR_OPT(IR_MERGE, IR_VOID), data->count + 1);
+		end = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), proj);
+		ir_use_list_replace_one(ctx, proj, next, end);
+		ir_set_op(ctx, merge, 1, end);
+		ir_use_list_add(ctx, end, merge);
+		ctx->ir_base[next].op1 = merge;
+		ir_use_list_add(ctx, merge, next);
+		for (copy = 0; copy < data->count; copy++) {
+			ref = ir_unroll_emit2(ctx, ctx->ir_base[proj].optx,
+				data->map[copy * data->map_size + ctx->ir_base[proj].op1], ctx->ir_base[proj].op2);
+			end = ir_unroll_emit2(ctx, IR_OPTX(IR_END, IR_VOID, 1), ref, IR_UNUSED);
+			ir_set_op(ctx, merge, copy + 2, end);
+			ir_use_list_add(ctx, end, merge);
+		}
+
+		for (j = 0; j < ir_list_len(&data->uses); j += 3) {
+			if ((uint32_t)ir_list_at(&data->uses, j + 2) != i) {
+				continue;
+			}
+			user = ir_list_at(&data->uses, j);
+			val = ir_insn_op(&ctx->ir_base[user], ir_list_at(&data->uses, j + 1));
+			phi = IR_UNUSED;
+			for (k = 0; k < ir_list_len(&exit_phis); k += 2) {
+				if (ir_list_at(&exit_phis, k) == val) {
+					phi = ir_list_at(&exit_phis, k + 1);
+					break;
+				}
+			}
+			if (!phi) {
+				phi = ir_emit_N(ctx, IR_OPT(IR_PHI, ctx->ir_base[val].type), data->count + 2);
+				ir_set_op(ctx, phi, 1, merge);
+				ir_use_list_add(ctx, merge, phi);
+				ir_set_op(ctx, phi, 2, val);
+				ir_use_list_add(ctx, val, phi);
+				for (copy = 0; copy < data->count; copy++) {
+					ref = ir_unroll_clone(ctx, data, val, copy);
+					ir_set_op(ctx, phi, copy + 3, ref);
+					ir_use_list_add(ctx, ref, phi);
+				}
+				ir_list_push(&exit_phis, val);
+				ir_list_push(&exit_phis, phi);
+			}
+			ir_use_list_remove_one(ctx, val, user);
+			ir_set_op(ctx, user, ir_list_at(&data->uses, j + 1), phi);
+			ir_use_list_add(ctx, phi, user);
+		}
+		ir_list_clear(&exit_phis);
+	}
+	ir_list_free(&exit_phis);
+
+	return new_header;
+}
+
+/* Recognize the loop, its induction variable, and check if it may be cloned */
+static bool ir_unroll_init(ir_ctx *ctx, ir_unroll_ctx *data, uint32_t hdr)
+{
+	ir_block *bb = &ctx->cfg_blocks[hdr];
+	ir_insn *insn = &ctx->ir_base[bb->start];
+	uint32_t i;
+
+	memset(data, 0, sizeof(ir_unroll_ctx));
+	data->header = bb->start;
+	data->loop = ir_bitset_malloc(ctx->insns_count);
+	ir_list_init(&data->nodes, 64);
+	ir_list_init(&data->phis, 8);
+	ir_list_init(&data->exits, 4);
+	ir_list_init(&data->uses, 8);
+
+	if (insn->op != IR_LOOP_BEGIN
+	 || insn->inputs_count != 2
+	 || ctx->ir_base[insn->op1].op != IR_END
+	 || ir_unroll_in_loop(ctx, ctx->cfg_map[insn->op1], hdr)
+	 || !ir_unroll_in_loop(ctx, ctx->cfg_map[insn->op2], hdr)) {
+		return 0;
+	}
+	data->latch = ctx->ir_base[insn->op2].op1;
+	if (!ir_unroll_collect(ctx, data, hdr)) {
+		return 0;
+	}
+
+	/* find the check of the induction variable */
+	for (i = 0; i < ir_list_len(&data->exits); i++) {
+		ir_ref exit = ir_list_at(&data->exits, i);
+
+		if (ir_dominates(ctx->cfg_blocks, ctx->cfg_map[ctx->ir_base[exit].op1], ctx->cfg_map[insn->op2])
+		 && ir_unroll_match_test(ctx, data, exit)) {
+			ir_list_del(&data->exits, i);
+			break;
+		}
+	}
+	return data->test && ir_unroll_collect_uses(ctx, data);
+}
+
+static void ir_unroll_free(ir_unroll_ctx *data)
+{
+	ir_list_free(&data->skip);
+	ir_list_free(&data->uses);
+	ir_list_free(&data->exits);
+	ir_list_free(&data->phis);
+	ir_list_free(&data->nodes);
+	ir_mem_free(data->loop);
+}
+
+/* The original loop of a versioned one (see ir_version_loops) is entered
+ * only to perform the last few iterations, or to fail on a GUARD */
+static bool ir_unroll_is_slow_path(const ir_ctx *ctx, ir_unroll_ctx *data)
+{
+	ir_ref ref = ctx->ir_base[ctx->ir_base[data->header].op1].op1;
+	uint32_t i;
+
+	if (ctx->ir_base[ref].op != IR_IF_FALSE
+	 || ctx->ir_base[ctx->ir_base[ctx->ir_base[ref].op1].op1].op != IR_LOOP_BEGIN) {
+		return 0;
+	}
+	for (i = 0; i < ir_list_len(&data->nodes); i++) {
+		ref = ir_list_at(&data->nodes, i);
+		if (ctx->ir_base[ref].op == IR_GUARD || ctx->ir_base[ref].op == IR_GUARD_NOT) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Returns the header of the new main loop or IR_UNUSED */
+static ir_ref ir_unroll_loop(ir_ctx *ctx, uint32_t hdr)
+{
+	ir_unroll_ctx data;
+	ir_type type;
+	ir_ref init_ref, ret = IR_UNUSED;
+	uint32_t size, bits;
+	uint64_t limit, init;
+
+	if (!ir_unroll_init(ctx, &data, hdr) || ir_unroll_is_slow_path(ctx, &data)) {
+		goto done;
+	}
+
+	size = ir_unroll_body_size(ctx, &data);
+	data.count = IR_UNROLL_FACTOR;
+	while (data.count > 1 && size * data.count > IR_UNROLL_MAX_INSNS) {
+		data.count--;
+	}
+	if (data.count < 2) {
+		goto done;
+	}
+
+	type = ctx->ir_base[data.iv].type;
+	bits = ir_type_size[type] * 8;
+	data.delta = (uint64_t)(data.count - 1 + data.offset) * (uint64_t)(data.step < 0 ? -data.step : data.step);
+	if ((data.step < 0 ? -data.step : data.step) >= ((int64_t)1 << 32)
+	 || data.delta >= ((uint64_t)1 << (bits - 2))) {
+		goto done;
+	}
+
+	/* don't unroll the loop if the main loop is never executed */
+	init_ref = ctx->ir_base[data.iv].op2;
+	if (ir_unroll_is_const(ctx, init_ref)
+	 && ir_unroll_const_limit(ctx, &data, &limit)) {
+		init = ir_unroll_ext(ctx->ir_base[init_ref].val.u64, data.type);
+		if ((data.op == IR_LT || data.op == IR_ULT) ?
+				!ir_unroll_less(init, limit, data.type) : !ir_unroll_less(limit, init, data.type)) {
+			goto done;
+		}
+	}
+
+	data.map_size = ctx->insns_count;
+	data.map = ir_mem_calloc(data.map_size * data.count, sizeof(ir_ref));
+	ret = ir_unroll(ctx, &data, data.op, ir_unroll_emit_limit(ctx, &data, type));
+	ir_mem_free(data.map);
+
+done:
+	ir_unroll_free(&data);
+	return ret;
+}
+
+/* Loop Rotation (Inversion)
+ *
+ * Converts a loop that checks the exit condition at the top
+ *
+ *   LOOP_BEGIN; IF(cond); IF_TRUE; body; LOOP_END
+ *
+ * into a guarded loop that checks the condition at the bottom
+ *
+ *   IF(cond[init]); IF_TRUE; LOOP_BEGIN; body; IF(cond[next]); IF_TRUE; LOOP_END
+ *
+ * The condition is cloned twice: for the initial values of the header PHIs
+ * (the guard in the preheader) and for their values on the back-edge. The
+ * body falls through into the latch that ends with a single backward
+ * conditional branch, and the first block of the body becomes the loop
+ * header where LICM may hoist invariant LOADs from. The values used after the
+ * loop get PHIs at the MERGE of the guard and the loop exits.
+ */
+#define IR_ROTATE_MAX_INSNS 16 /* max number of nodes to clone for the condition and the exit values */
+
+typedef struct _ir_rotate_ctx {
+	ir_ref     header;   /* LOOP_BEGIN */
+	ir_ref     stay;     /* projection of the header IF that continues the loop */
+	ir_ref     exit;     /* projection of the header IF that leaves the loop */
+	ir_bitset  deps;     /* data nodes that depend on the header PHIs */
+	ir_bitset  post;     /* deps computed after the loop exit (they use a node below the exit) */
+	ir_bitset  checked;  /* deps already checked for "post" */
+	ir_list    phis;     /* PHIs of the loop header */
+	ir_list    uses;     /* out of loop uses (user, operand number) */
+	ir_ref    *init_map; /* clones for the initial values of the header PHIs */
+	ir_ref    *next_map; /* clones for the back-edge values of the header PHIs */
+	ir_ref     map_size;
+} ir_rotate_ctx;
+
+static bool ir_loop_contains(const ir_ctx *ctx, uint32_t hdr, uint32_t b)
+{
+	while (b != hdr) {
+		b = ctx->cfg_blocks[b].loop_header;
+		if (!b) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static bool ir_loop_rebuild_cfg(ir_ctx *ctx)
+{
+	ir_reset_cfg(ctx);
+	return ir_build_cfg(ctx)
+		&& ir_build_dominators_tree(ctx)
+		&& ir_find_loops(ctx);
+}
+
+/* Emit a data node through the folding engine */
+static ir_ref ir_loop_fold(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3)
+{
+	ir_ref ref;
+
+restart:
+	switch (ir_folding(ctx, opt, op1, op2, op3, ctx->ir_base + op1, ctx->ir_base + op2, ctx->ir_base + op3)) {
+		case IR_FOLD_DO_RESTART:
+			opt = ctx->fold_insn.optx;
+			op1 = ctx->fold_insn.op1;
+			op2 = ctx->fold_insn.op2;
+			op3 = ctx->fold_insn.op3;
+			goto restart;
+		case IR_FOLD_DO_CSE:
+		case IR_FOLD_DO_EMIT:
+			opt = ctx->fold_insn.opt;
+			ref = ir_emit(ctx, opt, ctx->fold_insn.op1, ctx->fold_insn.op2, ctx->fold_insn.op3);
+			ctx->ir_base[ref].inputs_count = IR_INPUT_EDGES_COUNT(ir_op_flags[opt & IR_OPT_OP_MASK]);
+			if (ctx->fold_insn.op1 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op1, ref);
+			}
+			if (ctx->fold_insn.op2 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op2, ref);
+			}
+			if (ctx->fold_insn.op3 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op3, ref);
+			}
+			return ref;
+		case IR_FOLD_DO_COPY:
+			return ctx->fold_insn.op1;
+		case IR_FOLD_DO_CONST:
+			return ir_const(ctx, ctx->fold_insn.val, ctx->fold_insn.type);
+		default:
+			IR_ASSERT(0);
+			return IR_UNUSED;
+	}
+}
+
+/* Remove a dead node and the nodes of the "set" that become dead */
+static void ir_loop_remove_insn(ir_ctx *ctx, ir_bitset set, ir_ref set_size, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref n, *p, input;
+
+	IR_ASSERT(ctx->use_lists[ref].count == 0);
+	n = insn->inputs_count;
+	insn->opt = IR_NOP; /* keep "inputs_count" */
+	for (p = insn->ops + 1; n > 0; p++, n--) {
+		input = *p;
+		*p = IR_UNUSED;
+		if (input > 0) {
+			ir_use_list_remove_one(ctx, input, ref);
+			if (ctx->use_lists[input].count == 0
+			 && input < set_size
+			 && ir_bitset_in(set, input)
+			 && !(ir_op_flags[ctx->ir_base[input].op] & IR_OP_FLAG_CONTROL)) {
+				ir_loop_remove_insn(ctx, set, set_size, input);
+			}
+		}
+	}
+}
+
+/* Check if the node may be cloned and count the nodes to clone */
+static bool ir_rotate_check(const ir_ctx *ctx, ir_rotate_ctx *data, ir_ref ref, ir_bitset visited, uint32_t *count)
+{
+	const ir_insn *insn;
+	ir_ref j, n, input;
+	uint32_t flags;
+
+	if (ref <= 0 || !ir_bitset_in(data->deps, ref) || ir_bitset_in(visited, ref)) {
+		return 1;
+	}
+	ir_bitset_incl(visited, ref);
+	if (++(*count) > IR_ROTATE_MAX_INSNS) {
+		return 0;
+	}
+	insn = &ctx->ir_base[ref];
+	flags = ir_op_flags[insn->op];
+	if (IR_OP_HAS_VAR_INPUTS(flags)) {
+		return 0;
+	}
+	n = ir_input_edges_count(ctx, insn);
+	for (j = 1; j <= n; j++) {
+		input = ir_insn_op(insn, j);
+		if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			if (!ir_rotate_check(ctx, data, input, visited, count)) {
+				return 0;
+			}
+		} else if (IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j)) && input) {
+			return 0; /* control dependent node (e.g. guarded DIV) */
+		}
+	}
+	return 1;
+}
+
+static ir_ref ir_rotate_clone(ir_ctx *ctx, ir_rotate_ctx *data, ir_ref ref, ir_ref *map)
+{
+	ir_insn *insn;
+	ir_ref op1, op2, op3;
+	uint32_t flags;
+
+	if (ref <= 0 || ref >= data->map_size) {
+		return ref;
+	} else if (map[ref]) {
+		return map[ref];
+	} else if (!ir_bitset_in(data->deps, ref)) {
+		return ref;
+	}
+	insn = &ctx->ir_base[ref];
+	flags = ir_op_flags[insn->op];
+	op1 = insn->op1;
+	op2 = insn->op2;
+	op3 = insn->op3;
+	if (IR_OPND_KIND(flags, 1) == IR_OPND_DATA) {
+		op1 = ir_rotate_clone(ctx, data, op1, map);
+	}
+	if (IR_OPND_KIND(flags, 2) == IR_OPND_DATA) {
+		op2 = ir_rotate_clone(ctx, data, op2, map);
+	}
+	if (IR_OPND_KIND(flags, 3) == IR_OPND_DATA) {
+		op3 = ir_rotate_clone(ctx, data, op3, map);
+	}
+	map[ref] = ir_loop_fold(ctx, ctx->ir_base[ref].opt, op1, op2, op3);
+	return map[ref];
+}
+
+#define IR_ROTATE_MAX_CHECKS 256 /* max number of nodes visited to find the expressions computed after the exit */
+
+/* Check if the value may be computed only after the loop exit (it depends on a node below the exit) */
+static bool ir_rotate_after_exit(const ir_ctx *ctx, ir_rotate_ctx *data, ir_ref ref, uint32_t exit_b, int *budget)
+{
+	const ir_insn *insn;
+	ir_ref j, n, input;
+	uint32_t flags, b;
+	bool ret = 0;
+
+	if (ref <= 0) {
+		return 0;
+	} else if (ref < data->map_size && ir_bitset_in(data->checked, ref)) {
+		return ir_bitset_in(data->post, ref);
+	} else if (--(*budget) < 0) {
+		return 1;
+	}
+	insn = &ctx->ir_base[ref];
+	if (insn->op == IR_PHI) {
+		b = ctx->cfg_map[insn->op1];
+		return b && ir_dominates(ctx->cfg_blocks, exit_b, b);
+	}
+	flags = ir_op_flags[insn->op];
+	n = ir_input_edges_count(ctx, insn);
+	for (j = 1; j <= n && !ret; j++) {
+		input = ir_insn_op(insn, j);
+		if (input <= 0) {
+			continue;
+		} else if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			ret = ir_rotate_after_exit(ctx, data, input, exit_b, budget);
+		} else if (IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j))) {
+			b = ir_unroll_control_block(ctx, input);
+			ret = b && ir_dominates(ctx->cfg_blocks, exit_b, b);
+		}
+	}
+	if (ref < data->map_size && ir_bitset_in(data->deps, ref)) {
+		ir_bitset_incl(data->checked, ref);
+		if (ret) {
+			ir_bitset_incl(data->post, ref);
+		}
+	}
+	return ret;
+}
+
+/* A user is listed once per operand in the use list, record each (user, operand) pair once */
+static void ir_rotate_add_use(ir_rotate_ctx *data, ir_ref use, ir_ref j)
+{
+	uint32_t i;
+
+	for (i = 0; i < ir_list_len(&data->uses); i += 2) {
+		if (ir_list_at(&data->uses, i) == use && ir_list_at(&data->uses, i + 1) == j) {
+			return;
+		}
+	}
+	ir_list_push(&data->uses, use);
+	ir_list_push(&data->uses, j);
+}
+
+/* Collect the data nodes that depend on the header PHIs and their uses after the loop exit.
+ *
+ * Exit PHIs are created only for the header PHIs and the values computed in the loop.
+ * Expressions computed after the exit (e.g. "ADD(LOAD(exit, p), i)") are not cloned,
+ * their operands are replaced by the exit PHIs instead.
+ */
+static bool ir_rotate_collect(ir_ctx *ctx, ir_rotate_ctx *data, uint32_t hdr)
+{
+	ir_list nodes;
+	ir_use_list *use_list;
+	ir_insn *insn;
+	ir_ref ref, use, n, k, j, *p;
+	uint32_t i, b, flags, exit_b = ctx->cfg_map[data->exit];
+	int budget = IR_ROTATE_MAX_CHECKS;
+
+	use_list = &ctx->use_lists[data->header];
+	for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+		if (ctx->ir_base[*p].op == IR_PHI) {
+			ir_list_push(&data->phis, *p);
+		}
+	}
+
+	ir_list_init(&nodes, 16);
+	for (i = 0; i < ir_list_len(&data->phis); i++) {
+		ir_list_push(&nodes, ir_list_at(&data->phis, i));
+	}
+	for (i = 0; i < ir_list_len(&nodes); i++) {
+		ref = ir_list_at(&nodes, i);
+		use_list = &ctx->use_lists[ref];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			use = *p;
+			insn = &ctx->ir_base[use];
+			if (insn->op != IR_PHI
+			 && !(ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL)
+			 && !ir_bitset_in(data->deps, use)) {
+				ir_bitset_incl(data->deps, use);
+				ir_list_push(&nodes, use);
+			}
+		}
+	}
+
+	for (i = ir_list_len(&data->phis); i < ir_list_len(&nodes); i++) {
+		ir_rotate_after_exit(ctx, data, ir_list_at(&nodes, i), exit_b, &budget);
+	}
+	if (budget < 0) {
+		ir_list_free(&nodes);
+		return 0;
+	}
+
+	for (i = 0; i < ir_list_len(&nodes); i++) {
+		ref = ir_list_at(&nodes, i);
+		if (ir_bitset_in(data->post, ref)) {
+			continue;
+		}
+		use_list = &ctx->use_lists[ref];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			use = *p;
+			insn = &ctx->ir_base[use];
+			flags = ir_op_flags[insn->op];
+			if (insn->op != IR_PHI && !(flags & IR_OP_FLAG_CONTROL)) {
+				if (!ir_bitset_in(data->post, use)) {
+					continue;
+				}
+				/* expression computed after the exit */
+				k = ir_input_edges_count(ctx, insn);
+				for (j = 1; j <= k; j++) {
+					if (ir_insn_op(insn, j) == ref && IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+						ir_rotate_add_use(data, use, j);
+					}
+				}
+			} else if (use == ctx->cfg_blocks[hdr].end) {
+				continue;
+			} else if (insn->op == IR_PHI) {
+				b = ctx->cfg_map[insn->op1];
+				if (!b || ir_loop_contains(ctx, hdr, b)) {
+					continue;
+				}
+				k = insn->inputs_count;
+				for (j = 2; j <= k; j++) {
+					if (ir_insn_op(insn, j) == ref
+					 && ir_dominates(ctx->cfg_blocks, exit_b,
+							ctx->cfg_map[ir_insn_op(&ctx->ir_base[insn->op1], j - 1)])) {
+						ir_rotate_add_use(data, use, j);
+					}
+				}
+			} else {
+				b = ir_unroll_control_block(ctx, use);
+				if (!b
+				 || ir_loop_contains(ctx, hdr, b)
+				 || !ir_dominates(ctx->cfg_blocks, exit_b, b)) {
+					continue;
+				}
+				k = ir_input_edges_count(ctx, insn);
+				for (j = 1; j <= k; j++) {
+					if (ir_insn_op(insn, j) == ref && IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+						ir_rotate_add_use(data, use, j);
+					}
+				}
+			}
+		}
+	}
+	ir_list_free(&nodes);
+	return 1;
+}
+
+static ir_ref ir_rotate_exit_value(ir_ctx *ctx, ir_rotate_ctx *data, ir_ref val, ir_ref merge, ir_list *exit_phis)
+{
+	ir_ref phi, init, next;
+	uint32_t k;
+
+	for (k = 0; k < ir_list_len(exit_phis); k += 2) {
+		if (ir_list_at(exit_phis, k) == val) {
+			return ir_list_at(exit_phis, k + 1);
+		}
+	}
+	next = ir_rotate_clone(ctx, data, val, data->next_map);
+	if (!merge) {
+		phi = next;
+	} else {
+		init = ir_rotate_clone(ctx, data, val, data->init_map);
+		phi = ir_emit_N(ctx, IR_OPT(IR_PHI, ctx->ir_base[val].type), 3);
+		ir_set_op(ctx, phi, 1, merge);
+		ir_use_list_add(ctx, merge, phi);
+		ir_set_op(ctx, phi, 2, init);
+		if (init > 0) {
+			ir_use_list_add(ctx, init, phi);
+		}
+		ir_set_op(ctx, phi, 3, next);
+		if (next > 0) {
+			ir_use_list_add(ctx, next, phi);
+		}
+	}
+	ir_list_push(exit_phis, val);
+	ir_list_push(exit_phis, phi);
+	return phi;
+}
+
+static void ir_rotate(ir_ctx *ctx, ir_rotate_ctx *data, ir_ref if_ref)
+{
+	ir_ref header = data->header;
+	ir_ref cond = ctx->ir_base[if_ref].op2;
+	ir_ref stay_next = ctx->use_edges[ctx->use_lists[data->stay].refs];
+	ir_ref exit_next = ctx->use_edges[ctx->use_lists[data->exit].refs];
+	uint32_t stay_opt = IR_OPTX(ctx->ir_base[data->stay].op, IR_VOID, 1);
+	uint32_t exit_opt = IR_OPTX(ctx->ir_base[data->exit].op, IR_VOID, 1);
+	ir_ref stay_prob = ctx->ir_base[data->stay].op2;
+	ir_ref exit_prob = ctx->ir_base[data->exit].op2;
+	ir_ref entry_end, prev, loop_end, latch, guard_cond, latch_cond, ref, proj, merge, val, phi, user;
+	ir_ref guard_exit = IR_UNUSED;
+	ir_list exit_phis;
+	uint32_t i, j;
+
+	/* guard: check the condition for the initial values in the preheader */
+	guard_cond = ir_rotate_clone(ctx, data, cond, data->init_map);
+	if (!IR_IS_CONST_REF(guard_cond)
+	 || ir_const_is_true(&ctx->ir_base[guard_cond]) != (ctx->ir_base[data->stay].op == IR_IF_TRUE)) {
+		entry_end = ctx->ir_base[header].op1;
+		prev = ctx->ir_base[entry_end].op1;
+		ref = ir_emit2(ctx, IR_OPTX(IR_IF, IR_VOID, 2), prev, guard_cond);
+		ir_use_list_replace_one(ctx, prev, entry_end, ref);
+		if (guard_cond > 0) {
+			ir_use_list_add(ctx, guard_cond, ref);
+		}
+		proj = ir_emit2(ctx, stay_opt, ref, stay_prob);
+		ir_use_list_add(ctx, ref, proj);
+		ctx->ir_base[entry_end].op1 = proj;
+		ir_use_list_add(ctx, proj, entry_end);
+		proj = ir_emit2(ctx, exit_opt, ref, exit_prob);
+		ir_use_list_add(ctx, ref, proj);
+		guard_exit = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), proj);
+		ir_use_list_add(ctx, proj, guard_exit);
+	}
+
+	/* the body follows the LOOP_BEGIN directly */
+	ctx->ir_base[stay_next].op1 = header;
+	ir_use_list_replace_one(ctx, header, if_ref, stay_next);
+
+	/* latch: check the condition for the back-edge values */
+	loop_end = ctx->ir_base[header].op2;
+	latch = ctx->ir_base[loop_end].op1;
+	latch_cond = ir_rotate_clone(ctx, data, cond, data->next_map);
+	ref = ir_emit2(ctx, IR_OPTX(IR_IF, IR_VOID, 2), latch, latch_cond);
+	ir_use_list_replace_one(ctx, latch, loop_end, ref);
+	if (latch_cond > 0) {
+		ir_use_list_add(ctx, latch_cond, ref);
+	}
+	proj = ir_emit2(ctx, stay_opt, ref, stay_prob);
+	ir_use_list_add(ctx, ref, proj);
+	ctx->ir_base[loop_end].op1 = proj;
+	ir_use_list_add(ctx, proj, loop_end);
+	proj = ir_emit2(ctx, exit_opt, ref, exit_prob);
+	ir_use_list_add(ctx, ref, proj);
+
+	/* join the guard and the loop exits */
+	if (guard_exit) {
+		ref = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), proj);
+		ir_use_list_add(ctx, proj, ref);
+		merge = ir_emit_N(ctx, IR_OPT(IR_MERGE, IR_VOID), 2);
+		ir_set_op(ctx, merge, 1, guard_exit);
+		ir_use_list_add(ctx, guard_exit, merge);
+		ir_set_op(ctx, merge, 2, ref);
+		ir_use_list_add(ctx, ref, merge);
+		ref = merge;
+	} else {
+		merge = IR_UNUSED;
+		ref = proj;
+	}
+	ctx->ir_base[exit_next].op1 = ref;
+	ir_use_list_add(ctx, ref, exit_next);
+
+	/* values used after the loop */
+	ir_list_init(&exit_phis, 8);
+	for (i = 0; i < ir_list_len(&data->uses); i += 2) {
+		user = ir_list_at(&data->uses, i);
+		j = ir_list_at(&data->uses, i + 1);
+		val = ir_insn_op(&ctx->ir_base[user], j);
+		phi = ir_rotate_exit_value(ctx, data, val, merge, &exit_phis);
+		ir_use_list_remove_one(ctx, val, user);
+		ir_set_op(ctx, user, j, phi);
+		if (phi > 0) {
+			ir_use_list_add(ctx, phi, user);
+		}
+		if (ctx->use_lists[val].count == 0
+		 && ir_bitset_in(data->deps, val)) {
+			ir_loop_remove_insn(ctx, data->deps, data->map_size, val);
+		}
+	}
+	ir_list_free(&exit_phis);
+
+	/* remove the original check */
+	MAKE_NOP(&ctx->ir_base[data->stay]);
+	CLEAR_USES(data->stay);
+	MAKE_NOP(&ctx->ir_base[data->exit]);
+	CLEAR_USES(data->exit);
+	CLEAR_USES(if_ref);
+	if (cond > 0) {
+		ir_use_list_remove_one(ctx, cond, if_ref);
+	}
+	MAKE_NOP(&ctx->ir_base[if_ref]);
+	if (cond > 0
+	 && ctx->use_lists[cond].count == 0
+	 && ir_bitset_in(data->deps, cond)) {
+		ir_loop_remove_insn(ctx, data->deps, data->map_size, cond);
+	}
+
+	/* remove the header PHIs that were used only after the loop or only by their own update */
+	for (i = 0; i < ir_list_len(&data->phis); i++) {
+		phi = ir_list_at(&data->phis, i);
+		if (ctx->ir_base[phi].op != IR_PHI) {
+			continue;
+		}
+		if (ctx->use_lists[phi].count == 1) {
+			/* dead cycle: s = PHI(init, s2); s2 = ADD(s, x); */
+			user = ctx->use_edges[ctx->use_lists[phi].refs];
+			if (user == ctx->ir_base[phi].op3
+			 && user < data->map_size
+			 && ir_bitset_in(data->deps, user)
+			 && ctx->use_lists[user].count == 1) {
+				ctx->ir_base[phi].op3 = IR_UNUSED;
+				ir_use_list_remove_one(ctx, user, phi);
+				ir_loop_remove_insn(ctx, data->deps, data->map_size, user);
+			}
+		}
+		if (ctx->use_lists[phi].count == 0) {
+			ir_loop_remove_insn(ctx, data->deps, data->map_size, phi);
+		}
+	}
+}
+
+static bool ir_rotate_loop(ir_ctx *ctx, uint32_t hdr)
+{
+	ir_rotate_ctx data;
+	ir_block *bb = &ctx->cfg_blocks[hdr];
+	ir_insn *insn = &ctx->ir_base[bb->start];
+	ir_ref if_ref = bb->end;
+	ir_ref phi, cond;
+	ir_bitset visited;
+	uint32_t b1, b2, i, count = 0;
+	bool ret = 0;
+
+	if (insn->op != IR_LOOP_BEGIN
+	 || insn->inputs_count != 2
+	 || ctx->ir_base[insn->op1].op != IR_END
+	 || ir_loop_contains(ctx, hdr, ctx->cfg_map[insn->op1])
+	 || !ir_loop_contains(ctx, hdr, ctx->cfg_map[insn->op2])
+	 || ctx->ir_base[if_ref].op != IR_IF
+	 || ctx->ir_base[if_ref].op1 != bb->start
+	 || bb->successors_count != 2) {
+		return 0;
+	}
+
+	b1 = ctx->cfg_edges[bb->successors];
+	b2 = ctx->cfg_edges[bb->successors + 1];
+	if (ir_loop_contains(ctx, hdr, b1) == ir_loop_contains(ctx, hdr, b2)) {
+		return 0;
+	} else if (!ir_loop_contains(ctx, hdr, b1)) {
+		SWAP_REFS(b1, b2);
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.header = bb->start;
+	data.stay = ctx->cfg_blocks[b1].start;
+	data.exit = ctx->cfg_blocks[b2].start;
+	if (ctx->use_lists[data.stay].count != 1
+	 || ctx->use_lists[data.exit].count != 1
+	 || ctx->ir_base[ctx->use_edges[ctx->use_lists[data.stay].refs]].op == IR_LOOP_END) {
+		/* the loop is already bottom-tested */
+		return 0;
+	}
+
+	data.map_size = ctx->insns_count;
+	data.deps = ir_bitset_malloc(data.map_size);
+	data.post = ir_bitset_malloc(data.map_size);
+	data.checked = ir_bitset_malloc(data.map_size);
+	ir_list_init(&data.phis, 8);
+	ir_list_init(&data.uses, 8);
+
+	visited = ir_bitset_malloc(data.map_size);
+	cond = ctx->ir_base[if_ref].op2;
+	if (ir_rotate_collect(ctx, &data, hdr)
+	 && cond > 0
+	 && !ir_bitset_in(data.post, cond)
+	 && (ir_bitset_in(data.deps, cond)
+	  || (ctx->ir_base[cond].op == IR_PHI && ctx->ir_base[cond].op1 == data.header)) /* invariant conditions are not rotated */
+	 && ir_rotate_check(ctx, &data, cond, visited, &count)) {
+		for (i = 0; i < ir_list_len(&data.uses); i += 2) {
+			if (!ir_rotate_check(ctx, &data,
+					ir_insn_op(&ctx->ir_base[ir_list_at(&data.uses, i)], ir_list_at(&data.uses, i + 1)),
+					visited, &count)) {
+				break;
+			}
+		}
+		if (i == ir_list_len(&data.uses)) {
+			data.init_map = ir_mem_calloc(data.map_size * 2, sizeof(ir_ref));
+			data.next_map = data.init_map + data.map_size;
+			for (i = 0; i < ir_list_len(&data.phis); i++) {
+				phi = ir_list_at(&data.phis, i);
+				data.init_map[phi] = ctx->ir_base[phi].op2;
+				data.next_map[phi] = ctx->ir_base[phi].op3;
+			}
+			ir_rotate(ctx, &data, if_ref);
+			ir_mem_free(data.init_map);
+			ret = 1;
+		}
+	}
+	ir_mem_free(visited);
+
+	ir_list_free(&data.uses);
+	ir_list_free(&data.phis);
+	ir_mem_free(data.checked);
+	ir_mem_free(data.post);
+	ir_mem_free(data.deps);
+	return ret;
+}
+
+int ir_rotate_loops(ir_ctx *ctx)
+{
+	ir_list headers;
+	uint32_t b;
+	ir_block *bb;
+	bool changed;
+
+	if (!(ctx->flags2 & IR_CFG_HAS_LOOPS)
+	 || (ctx->flags2 & IR_IRREDUCIBLE_CFG)
+	 || (ctx->flags2 & IR_NO_LOOPS)) {
+		return 1;
+	}
+
+	ir_list_init(&headers, 16);
+	do {
+		changed = 0;
+		for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+			if ((bb->flags & (IR_BB_LOOP_HEADER|IR_BB_LOOP_WITH_ENTRY)) == IR_BB_LOOP_HEADER
+			 && !ir_list_contains(&headers, bb->start)) {
+				/* the LOOP_BEGIN is kept, so the loop is rotated only once */
+				ir_list_push(&headers, bb->start);
+				if (ir_rotate_loop(ctx, b)) {
+					changed = 1;
+					break;
+				}
+			}
+		}
+		if (changed && !ir_loop_rebuild_cfg(ctx)) {
+			ir_list_free(&headers);
+			return 0;
+		}
+	} while (changed);
+	ir_list_free(&headers);
+
+	return 1;
+}
+
+int ir_unroll_loops(ir_ctx *ctx)
+{
+	ir_list headers, mains;
+	uint32_t b, i;
+	ir_block *bb;
+	ir_ref new_header;
+	bool changed;
+
+	if (!(ctx->flags2 & IR_CFG_HAS_LOOPS)
+	 || (ctx->flags2 & IR_IRREDUCIBLE_CFG)
+	 || (ctx->flags2 & IR_NO_LOOPS)) {
+		return 1;
+	}
+
+	ir_list_init(&headers, 16);
+	ir_list_init(&mains, 4);
+	do {
+		changed = 0;
+		for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+			if ((bb->flags & (IR_BB_LOOP_HEADER|IR_BB_LOOP_WITH_ENTRY)) == IR_BB_LOOP_HEADER
+			 && !ir_list_contains(&headers, bb->start)) {
+				ir_list_push(&headers, bb->start);
+				new_header = ir_unroll_loop(ctx, b);
+				if (new_header) {
+					/* don't unroll the main loop again */
+					ir_list_push(&headers, new_header);
+					ir_list_push(&mains, new_header);
+					changed = 1;
+					break;
+				}
+			}
+		}
+		if (changed && !ir_loop_rebuild_cfg(ctx)) {
+			ir_list_free(&mains);
+			ir_list_free(&headers);
+			return 0;
+		}
+	} while (changed);
+	ir_list_free(&headers);
+
+	/* the main loops check the limit at the top */
+	for (i = 0; i < ir_list_len(&mains); i++) {
+		if (ir_rotate_loop(ctx, ctx->cfg_map[ir_list_at(&mains, i)])
+		 && !ir_loop_rebuild_cfg(ctx)) {
+			ir_list_free(&mains);
+			return 0;
+		}
+	}
+	ir_list_free(&mains);
+
+	return 1;
+}
+
+/* Loop Versioning
+ *
+ * Eliminates the bounds checks of the loops recognized by the unroller
+ *
+ *   GUARD(ULT(x, len)) or GUARD_NOT(UGE(x, len)), where x = iv or ADD(iv, c)
+ *
+ * "len" is loop invariant and "c" is a non-negative constant. The loop is
+ * cloned into a "fast" loop without these GUARDs (a single copy made by
+ * ir_unroll()). The header of the fast loop checks that the current iteration
+ * stays in the loop and passes all the checks
+ *
+ *   ULT(iv, MIN(limit, len - c, ...))
+ *
+ * otherwise the original loop performs the remaining iterations. So a failing
+ * GUARD is still executed at the same iteration, with its SNAPSHOT and exit
+ * address. Loop invariant GUARDs are moved out of the loops by LICM.
+ */
+#define IR_VERSION_MAX_INSNS 256 /* max number of nodes in the fast loop */
+
+/* Match the GUARD and return the bound of the induction variable (len - c) */
+static ir_ref ir_version_match_guard(ir_ctx *ctx, ir_unroll_ctx *data, ir_ref ref, ir_type cmp_type)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = ctx->ir_base[data->iv].type;
+	ir_ref x, len, cond, c_ref;
+	ir_op op;
+	ir_val c;
+
+	if (IR_IS_CONST_REF(insn->op2)) {
+		return IR_UNUSED;
+	}
+	cond = insn->op2;
+	op = ctx->ir_base[cond].op;
+	if (insn->op == IR_GUARD_NOT) {
+		op ^= 1; /* negate */
+	}
+	if (op == IR_ULT) {
+		x = ctx->ir_base[cond].op1;
+		len = ctx->ir_base[cond].op2;
+	} else if (op == IR_UGT) {
+		x = ctx->ir_base[cond].op2;
+		len = ctx->ir_base[cond].op1;
+	} else {
+		return IR_UNUSED;
+	}
+	if (len > 0 && ir_bitset_in(data->loop, len)) {
+		return IR_UNUSED;
+	}
+
+	if (x == data->iv) {
+		return len;
+	} else if (x <= 0 || ctx->ir_base[x].op != IR_ADD) {
+		return IR_UNUSED;
+	}
+	insn = &ctx->ir_base[x];
+	if (insn->op1 == data->iv) {
+		c_ref = insn->op2;
+	} else if (insn->op2 == data->iv) {
+		c_ref = insn->op1;
+	} else {
+		return IR_UNUSED;
+	}
+	if (!ir_unroll_is_const(ctx, c_ref)) {
+		return IR_UNUSED;
+	}
+	c.u64 = ir_unroll_ext(ctx->ir_base[c_ref].val.u64, cmp_type);
+	if (c.u64 >= ((uint64_t)1 << (ir_type_size[type] * 8 - 2))) {
+		return IR_UNUSED;
+	}
+
+	/* len - c, saturated to 0 */
+	cond = ir_unroll_emit2(ctx, IR_OPTX(IR_ULT, IR_BOOL, 2), len, c_ref);
+	x = ir_unroll_emit2(ctx, IR_OPTX(IR_SUB, type, 2), len, c_ref);
+	c.u64 = 0;
+	ref = ir_emit3(ctx, IR_OPTX(IR_COND, type, 3), cond, ir_const(ctx, c, type), x);
+	ir_use_list_add(ctx, cond, ref);
+	ir_use_list_add(ctx, x, ref);
+	return ref;
+}
+
+/* Returns the header of the fast loop or IR_UNUSED */
+static ir_ref ir_version_loop(ir_ctx *ctx, uint32_t hdr)
+{
+	ir_unroll_ctx data;
+	ir_type type, cmp_type;
+	ir_ref ref, bound, limit, ret = IR_UNUSED;
+	ir_insn *insn;
+	uint32_t i, n;
+	ir_val val;
+
+	if (!ir_unroll_init(ctx, &data, hdr)) {
+		goto done;
+	}
+
+	type = ctx->ir_base[data.iv].type;
+	cmp_type = ir_unroll_cmp_type(type, IR_ULT);
+	data.delta = (uint64_t)data.offset * (uint64_t)data.step;
+	if ((data.op != IR_ULT && (data.op != IR_LT || !IR_IS_TYPE_SIGNED(type)))
+	 || data.step >= ((int64_t)1 << 32)
+	 || data.delta >= ((uint64_t)1 << (ir_type_size[type] * 8 - 2))
+	 || ir_unroll_body_size(ctx, &data) > IR_VERSION_MAX_INSNS) {
+		goto done;
+	}
+
+	/* the limit of the fast loop: MIN(limit, len - c, ...) */
+	ir_list_init(&data.skip, 4);
+	limit = IR_UNUSED;
+	n = ir_list_len(&data.nodes);
+	for (i = 0; i < n; i++) {
+		ref = ir_list_at(&data.nodes, i);
+		insn = &ctx->ir_base[ref];
+		if ((insn->op == IR_GUARD || insn->op == IR_GUARD_NOT)
+		 && (bound = ir_version_match_guard(ctx, &data, ref, cmp_type))) {
+			if (!limit) {
+				limit = ir_unroll_emit_limit(ctx, &data, type);
+				if (data.op == IR_LT) {
+					/* negative values of the induction variable fail the ULT check */
+					val.u64 = 0;
+					limit = ir_unroll_emit_minmax(ctx, IR_MAX, type, type, limit, ir_const(ctx, val, type));
+				}
+			}
+			limit = ir_unroll_emit_minmax(ctx, IR_MIN, type, cmp_type, limit, bound);
+			ir_list_push(&data.skip, ref);
+			if (insn->op1 != data.header
+			 && ctx->ir_base[insn->op1].op == IR_SNAPSHOT
+			 && ctx->use_lists[insn->op1].count == 1) {
+				ir_list_push(&data.skip, insn->op1);
+			}
+		}
+	}
+	if (!limit) {
+		goto done;
+	}
+
+	data.count = 1;
+	data.map_size = ctx->insns_count;
+	data.map = ir_mem_calloc(data.map_size, sizeof(ir_ref));
+	ret = ir_unroll(ctx, &data, IR_ULT, limit);
+	ir_mem_free(data.map);
+
+done:
+	ir_unroll_free(&data);
+	return ret;
+}
+
+int ir_version_loops(ir_ctx *ctx)
+{
+	ir_list headers;
+	uint32_t b;
+	ir_block *bb;
+	ir_ref new_header;
+	bool changed;
+
+	if (!(ctx->flags2 & IR_CFG_HAS_LOOPS)
+	 || (ctx->flags2 & IR_IRREDUCIBLE_CFG)
+	 || (ctx->flags2 & IR_NO_LOOPS)) {
+		return 1;
+	}
+
+	ir_list_init(&headers, 16);
+	do {
+		changed = 0;
+		for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+			if ((bb->flags & (IR_BB_LOOP_HEADER|IR_BB_LOOP_WITH_ENTRY)) == IR_BB_LOOP_HEADER
+			 && !ir_list_contains(&headers, bb->start)) {
+				ir_list_push(&headers, bb->start);
+				new_header = ir_version_loop(ctx, b);
+				if (new_header) {
+					/* the fast loop doesn't have the GUARDs */
+					ir_list_push(&headers, new_header);
+					changed = 1;
+					break;
+				}
+			}
+		}
+		if (changed && !ir_loop_rebuild_cfg(ctx)) {
+			ir_list_free(&headers);
+			return 0;
+		}
+	} while (changed);
+	ir_list_free(&headers);
+
+	return 1;
+}
+
+/* Induction Variable Strength Reduction
+ *
+ * Replaces the address expressions computed from a simple induction variable
+ *
+ *   x2 = PHI(loop, x1, x3); x3 = ADD(x2, step); ... ADD(base, MUL(EXT(x2 + k), scale))
+ *
+ * where "base" is loop invariant and "step", "k" and "scale" are constants,
+ * by a pointer induction variable
+ *
+ *   p2 = PHI(loop, p1, p3); p3 = ADD(p2, step * scale); ... ADD(p2, k * scale)
+ *
+ * where p1 is the address computed for x1. The expressions with the same
+ * "base" and "scale" share the pointer. When the induction variable is used
+ * only by these expressions and by comparisons with loop invariant limits,
+ * the comparisons are rewritten to compare the pointer with the address
+ * computed for the limit (Linear Function Test Replacement) and the variable
+ * is removed. Otherwise, only the expressions with the scales that can't be
+ * folded into addressing modes are reduced.
+ *
+ * As ir_try_promote_induction_var_ext(), this assumes that the induction
+ * variable doesn't overflow.
+ */
+#define IR_IVSR_MAX_VALUES 16 /* max number of the "x2 + k" values */
+#define IR_IVSR_MAX_SHIFT  16 /* max scale is (1 << IR_IVSR_MAX_SHIFT) */
+#define IR_IVSR_MAX_GROUPS 2  /* max number of pointers that may replace the induction variable */
+
+typedef struct _ir_ivsr_ctx {
+	ir_ref     header;   /* LOOP_BEGIN */
+	ir_ref     iv;       /* PHI of the induction variable */
+	int64_t    step;
+	uint32_t   count;    /* number of the values */
+	ir_ref     values[IR_IVSR_MAX_VALUES];  /* x2 + k */
+	int64_t    offsets[IR_IVSR_MAX_VALUES]; /* k */
+	ir_bitset  loop;     /* the loop nodes and the nodes that depend on them */
+	ir_ref     loop_size;
+	ir_list    exprs;    /* address expressions */
+	ir_list    tests;    /* comparisons with loop invariant limits */
+} ir_ivsr_ctx;
+
+typedef struct _ir_ivsr_expr {
+	ir_ref     base;
+	ir_ref     scale;    /* constant operand of MUL or SHL */
+	ir_op      op;       /* MUL or SHL */
+	ir_op      ext;      /* SEXT, ZEXT or NOP */
+	ir_type    type;
+	uint64_t   factor;   /* the value of the scale */
+	int64_t    offset;   /* k */
+} ir_ivsr_expr;
+
+/* The constants are signed even for unsigned variables */
+static int64_t ir_ivsr_const(const ir_ctx *ctx, ir_ref ref, ir_type type)
+{
+	return (int64_t)ir_unroll_ext(ctx->ir_base[ref].val.u64,
+		IR_IS_TYPE_SIGNED(type) ? type : (ir_type_size[type] == 8 ? IR_I64 : IR_I32));
+}
+
+static void ir_ivsr_mark_loop(ir_ctx *ctx, ir_ivsr_ctx *data, uint32_t hdr)
+{
+	ir_list nodes;
+	ir_block *bb;
+	ir_use_list *use_list;
+	ir_ref ref, use, n, *p;
+	uint32_t b, i;
+
+	ir_list_init(&nodes, 64);
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		if (ir_loop_contains(ctx, hdr, b)) {
+			ref = bb->end;
+			while (1) {
+				ir_bitset_incl(data->loop, ref);
+				ir_list_push(&nodes, ref);
+				if (ref == bb->start) {
+					break;
+				}
+				ref = ctx->ir_base[ref].op1;
+			}
+		}
+	}
+	for (i = 0; i < ir_list_len(&nodes); i++) {
+		use_list = &ctx->use_lists[ir_list_at(&nodes, i)];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			use = *p;
+			if (!ir_bitset_in(data->loop, use)
+			 && !(ir_op_flags[ctx->ir_base[use].op] & IR_OP_FLAG_CONTROL)) {
+				ir_bitset_incl(data->loop, use);
+				ir_list_push(&nodes, use);
+			}
+		}
+	}
+	ir_list_free(&nodes);
+}
+
+static bool ir_ivsr_is_invariant(const ir_ivsr_ctx *data, ir_ref ref)
+{
+	return IR_IS_CONST_REF(ref) || (ref > 0 && ref < data->loop_size && !ir_bitset_in(data->loop, ref));
+}
+
+static int ir_ivsr_find_value(const ir_ivsr_ctx *data, ir_ref ref)
+{
+	uint32_t i;
+
+	for (i = 0; i < data->count; i++) {
+		if (data->values[i] == ref) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Match x2 = PHI(loop, x1, x3); x3 = ADD(x2, step) and collect the values "x2 + k" */
+static bool ir_ivsr_match_iv(ir_ctx *ctx, ir_ivsr_ctx *data, ir_ref phi)
+{
+	const ir_insn *insn = &ctx->ir_base[phi];
+	const ir_insn *use_insn;
+	ir_use_list *use_list;
+	ir_ref next, ref, n, *p;
+	ir_type type = insn->type;
+	uint32_t i;
+	int j;
+	int64_t k;
+
+	next = insn->op3;
+	if (insn->inputs_count != 3
+	 || IR_IS_CONST_REF(next)
+	 || !IR_IS_TYPE_INT(type)
+	 || ir_type_size[type] < 4) {
+		return 0;
+	}
+
+	data->iv = phi;
+	data->count = 1;
+	data->values[0] = phi;
+	data->offsets[0] = 0;
+	for (i = 0; i < data->count; i++) {
+		use_list = &ctx->use_lists[data->values[i]];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			ref = *p;
+			use_insn = &ctx->ir_base[ref];
+			if (use_insn->type != type
+			 || (use_insn->op != IR_ADD && use_insn->op != IR_SUB)) {
+				continue;
+			} else if (use_insn->op1 == data->values[i] && ir_unroll_is_const(ctx, use_insn->op2)) {
+				k = ir_ivsr_const(ctx, use_insn->op2, type);
+			} else if (use_insn->op == IR_ADD
+			 && use_insn->op2 == data->values[i]
+			 && ir_unroll_is_const(ctx, use_insn->op1)) {
+				k = ir_ivsr_const(ctx, use_insn->op1, type);
+			} else {
+				continue;
+			}
+			if (ir_ivsr_find_value(data, ref) >= 0) {
+				continue;
+			} else if (data->count == IR_IVSR_MAX_VALUES) {
+				return 0;
+			}
+			data->values[data->count] = ref;
+			data->offsets[data->count] = data->offsets[i] + (use_insn->op == IR_SUB ? -k : k);
+			data->count++;
+		}
+	}
+
+	j = ir_ivsr_find_value(data, next);
+	if (j < 0 || data->offsets[j] == 0) {
+		return 0;
+	}
+	data->step = data->offsets[j];
+	return 1;
+}
+
+/* Match ADD(base, MUL(EXT(x2 + k), scale)) or ADD(base, SHL(EXT(x2 + k), scale)) */
+static bool ir_ivsr_match_expr(const ir_ctx *ctx, const ir_ivsr_ctx *data, ir_ref ref, ir_ivsr_expr *expr)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	const ir_insn *scale_insn;
+	ir_ref base, scaled, idx;
+	ir_type iv_type = ctx->ir_base[data->iv].type;
+	uint64_t factor;
+	ir_op ext;
+	int i, j;
+
+	if (insn->op != IR_ADD) {
+		return 0;
+	}
+	for (j = 0; j < 2; j++) {
+		base = j ? insn->op2 : insn->op1;
+		scaled = j ? insn->op1 : insn->op2;
+		if (IR_IS_CONST_REF(scaled) || !ir_ivsr_is_invariant(data, base)) {
+			continue;
+		}
+		scale_insn = &ctx->ir_base[scaled];
+		if (scale_insn->type != insn->type || !ir_unroll_is_const(ctx, scale_insn->op2)) {
+			continue;
+		}
+		factor = ir_unroll_ext(ctx->ir_base[scale_insn->op2].val.u64, insn->type);
+		if (scale_insn->op == IR_MUL) {
+			if (factor < 2 || factor > ((uint64_t)1 << IR_IVSR_MAX_SHIFT)) {
+				continue;
+			}
+		} else if (scale_insn->op == IR_SHL) {
+			if (factor < 1 || factor > IR_IVSR_MAX_SHIFT) {
+				continue;
+			}
+			factor = (uint64_t)1 << factor;
+		} else {
+			continue;
+		}
+		idx = scale_insn->op1;
+		ext = IR_NOP;
+		if (!IR_IS_CONST_REF(idx)
+		 && (ctx->ir_base[idx].op == IR_SEXT || ctx->ir_base[idx].op == IR_ZEXT)) {
+			ext = ctx->ir_base[idx].op;
+			idx = ctx->ir_base[idx].op1;
+		}
+		if (IR_IS_CONST_REF(idx)
+		 || ctx->ir_base[idx].type != (ext != IR_NOP ? iv_type : insn->type)) {
+			continue;
+		}
+		i = ir_ivsr_find_value(data, idx);
+		if (i < 0) {
+			continue;
+		}
+		expr->base = base;
+		expr->scale = scale_insn->op2;
+		expr->op = scale_insn->op;
+		expr->ext = ext;
+		expr->type = insn->type;
+		expr->factor = factor;
+		expr->offset = data->offsets[i];
+		return 1;
+	}
+	return 0;
+}
+
+#define IR_IVSR_MAX_CHECKS 64 /* max number of nodes visited to check the base */
+
+/* Check if the value is computed before the loop (e.g. not after the exit) */
+static bool ir_ivsr_before_loop(const ir_ctx *ctx, ir_ref ref, uint32_t hdr, int *budget)
+{
+	const ir_insn *insn;
+	ir_ref j, n, input;
+	uint32_t flags, b;
+
+	if (IR_IS_CONST_REF(ref)) {
+		return 1;
+	} else if (--(*budget) < 0) {
+		return 0;
+	}
+	insn = &ctx->ir_base[ref];
+	if (insn->op == IR_PHI) {
+		b = ctx->cfg_map[insn->op1];
+		return b && b != hdr && ir_dominates(ctx->cfg_blocks, b, hdr);
+	}
+	flags = ir_op_flags[insn->op];
+	n = ir_input_edges_count(ctx, insn);
+	for (j = 1; j <= n; j++) {
+		input = ir_insn_op(insn, j);
+		if (input <= 0) {
+			continue;
+		} else if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			if (!ir_ivsr_before_loop(ctx, input, hdr, budget)) {
+				return 0;
+			}
+		} else if (IR_IS_REF_OPND_KIND(IR_OPND_KIND(flags, j))) {
+			b = ir_unroll_control_block(ctx, input);
+			if (!b || b == hdr || !ir_dominates(ctx->cfg_blocks, b, hdr)) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static bool ir_ivsr_same_group(const ir_ivsr_expr *a, const ir_ivsr_expr *b)
+{
+	return a->base == b->base
+		&& a->scale == b->scale
+		&& a->op == b->op
+		&& a->ext == b->ext
+		&& a->type == b->type;
+}
+
+/* Collect the address expressions that use EXT, MUL or SHL (their base must be available in the preheader) */
+static bool ir_ivsr_collect_exprs(ir_ctx *ctx, ir_ivsr_ctx *data, ir_ref ref)
+{
+	ir_use_list *use_list = &ctx->use_lists[ref];
+	ir_ref n, *p, use;
+	ir_op op;
+	ir_ivsr_expr expr;
+	int budget = IR_IVSR_MAX_CHECKS;
+	bool ret = 1;
+
+	for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+		use = *p;
+		op = ctx->ir_base[use].op;
+		if ((ctx->ir_base[ref].op == IR_SEXT || ctx->ir_base[ref].op == IR_ZEXT)
+		 && (op == IR_MUL || op == IR_SHL)) {
+			if (!ir_ivsr_collect_exprs(ctx, data, use)) {
+				ret = 0;
+			}
+		} else if (ir_ivsr_match_expr(ctx, data, use, &expr)
+		 && (ir_list_contains(&data->exprs, use)
+		  || ir_ivsr_before_loop(ctx, expr.base, ctx->cfg_map[data->header], &budget))) {
+			if (!ir_list_contains(&data->exprs, use)) {
+				ir_list_push(&data->exprs, use);
+			}
+		} else {
+			ret = 0;
+		}
+	}
+	return ret;
+}
+
+/* Collect the address expressions and the comparisons. Returns 0 if the values have other uses. */
+static bool ir_ivsr_collect(ir_ctx *ctx, ir_ivsr_ctx *data)
+{
+	ir_use_list *use_list;
+	ir_insn *insn;
+	ir_ref ref, use, n, *p;
+	uint32_t i;
+	bool ret = 1;
+
+	for (i = 0; i < data->count; i++) {
+		ref = data->values[i];
+		use_list = &ctx->use_lists[ref];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			use = *p;
+			if (use == data->iv || ir_ivsr_find_value(data, use) >= 0) {
+				continue;
+			}
+			insn = &ctx->ir_base[use];
+			if (insn->op >= IR_LT && insn->op <= IR_UGT) {
+				if (ir_ivsr_is_invariant(data, insn->op1 == ref ? insn->op2 : insn->op1)) {
+					if (!ir_list_contains(&data->tests, use)) {
+						ir_list_push(&data->tests, use);
+					}
+					continue;
+				}
+			} else if (insn->op == IR_SEXT || insn->op == IR_ZEXT || insn->op == IR_MUL || insn->op == IR_SHL) {
+				if (ir_ivsr_collect_exprs(ctx, data, use)) {
+					continue;
+				}
+			}
+			ret = 0;
+		}
+	}
+	return ret;
+}
+
+/* Check if the comparison may be replaced by the comparison of the pointers */
+static bool ir_ivsr_check_test(const ir_ctx *ctx, const ir_ivsr_ctx *data, ir_ref ref, const ir_ivsr_expr *expr)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = ctx->ir_base[data->iv].type;
+	ir_op op = insn->op;
+
+	if (ir_ivsr_find_value(data, insn->op1) < 0) {
+		op ^= 3; /* swap operands */
+	}
+
+	/* the pointers must keep all the values of the variable and the limit */
+	if (ir_type_size[type] != 4 || ir_type_size[expr->type] != 8) {
+		return 0;
+	} else if (op >= IR_ULT || !IR_IS_TYPE_SIGNED(type)) {
+		if (IR_IS_TYPE_SIGNED(type) || expr->ext != IR_ZEXT) {
+			return 0;
+		}
+	} else if (expr->ext != IR_SEXT) {
+		return 0;
+	}
+
+	/* LT and GE for increasing variables, GT and LE for decreasing ones */
+	return data->step > 0 ? (op & 3) <= 1 : (op & 3) >= 2;
+}
+
+static ir_ref ir_ivsr_emit_const(ir_ctx *ctx, uint64_t val, ir_type type)
+{
+	ir_val v;
+
+	v.u64 = ir_unroll_ext(val, type);
+	return ir_const(ctx, v, type);
+}
+
+/* Emit ADD(base, MUL(EXT(ref), scale)) */
+static ir_ref ir_ivsr_emit_addr(ir_ctx *ctx, const ir_ivsr_expr *expr, ir_ref ref)
+{
+	if (expr->ext != IR_NOP) {
+		ref = ir_loop_fold(ctx, IR_OPT(expr->ext, expr->type), ref, IR_UNUSED, IR_UNUSED);
+	}
+	ref = ir_loop_fold(ctx, IR_OPT(expr->op, expr->type), ref, expr->scale, IR_UNUSED);
+	return ir_loop_fold(ctx, IR_OPT(IR_ADD, expr->type), expr->base, ref, IR_UNUSED);
+}
+
+/* Emit the pointer for "x2 + k" */
+static ir_ref ir_ivsr_emit_ptr(ir_ctx *ctx, const ir_ivsr_ctx *data, const ir_ivsr_expr *expr, ir_ref ptr, int64_t k)
+{
+	if (k == 0) {
+		return ptr;
+	} else if (k == data->step) {
+		return ctx->ir_base[ptr].op3;
+	}
+	return ir_loop_fold(ctx, IR_OPT(IR_ADD, expr->type),
+		ptr, ir_ivsr_emit_const(ctx, (uint64_t)k * expr->factor, expr->type), IR_UNUSED);
+}
+
+static void ir_ivsr_replace_test(ir_ctx *ctx, ir_ivsr_ctx *data, ir_ref ref, const ir_ivsr_expr *expr, ir_ref ptr)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_type type = ctx->ir_base[data->iv].type;
+	ir_ref val = insn->op1;
+	ir_ref limit = insn->op2;
+	ir_ref first;
+	ir_op op = insn->op;
+	int i;
+
+	i = ir_ivsr_find_value(data, val);
+	if (i < 0) {
+		SWAP_REFS(val, limit);
+		op ^= 3; /* swap operands */
+		i = ir_ivsr_find_value(data, val);
+	}
+	IR_ASSERT(i >= 0);
+
+	/* The variable is compared starting from "x1 + k". The limit is moved to this value,
+	 * if it's before, to avoid overflow of the address computed for the limit. */
+	first = ir_loop_fold(ctx, IR_OPT(IR_ADD, type), ctx->ir_base[data->iv].op2,
+		ir_ivsr_emit_const(ctx, (uint64_t)data->offsets[i], type), IR_UNUSED);
+	limit = ir_loop_fold(ctx, IR_OPT(data->step > 0 ? IR_MAX : IR_MIN, type), limit, first, IR_UNUSED);
+	limit = ir_ivsr_emit_addr(ctx, expr, limit);
+
+	val = ir_ivsr_emit_ptr(ctx, data, expr, ptr, data->offsets[i]);
+	val = ir_loop_fold(ctx, IR_OPT(IR_ULT + (op & 3), IR_BOOL), val, limit, IR_UNUSED);
+	ir_replace(ctx, ref, val);
+	CLEAR_USES(ref);
+	ir_loop_remove_insn(ctx, data->loop, data->loop_size, ref);
+}
+
+/* Remove the induction variable that is used only by its own values */
+static void ir_ivsr_remove_iv(ir_ctx *ctx, ir_ivsr_ctx *data)
+{
+	ir_use_list *use_list;
+	ir_insn *insn;
+	ir_ref ref, n, *p;
+	uint32_t i;
+
+	for (i = 0; i < data->count; i++) {
+		use_list = &ctx->use_lists[data->values[i]];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			if (ir_ivsr_find_value(data, *p) < 0) {
+				return;
+			}
+		}
+	}
+	for (i = 0; i < data->count; i++) {
+		ref = data->values[i];
+		insn = &ctx->ir_base[ref];
+		if (insn->op == IR_NOP) {
+			continue;
+		}
+		for (n = insn->inputs_count, p = insn->ops + 1; n > 0; p++, n--) {
+			if (*p > 0) {
+				ir_use_list_remove_one(ctx, *p, ref);
+			}
+			*p = IR_UNUSED;
+		}
+		insn->opt = IR_NOP; /* keep "inputs_count" */
+	}
+	for (i = 0; i < data->count; i++) {
+		CLEAR_USES(data->values[i]);
+	}
+}
+
+static void ir_ivsr(ir_ctx *ctx, ir_ivsr_ctx *data)
+{
+	ir_ivsr_expr expr, e;
+	ir_ref ref, ptr, val;
+	uint32_t i, j, groups = 0;
+	bool replace_iv;
+
+	replace_iv = ir_ivsr_collect(ctx, data);
+	if (ir_list_len(&data->exprs) == 0) {
+		return;
+	}
+
+	/* check if all the uses of the variable may be replaced */
+	if (replace_iv) {
+		for (i = 0; i < ir_list_len(&data->exprs); i++) {
+			ir_ivsr_match_expr(ctx, data, ir_list_at(&data->exprs, i), &expr);
+			for (j = 0; j < i; j++) {
+				ir_ivsr_match_expr(ctx, data, ir_list_at(&data->exprs, j), &e);
+				if (ir_ivsr_same_group(&expr, &e)) {
+					break;
+				}
+			}
+			if (j == i) {
+				groups++;
+			}
+		}
+		ir_ivsr_match_expr(ctx, data, ir_list_at(&data->exprs, 0), &expr);
+		for (i = 0; i < ir_list_len(&data->tests); i++) {
+			if (!ir_ivsr_check_test(ctx, data, ir_list_at(&data->tests, i), &expr)) {
+				break;
+			}
+		}
+		replace_iv = groups <= IR_IVSR_MAX_GROUPS && i == ir_list_len(&data->tests);
+	}
+
+	for (i = 0; i < ir_list_len(&data->exprs); i++) {
+		ref = ir_list_at(&data->exprs, i);
+		if (!ref) {
+			continue;
+		}
+		ir_ivsr_match_expr(ctx, data, ref, &expr);
+		if (!replace_iv && !(expr.factor & (expr.factor - 1)) && expr.factor <= 8) {
+			/* the scale may be folded into the addressing mode */
+			continue;
+		}
+
+		/* p2 = PHI(loop, p1, p3); p3 = ADD(p2, step * scale) */
+		ptr = ir_emit_N(ctx, IR_OPT(IR_PHI, expr.type), 3);
+		ir_set_op(ctx, ptr, 1, data->header);
+		ir_use_list_add(ctx, data->header, ptr);
+		val = ir_ivsr_emit_addr(ctx, &expr, ctx->ir_base[data->iv].op2);
+		ir_set_op(ctx, ptr, 2, val);
+		if (val > 0) {
+			ir_use_list_add(ctx, val, ptr);
+		}
+		val = ir_loop_fold(ctx, IR_OPT(IR_ADD, expr.type),
+			ptr, ir_ivsr_emit_const(ctx, (uint64_t)data->step * expr.factor, expr.type), IR_UNUSED);
+		ir_set_op(ctx, ptr, 3, val);
+		ir_use_list_add(ctx, val, ptr);
+
+		for (j = i; j < ir_list_len(&data->exprs); j++) {
+			ref = ir_list_at(&data->exprs, j);
+			if (!ref) {
+				continue;
+			}
+			ir_ivsr_match_expr(ctx, data, ref, &e);
+			if (!ir_ivsr_same_group(&expr, &e)) {
+				continue;
+			}
+			val = ir_ivsr_emit_ptr(ctx, data, &expr, ptr, e.offset);
+			ir_replace(ctx, ref, val);
+			CLEAR_USES(ref);
+			ir_loop_remove_insn(ctx, data->loop, data->loop_size, ref);
+			ir_list_set(&data->exprs, j, IR_UNUSED);
+		}
+
+		if (replace_iv && i == 0) {
+			for (j = 0; j < ir_list_len(&data->tests); j++) {
+				ir_ivsr_replace_test(ctx, data, ir_list_at(&data->tests, j), &expr, ptr);
+			}
+		}
+	}
+
+	if (replace_iv) {
+		ir_ivsr_remove_iv(ctx, data);
+	}
+}
+
+int ir_reduce_induction_vars(ir_ctx *ctx)
+{
+	ir_ivsr_ctx data;
+	ir_list phis;
+	ir_use_list *use_list;
+	ir_insn *insn;
+	ir_block *bb;
+	ir_ref n, *p;
+	uint32_t b, i;
+
+	if (!(ctx->flags2 & IR_CFG_HAS_LOOPS)
+	 || (ctx->flags2 & IR_IRREDUCIBLE_CFG)
+	 || (ctx->flags2 & IR_NO_LOOPS)) {
+		return 1;
+	}
+
+	ir_list_init(&phis, 8);
+	ir_list_init(&data.exprs, 8);
+	ir_list_init(&data.tests, 4);
+	for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+		if ((bb->flags & (IR_BB_LOOP_HEADER|IR_BB_LOOP_WITH_ENTRY)) != IR_BB_LOOP_HEADER) {
+			continue;
+		}
+		insn = &ctx->ir_base[bb->start];
+		if (insn->op != IR_LOOP_BEGIN
+		 || insn->inputs_count != 2
+		 || ir_loop_contains(ctx, b, ctx->cfg_map[insn->op1])
+		 || !ir_loop_contains(ctx, b, ctx->cfg_map[insn->op2])) {
+			continue;
+		}
+
+		ir_list_clear(&phis);
+		use_list = &ctx->use_lists[bb->start];
+		for (n = use_list->count, p = &ctx->use_edges[use_list->refs]; n > 0; p++, n--) {
+			if (ctx->ir_base[*p].op == IR_PHI) {
+				ir_list_push(&phis, *p);
+			}
+		}
+		if (ir_list_len(&phis) == 0) {
+			continue;
+		}
+
+		data.header = bb->start;
+		data.loop_size = ctx->insns_count;
+		data.loop = ir_bitset_malloc(data.loop_size);
+		ir_ivsr_mark_loop(ctx, &data, b);
+		for (i = 0; i < ir_list_len(&phis); i++) {
+			if (ir_ivsr_match_iv(ctx, &data, ir_list_at(&phis, i))) {
+				ir_list_clear(&data.exprs);
+				ir_list_clear(&data.tests);
+				ir_ivsr(ctx, &data);
+			}
+		}
+		ir_mem_free(data.loop);
+	}
+	ir_list_free(&data.tests);
+	ir_list_free(&data.exprs);
+	ir_list_free(&phis);
+
+	return 1;
+}
@@ -20,6 +20,10 @@
 # include <alloca.h>
 #endif
 
+#ifndef _WIN32
+# include <pthread.h>
+#endif
+
 #ifndef _WIN32
 # include <sys/time.h>
 static double ir_time(void)
@@ -55,9 +59,9 @@ static void help(const char *cmd)
 {
 	printf(
 #if HAVE_LLVM
-		"Usage: %s [options] [--llvm-bitcode|--llvm-asm] input-file...\n"
+		"Usage: %s [options] [--llvm-bitcode|--llvm-asm|--load-bin] input-file...\n"
 #else
-		"Usage: %s [options] input-file...\n"
+		"Usage: %s [options] [--load-bin] input-file...\n"
 #endif
 		"General Options:\n"
 		"  --run ...                  - run the main() function of generated code\n"
@@ -70,9 +74,15 @@ static void help(const char *cmd)
 		"  -f[no-]inline              - enable/disable function inlining (default: enabled at -O1)\n"
 		"  -f[no-]tail-calls          - enable/disable tail call optimization (default: enabled at -O1)\n"
 		"  -fno-mem2ssa               - disable MEM2SSA pass (default: enabled at -O1)\n"
+		"  -fno-ranges                - disable value range inference in SCCP (default: enabled at -O2)\n"
+		"  -fno-gvn                   - disable GVN, load PRE and dead store elimination (default: enabled at -O2)\n"
+		"  -fno-loop-opts             - disable loop rotation, LICM, versioning, unrolling and IV strength reduction\n"
+		"                               (default: enabled at -O2)\n"
+		"  -fno-jump-threading        - disable jump threading and tail duplication (default: enabled at -O2)\n"
 		"Code Generation Options:\n"
 #if defined(IR_TARGET_X86) || defined(IR_TARGET_X64)
 		"  -mavx                      - use AVX instruction set\n"
+		"  -mavx2                     - use AVX2 instruction set (enables 256-bit vectors)\n"
 		"  -m[no-]bmi1                - enable/disable BMI1 instruction set\n"
 		"  -m[no-]sse3                - enable/disable SSE3 instruction set\n"
 		"  -m[no-]ssse3               - enable/disable SSSE3 instruction set\n"
@@ -97,6 +107,10 @@ static void help(const char *cmd)
 		"  --save-rules               - save IR with information selectd code-generation \n"
 		"  --save-regs                - save IR with information about assigned CPU register\n"
 		"  --save-use-lists           - save IR with def->use chains\n"
+		"  --incremental-use-lists    - build def->use chains during IR loading (disables inlining)\n"
+		"  --arena-storage            - allocate per-pass data from a per-function arena\n"
+		"  --reuse-ctx                - reuse the function contexts and their arenas (implies --arena-storage,\n"
+		"                               disables inlining)\n"
 		"  --save-ir-after-load       - save IR after load and local optimization\n"
 		"  --save-ir-after-use-lists  - save IR after USE-LISTS construction\n"
 		"  --save-ir-after-mem2ssa    - save IR after MEM2SSA pass\n"
@@ -128,10 +142,17 @@ static void help(const char *cmd)
 #endif
 		"Utility Options\n"
 		"  -fsyntax-only              - check the input files for syntax errors, but don't do anything beyond that\n"
+		"  --save-bin <file-name>     - save the input module in binary format (loaded by --load-bin)\n"
+		"  --load-bin <file-name>     - load the input module in binary format (produced by --save-bin)\n"
 		"  --emit-c                   - convert final IR to C source (implementation is incomplete)\n"
 		"  --emit-llvm                - convert final IR to LLVM code (implementation is incomplete)\n"
 		"  --dump-size                - dump generated code size\n"
 		"  --dump-time                - dump compilation and execution time\n"
+		"  --dump-pass-stats          - dump per-pass compilation time and memory usage\n"
+		"  --dump-fold-stats          - dump folding rules statistics (requires build with FOLD_STATS=yes)\n"
+		"  --dump-hash                - dump structural hash of each input function\n"
+		"  -j <number>                - compile functions in parallel threads (with --run or --dump-size)\n"
+		"  --code-cache <dir>         - reuse machine code cached in the directory (with --run, -S or --dump-size)\n"
 		"  --target                   - print JIT target\n"
 		"  --version\n"
 		"  --help\n",
@@ -152,6 +173,7 @@ static void help(const char *cmd)
 #define IR_GDB                      (1<<9)
 
 #define IR_LOAD_ONLY                (1<<10)
+#define IR_DUMP_HASH                (1<<11)
 
 #define IR_GEN_NATIVE               (IR_RUN|IR_DUMP_ASM|IR_DUMP_SIZE)
 #define IR_GEN_CODE                 (IR_DUMP_LLVM|IR_DUMP_C)
@@ -297,13 +319,17 @@ static int _save(ir_ctx *ctx, uint32_t save_flags, uint32_t dump, uint32_t pass,
 
 int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t dump, FILE *dump_file, const char *func_name)
 {
+	if (ctx->stats) {
+		ir_compile_stats_func(ctx);
+	}
+
 	if ((dump & IR_DUMP_AFTER_LOAD)
 	 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_LOAD, dump_file, func_name)) {
 		return 0;
 	}
 
 	if (opt_level > 0 || (dump & (IR_GEN_NATIVE|IR_GEN_CODE))) {
-		ir_build_def_use_lists(ctx);
+		(void)IR_PASS_RUN(ctx, USE_LISTS, (ir_build_def_use_lists(ctx), 1));
 		if ((dump & IR_DUMP_AFTER_USE_LISTS)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_USE_LISTS, dump_file, func_name)) {
 			return 0;
@@ -319,7 +345,7 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 	}
 
 	if (opt_level > 0 && (ctx->flags & IR_OPT_MEM2SSA)) {
-		ir_build_cfg(ctx);
+		IR_PASS_RUN(ctx, CFG, ir_build_cfg(ctx));
 		if ((dump & IR_DUMP_AFTER_CFG)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_CFG, dump_file, func_name)) {
 			return 0;
@@ -328,13 +354,13 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 		if (!ir_check(ctx)) return 0;
 #endif
 
-		ir_build_dominators_tree(ctx);
+		IR_PASS_RUN(ctx, DOM, ir_build_dominators_tree(ctx));
 		if ((dump & IR_DUMP_AFTER_DOM)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_DOM, dump_file, func_name)) {
 			return 0;
 		}
 
-		ir_mem2ssa(ctx);
+		IR_PASS_RUN(ctx, MEM2SSA, ir_mem2ssa(ctx));
 		ir_reset_cfg(ctx);
 
 		if ((dump & IR_DUMP_AFTER_MEM2SSA)
@@ -348,7 +374,7 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 
 	/* Global Optimization */
 	if (opt_level > 1) {
-		ir_sccp(ctx);
+		IR_PASS_RUN(ctx, SCCP, ir_sccp(ctx));
 		if ((dump & IR_DUMP_AFTER_SCCP)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_SCCP, dump_file, func_name)) {
 			return 0;
@@ -359,7 +385,7 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 	}
 
 	if ((opt_level > 0 || (dump & (IR_GEN_NATIVE|IR_GEN_CODE))) && !ctx->cfg_blocks) {
-		ir_build_cfg(ctx);
+		IR_PASS_RUN(ctx, CFG, ir_build_cfg(ctx));
 		if ((dump & IR_DUMP_AFTER_CFG)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_CFG, dump_file, func_name)) {
 			return 0;
@@ -369,7 +395,7 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 #endif
 
 		if (opt_level > 0) {
-			ir_build_dominators_tree(ctx);
+			IR_PASS_RUN(ctx, DOM, ir_build_dominators_tree(ctx));
 			if ((dump & IR_DUMP_AFTER_DOM)
 			 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_DOM, dump_file, func_name)) {
 				return 0;
@@ -379,13 +405,62 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 
 	/* Schedule */
 	if (opt_level > 0) {
-		ir_find_loops(ctx);
+		IR_PASS_RUN(ctx, LOOPS, ir_find_loops(ctx));
 		if ((dump & IR_DUMP_AFTER_LOOP)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_LOOP, dump_file, func_name)) {
 			return 0;
 		}
 
-		ir_gcm(ctx);
+		if (opt_level > 1) {
+			if (ctx->flags & IR_OPT_JUMP_THREAD) {
+				IR_PASS_RUN(ctx, JUMP_THREAD, ir_thread_jumps(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+			}
+			if (ctx->flags & IR_OPT_LOOPS) {
+				IR_PASS_RUN(ctx, ROTATE, ir_rotate_loops(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+			}
+			if (ctx->flags & IR_OPT_GVN) {
+				IR_PASS_RUN(ctx, GVN, ir_gvn(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+				IR_PASS_RUN(ctx, DSE, ir_dse(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+			}
+			if (ctx->flags & IR_OPT_LOOPS) {
+				IR_PASS_RUN(ctx, LICM, ir_licm(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+				IR_PASS_RUN(ctx, VERSION, ir_version_loops(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+				IR_PASS_RUN(ctx, UNROLL, ir_unroll_loops(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+				IR_PASS_RUN(ctx, IVSR, ir_reduce_induction_vars(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+			}
+			if (ctx->flags & IR_OPT_JUMP_THREAD) {
+				IR_PASS_RUN(ctx, TAIL_DUP, ir_tail_dup(ctx));
+#ifdef IR_DEBUG
+				if (!ir_check(ctx)) return 0;
+#endif
+			}
+		}
+
+		IR_PASS_RUN(ctx, GCM, ir_gcm(ctx));
 		if ((dump & IR_DUMP_AFTER_GCM)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_GCM, dump_file, func_name)) {
 			return 0;
@@ -394,7 +469,7 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 		if (!ir_check(ctx)) return 0;
 #endif
 
-		ir_schedule(ctx);
+		IR_PASS_RUN(ctx, SCHEDULE, ir_schedule(ctx));
 		if ((dump & IR_DUMP_AFTER_SCHEDULING)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_SCHEDULING, dump_file, func_name)) {
 			return 0;
@@ -407,7 +482,10 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 	if (dump & IR_GEN_NATIVE) {
 		ctx->func_name = ir_string(ctx, func_name);
 
-		ir_match(ctx);
+		if (!IR_PASS_RUN(ctx, MATCH, ir_match(ctx))) {
+			fprintf(stderr, "\nERROR: %d\n", ctx->status);
+			return 0;
+		}
 
 		if ((dump & IR_DUMP_AFTER_CODE_MATCHING)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_CODE_MATCHING, dump_file, func_name)) {
@@ -416,15 +494,15 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 	}
 
 	if (opt_level > 0) {
-		ir_assign_virtual_registers(ctx);
-		ir_compute_live_ranges(ctx);
+		IR_PASS_RUN(ctx, VREGS, ir_assign_virtual_registers(ctx));
+		IR_PASS_RUN(ctx, LIVE_RANGES, ir_compute_live_ranges(ctx));
 
 		if ((dump & IR_DUMP_AFTER_LIVE_RANGES)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_LIVE_RANGES, dump_file, func_name)) {
 			return 0;
 		}
 
-		ir_coalesce(ctx);
+		IR_PASS_RUN(ctx, COALESCE, ir_coalesce(ctx));
 
 		if ((dump & IR_DUMP_AFTER_COALESCING)
 		 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_COALESCING, dump_file, func_name)) {
@@ -432,17 +510,17 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 		}
 
 		if (dump & IR_GEN_NATIVE) {
-			ir_reg_alloc(ctx);
+			IR_PASS_RUN(ctx, REG_ALLOC, ir_reg_alloc(ctx));
 			if ((dump & IR_DUMP_AFTER_REGALLOC)
 			 && !_save(ctx, save_flags, dump, IR_DUMP_AFTER_REGALLOC, dump_file, func_name)) {
 				return 0;
 			}
 		}
 
-		ir_schedule_blocks(ctx);
+		IR_PASS_RUN(ctx, SCHEDULE_BLOCKS, ir_schedule_blocks(ctx));
 	} else if (dump & (IR_GEN_NATIVE|IR_GEN_CODE)) {
-		ir_assign_virtual_registers(ctx);
-		ir_compute_dessa_moves(ctx);
+		IR_PASS_RUN(ctx, VREGS, ir_assign_virtual_registers(ctx));
+		IR_PASS_RUN(ctx, DESSA, ir_compute_dessa_moves(ctx));
 	}
 
 	if ((dump & (IR_DUMP_FINAL|IR_DUMP_CODEGEN))
@@ -457,6 +535,52 @@ int ir_compile_func(ir_ctx *ctx, int opt_level, uint32_t save_flags, uint32_t du
 	return 1;
 }
 
+/* Threads support (used by parallel compilation) */
+#ifndef _WIN32
+typedef pthread_t        ir_thread;
+typedef pthread_mutex_t  ir_mutex;
+typedef pthread_cond_t   ir_cond;
+
+static void ir_mutex_init(ir_mutex *mutex)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+# define ir_mutex_destroy(m)        pthread_mutex_destroy(m)
+# define ir_mutex_lock(m)           pthread_mutex_lock(m)
+# define ir_mutex_unlock(m)         pthread_mutex_unlock(m)
+# define ir_cond_init(c)            pthread_cond_init(c, NULL)
+# define ir_cond_destroy(c)         pthread_cond_destroy(c)
+# define ir_cond_wait(c, m)         pthread_cond_wait(c, m)
+# define ir_cond_broadcast(c)       pthread_cond_broadcast(c)
+# define ir_thread_create(t, f, a)  (pthread_create(t, NULL, f, a) == 0)
+# define ir_thread_join(t)          pthread_join(t, NULL)
+# define IR_THREAD_FUNC(name, arg)  static void *name(void *arg)
+# define IR_THREAD_RETURN           return NULL
+#else
+typedef HANDLE             ir_thread;
+typedef CRITICAL_SECTION   ir_mutex;
+typedef CONDITION_VARIABLE ir_cond;
+
+# define ir_mutex_init(m)           InitializeCriticalSection(m)
+# define ir_mutex_destroy(m)        DeleteCriticalSection(m)
+# define ir_mutex_lock(m)           EnterCriticalSection(m)
+# define ir_mutex_unlock(m)         LeaveCriticalSection(m)
+# define ir_cond_init(c)            InitializeConditionVariable(c)
+# define ir_cond_destroy(c)
+# define ir_cond_wait(c, m)         SleepConditionVariableCS(c, m, INFINITE)
+# define ir_cond_broadcast(c)       WakeAllConditionVariable(c)
+# define ir_thread_create(t, f, a)  ((*(t) = CreateThread(NULL, 0, f, a, 0, NULL)) != NULL)
+# define ir_thread_join(t)          do {WaitForSingleObject(t, INFINITE); CloseHandle(t);} while (0)
+# define IR_THREAD_FUNC(name, arg)  static DWORD WINAPI name(LPVOID arg)
+# define IR_THREAD_RETURN           return 0
+#endif
+
 typedef struct _ir_sym {
 	void *addr;
 	void *thunk_addr;
@@ -467,10 +591,48 @@ typedef struct _ir_reloc {
 	ir_str  sym;
 } ir_reloc;
 
+typedef struct _ir_main_job {
+	struct _ir_main_job *next;
+	ir_ctx               ctx;
+	char                 name[1];
+} ir_main_job;
+
+/* Function kept till the end of the module for inlining */
+typedef struct _ir_main_func {
+	ir_ctx               ctx;
+	uint8_t              state;
+	bool                 print_proto;
+	char                 name[1];
+} ir_main_func;
+
+#define IR_MAIN_FUNC_NEW         0
+#define IR_MAIN_FUNC_IN_PROGRESS 1
+#define IR_MAIN_FUNC_DONE        2
+
+typedef struct _ir_main_worker {
+	struct _ir_main_loader *loader;
+	ir_thread               thread;
+	ir_compile_stats        stats;
+} ir_main_worker;
+
+/* Pool of worker threads that compile functions in parallel into the shared code buffer */
+typedef struct _ir_main_pool {
+	ir_mutex          sym_lock;   /* recursive lock, protects the loader symbol tables */
+	ir_mutex          queue_lock;
+	ir_cond           queue_cond;
+	ir_main_job      *head;
+	ir_main_job      *tail;
+	bool              done;
+	bool              failed;
+	uint32_t          workers_count;
+	ir_main_worker   *workers;
+} ir_main_pool;
+
 typedef struct _ir_main_loader {
 	ir_loader  loader;
 	int        opt_level;
 	uint32_t   mflags;
+	uint32_t   debug_flags;
 	uint64_t   debug_regset;
 	uint32_t   save_flags;
 	uint32_t   dump;
@@ -478,6 +640,10 @@ typedef struct _ir_main_loader {
 	void      *main;
 	FILE      *dump_file;
 	FILE      *out_file;
+	FILE      *bin_file;
+	ir_code_cache *code_cache;
+	ir_compile_stats *stats;
+	ir_main_pool *pool;
 	ir_strtab  symtab;
 	ir_sym    *sym;
 	ir_reloc  *reloc;
@@ -486,6 +652,14 @@ typedef struct _ir_main_loader {
 	void      *data_start;
 	size_t     data_pos;
 	ir_code_buffer code_buffer;
+	bool       inline_funcs;
+	bool       incremental_use_lists;
+	bool       reuse_ctx;
+	ir_ctx_pool ctx_pool;
+	ir_strtab  funcs_tab;
+	ir_main_func **funcs;
+	uint32_t   funcs_count;
+	uint32_t   funcs_limit;
 } ir_main_loader;
 
 static void ir_loader_free_symbols(ir_main_loader *l)
@@ -499,11 +673,43 @@ static void ir_loader_free_symbols(ir_main_loader *l)
 	}
 }
 
+static void ir_loader_lock(ir_main_loader *l)
+{
+	if (l->pool) {
+		ir_mutex_lock(&l->pool->sym_lock);
+	}
+}
+
+static void ir_loader_unlock(ir_main_loader *l)
+{
+	if (l->pool) {
+		ir_mutex_unlock(&l->pool->sym_lock);
+	}
+}
+
+/* The code buffer is kept writable while the worker threads are running */
+static void ir_loader_unprotect(ir_main_loader *l)
+{
+	if (!l->pool) {
+		ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+	}
+}
+
+static void ir_loader_protect(ir_main_loader *l)
+{
+	if (!l->pool) {
+		ir_mem_protect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+	}
+}
+
 static void ir_loader_add_reloc(ir_main_loader *l, const char *name, void *addr)
 {
 	ir_reloc *r;
-	ir_str val = ir_strtab_count(&l->symtab) + 1;
-	ir_str sym = ir_strtab_lookup(&l->symtab, name, strlen(name), val);
+	ir_str val, sym;
+
+	ir_loader_lock(l);
+	val = ir_strtab_count(&l->symtab) + 1;
+	sym = ir_strtab_lookup(&l->symtab, name, strlen(name), val);
 
 	if (sym == val) {
 		if (val >= l->sym_count) {
@@ -519,6 +725,7 @@ static void ir_loader_add_reloc(ir_main_loader *l, const char *name, void *addr)
 	r->addr = addr;
 	r->sym = sym;
 	l->reloc_count++;
+	ir_loader_unlock(l);
 }
 
 static bool ir_loader_fix_relocs(ir_main_loader *l)
@@ -575,9 +782,11 @@ static bool ir_loader_add_sym(ir_loader *loader, const char *name, void *addr)
 {
 	ir_main_loader *l = (ir_main_loader*)loader;
 	uint32_t len = (uint32_t)strlen(name);
-	ir_str val = ir_strtab_count(&l->symtab) + 1;
-	ir_str old_val = ir_strtab_lookup(&l->symtab, name, len, val);
+	ir_str val, old_val;
 
+	ir_loader_lock(l);
+	val = ir_strtab_count(&l->symtab) + 1;
+	old_val = ir_strtab_lookup(&l->symtab, name, len, val);
 	if (old_val != val) {
 		if (addr && !l->sym[old_val].addr) {
 			/* Update forward declaration */
@@ -585,15 +794,17 @@ static bool ir_loader_add_sym(ir_loader *loader, const char *name, void *addr)
 			if (l->sym[old_val].thunk_addr) {
 				// TODO: Fix thunk or relocation ???
 				if (l->code_buffer.start) {
-					ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+					ir_loader_unprotect(l);
 				}
 				ir_fix_thunk(l->sym[old_val].thunk_addr, addr);
 				if (l->code_buffer.start) {
-					ir_mem_protect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+					ir_loader_protect(l);
 				}
 			}
+			ir_loader_unlock(l);
 			return 1;
 		}
+		ir_loader_unlock(l);
 		return 0;
 	}
 	if (val >= l->sym_count) {
@@ -602,6 +813,7 @@ static bool ir_loader_add_sym(ir_loader *loader, const char *name, void *addr)
 	}
 	l->sym[val].addr = addr;
 	l->sym[val].thunk_addr = NULL;
+	ir_loader_unlock(l);
 	return 1;
 }
 
@@ -609,7 +821,11 @@ static bool ir_loader_has_sym(ir_loader *loader, const char *name)
 {
 	ir_main_loader *l = (ir_main_loader*)loader;
 	uint32_t len = (uint32_t)strlen(name);
-	ir_ref val = ir_strtab_find(&l->symtab, name, len);
+	ir_ref val;
+
+	ir_loader_lock(l);
+	val = ir_strtab_find(&l->symtab, name, len);
+	ir_loader_unlock(l);
 	return val != 0;
 }
 
@@ -617,12 +833,16 @@ static void* ir_loader_resolve_sym_name(ir_loader *loader, const char *name, uin
 {
 	ir_main_loader *l = (ir_main_loader*)loader;
 	uint32_t len = (uint32_t)strlen(name);
-	ir_ref val = ir_strtab_find(&l->symtab, name, len);
+	ir_ref val;
 	void *addr;
 
+	ir_loader_lock(l);
+	val = ir_strtab_find(&l->symtab, name, len);
 	if (val) {
 		if (l->sym[val].addr) {
-			return l->sym[val].addr;
+			addr = l->sym[val].addr;
+			ir_loader_unlock(l);
+			return addr;
 		}
 		if (!l->sym[val].thunk_addr && (flags & IR_RESOLVE_SYM_ADD_THUNK)) {
 			/* Undefined declaration */
@@ -632,12 +852,15 @@ static void* ir_loader_resolve_sym_name(ir_loader *loader, const char *name, uin
 			l->sym[val].thunk_addr = ir_emit_thunk(&l->code_buffer, NULL, &size);
 			ir_disasm_add_symbol(name, (uint64_t)(uintptr_t)l->sym[val].thunk_addr, size);
 		}
-		return l->sym[val].thunk_addr;
+		addr = l->sym[val].thunk_addr;
+		ir_loader_unlock(l);
+		return addr;
 	}
 	addr = ir_resolve_sym_name(name);
 	if (addr) {
 		ir_loader_add_sym(loader, name, addr); /* cache */
 	}
+	ir_loader_unlock(l);
 	if (!addr && !(flags & IR_RESOLVE_SYM_SILENT)) {
 		fprintf(stderr, "Undefined symbol: %s\n", name);
 	}
@@ -653,6 +876,9 @@ static bool ir_loader_external_sym_dcl(ir_loader *loader, const char *name, uint
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file && !ir_save_bin_external_sym_dcl(name, flags, l->bin_file)) {
+		return 0;
+	}
 	if (ir_loader_has_sym(loader, name)) {
 		return 1;
 	}
@@ -703,6 +929,10 @@ static bool ir_loader_external_func_dcl(ir_loader *loader, const char *name, uin
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file
+	 && !ir_save_bin_external_func_dcl(name, flags, ret_type, params_count, param_types, l->bin_file)) {
+		return 0;
+	}
 	if (ir_loader_has_sym(loader, name)) {
 		return 1;
 	}
@@ -738,6 +968,10 @@ static bool ir_loader_forward_func_dcl(ir_loader *loader, const char *name, uint
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file
+	 && !ir_save_bin_forward_func_dcl(name, flags, ret_type, params_count, param_types, l->bin_file)) {
+		return 0;
+	}
 	if (ir_loader_has_sym(loader, name)) {
 		return 1;
 	}
@@ -757,6 +991,9 @@ static bool ir_loader_sym_dcl(ir_loader *loader, const char *name, uint32_t flag
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file && !ir_save_bin_sym_dcl(name, flags, size, l->bin_file)) {
+		return 0;
+	}
 	l->data_start = NULL;
 	l->data_pos = 0;
 
@@ -781,22 +1018,23 @@ static bool ir_loader_sym_dcl(ir_loader *loader, const char *name, uint32_t flag
 		void *data;
 
 		if (flags & IR_CONST) {
-			data = l->code_buffer.pos;
+			size_t align = 1;
+
 			/* Data Alignment */
 			if (size > 8) {
-				data = (void*)IR_ALIGNED_SIZE(((size_t)(data)), 16);
+				align = 16;
 			} else if (size == 8) {
-				data = (void*)IR_ALIGNED_SIZE(((size_t)(data)), 8);
+				align = 8;
 			} else if (size >= 4) {
-				data = (void*)IR_ALIGNED_SIZE(((size_t)(data)), 4);
+				align = 4;
 			} else if (size >= 2) {
-				data = (void*)IR_ALIGNED_SIZE(((size_t)(data)), 2);
+				align = 2;
 			}
-			if (size > (size_t)((char*)l->code_buffer.end - (char*)data)) {
+			data = ir_code_buffer_alloc(&l->code_buffer, size, align);
+			if (!data) {
 				return 0;
 			}
-			l->code_buffer.pos = (char*)data + size;
-			ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+			ir_loader_unprotect(l);
 		} else {
 			data = ir_mem_malloc(size);
 		}
@@ -828,6 +1066,9 @@ static bool ir_loader_sym_data(ir_loader *loader, ir_type type, uint32_t count,
 	ir_main_loader *l = (ir_main_loader*) loader;
 	size_t size = ir_type_size[type];
 
+	if (l->bin_file && !ir_save_bin_sym_data(type, count, data, l->bin_file)) {
+		return 0;
+	}
 	if ((l->dump & IR_DUMP_IR) && (l->dump_file)) {
 		const void *p = data;
 		uint32_t i;
@@ -900,6 +1141,9 @@ static bool ir_loader_sym_data_str(ir_loader *loader, const char *str, size_t le
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file && !ir_save_bin_sym_data_str(str, len, l->bin_file)) {
+		return 0;
+	}
 	if ((l->dump & IR_DUMP_IR) && (l->dump_file)) {
 		fprintf(l->dump_file, "\"");
 		ir_print_escaped_str(str, len, l->dump_file);
@@ -924,6 +1168,9 @@ static bool ir_loader_sym_data_pad(ir_loader *loader, size_t offset)
 	ir_main_loader *l = (ir_main_loader*) loader;
 	size_t i;
 
+	if (l->bin_file && !ir_save_bin_sym_data_pad(offset, l->bin_file)) {
+		return 0;
+	}
 	IR_ASSERT(offset >= l->data_pos);
 	offset -= l->data_pos;
 	if (offset) {
@@ -951,6 +1198,9 @@ static bool ir_loader_sym_data_ref(ir_loader *loader, ir_op op, const char *ref,
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file && !ir_save_bin_sym_data_ref(op, ref, offset, l->bin_file)) {
+		return 0;
+	}
 	IR_ASSERT(op == IR_FUNC || op == IR_SYM);
 	if ((l->dump & IR_DUMP_IR) && (l->dump_file)) {
 		if (!offset) {
@@ -993,6 +1243,9 @@ static bool ir_loader_sym_data_end(ir_loader *loader, uint32_t flags)
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
+	if (l->bin_file && !ir_save_bin_sym_data_end(flags, l->bin_file)) {
+		return 0;
+	}
 	if ((l->dump & IR_DUMP_IR) && (l->dump_file)) {
 		if (flags & IR_CONST_STRING) {
 			fprintf(l->dump_file, ";\n");
@@ -1009,7 +1262,7 @@ static bool ir_loader_sym_data_end(ir_loader *loader, uint32_t flags)
 	if (l->dump & (IR_DUMP_ASM|IR_DUMP_SIZE|IR_RUN)) {
 		if ((char*)l->data_start >= (char*)l->code_buffer.start
 		 && (char*)l->data_start < (char*)l->code_buffer.end) {
-			ir_mem_protect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+			ir_loader_protect(l);
 		}
 		// TODO:
 	}
@@ -1020,16 +1273,286 @@ static bool ir_loader_func_init(ir_loader *loader, ir_ctx *ctx, const char *name
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
 
-	ir_init(ctx, loader->default_func_flags, 256, 1024);
+	if (l->reuse_ctx) {
+		ir_ctx_pool_acquire(&l->ctx_pool, ctx, loader->default_func_flags, 256, 1024);
+	} else {
+		ir_init(ctx, loader->default_func_flags, 256, 1024);
+	}
+	if (l->incremental_use_lists) {
+		ir_init_use_lists(ctx);
+	}
+	ctx->flags2 |= l->debug_flags;
 	ctx->mflags = l->mflags;
 	ctx->fixed_regset = ~l->debug_regset;
 	ctx->loader = loader;
 	return 1;
 }
 
+static bool ir_loader_compile_func(ir_main_loader *l, ir_ctx *ctx, const char *name);
+
+/* Parallel compilation */
+IR_THREAD_FUNC(ir_loader_worker, arg)
+{
+	ir_main_worker *worker = (ir_main_worker*)arg;
+	ir_main_loader *l = worker->loader;
+	ir_main_pool *pool = l->pool;
+	ir_main_job *job;
+
+	/* write protection keys are per-thread */
+	ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+
+	while (1) {
+		ir_mutex_lock(&pool->queue_lock);
+		while (!pool->head && !pool->done) {
+			ir_cond_wait(&pool->queue_cond, &pool->queue_lock);
+		}
+		job = pool->head;
+		if (!job) {
+			ir_mutex_unlock(&pool->queue_lock);
+			break;
+		}
+		pool->head = job->next;
+		if (!pool->head) {
+			pool->tail = NULL;
+		}
+		ir_mutex_unlock(&pool->queue_lock);
+
+		job->ctx.stats = l->stats ? &worker->stats : NULL;
+		if (!ir_loader_compile_func(l, &job->ctx, job->name)) {
+			ir_mutex_lock(&pool->queue_lock);
+			pool->failed = 1;
+			ir_mutex_unlock(&pool->queue_lock);
+		}
+		ir_free(&job->ctx);
+		ir_mem_free(job);
+	}
+
+	IR_THREAD_RETURN;
+}
+
+static bool ir_loader_queue_func(ir_main_loader *l, ir_ctx *ctx, const char *name)
+{
+	ir_main_pool *pool = l->pool;
+	size_t len = strlen(name);
+	ir_main_job *job = ir_mem_malloc(sizeof(ir_main_job) + len);
+
+	/* Move the function context into the job. ir_load() is going to free the original one. */
+	memcpy(&job->ctx, ctx, sizeof(ir_ctx));
+	if (ctx->const_hash == ctx->_const_hash) {
+		job->ctx.const_hash = job->ctx._const_hash;
+	}
+	memset(ctx, 0, sizeof(ir_ctx));
+	memcpy(job->name, name, len + 1);
+	job->next = NULL;
+
+	/* Declare the function in advance. Functions compiled earlier are going to call it through a thunk. */
+	ir_loader_add_sym(&l->loader, name, NULL);
+
+	ir_mutex_lock(&pool->queue_lock);
+	if (pool->tail) {
+		pool->tail->next = job;
+	} else {
+		pool->head = job;
+	}
+	pool->tail = job;
+	ir_cond_broadcast(&pool->queue_cond);
+	ir_mutex_unlock(&pool->queue_lock);
+	return 1;
+}
+
+static bool ir_loader_start_pool(ir_main_loader *l, uint32_t threads_count)
+{
+	ir_main_pool *pool = ir_mem_calloc(1, sizeof(ir_main_pool));
+	uint32_t i;
+
+	ir_mutex_init(&pool->sym_lock);
+	ir_mutex_init(&pool->queue_lock);
+	ir_cond_init(&pool->queue_cond);
+	pool->workers = ir_mem_calloc(threads_count, sizeof(ir_main_worker));
+	l->pool = pool;
+
+	ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+	for (i = 0; i < threads_count; i++) {
+		ir_main_worker *worker = &pool->workers[i];
+
+		worker->loader = l;
+		ir_compile_stats_init(&worker->stats);
+		if (!ir_thread_create(&worker->thread, ir_loader_worker, worker)) {
+			break;
+		}
+		pool->workers_count++;
+	}
+	return pool->workers_count != 0;
+}
+
+static bool ir_loader_join_pool(ir_main_loader *l)
+{
+	ir_main_pool *pool = l->pool;
+	ir_main_job *job;
+	uint32_t i, p;
+	bool ret;
+
+	ir_mutex_lock(&pool->queue_lock);
+	pool->done = 1;
+	ir_cond_broadcast(&pool->queue_cond);
+	ir_mutex_unlock(&pool->queue_lock);
+
+	for (i = 0; i < pool->workers_count; i++) {
+		ir_thread_join(pool->workers[i].thread);
+	}
+	l->pool = NULL;
+	ir_mem_protect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+
+	/* free jobs that were not compiled (no worker thread could be started) */
+	while ((job = pool->head) != NULL) {
+		pool->head = job->next;
+		ir_free(&job->ctx);
+		ir_mem_free(job);
+	}
+
+	if (l->stats) {
+		for (i = 0; i < pool->workers_count; i++) {
+			ir_compile_stats *stats = &pool->workers[i].stats;
+
+			l->stats->funcs_count += stats->funcs_count;
+			for (p = 0; p < IR_LAST_PASS; p++) {
+				l->stats->pass[p].count += stats->pass[p].count;
+				l->stats->pass[p].time += stats->pass[p].time;
+				l->stats->pass[p].insns_in += stats->pass[p].insns_in;
+				l->stats->pass[p].insns_out += stats->pass[p].insns_out;
+				if (stats->pass[p].peak_heap > l->stats->pass[p].peak_heap) {
+					l->stats->pass[p].peak_heap = stats->pass[p].peak_heap;
+				}
+				if (stats->pass[p].peak_arena > l->stats->pass[p].peak_arena) {
+					l->stats->pass[p].peak_arena = stats->pass[p].peak_arena;
+				}
+			}
+		}
+	}
+
+	ret = !pool->failed && pool->workers_count != 0;
+	ir_cond_destroy(&pool->queue_cond);
+	ir_mutex_destroy(&pool->queue_lock);
+	ir_mutex_destroy(&pool->sym_lock);
+	ir_mem_free(pool->workers);
+	ir_mem_free(pool);
+	return ret;
+}
+
+static bool ir_loader_process_func(ir_main_loader *l, ir_ctx *ctx, const char *name, bool print_proto);
+
+/* Inlining */
+static bool ir_loader_defer_func(ir_main_loader *l, ir_ctx *ctx, const char *name, bool print_proto)
+{
+	size_t len = strlen(name);
+	ir_main_func *func;
+
+	if (l->funcs_count == l->funcs_limit) {
+		if (!l->funcs_limit) {
+			ir_strtab_init(&l->funcs_tab, 16, 256);
+		}
+		l->funcs_limit = l->funcs_limit ? l->funcs_limit * 2 : 16;
+		l->funcs = ir_mem_realloc(l->funcs, l->funcs_limit * sizeof(ir_main_func*));
+	}
+	if (ir_strtab_lookup(&l->funcs_tab, name, (uint32_t)len, l->funcs_count + 1) != (ir_str)(l->funcs_count + 1)) {
+		fprintf(stderr, "ERROR: Function '%s' is defined twice\n", name);
+		return 0;
+	}
+
+	/* Move the function context. ir_load() is going to free the original one. */
+	func = ir_mem_malloc(sizeof(ir_main_func) + len);
+	memcpy(&func->ctx, ctx, sizeof(ir_ctx));
+	if (ctx->const_hash == ctx->_const_hash) {
+		func->ctx.const_hash = func->ctx._const_hash;
+	}
+	memset(ctx, 0, sizeof(ir_ctx));
+	func->state = IR_MAIN_FUNC_NEW;
+	func->print_proto = print_proto;
+	memcpy(func->name, name, len + 1);
+	l->funcs[l->funcs_count++] = func;
+	return 1;
+}
+
+static void ir_loader_inline_func(ir_main_loader *l, ir_main_func *func);
+
+/* Callees are processed first (bottom-up order of the call graph). Functions that are still
+ * in progress are not inlined to break recursion. */
+static const ir_ctx *ir_loader_inline_lookup(const ir_ctx *ctx, ir_ref ref, void *data)
+{
+	ir_main_loader *l = (ir_main_loader*)data;
+	const char *name = ir_get_str(ctx, ctx->ir_base[ref].val.name);
+	ir_ref n = ir_strtab_find(&l->funcs_tab, name, (uint32_t)strlen(name));
+	ir_main_func *func;
+
+	if (!n) {
+		return NULL;
+	}
+	func = l->funcs[n - 1];
+	if (func->state == IR_MAIN_FUNC_NEW) {
+		ir_loader_inline_func(l, func);
+	}
+	return func->state == IR_MAIN_FUNC_DONE ? &func->ctx : NULL;
+}
+
+static void ir_loader_inline_func(ir_main_loader *l, ir_main_func *func)
+{
+	func->state = IR_MAIN_FUNC_IN_PROGRESS;
+	ir_inline(&func->ctx, ir_loader_inline_lookup, l);
+	func->state = IR_MAIN_FUNC_DONE;
+}
+
+static void ir_loader_free_funcs(ir_main_loader *l)
+{
+	uint32_t i;
+
+	if (l->funcs) {
+		for (i = 0; i < l->funcs_count; i++) {
+			if (l->funcs[i]) {
+				ir_free(&l->funcs[i]->ctx);
+				ir_mem_free(l->funcs[i]);
+			}
+		}
+		ir_mem_free(l->funcs);
+		ir_strtab_free(&l->funcs_tab);
+		l->funcs = NULL;
+		l->funcs_count = l->funcs_limit = 0;
+	}
+}
+
+/* Inline the calls between the functions of the module and compile them in the original order */
+static bool ir_loader_inline_module(ir_main_loader *l)
+{
+	uint32_t i;
+	ir_main_func *func;
+	bool ret = 1;
+
+	for (i = 0; i < l->funcs_count; i++) {
+		func = l->funcs[i];
+		if (func->state == IR_MAIN_FUNC_NEW) {
+			ir_loader_inline_func(l, func);
+		}
+	}
+	for (i = 0; i < l->funcs_count; i++) {
+		func = l->funcs[i];
+		if (ret && !ir_loader_process_func(l, &func->ctx, func->name, func->print_proto)) {
+			ret = 0;
+		}
+		ir_free(&func->ctx);
+		ir_mem_free(func);
+		l->funcs[i] = NULL;
+	}
+	ir_loader_free_funcs(l);
+	return ret;
+}
+
 static bool ir_loader_func_process(ir_loader *loader, ir_ctx *ctx, const char *name)
 {
 	ir_main_loader *l = (ir_main_loader*) loader;
+	bool print_proto = 1;
+
+	if (l->bin_file && !ir_save_bin_func(ctx, name, l->bin_file)) {
+		return 0;
+	}
 
 	// TODO: remove this
 	if (ctx->ret_type == (ir_type)-1 && ctx->insns_count > 1 && ctx->ir_base[1].op == IR_START) {
@@ -1049,12 +1572,57 @@ static bool ir_loader_func_process(ir_loader *loader, ir_ctx *ctx, const char *n
 
 	if (name == NULL) {
 		name = (l->dump & IR_RUN) ? "main" : "test";
-	} else if ((l->dump & (IR_DUMP_IR|IR_DUMP_CODEGEN|IR_DUMP_LIVE_RANGES)) && l->dump_file) {
+		print_proto = 0;
+	}
+
+	if (l->inline_funcs) {
+		/* compile the module at once, after the functions are inlined (see ir_loader_inline_module()) */
+		return ir_loader_defer_func(l, ctx, name, print_proto);
+	}
+
+	return ir_loader_process_func(l, ctx, name, print_proto);
+}
+
+static bool ir_loader_process_func(ir_main_loader *l, ir_ctx *ctx, const char *name, bool print_proto)
+{
+	if (print_proto && (l->dump & (IR_DUMP_IR|IR_DUMP_CODEGEN|IR_DUMP_LIVE_RANGES)) && l->dump_file) {
 		ir_print_func_proto(ctx, name, (l->save_flags & IR_SAVE_SAFE_NAMES) != 0, l->dump_file);
 		fprintf(l->dump_file, "\n");
 	}
 
-	if (!ir_compile_func(ctx, l->opt_level, l->save_flags, l->dump, l->dump_file, name)) {
+	if (l->dump & IR_DUMP_HASH) {
+		ir_hash128 hash;
+
+		ir_ctx_hash(ctx, &hash);
+		fprintf(stderr, "%s: hash = %016llx%016llx\n", name,
+			(unsigned long long)hash.hi, (unsigned long long)hash.lo);
+	}
+
+	if (l->pool) {
+		return ir_loader_queue_func(l, ctx, name);
+	}
+
+	if (!ir_loader_compile_func(l, ctx, name)) {
+		return 0;
+	}
+	if (l->reuse_ctx) {
+		/* keep the buffers for the next function. ir_load() is going to free the empty context. */
+		ir_ctx_pool_release(&l->ctx_pool, ctx);
+	}
+	return 1;
+}
+
+static bool ir_loader_compile_func(ir_main_loader *l, ir_ctx *ctx, const char *name)
+{
+	ir_loader *loader = &l->loader;
+
+	if (!ctx->stats) {
+		ctx->stats = l->stats;
+	}
+	if (l->code_cache) {
+		/* the whole pipeline is executed by ir_code_cache_jit_compile() */
+		ctx->func_name = ir_string(ctx, name);
+	} else if (!ir_compile_func(ctx, l->opt_level, l->save_flags, l->dump, l->dump_file, name)) {
 		return 0;
 	}
 
@@ -1078,9 +1646,13 @@ static bool ir_loader_func_process(ir_loader *loader, ir_ctx *ctx, const char *n
 
 		if (l->code_buffer.start) {
 			ctx->code_buffer = &l->code_buffer;
-			ir_mem_unprotect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+			ir_loader_unprotect(l);
+		}
+		if (l->code_cache) {
+			entry = ir_code_cache_jit_compile(l->code_cache, ctx, l->opt_level, &size);
+		} else {
+			entry = ir_jit_emit_code(ctx, &size);
 		}
-		entry = ir_emit_code(ctx, &size);
 #ifndef _WIN32
 		if (l->dump & IR_GDB) {
 			if (!l->code_buffer.start) {
@@ -1093,7 +1665,7 @@ static bool ir_loader_func_process(ir_loader *loader, ir_ctx *ctx, const char *n
 		}
 #endif
 		if (l->code_buffer.start) {
-			ir_mem_protect(l->code_buffer.start, (char*)l->code_buffer.end - (char*)l->code_buffer.start);
+			ir_loader_protect(l);
 		}
 		if (entry) {
 			if (!l->code_buffer.start) {
@@ -1131,7 +1703,9 @@ static bool ir_loader_func_process(ir_loader *loader, ir_ctx *ctx, const char *n
 				}
 #endif
 				if (strcmp(name, "main") == 0) {
+					ir_loader_lock(l);
 					l->main = entry;
+					ir_loader_unlock(l);
 				}
 			}
 		} else {
@@ -1155,11 +1729,18 @@ int main(int argc, char **argv)
 	char *dump_file = NULL, *out_file = 0;
 	FILE *f;
 	bool dump_time = 0;
+	bool dump_pass_stats = 0;
+	bool dump_fold_stats = 0;
+	ir_compile_stats pass_stats;
+	uint32_t jobs = 0;
 	bool disable_inline = 0;
 	bool force_inline = 0;
+	bool incremental_use_lists = 0;
+	bool reuse_ctx = 0;
 	bool disable_tail_calls = 0;
 	bool force_tail_calls = 0;
 	bool disable_mem2ssa = 0;
+	uint32_t disabled_opts = 0;
 	uint32_t save_flags = 0;
 	uint32_t dump = 0;
 	int opt_level = 2;
@@ -1168,6 +1749,7 @@ int main(int argc, char **argv)
 #if defined(IR_TARGET_X86) || defined(IR_TARGET_X64)
 	uint32_t mflags_disabled = 0;
 #endif
+	uint32_t debug_flags = 0;
 	uint64_t debug_regset = 0xffffffffffffffff;
 #ifdef _WIN32
 	bool abort_fault = 1;
@@ -1176,9 +1758,12 @@ int main(int argc, char **argv)
 	bool load_llvm_bitcode = 0;
 	bool load_llvm_asm = 0;
 #endif
+	bool load_bin = 0;
+	char *save_bin_file = NULL;
+	char *code_cache_dir = NULL;
 	ir_main_loader loader;
 	int ret = 0;
-	double start;
+	double start = 0.0;
 
 	ir_consistency_check();
 
@@ -1244,6 +1829,13 @@ int main(int argc, char **argv)
 			save_flags |= IR_SAVE_REGS;
 		} else if (strcmp(argv[i], "--save-use-lists") == 0) {
 			save_flags |= IR_SAVE_USE_LISTS;
+		} else if (strcmp(argv[i], "--incremental-use-lists") == 0) {
+			incremental_use_lists = 1;
+		} else if (strcmp(argv[i], "--arena-storage") == 0) {
+			flags |= IR_ARENA_STORAGE;
+		} else if (strcmp(argv[i], "--reuse-ctx") == 0) {
+			reuse_ctx = 1;
+			flags |= IR_ARENA_STORAGE;
 		} else if (strcmp(argv[i], "--save-dot") == 0) {
 			dump |= IR_DUMP_DOT;
 			if (i + 1 < argc && argv[i + 1][0] != '-') {
@@ -1286,6 +1878,25 @@ int main(int argc, char **argv)
 			dump |= IR_DUMP_SIZE;
 		} else if (strcmp(argv[i], "--dump-time") == 0) {
 			dump_time = 1;
+		} else if (strcmp(argv[i], "--dump-pass-stats") == 0) {
+			dump_pass_stats = 1;
+		} else if (strcmp(argv[i], "--dump-fold-stats") == 0) {
+			dump_fold_stats = 1;
+		} else if (strcmp(argv[i], "--dump-hash") == 0) {
+			dump |= IR_DUMP_HASH;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			if (i + 1 == argc || argv[i + 1][0] < '0' || argv[i + 1][0] > '9') {
+				fprintf(stderr, "ERROR: Invalid usage' (use --help)\n");
+				return 1;
+			}
+			jobs = atoi(argv[i + 1]);
+			i++;
+		} else if (strcmp(argv[i], "--code-cache") == 0) {
+			if (i + 1 == argc || argv[i + 1][0] == '-') {
+				fprintf(stderr, "ERROR: Invalid usage' (use --help)\n");
+				return 1;
+			}
+			code_cache_dir = argv[++i];
 		} else if (strcmp(argv[i], "-S") == 0) {
 			dump |= IR_DUMP_ASM;
 		} else if (strcmp(argv[i], "--run") == 0) {
@@ -1297,6 +1908,8 @@ int main(int argc, char **argv)
 #if defined(IR_TARGET_X86) || defined(IR_TARGET_X64)
 		} else if (strcmp(argv[i], "-mavx") == 0) {
 			mflags |= IR_X86_AVX;
+		} else if (strcmp(argv[i], "-mavx2") == 0) {
+			mflags |= IR_X86_AVX | IR_X86_AVX2;
 		} else if (strcmp(argv[i], "-mbmi1") == 0) {
 			mflags |= IR_X86_BMI1;
 			mflags_disabled &= ~IR_X86_BMI1;
@@ -1348,19 +1961,27 @@ int main(int argc, char **argv)
 			force_tail_calls = 1;
 		} else if (strcmp(argv[i], "-fno-mem2ssa") == 0) {
 			disable_mem2ssa = 1;
+		} else if (strcmp(argv[i], "-fno-ranges") == 0) {
+			disabled_opts |= IR_OPT_RANGES;
+		} else if (strcmp(argv[i], "-fno-gvn") == 0) {
+			disabled_opts |= IR_OPT_GVN;
+		} else if (strcmp(argv[i], "-fno-loop-opts") == 0) {
+			disabled_opts |= IR_OPT_LOOPS;
+		} else if (strcmp(argv[i], "-fno-jump-threading") == 0) {
+			disabled_opts |= IR_OPT_JUMP_THREAD;
 #ifdef IR_DEBUG
 		} else if (strcmp(argv[i], "--debug-sccp") == 0) {
-			flags |= IR_DEBUG_SCCP;
+			debug_flags |= IR_DEBUG_SCCP;
 		} else if (strcmp(argv[i], "--debug-gcm") == 0) {
-			flags |= IR_DEBUG_GCM;
+			debug_flags |= IR_DEBUG_GCM;
 		} else if (strcmp(argv[i], "--debug-gcm-split") == 0) {
-			flags |= IR_DEBUG_GCM_SPLIT;
+			debug_flags |= IR_DEBUG_GCM_SPLIT;
 		} else if (strcmp(argv[i], "--debug-scheduling") == 0) {
-			flags |= IR_DEBUG_SCHEDULE;
+			debug_flags |= IR_DEBUG_SCHEDULE;
 		} else if (strcmp(argv[i], "--debug-regalloc") == 0) {
-			flags |= IR_DEBUG_RA;
+			debug_flags |= IR_DEBUG_RA;
 		} else if (strcmp(argv[i], "--debug-bb-scheduling") == 0) {
-			flags |= IR_DEBUG_BB_SCHEDULE;
+			debug_flags |= IR_DEBUG_BB_SCHEDULE;
 #endif
 		} else if (strcmp(argv[i], "--debug-regset") == 0) {
 			if (i + 1 == argc || argv[i + 1][0] == '-') {
@@ -1395,6 +2016,19 @@ int main(int argc, char **argv)
 			dump |= IR_PERF;
 		} else if (strcmp(argv[i], "-fsyntax-only") == 0) {
 			dump |= IR_LOAD_ONLY;
+		} else if (strcmp(argv[i], "--load-bin") == 0) {
+			if (input || i + 1 == argc || argv[i + 1][0] == '-') {
+				fprintf(stderr, "ERROR: Invalid usage' (use --help)\n");
+				return 1;
+			}
+			load_bin = 1;
+			input = argv[++i];
+		} else if (strcmp(argv[i], "--save-bin") == 0) {
+			if (i + 1 == argc || argv[i + 1][0] == '-') {
+				fprintf(stderr, "ERROR: Invalid usage' (use --help)\n");
+				return 1;
+			}
+			save_bin_file = argv[++i];
 		} else if (argv[i][0] == '-') {
 			fprintf(stderr, "ERROR: Unknown option '%s' (use --help)\n", argv[i]);
 			return 1;
@@ -1428,6 +2062,10 @@ int main(int argc, char **argv)
 		fprintf(stderr, "ERROR: -mavx is not compatible with CPU (AVX is not supported)\n");
 		return 1;
 	}
+	if ((mflags & IR_X86_AVX2) && !(cpuinfo & IR_X86_AVX2)) {
+		fprintf(stderr, "ERROR: -mavx2 is not compatible with CPU (AVX2 is not supported)\n");
+		return 1;
+	}
 	mflags |= (cpuinfo & (IR_X86_SSE3|IR_X86_SSSE3|IR_X86_SSE41|IR_X86_SSE42|IR_X86_BMI1)) & ~mflags_disabled;
 #endif
 
@@ -1443,7 +2081,8 @@ int main(int argc, char **argv)
 	if (opt_level > 0) {
 		flags |= IR_OPT_FOLDING | IR_OPT_CFG | IR_OPT_CODEGEN;
 	}
-	if ((opt_level > 1 && !disable_inline) || force_inline) {
+	if (((opt_level > 1 && !disable_inline) || force_inline) && !incremental_use_lists && !reuse_ctx) {
+		/* ir_inline() works on the graphs without use lists, and keeps all the function contexts alive */
 		flags |= IR_OPT_INLINE;
 	}
 	if ((opt_level > 1 && !disable_tail_calls) || force_tail_calls) {
@@ -1452,6 +2091,9 @@ int main(int argc, char **argv)
 	if (opt_level > 0 && !disable_mem2ssa) {
 		flags |= IR_OPT_MEM2SSA;
 	}
+	if (opt_level > 1) {
+		flags |= (IR_OPT_RANGES | IR_OPT_GVN | IR_OPT_LOOPS | IR_OPT_JUMP_THREAD) & ~disabled_opts;
+	}
 	if (dump & IR_GEN_CODE) {
 		if ((dump & (IR_DUMP_C|IR_DUMP_LLVM)) == (IR_DUMP_C|IR_DUMP_LLVM)) {
 			fprintf(stderr, "ERROR: --emit-c and --emit-llvm are incompatible\n");
@@ -1474,10 +2116,44 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (incremental_use_lists && load_bin) {
+		/* binary modules are loaded as the whole ir_base[] arrays */
+		fprintf(stderr, "ERROR: --incremental-use-lists is not compatible with --load-bin\n");
+		return 1;
+	}
+
 	if (!(dump & IR_RUN)) {
 		dump &= ~(IR_GDB|IR_PERF);
 	}
 
+	if (jobs > 1) {
+		if (!(dump & IR_GEN_NATIVE)
+		 || (dump & (IR_DUMP_ASM|IR_DUMP_IR|IR_DUMP_CODEGEN|IR_DUMP_LIVE_RANGES|IR_DUMP_DOT|IR_DUMP_AFTER_ALL))
+		 || save_flags) {
+			fprintf(stderr, "ERROR: -j may be used only with --run or --dump-size (without -S and --save-... options)\n");
+			return 1;
+		}
+	}
+
+	if (code_cache_dir) {
+		if (!(dump & IR_GEN_NATIVE)
+		 || (dump & (IR_DUMP_IR|IR_DUMP_CODEGEN|IR_DUMP_LIVE_RANGES|IR_DUMP_DOT|IR_DUMP_AFTER_ALL|IR_DUMP_C|IR_DUMP_LLVM))
+		 || save_flags) {
+			fprintf(stderr, "ERROR: --code-cache may be used only with --run, -S or --dump-size (without --save-... options)\n");
+			return 1;
+		}
+	}
+
+	if (dump_fold_stats) {
+		uint32_t count;
+
+		if (!ir_fold_stats_get(&count)) {
+			fprintf(stderr, "ERROR: --dump-fold-stats requires IR built with FOLD_STATS=yes\n");
+			return 1;
+		}
+		ir_fold_stats_reset();
+	}
+
 	memset(&loader, 0, sizeof(loader));
 	loader.loader.default_func_flags = flags;
 	loader.loader.init_module        = NULL;
@@ -1499,6 +2175,7 @@ int main(int argc, char **argv)
 
 	loader.opt_level = opt_level;
 	loader.mflags = mflags;
+	loader.debug_flags = debug_flags;
 	loader.debug_regset = debug_regset;
 	loader.save_flags = save_flags;
 	loader.dump = dump;
@@ -1534,6 +2211,24 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (code_cache_dir) {
+		loader.code_cache = ir_code_cache_open(code_cache_dir);
+		if (!loader.code_cache) {
+			fprintf(stderr, "ERROR: Cannot open code cache directory '%s'\n", code_cache_dir);
+			ret = 1;
+			goto exit;
+		}
+	}
+
+	if (save_bin_file) {
+		loader.bin_file = fopen(save_bin_file, "wb");
+		if (!loader.bin_file || !ir_save_bin_header(loader.bin_file)) {
+			fprintf(stderr, "ERROR: Cannot create file '%s'\n", save_bin_file);
+			ret = 1;
+			goto exit;
+		}
+	}
+
 	if (dump & (IR_DUMP_ASM|IR_DUMP_SIZE|IR_RUN)) {
 		/* Preallocate 2MB JIT code buffer. It may be necessary to generate veneers and thunks. */
 		size_t size = 2 * 1024 * 1024;
@@ -1576,6 +2271,11 @@ int main(int argc, char **argv)
 		start = ir_time();
 	}
 
+	if (dump_pass_stats) {
+		ir_compile_stats_init(&pass_stats);
+		loader.stats = &pass_stats;
+	}
+
 #if HAVE_LLVM
 	if (load_llvm_bitcode) {
 		if (!ir_load_llvm_bitcode(&loader.loader, input)) {
@@ -1594,6 +2294,35 @@ int main(int argc, char **argv)
 	}
 #endif
 
+	/* The LLVM loader performs inlining on its own */
+	loader.inline_funcs = (flags & IR_OPT_INLINE) != 0;
+	loader.incremental_use_lists = incremental_use_lists;
+	loader.reuse_ctx = reuse_ctx;
+	ir_ctx_pool_init(&loader.ctx_pool);
+
+	if (load_bin) {
+		if (jobs > 1 && !ir_loader_start_pool(&loader, jobs)) {
+			fprintf(stderr, "ERROR: Cannot start compilation threads\n");
+			ir_loader_join_pool(&loader);
+			ret = 1;
+			goto exit;
+		}
+		if (!ir_load_bin_file(&loader.loader, input)
+		 || !ir_loader_inline_module(&loader)) {
+			fprintf(stderr, "ERROR: Cannot load binary file '%s'\n", input);
+			if (loader.pool) {
+				ir_loader_join_pool(&loader);
+			}
+			ret = 2;
+			goto exit;
+		}
+		if (loader.pool && !ir_loader_join_pool(&loader)) {
+			ret = 2;
+			goto exit;
+		}
+		goto finish;
+	}
+
 	f = fopen(input, "rb");
 	if (!f) {
 		fprintf(stderr, "ERROR: Cannot open input file '%s'\n", input);
@@ -1601,11 +2330,23 @@ int main(int argc, char **argv)
 		goto exit;
 	}
 
+	if (jobs > 1 && !ir_loader_start_pool(&loader, jobs)) {
+		fprintf(stderr, "ERROR: Cannot start compilation threads\n");
+		ir_loader_join_pool(&loader);
+		fclose(f);
+		ret = 1;
+		goto exit;
+	}
+
 	ir_loader_init();
 
-	if (!ir_load(&loader.loader, f)) {
+	if (!ir_load(&loader.loader, f)
+	 || !ir_loader_inline_module(&loader)) {
 		fclose(f);
 		ir_loader_free();
+		if (loader.pool) {
+			ir_loader_join_pool(&loader);
+		}
 		ret = 2;
 		goto exit;
 	}
@@ -1613,10 +2354,21 @@ int main(int argc, char **argv)
 	fclose(f);
 	ir_loader_free();
 
-#if HAVE_LLVM
-finish:
-#endif
+	if (loader.pool && !ir_loader_join_pool(&loader)) {
+		ret = 2;
+		goto exit;
+	}
 
+finish:
+	if (loader.bin_file) {
+		if (fclose(loader.bin_file) != 0) {
+			fprintf(stderr, "ERROR: Cannot write file '%s'\n", save_bin_file);
+			loader.bin_file = NULL;
+			ret = 1;
+			goto exit;
+		}
+		loader.bin_file = NULL;
+	}
 	if (loader.dump_file && loader.dump_file != stderr && loader.dump_file != stdout) {
 		fclose(loader.dump_file);
 	}
@@ -1645,6 +2397,14 @@ finish:
 		start = t;
 	}
 
+	if (dump_pass_stats) {
+		ir_dump_compile_stats(&pass_stats, stderr);
+	}
+
+	if (dump_fold_stats) {
+		ir_dump_fold_stats(stderr);
+	}
+
 	if ((dump & IR_RUN) && loader.main) {
 		int jit_argc = 1;
 		char **jit_argv;
@@ -1679,6 +2439,14 @@ finish:
 	}
 
 exit:
+	if (loader.bin_file) {
+		fclose(loader.bin_file);
+	}
+	if (loader.code_cache) {
+		ir_code_cache_close(loader.code_cache);
+	}
+	ir_loader_free_funcs(&loader);
 	ir_loader_free_symbols(&loader);
+	ir_ctx_pool_free(&loader.ctx_pool);
 	return ret;
 }
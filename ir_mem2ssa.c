@@ -678,6 +678,12 @@ static int ir_mem2ssa_may_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *lay
 				&& ctx->ir_base[use_insn->op2].val.u64 < layout->size
 				&& ir_mem2ssa_may_promote(ctx, layout, use, (size_t)ctx->ir_base[use_insn->op2].val.u64)) {
 			/* pass */
+		} else if (use_insn->op == IR_MEMSET
+				&& use_insn->op2 == var
+				&& IR_IS_CONST_REF(use_insn->op3)
+				&& IR_IS_CONST_REF(ir_insn_op(use_insn, 4))
+				&& ctx->ir_base[ir_insn_op(use_insn, 4)].val.u64 == layout->size) {
+			/* MEMSET of the whole ALLOCA is replaced by STOREs into all the fields */
 		} else {
 			return IR_CANNOT_CONVERT;
 		}
@@ -687,8 +693,69 @@ static int ir_mem2ssa_may_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *lay
 	return layout->count > 0 ? IR_MAY_SPLIT : IR_CANNOT_CONVERT;
 }
 
+static void ir_mem2ssa_split_memset(ir_ctx *ctx, ir_mem2ssa_split_layout *layout, ir_ref var,
+                                    size_t var_offset, ir_ref first_new_alloca, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	uint64_t pattern = ctx->ir_base[insn->op3].val.u8 * 0x0101010101010101ULL;
+	ir_ref next = ir_next_control(ctx, ref);
+	ir_ref prev = ref;
+	ir_ref addr, store, val;
+	uint32_t b = ctx->cfg_map[ref];
+	size_t offset, size;
+
+	/*
+	 *  prev  ALLOCA       prev  ALLOCA
+	 *     \  /               \  /
+	 *    MEMSET    =>       STORE  ALLOCA2
+	 *     /                     \  /
+	 *  next                    STORE ...
+	 *                           /
+	 *                       next
+	 */
+	for (offset = 0; offset < layout->size; offset++) {
+		if (offset == var_offset) {
+			addr = var;
+		} else if (layout->sizes[offset]) {
+			addr = first_new_alloca + layout->sizes[offset] - 1;
+		} else {
+			continue;
+		}
+		size = (size_t)ctx->ir_base[ctx->ir_base[addr].op2].val.u64;
+		switch (size) {
+			default:
+				IR_ASSERT(0);
+			case 1: val = ir_const_u8(ctx, (uint8_t)pattern); break;
+			case 2: val = ir_const_u16(ctx, (uint16_t)pattern); break;
+			case 4: val = ir_const_u32(ctx, (uint32_t)pattern); break;
+			case 8: val = ir_const_u64(ctx, pattern); break;
+		}
+		if (addr == var) {
+			/* reuse MEMSET node (it already uses ALLOCA), but keep "inputs_count" */
+			insn = &ctx->ir_base[ref];
+			insn->opt = IR_OPT(IR_STORE, IR_VOID);
+			insn->op3 = val;
+			ir_insn_set_op(insn, 4, IR_UNUSED);
+		} else {
+			store = ir_emit3(ctx, IR_STORE, prev, addr, val);
+			ir_use_list_add(ctx, addr, store);
+			if (prev == ref) {
+				ir_use_list_replace_one(ctx, ref, next, store);
+			} else {
+				ir_use_list_add(ctx, prev, store);
+			}
+			ctx->cfg_map[store] = b;
+			prev = store;
+		}
+	}
+	if (prev != ref) {
+		ctx->ir_base[next].op1 = prev;
+		ir_use_list_add(ctx, prev, next);
+	}
+}
+
 /* SRA - Scalar Replacement Of Aggregates */
-static void ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout, ir_ref var, ir_ref next)
+static bool ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout, ir_ref var, ir_ref next)
 {
 	ir_ref ref;
 	ir_ref i, j, use;
@@ -696,6 +763,8 @@ static void ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout
 	ir_use_list *use_list;
 	ir_ref first_new_alloca = IR_UNUSED;
 	uint32_t b = ctx->cfg_map[var];
+	size_t var_offset;
+	bool has_memset = 0;
 
 	IR_ASSERT(layout->count > 0);
 
@@ -704,6 +773,7 @@ static void ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout
 	while (!layout->sizes[i]) i++;
 	ctx->ir_base[var].op2 = ir_const_size_t(ctx, layout->sizes[i]);
 	layout->sizes[i] = 0; /* reuse original ALLOCA node */
+	var_offset = i;
 
 	if (layout->count > 1) {
 		/* create new ALLOCA nodes and link them into the control chain */
@@ -729,6 +799,15 @@ static void ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout
 	}
 
 	use_list = &ctx->use_lists[var];
+	for (i = 0; i < use_list->count; i++) {
+		use = ctx->use_edges[use_list->refs + i];
+		if (ctx->ir_base[use].op == IR_MEMSET) {
+			ir_mem2ssa_split_memset(ctx, layout, var, var_offset, first_new_alloca, use);
+			use_list = &ctx->use_lists[var]; /* reload */
+			has_memset = 1;
+		}
+	}
+
 	for (i = 0, j = 0; i < use_list->count; i++) {
 		use = ctx->use_edges[use_list->refs + i];
 		IR_ASSERT(use);
@@ -770,6 +849,8 @@ static void ir_mem2ssa_split_alloca(ir_ctx *ctx, ir_mem2ssa_split_layout *layout
 	for (; j < i; j++) {
 		ctx->use_edges[use_list->refs + j] = IR_UNUSED;
 	}
+
+	return has_memset;
 }
 
 static bool ir_mem2ssa_may_convert_var(ir_ctx *ctx, ir_ref var, ir_insn *insn)
@@ -947,7 +1028,11 @@ int ir_mem2ssa(ir_ctx *ctx)
 					ctx->flags2 |= IR_MEM2SSA_VARS;
 					continue;
 				} else if (convert == IR_MAY_SPLIT) {
-					ir_mem2ssa_split_alloca(ctx, &split_layout, ref, next);
+					if (ir_mem2ssa_split_alloca(ctx, &split_layout, ref, next) && ssa_vars) {
+						/* new STOREs are not numbered yet */
+						ir_mem_free(order);
+						order = ir_mem2ssa_order(ctx);
+					}
 					continue;
 				}
 			} else if (ssa_vars
@@ -48,6 +48,7 @@ extern unsigned int thr_self(void);
 #endif
 
 #include "ir.h"
+#include "ir_private.h"
 #include "ir_elf.h"
 
 #define IR_PERF_JITDUMP_HEADER_MAGIC   0x4A695444
@@ -91,6 +92,7 @@ typedef struct _ir_perf_jitdump_load_record {
 
 static int   jitdump_fd  = -1;
 static void *jitdump_mem = MAP_FAILED;
+static ir_spinlock jitdump_lock = 0; /* serializes records written by different threads */
 
 static uint64_t ir_perf_timestamp(void)
 {
@@ -213,6 +215,7 @@ int ir_perf_jitdump_register(const char *name, const void *start, size_t size)
 		ir_perf_jitdump_load_record rec;
 		size_t len = strlen(name);
 		uint32_t thread_id = 0;
+		int ret = 1;
 #if defined(__linux__)
 		thread_id = syscall(SYS_gettid);
 #elif defined(__APPLE__)
@@ -242,13 +245,16 @@ int ir_perf_jitdump_register(const char *name, const void *start, size_t size)
 		rec.vma            = (uint64_t)(uintptr_t)start;
 		rec.code_address   = (uint64_t)(uintptr_t)start;
 		rec.code_size      = (uint64_t)size;
-		rec.code_id        = id++;
 
+		ir_spin_lock(&jitdump_lock);
+		rec.code_id        = id++;
 		if (write(jitdump_fd, &rec, sizeof(rec)) != sizeof(rec)
 		 || write(jitdump_fd, name, len + 1) < 0
 		 || write(jitdump_fd, start, size) < 0) {
-			return 0;
+			ret = 0;
 		}
+		ir_spin_unlock(&jitdump_lock);
+		return ret;
 	}
 	return 1;
 }
@@ -256,16 +262,20 @@ int ir_perf_jitdump_register(const char *name, const void *start, size_t size)
 void ir_perf_map_register(const char *name, const void *start, size_t size)
 {
 	static FILE *fp = NULL;
+	static ir_spinlock lock = 0;
 
+	ir_spin_lock(&lock);
 	if (!fp) {
 		char filename[64];
 
 		snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", getpid());
 		fp = fopen(filename, "w");
 		if (!fp) {
+			ir_spin_unlock(&lock);
 			return;
 		}
 	    setlinebuf(fp);
 	}
 	fprintf(fp, "%zx %zx %s\n", (size_t)(uintptr_t)start, size, name);
+	ir_spin_unlock(&lock);
 }
@@ -55,6 +55,74 @@
 #  define IR_FALLTHROUGH ((void)0)
 #endif
 
+#if defined(_MSC_VER)
+# define IR_THREAD_LOCAL __declspec(thread)
+#else
+# define IR_THREAD_LOCAL __thread
+#endif
+
+/*** Atomic operations and spin locks ***/
+
+IR_ALWAYS_INLINE void *ir_atomic_load_ptr(void *volatile *ptr)
+{
+#ifdef _WIN32
+	return *ptr;
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+IR_ALWAYS_INLINE bool ir_atomic_cas_ptr(void *volatile *ptr, void *old_val, void *new_val)
+{
+#ifdef _WIN32
+	return _InterlockedCompareExchangePointer(ptr, new_val, old_val) == old_val;
+#else
+	return __atomic_compare_exchange_n(ptr, &old_val, new_val, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+IR_ALWAYS_INLINE bool ir_atomic_cas_int(volatile int *ptr, int old_val, int new_val)
+{
+#ifdef _WIN32
+	return _InterlockedCompareExchange((volatile long*)ptr, new_val, old_val) == old_val;
+#else
+	return __atomic_compare_exchange_n(ptr, &old_val, new_val, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+IR_ALWAYS_INLINE void ir_atomic_inc_u64(volatile uint64_t *ptr)
+{
+#ifdef _WIN32
+	_InterlockedIncrement64((volatile long long*)ptr);
+#else
+	__atomic_fetch_add(ptr, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+typedef volatile long ir_spinlock;
+
+IR_ALWAYS_INLINE void ir_spin_lock(ir_spinlock *lock)
+{
+#ifdef _WIN32
+	while (_InterlockedExchange(lock, 1)) {
+		while (*lock);
+	}
+#else
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED));
+	}
+#endif
+}
+
+IR_ALWAYS_INLINE void ir_spin_unlock(ir_spinlock *lock)
+{
+#ifdef _WIN32
+	_InterlockedExchange(lock, 0);
+#else
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
 /*** Helper routines ***/
 
 #define IR_ALIGNED_SIZE(size, alignment) \
@@ -307,6 +375,27 @@ IR_ALWAYS_INLINE void ir_arena_release(ir_arena **arena_ptr, void *checkpoint)
 	arena->ptr = (char*)checkpoint;
 }
 
+/* Release all the allocated memory, but keep the arena for reuse */
+IR_ALWAYS_INLINE void ir_arena_reset(ir_arena **arena_ptr)
+{
+	ir_arena *arena = *arena_ptr;
+
+	if (arena->prev) {
+		/* replace the chain by a single block of the same total size */
+		size_t size = 0;
+
+		do {
+			ir_arena *prev = arena->prev;
+			size += arena->end - (char*)arena;
+			ir_mem_free(arena);
+			arena = prev;
+		} while (arena);
+		*arena_ptr = ir_arena_create(size);
+	} else {
+		arena->ptr = (char*) arena + IR_ALIGNED_SIZE(sizeof(ir_arena), 8);
+	}
+}
+
 /* Bitsets */
 #if defined(IR_TARGET_X86)
 # define IR_BITSET_BITS 32
@@ -900,6 +989,34 @@ void ir_print_escaped_str(const char *s, size_t len, FILE *f);
 
 ir_ref ir_const_ex(ir_ctx *ctx, ir_val val, uint8_t type, uint32_t optx);
 
+/* Type of a single lane of a vector type */
+IR_ALWAYS_INLINE ir_type ir_vec_lane_type(ir_type type)
+{
+	switch (type) {
+		case IR_I8X16: return IR_I8;
+		case IR_I32X4: return IR_I32;
+		case IR_F32X4: return IR_FLOAT;
+		case IR_F64X2: return IR_DOUBLE;
+		case IR_I8X32: return IR_I8;
+		case IR_I32X8: return IR_I32;
+		case IR_F32X8: return IR_FLOAT;
+		case IR_F64X4: return IR_DOUBLE;
+		default: IR_ASSERT(0); return IR_VOID;
+	}
+}
+
+#define IR_VEC_LANES(type) (ir_type_size[type] / ir_type_size[ir_vec_lane_type(type)])
+
+/* Source lane of VSHUFFLE. Two lane vectors use 1-bit selectors. Otherwise, 2-bit selectors
+ * are applied to each group of 4 lanes (like PSHUFD does for each 128-bit half) */
+IR_ALWAYS_INLINE uint32_t ir_vshuffle_lane(uint32_t mask, uint32_t lanes, uint32_t i)
+{
+	if (lanes == 2) {
+		return (mask >> i) & 1;
+	}
+	return (i & ~3) + ((mask >> ((i & 3) * 2)) & 3);
+}
+
 IR_ALWAYS_INLINE bool ir_const_is_true(const ir_insn *v)
 {
 	if (IR_IS_SYM_CONST(v->op)) {
@@ -1027,7 +1144,11 @@ IR_ALWAYS_INLINE uint32_t ir_insn_len(const ir_insn *insn)
 #define IR_HAS_BLOCK_ADDR      (1<<12)
 #define IR_PREALLOCATED_STACK  (1<<13)
 #define IR_RECURSIVE_TAILCALL  (1<<14)
+#define IR_INCREMENTAL_USE_LISTS (1<<15) /* use_lists are maintained by the builder */
 
+/* Bits 16-21 are occupied by IR_DEBUG_* flags (see ir.h) */
+
+#define IR_HAS_VEC256          (1<<22) /* upper halves of ymm registers are used (x86 AVX2) */
 
 /* Temporary: MEM2SSA -> SCCP */
 #define IR_MEM2SSA_VARS        (1<<25)
@@ -1047,6 +1168,50 @@ IR_ALWAYS_INLINE uint32_t ir_insn_len(const ir_insn *insn)
 
 #define IR_RESERVED_FLAG_1     (1U<<31)
 
+/*** Per-pass data allocation (ctx->storage arena is used with IR_ARENA_STORAGE) ***/
+void *ir_ctx_storage_alloc(ir_ctx *ctx, size_t size);
+
+IR_ALWAYS_INLINE void *ir_ctx_malloc(ir_ctx *ctx, size_t size)
+{
+	if (ctx->flags & IR_ARENA_STORAGE) {
+		return ir_ctx_storage_alloc(ctx, size);
+	}
+	return ir_mem_malloc(size);
+}
+
+IR_ALWAYS_INLINE void *ir_ctx_calloc(ir_ctx *ctx, size_t num, size_t size)
+{
+	if (ctx->flags & IR_ARENA_STORAGE) {
+		void *ptr = ir_ctx_storage_alloc(ctx, num * size);
+
+		memset(ptr, 0, num * size);
+		return ptr;
+	}
+	return ir_mem_calloc(num, size);
+}
+
+IR_ALWAYS_INLINE void *ir_ctx_realloc(ir_ctx *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	if (ctx->flags & IR_ARENA_STORAGE) {
+		void *new_ptr;
+
+		if (new_size <= old_size) {
+			return ptr;
+		}
+		new_ptr = ir_ctx_storage_alloc(ctx, new_size);
+		memcpy(new_ptr, ptr, old_size);
+		return new_ptr;
+	}
+	return ir_mem_realloc(ptr, new_size);
+}
+
+IR_ALWAYS_INLINE void ir_ctx_free(ir_ctx *ctx, void *ptr)
+{
+	if (!(ctx->flags & IR_ARENA_STORAGE)) {
+		ir_mem_free(ptr);
+	}
+}
+
 /*** IR Use Lists ***/
 struct _ir_use_list {
 	ir_ref        refs; /* index in ir_ctx->use_edges[] array */
@@ -1179,6 +1344,7 @@ void ir_build_prev_refs(ir_ctx *ctx);
 uint32_t ir_skip_empty_target_blocks(const ir_ctx *ctx, uint32_t b);
 uint32_t ir_next_block(const ir_ctx *ctx, uint32_t b);
 void ir_get_true_false_blocks(const ir_ctx *ctx, uint32_t b, uint32_t *true_block, uint32_t *false_block);
+void ir_remove_merge_input(ir_ctx *ctx, ir_ref merge, ir_ref from);
 
 IR_ALWAYS_INLINE uint32_t ir_phi_input_number(const ir_ctx *ctx, const ir_block *bb, uint32_t from)
 {
@@ -1193,6 +1359,18 @@ IR_ALWAYS_INLINE uint32_t ir_phi_input_number(const ir_ctx *ctx, const ir_block
 	return 0;
 }
 
+IR_ALWAYS_INLINE bool ir_dominates(const ir_block *blocks, uint32_t b1, uint32_t b2)
+{
+	uint32_t b1_depth = blocks[b1].dom_depth;
+	const ir_block *bb2 = &blocks[b2];
+
+	while (bb2->dom_depth > b1_depth) {
+		b2 = bb2->dom_parent;
+		bb2 = &blocks[b2];
+	}
+	return b1 == b2;
+}
+
 /*** Folding Engine (see ir.c and ir_fold.h) ***/
 typedef enum _ir_fold_action {
 	IR_FOLD_DO_RESTART,
@@ -1205,10 +1383,45 @@ typedef enum _ir_fold_action {
 ir_ref ir_folding(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3,
                   const ir_insn *op1_insn, const ir_insn *op2_insn, const ir_insn *op3_insn);
 
+/* ir_folding() is called from SCCP or iterative optimizations (not during IR construction).
+ * Incrementally built use_lists are incomplete and must not affect folding.
+ */
+#define IR_FOLD_IN_OPT(ctx) \
+	((ctx)->use_lists && !((ctx)->flags2 & IR_INCREMENTAL_USE_LISTS))
+
+#ifdef IR_FOLD_STATS
+/* IR_FOLD_DO_CSE was resolved to an existing instruction by the caller of ir_folding() */
+void ir_fold_stats_cse_hit(void);
+# define IR_FOLD_STATS_CSE_HIT() ir_fold_stats_cse_hit()
+#else
+# define IR_FOLD_STATS_CSE_HIT()
+#endif
+
 /*** Alias Analyzes (see ir.c) ***/
-ir_ref ir_find_aliasing_load(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr);
+typedef enum _ir_alias {
+	IR_MAY_ALIAS  = -1,
+	IR_NO_ALIAS   =  0,
+	IR_MUST_ALIAS =  1,
+} ir_alias;
+
+/* Alias classes of LOADs and STOREs (0 is the class of unknown memory) */
+void ir_set_alias_class(ir_ctx *ctx, ir_ref ref, uint16_t alias_class);
+
+IR_ALWAYS_INLINE uint16_t ir_alias_class(const ir_ctx *ctx, ir_ref ref)
+{
+	return ctx->alias_classes ? ctx->alias_classes[ref] : 0;
+}
+
+/* Memory accessed with different alias classes never overlaps */
+IR_ALWAYS_INLINE bool ir_alias_class_disjoint(uint16_t alias_class1, uint16_t alias_class2)
+{
+	return alias_class1 && alias_class2 && alias_class1 != alias_class2;
+}
+
+ir_alias ir_check_aliasing(const ir_ctx *ctx, ir_ref addr1, ir_ref addr2, ir_type type1, ir_type type2);
+ir_ref ir_find_aliasing_load(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref addr, uint16_t alias_class);
 ir_ref ir_find_aliasing_vload(const ir_ctx *ctx, ir_ref ref, ir_type type, ir_ref var);
-ir_ref ir_find_aliasing_store(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val);
+ir_ref ir_find_aliasing_store(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val, uint16_t alias_class);
 ir_ref ir_find_aliasing_vstore(ir_ctx *ctx, ir_ref ref, ir_ref addr, ir_ref val);
 
 /*** Predicates (see ir.c) ***/
@@ -49,7 +49,7 @@ static int ir_assign_virtual_registers_slow(ir_ctx *ctx)
 	uint32_t flags;
 
 	/* Assign unique virtual register to each data node */
-	vregs = ir_mem_calloc(ctx->insns_count, sizeof(ir_ref));
+	vregs = ir_ctx_calloc(ctx, ctx->insns_count, sizeof(ir_ref));
 	n = 1;
 	for (b = 1, bb = ctx->cfg_blocks + b; b <= ctx->cfg_blocks_count; b++, bb++) {
 		IR_ASSERT(!(bb->flags & IR_BB_UNREACHABLE));
@@ -91,7 +91,7 @@ int ir_assign_virtual_registers(ir_ctx *ctx)
 	}
 
 	/* Assign unique virtual register to each rule that needs it */
-	vregs = ir_mem_malloc(ctx->insns_count * sizeof(ir_ref));
+	vregs = ir_ctx_malloc(ctx, ctx->insns_count * sizeof(ir_ref));
 
 	for (i = 1, insn = &ctx->ir_base[1]; i < ctx->insns_count; i++, insn++) {
 		uint32_t v = 0;
@@ -603,7 +603,7 @@ int ir_compute_live_ranges(ir_ctx *ctx)
 	}
 
 	if (ctx->rules) {
-		ctx->regs = ir_mem_malloc(sizeof(ir_regs) * ctx->insns_count);
+		ctx->regs = ir_ctx_malloc(ctx, sizeof(ir_regs) * ctx->insns_count);
 		memset(ctx->regs, IR_REG_NONE, sizeof(ir_regs) * ctx->insns_count);
 	}
 
@@ -616,7 +616,7 @@ int ir_compute_live_ranges(ir_ctx *ctx)
 	bb_live = ir_mem_malloc((ctx->cfg_blocks_count + 1) * len * sizeof(ir_bitset_base_t));
 
 	/* vregs + tmp + fixed + ALL + SCRATCH_N */
-	ctx->live_intervals = ir_mem_calloc(ctx->vregs_count + 1 + IR_REG_SET_NUM, sizeof(ir_live_interval*));
+	ctx->live_intervals = ir_ctx_calloc(ctx, ctx->vregs_count + 1 + IR_REG_SET_NUM, sizeof(ir_live_interval*));
 
 #ifdef IR_DEBUG
 	visited = ir_bitset_malloc(ctx->cfg_blocks_count + 1);
@@ -1323,7 +1323,7 @@ int ir_compute_live_ranges(ir_ctx *ctx)
 	}
 
 	if (ctx->rules) {
-		ctx->regs = ir_mem_malloc(sizeof(ir_regs) * ctx->insns_count);
+		ctx->regs = ir_ctx_malloc(ctx, sizeof(ir_regs) * ctx->insns_count);
 		memset(ctx->regs, IR_REG_NONE, sizeof(ir_regs) * ctx->insns_count);
 	}
 
@@ -1334,7 +1334,7 @@ int ir_compute_live_ranges(ir_ctx *ctx)
 	ctx->flags2 &= ~IR_LR_HAVE_DESSA_MOVES;
 
 	/* vregs + tmp + fixed + ALL + SCRATCH_N */
-	ctx->live_intervals = ir_mem_calloc(ctx->vregs_count + 1 + IR_REG_SET_NUM, sizeof(ir_live_interval*));
+	ctx->live_intervals = ir_ctx_calloc(ctx, ctx->vregs_count + 1 + IR_REG_SET_NUM, sizeof(ir_live_interval*));
 
     if (!ctx->arena) {
 		ctx->arena = ir_arena_create(16 * 1024);
@@ -2379,7 +2379,7 @@ int ir_gen_dessa_moves(ir_ctx *ctx, uint32_t b, emit_copy_t emit_copy, void *dat
 #  define IR_REG_NAME_VAL(_ival) ir_reg_name((_ival)->reg, (_ival)->type)
 # endif
 # define IR_LOG_LSRA(action, ival, comment) do { \
-		if (ctx->flags & IR_DEBUG_RA) { \
+		if (ctx->flags2 & IR_DEBUG_RA) { \
 			ir_live_interval *_ival = (ival); \
 			ir_live_pos _start = _ival->range.start; \
 			ir_live_pos _end = _ival->end; \
@@ -2390,7 +2390,7 @@ int ir_gen_dessa_moves(ir_ctx *ctx, uint32_t b, emit_copy_t emit_copy, void *dat
 		} \
 	} while (0)
 # define IR_LOG_LSRA_ASSIGN(action, ival, comment) do { \
-		if (ctx->flags & IR_DEBUG_RA) { \
+		if (ctx->flags2 & IR_DEBUG_RA) { \
 			ir_live_interval *_ival = (ival); \
 			ir_live_pos _start = _ival->range.start; \
 			ir_live_pos _end = _ival->end; \
@@ -2402,7 +2402,7 @@ int ir_gen_dessa_moves(ir_ctx *ctx, uint32_t b, emit_copy_t emit_copy, void *dat
 		} \
 	} while (0)
 # define IR_LOG_LSRA_SPLIT(ival, pos) do { \
-		if (ctx->flags & IR_DEBUG_RA) { \
+		if (ctx->flags2 & IR_DEBUG_RA) { \
 			ir_live_interval *_ival = (ival); \
 			ir_live_pos _start = _ival->range.start; \
 			ir_live_pos _end = _ival->end; \
@@ -2415,7 +2415,7 @@ int ir_gen_dessa_moves(ir_ctx *ctx, uint32_t b, emit_copy_t emit_copy, void *dat
 		} \
 	} while (0)
 # define IR_LOG_LSRA_CONFLICT(action, ival, pos) do { \
-		if (ctx->flags & IR_DEBUG_RA) { \
+		if (ctx->flags2 & IR_DEBUG_RA) { \
 			ir_live_interval *_ival = (ival); \
 			ir_live_pos _start = _ival->range.start; \
 			ir_live_pos _end = _ival->end; \
@@ -2666,10 +2666,14 @@ static int32_t ir_allocate_small_spill_slot(ir_ctx *ctx, size_t size)
 	ir_reg_alloc_data *data = ctx->data;
 	int32_t ret;
 
-	IR_ASSERT(size == 0 || size == 1 || size == 2 || size == 4 || size == 8);
+	IR_ASSERT(size == 0 || size == 1 || size == 2 || size == 4 || size == 8 || size == 16 || size == 32);
 	if (data->handled && data->handled[size]) {
 		ret = data->handled[size]->stack_spill_pos;
 		data->handled[size] = data->handled[size]->list_next;
+	} else if (size == 16 || size == 32) {
+		/* vectors are spilled using unaligned moves */
+		ret = ctx->stack_frame_size;
+		ctx->stack_frame_size += size;
 	} else if (size == 8) {
 		ret = ctx->stack_frame_size;
 		ctx->stack_frame_size += 8;
@@ -3066,8 +3070,12 @@ static ir_reg ir_try_allocate_free_reg(ir_ctx *ctx, ir_live_interval *ival, ir_l
 	ir_live_interval *other;
 	ir_regset available, overlapped, scratch;
 
-	if (IR_IS_TYPE_FP(ival->type)) {
+	if (!IR_IS_TYPE_INT(ival->type)) {
 		available = IR_REGSET_FP;
+		if (IR_IS_TYPE_VEC(ival->type)) {
+			/* callee-saved FP registers are preserved only as scalars (low 64 bits) */
+			available = IR_REGSET_DIFFERENCE(available, ((ir_reg_alloc_data*)(ctx->data))->cc->preserved_regs);
+		}
 		/* set freeUntilPos of all physical registers to maxInt */
 		for (i = IR_REG_FP_FIRST; i <= IR_REG_FP_LAST; i++) {
 			freeUntilPos[i] = 0x7fffffff;
@@ -3404,8 +3412,12 @@ static ir_reg ir_allocate_blocked_reg(ir_ctx *ctx, ir_live_interval *ival, ir_li
 		next_use_pos = ival->range.end;
 	}
 
-	if (IR_IS_TYPE_FP(ival->type)) {
+	if (!IR_IS_TYPE_INT(ival->type)) {
 		available = IR_REGSET_FP;
+		if (IR_IS_TYPE_VEC(ival->type)) {
+			/* callee-saved FP registers are preserved only as scalars (low 64 bits) */
+			available = IR_REGSET_DIFFERENCE(available, ((ir_reg_alloc_data*)(ctx->data))->cc->preserved_regs);
+		}
 		/* set nextUsePos of all physical registers to maxInt */
 		for (i = IR_REG_FP_FIRST; i <= IR_REG_FP_LAST; i++) {
 			nextUsePos[i] = 0x7fffffff;
@@ -3975,7 +3987,7 @@ static int ir_linear_scan(ir_ctx *ctx, ir_ref vars)
 	ctx->flags2 &= ~(IR_RA_HAVE_SPLITS|IR_RA_HAVE_SPILLS);
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_RA) {
+	if (ctx->flags2 & IR_DEBUG_RA) {
 		fprintf(stderr, "----\n");
 		ir_dump_live_ranges(ctx, stderr);
 		fprintf(stderr, "---- Start LSRA\n");
@@ -4119,7 +4131,7 @@ static int ir_linear_scan(ir_ctx *ctx, ir_ref vars)
 
 		if (unhandled) {
 			uint8_t size;
-			ir_live_interval *handled[9] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+			ir_live_interval *handled[33] = {NULL};
 			ir_live_interval *old;
 
 			((ir_reg_alloc_data*)(ctx->data))->handled = handled;
@@ -4142,7 +4154,7 @@ static int ir_linear_scan(ir_ctx *ctx, ir_ref vars)
 							active = other->list_next;
 						}
 						size = ir_type_size[other->type];
-						IR_ASSERT(size == 1 || size == 2 || size == 4 || size == 8);
+						IR_ASSERT(size == 1 || size == 2 || size == 4 || size == 8 || size == 16 || size == 32);
 						old = handled[size];
 						while (old) {
 							if (old->stack_spill_pos == other->stack_spill_pos) {
@@ -4166,7 +4178,7 @@ static int ir_linear_scan(ir_ctx *ctx, ir_ref vars)
 					active = ival;
 				} else {
 					size = ir_type_size[ival->type];
-					IR_ASSERT(size == 1 || size == 2 || size == 4 || size == 8);
+					IR_ASSERT(size == 1 || size == 2 || size == 4 || size == 8 || size == 16 || size == 32);
 					old = handled[size];
 					while (old) {
 						if (old->stack_spill_pos == ival->stack_spill_pos) {
@@ -4196,7 +4208,7 @@ static int ir_linear_scan(ir_ctx *ctx, ir_ref vars)
 #endif
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_RA) {
+	if (ctx->flags2 & IR_DEBUG_RA) {
 		fprintf(stderr, "---- Finish LSRA\n");
 		ir_dump_live_ranges(ctx, stderr);
 		fprintf(stderr, "----\n");
@@ -4273,7 +4285,7 @@ static void assign_regs(ir_ctx *ctx)
 	ir_regset used_regs = 0;
 
 	if (!ctx->regs) {
-		ctx->regs = ir_mem_malloc(sizeof(ir_regs) * ctx->insns_count);
+		ctx->regs = ir_ctx_malloc(ctx, sizeof(ir_regs) * ctx->insns_count);
 		memset(ctx->regs, IR_REG_NONE, sizeof(ir_regs) * ctx->insns_count);
 	}
 
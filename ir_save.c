@@ -285,6 +285,8 @@ void ir_save(const ir_ctx *ctx, uint32_t save_flags, FILE *f)
 			fprintf(f, "/%d", n - 1);
 		} else if (insn->op == IR_SNAPSHOT) {
 			fprintf(f, "/%d", n - 1);
+		} else if ((insn->op == IR_LOAD || insn->op == IR_STORE) && ir_alias_class(ctx, i)) {
+			fprintf(f, "/%d", ir_alias_class(ctx, i));
 		}
 		first = 1;
 		for (j = 1, p = insn->ops + 1; j <= n; j++, p++) {
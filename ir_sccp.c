@@ -501,6 +501,44 @@ static bool ir_is_dead(const ir_ctx *ctx, ir_ref ref)
 	return 0;
 }
 
+static bool ir_is_reassoc_op(ir_op op, ir_type type)
+{
+	switch (op) {
+		case IR_ADD:
+		case IR_MUL:
+			return IR_IS_TYPE_INT(type) && type != IR_BOOL;
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+			return IR_IS_TYPE_INT(type);
+		default:
+			return 0;
+	}
+}
+
+/* Schedule the operation for reassociation if one of its operands is the same operation */
+static bool ir_may_reassociate(const ir_ctx *ctx, const ir_insn *insn)
+{
+	const ir_insn *op_insn;
+
+	if (!ir_is_reassoc_op(insn->op, insn->type)) {
+		return 0;
+	}
+	if (insn->op1 > 0) {
+		op_insn = &ctx->ir_base[insn->op1];
+		if (op_insn->op == insn->op && op_insn->type == insn->type) {
+			return 1;
+		}
+	}
+	if (insn->op2 > 0) {
+		op_insn = &ctx->ir_base[insn->op2];
+		if (op_insn->op == insn->op && op_insn->type == insn->type) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static bool ir_sccp_is_true(const ir_ctx *ctx, const ir_sccp_val *_values, ir_ref a)
 {
 	const ir_insn *v = IR_IS_CONST_REF(a) ? &ctx->ir_base[a] : &_values[a].insn;
@@ -634,7 +672,8 @@ static IR_NEVER_INLINE void ir_sccp_analyze(const ir_ctx *ctx, ir_sccp_val *_val
 				}
 				if (!may_benefit) {
 					IR_MAKE_BOTTOM_EX(i);
-					if (insn->op == IR_FP2FP || insn->op == IR_FP2INT || insn->op == IR_TRUNC) {
+					if (insn->op == IR_FP2FP || insn->op == IR_FP2INT || insn->op == IR_TRUNC
+					 || ir_may_reassociate(ctx, insn)) {
 						ir_bitqueue_add(iter_worklist, i);
 					}
 				} else if (!ir_sccp_fold(ctx, _values, worklist, i, insn)) {
@@ -642,7 +681,8 @@ static IR_NEVER_INLINE void ir_sccp_analyze(const ir_ctx *ctx, ir_sccp_val *_val
 					continue;
 				} else if (_values[i].op == IR_BOTTOM) {
 					insn = &ctx->ir_base[i];
-					if (insn->op == IR_FP2FP || insn->op == IR_FP2INT || insn->op == IR_TRUNC) {
+					if (insn->op == IR_FP2FP || insn->op == IR_FP2INT || insn->op == IR_TRUNC
+					 || ir_may_reassociate(ctx, insn)) {
 						ir_bitqueue_add(iter_worklist, i);
 					}
 				}
@@ -826,7 +866,7 @@ static IR_NEVER_INLINE void ir_sccp_analyze(const ir_ctx *ctx, ir_sccp_val *_val
 	}
 
 #ifdef IR_DEBUG
-	if (ctx->flags & IR_DEBUG_SCCP) {
+	if (ctx->flags2 & IR_DEBUG_SCCP) {
 		for (i = 1; i < ctx->insns_count; i++) {
 			if (IR_IS_CONST_OP(_values[i].op) || IR_IS_SYM_CONST(_values[i].op)) {
 				fprintf(stderr, "%d. CONST(", i);
@@ -1475,6 +1515,7 @@ restart:
 			copy = ir_iter_find_cse(ctx, ref, ctx->fold_insn.opt,
 				ctx->fold_insn.op1, ctx->fold_insn.op2, ctx->fold_insn.op3);
 			if (copy) {
+				IR_FOLD_STATS_CSE_HIT();
 				ir_iter_replace_insn(ctx, ref, copy);
 				break;
 			}
@@ -2676,7 +2717,10 @@ static bool ir_optimize_phi(ir_ctx *ctx, ir_ref merge_ref, ir_insn *merge, ir_re
 				ir_type type = insn->type;
 				bool is_cmp, is_less;
 
-				if (IR_IS_TYPE_FP(type)) {
+				if (IR_IS_TYPE_VEC(type)) {
+					/* vector compares produce lane masks, they are not used as IF conditions */
+					is_cmp = is_less = 0;
+				} else if (IR_IS_TYPE_FP(type)) {
 					is_cmp = (cond->op == IR_LT || cond->op == IR_LE || cond->op == IR_GT || cond->op == IR_GE ||
 						cond->op == IR_ULT || cond->op == IR_ULE || cond->op == IR_UGT || cond->op == IR_UGE);
 					is_less = (cond->op == IR_LT || cond->op == IR_LE ||
@@ -3840,6 +3884,245 @@ remove_guard:
 	}
 }
 
+/* Reassociation of commutative and associative integer operations (ADD, MUL, AND, OR, XOR).
+ *
+ * A tree of the same operations, where each interior node has a single use, is flattened into
+ * a list of leaves. Constant leaves are combined, duplicate leaves are removed (AND, OR) or
+ * cancelled (XOR), and the tree is rebuilt in a balanced form with the constant at the root:
+ *
+ * (a + 1) + (b + 2)   => (a + b) + 3
+ * ((a * b) * c) * d   => (a * b) * (c * d)
+ *
+ * The nodes of the original tree are reused, so no new instructions are created.
+ */
+#define IR_REASSOC_MAX_NODES 64
+
+typedef struct _ir_reassoc {
+	ir_op    op;
+	ir_type  type;
+	int      depth;
+	uint32_t nodes_count;
+	uint32_t leaves_count;
+	ir_ref   nodes[IR_REASSOC_MAX_NODES];
+	ir_ref   leaves[IR_REASSOC_MAX_NODES + 1];
+} ir_reassoc;
+
+static bool ir_reassoc_is_interior(const ir_ctx *ctx, const ir_reassoc *r, ir_ref ref)
+{
+	return ref > 0
+		&& ctx->ir_base[ref].op == r->op
+		&& ctx->ir_base[ref].type == r->type
+		&& ctx->use_lists[ref].count == 1
+		&& r->nodes_count < IR_REASSOC_MAX_NODES;
+}
+
+static void ir_reassoc_collect(const ir_ctx *ctx, ir_reassoc *r, ir_ref ref, int depth)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+
+	r->nodes[r->nodes_count++] = ref;
+	if (depth > r->depth) {
+		r->depth = depth;
+	}
+	if (ir_reassoc_is_interior(ctx, r, insn->op1)) {
+		ir_reassoc_collect(ctx, r, insn->op1, depth + 1);
+	} else {
+		r->leaves[r->leaves_count++] = insn->op1;
+	}
+	if (ir_reassoc_is_interior(ctx, r, insn->op2)) {
+		ir_reassoc_collect(ctx, r, insn->op2, depth + 1);
+	} else {
+		r->leaves[r->leaves_count++] = insn->op2;
+	}
+}
+
+static uint64_t ir_normalize_int_val(ir_type type, uint64_t val)
+{
+	uint32_t bits = ir_type_size[type] * 8;
+
+	if (type == IR_BOOL) {
+		return val & 1;
+	} else if (bits < 64) {
+		if (IR_IS_TYPE_SIGNED(type)) {
+			return (uint64_t)((int64_t)(val << (64 - bits)) >> (64 - bits));
+		} else {
+			return val & ((UINT64_C(1) << bits) - 1);
+		}
+	}
+	return val;
+}
+
+static void ir_reassoc_link(ir_ctx *ctx, ir_ref ref, ir_ref op1, ir_ref op2)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+
+	insn->op1 = op1;
+	insn->op2 = op2;
+	if (op1 > 0) {
+		ir_use_list_add(ctx, op1, ref);
+	}
+	if (op2 > 0) {
+		ir_use_list_add(ctx, op2, ref);
+	}
+	/* schedule folding */
+	ir_bitqueue_add(ctx->iter_worklist, ref);
+}
+
+static bool ir_try_reassociate(ir_ctx *ctx, ir_ref ref, ir_insn *insn)
+{
+	ir_reassoc r;
+	ir_ref leaf, result, *level;
+	uint32_t i, j, n, count, consts_count, next_node;
+	uint64_t c, identity, all_ones;
+	bool changed = 0, has_const;
+	int depth;
+
+	if (!ir_is_reassoc_op(insn->op, insn->type) || (ctx->flags2 & IR_LINEAR)) {
+		return 0;
+	}
+	if (ctx->use_lists[ref].count == 1) {
+		ir_ref use = ctx->use_edges[ctx->use_lists[ref].refs];
+		ir_insn *use_insn = &ctx->ir_base[use];
+
+		if (use_insn->op == insn->op && use_insn->type == insn->type) {
+			/* the whole tree is processed starting from its root */
+			ir_bitqueue_add(ctx->iter_worklist, use);
+			return 0;
+		}
+	}
+
+	r.op = insn->op;
+	r.type = insn->type;
+	r.depth = 0;
+	r.nodes_count = 0;
+	r.leaves_count = 0;
+	ir_reassoc_collect(ctx, &r, ref, 1);
+	if (r.nodes_count == 1) {
+		return 0;
+	}
+
+	all_ones = ir_normalize_int_val(r.type, (uint64_t)-1);
+	identity = (r.op == IR_MUL) ? 1 : (r.op == IR_AND) ? all_ones : 0;
+
+	/* Combine constants */
+	c = identity;
+	consts_count = 0;
+	for (i = 0, n = 0; i < r.leaves_count; i++) {
+		leaf = r.leaves[i];
+		if (IR_IS_CONST_REF(leaf) && !IR_IS_SYM_CONST(ctx->ir_base[leaf].op)) {
+			uint64_t val = ctx->ir_base[leaf].val.u64;
+
+			switch (r.op) {
+				case IR_ADD: c += val; break;
+				case IR_MUL: c *= val; break;
+				case IR_AND: c &= val; break;
+				case IR_OR:  c |= val; break;
+				default:     c ^= val; break;
+			}
+			consts_count++;
+		} else {
+			r.leaves[n++] = leaf;
+		}
+	}
+	c = ir_normalize_int_val(r.type, c);
+
+	/* Remove duplicate (AND, OR) or cancel paired (XOR) leaves */
+	if (r.op != IR_ADD && r.op != IR_MUL) {
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; j++) {
+				if (r.leaves[j] == r.leaves[i]) {
+					if (r.op == IR_XOR) {
+						r.leaves[j] = r.leaves[--n];
+						r.leaves[i] = r.leaves[--n];
+						i--;
+						break;
+					}
+					r.leaves[j--] = r.leaves[--n];
+				}
+			}
+		}
+		changed = n + consts_count != r.leaves_count;
+	}
+
+	/* Sort leaves to group the older (often loop invariant) values and to allow CSE */
+	for (i = 1; i < n; i++) {
+		leaf = r.leaves[i];
+		for (j = i; j > 0 && (uint32_t)r.leaves[j - 1] > (uint32_t)leaf; j--) {
+			r.leaves[j] = r.leaves[j - 1];
+		}
+		r.leaves[j] = leaf;
+	}
+
+	if ((r.op == IR_MUL || r.op == IR_AND) && c == 0) {
+		/* a * 0 => 0, a & 0 => 0 */
+		result = ir_const(ctx, *(ir_val*)&c, r.type);
+	} else if (r.op == IR_OR && c == all_ones) {
+		/* a | -1 => -1 */
+		result = ir_const(ctx, *(ir_val*)&c, r.type);
+	} else if (n == 0) {
+		result = ir_const(ctx, *(ir_val*)&c, r.type);
+	} else if (n == 1 && c == identity) {
+		result = r.leaves[0];
+	} else {
+		result = IR_UNUSED;
+	}
+	if (result) {
+		ir_iter_replace_insn(ctx, ref, result);
+		return 1;
+	}
+
+	has_const = c != identity;
+	for (depth = has_const, count = 1; count < n; count *= 2) {
+		depth++;
+	}
+	if (!changed
+	 && (consts_count == 0 || (consts_count == 1 && has_const))
+	 && r.depth <= depth) {
+		/* keep the original form (it may group loop invariant values) */
+		return 0;
+	}
+
+	/* Unlink the tree */
+	for (i = 0; i < r.nodes_count; i++) {
+		insn = &ctx->ir_base[r.nodes[i]];
+		if (insn->op1 > 0) {
+			ir_use_list_remove_one(ctx, insn->op1, r.nodes[i]);
+		}
+		if (insn->op2 > 0) {
+			ir_use_list_remove_one(ctx, insn->op2, r.nodes[i]);
+		}
+		insn->op1 = IR_UNUSED;
+		insn->op2 = IR_UNUSED;
+	}
+
+	/* Build a balanced tree (the root node is used for the last operation) */
+	level = r.leaves;
+	next_node = 1;
+	while (n > 1) {
+		count = 0;
+		for (i = 0; i + 1 < n; i += 2) {
+			ir_ref node = (n == 2 && !has_const) ? ref : r.nodes[next_node++];
+
+			ir_reassoc_link(ctx, node, level[i], level[i + 1]);
+			level[count++] = node;
+		}
+		if (n & 1) {
+			level[count++] = level[n - 1];
+		}
+		n = count;
+	}
+	if (has_const) {
+		ir_reassoc_link(ctx, ref, level[0], ir_const(ctx, *(ir_val*)&c, r.type));
+	}
+
+	/* Remove unused nodes */
+	for (i = next_node; i < r.nodes_count; i++) {
+		ir_iter_remove_insn(ctx, r.nodes[i]);
+	}
+
+	return 1;
+}
+
 void ir_iter_opt(ir_ctx *ctx, ir_bitqueue *worklist)
 {
 	ir_ref i, val;
@@ -3906,6 +4189,15 @@ void ir_iter_opt(ir_ctx *ctx, ir_bitqueue *worklist)
 							break;
 						}
 						goto folding;
+					case IR_ADD:
+					case IR_MUL:
+					case IR_AND:
+					case IR_OR:
+					case IR_XOR:
+						if (ir_try_reassociate(ctx, i, insn)) {
+							break;
+						}
+						goto folding;
 					case IR_PHI:
 						break;
 					default:
@@ -3941,7 +4233,7 @@ remove_mem_insn:
 			insn->op1 = IR_UNUSED;
 			ir_iter_remove_insn(ctx, i);
 		} else if (insn->op == IR_LOAD) {
-			val = ir_find_aliasing_load(ctx, insn->op1, insn->type, insn->op2);
+			val = ir_find_aliasing_load(ctx, insn->op1, insn->type, insn->op2, ir_alias_class(ctx, i));
 			if (val) {
 				ir_insn *val_insn;
 				ir_ref prev, next;
@@ -3982,7 +4274,7 @@ remove_aliased_load:
 				}
 			}
 		} else if (insn->op == IR_STORE) {
-			if (ir_find_aliasing_store(ctx, insn->op1, insn->op2, insn->op3)) {
+			if (ir_find_aliasing_store(ctx, insn->op1, insn->op2, insn->op3, ir_alias_class(ctx, i))) {
 				goto remove_mem_insn;
 			} else {
 				ir_insn *val_insn;
@@ -4069,6 +4361,1027 @@ void ir_iter_cleanup(ir_ctx *ctx)
 	ir_bitqueue_free(&cfg_worklist);
 }
 
+/*******************/
+/* Range Inference */
+/*******************/
+
+/* Integer range inference based on "Eliminating Range Checks using SSA Form"
+ * by John Gough and Herbert Klaeren.
+ *
+ * IF and GUARD conditions are converted into e-SSA PI constraints. A PI node is
+ * inserted for each compared value and replaces the uses of this value dominated
+ * by IF_TRUE/IF_FALSE or GUARD. Ranges are propagated through the SSA graph with
+ * widening at PHIs and a few following narrowing passes. PI constraints also keep
+ * the relation with the other compared value, that allows to evaluate repeated
+ * comparisons of the same values (e.g. "i < len").
+ *
+ * Instructions that may have only a single value (comparisons in the first place)
+ * are replaced by constants, and ADD_OV, SUB_OV and MUL_OV that can't overflow are
+ * converted into regular operations. The IF and GUARD instructions that became
+ * constant are removed by the following iterative optimization pass.
+ *
+ * PI nodes live only during the analysis and are removed at the end.
+ * Ranges are tracked only for integer types that fit into int64_t.
+ */
+#define IR_RANGE_WIDEN_LIMIT    2    /* number of PHI updates before widening */
+#define IR_RANGE_NARROW_PASSES  2
+#define IR_RANGE_DOM_BUDGET     1024 /* max number of control nodes visited to prove dominance */
+#define IR_RANGE_USE_DEPTH      4    /* max depth of data uses checked for dominance */
+
+typedef struct _ir_range {
+	int64_t min;
+	int64_t max;
+} ir_range;
+
+typedef struct _ir_range_pi {
+	ir_ref  bound; /* IR_UNUSED means zero */
+	ir_op   op;    /* PI(src) <op> bound */
+} ir_range_pi;
+
+typedef struct _ir_range_ctx {
+	ir_ref       insns_count; /* number of instructions before PI insertion */
+	ir_ref       pis_count;
+	ir_ref       pis_limit;
+	ir_range_pi *pis;
+	ir_range    *ranges;
+	uint8_t     *state;       /* 0 - not evaluated (TOP), otherwise - number of updates */
+	ir_ref      *uses;
+	ir_ref       uses_limit;
+} ir_range_ctx;
+
+#define IR_RANGE_IS_PI(rc, ref) ((ref) >= (rc)->insns_count)
+#define IR_RANGE_PI(rc, ref)    (&(rc)->pis[(ref) - (rc)->insns_count])
+
+static bool ir_range_type(ir_type type)
+{
+	return IR_IS_TYPE_INT(type) && (IR_IS_TYPE_SIGNED(type) || ir_type_size[type] < 8);
+}
+
+static void ir_range_limits(ir_type type, ir_range *r)
+{
+	uint32_t bits = ir_type_size[type] * 8;
+
+	if (type == IR_BOOL) {
+		r->min = 0;
+		r->max = 1;
+	} else if (!IR_IS_TYPE_SIGNED(type)) {
+		r->min = 0;
+		r->max = (int64_t)((UINT64_C(1) << bits) - 1);
+	} else if (bits < 64) {
+		r->min = -(INT64_C(1) << (bits - 1));
+		r->max = (INT64_C(1) << (bits - 1)) - 1;
+	} else {
+		r->min = INT64_MIN;
+		r->max = INT64_MAX;
+	}
+}
+
+static bool ir_range_fits(ir_type type, int64_t min, int64_t max)
+{
+	ir_range limits;
+
+	ir_range_limits(type, &limits);
+	return min >= limits.min && max <= limits.max;
+}
+
+static bool ir_range_is_evaluated_op(ir_op op)
+{
+	return IR_IS_FOLDABLE_OP(op) || op == IR_PI;
+}
+
+/* Returns 0 if the range of "ref" is not known yet */
+static bool ir_range_get(const ir_ctx *ctx, const ir_range_ctx *rc, ir_ref ref, ir_range *r)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+
+	if (!ir_range_type(insn->type)) {
+		r->min = INT64_MIN;
+		r->max = INT64_MAX;
+	} else if (IR_IS_CONST_REF(ref)) {
+		if (IR_IS_SYM_CONST(insn->op)) {
+			ir_range_limits(insn->type, r);
+		} else {
+			r->min = r->max = (int64_t)ir_normalize_int_val(insn->type, insn->val.u64);
+		}
+	} else if (!ir_range_is_evaluated_op(insn->op)) {
+		ir_range_limits(insn->type, r);
+	} else if (!rc->state[ref]) {
+		return 0;
+	} else {
+		*r = rc->ranges[ref];
+	}
+	return 1;
+}
+
+static bool ir_range_add_ov(int64_t a, int64_t b, int64_t *res)
+{
+	if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+		return 1;
+	}
+	*res = a + b;
+	return 0;
+}
+
+static bool ir_range_sub_ov(int64_t a, int64_t b, int64_t *res)
+{
+	if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) {
+		return 1;
+	}
+	*res = a - b;
+	return 0;
+}
+
+static bool ir_range_mul_ov(int64_t a, int64_t b, int64_t *res)
+{
+	if (a > 0) {
+		if (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a) {
+			return 1;
+		}
+	} else if (a < 0) {
+		if (b > 0 ? a < INT64_MIN / b : (b != 0 && a < INT64_MAX / b)) {
+			return 1;
+		}
+	}
+	*res = a * b;
+	return 0;
+}
+
+/* Evaluate the exact range of ADD, SUB or MUL. Returns 0 if the result may overflow the type */
+static bool ir_range_arith(ir_op op, ir_type type, const ir_range *a, const ir_range *b, ir_range *r)
+{
+	int64_t v[4];
+	int i;
+
+	switch (op) {
+		case IR_ADD:
+		case IR_ADD_OV:
+			if (ir_range_add_ov(a->min, b->min, &r->min)
+			 || ir_range_add_ov(a->max, b->max, &r->max)) {
+				return 0;
+			}
+			break;
+		case IR_SUB:
+		case IR_SUB_OV:
+			if (ir_range_sub_ov(a->min, b->max, &r->min)
+			 || ir_range_sub_ov(a->max, b->min, &r->max)) {
+				return 0;
+			}
+			break;
+		default:
+			IR_ASSERT(op == IR_MUL || op == IR_MUL_OV);
+			if (ir_range_mul_ov(a->min, b->min, &v[0])
+			 || ir_range_mul_ov(a->min, b->max, &v[1])
+			 || ir_range_mul_ov(a->max, b->min, &v[2])
+			 || ir_range_mul_ov(a->max, b->max, &v[3])) {
+				return 0;
+			}
+			r->min = r->max = v[0];
+			for (i = 1; i < 4; i++) {
+				if (v[i] < r->min) r->min = v[i];
+				if (v[i] > r->max) r->max = v[i];
+			}
+			break;
+	}
+	return ir_range_fits(type, r->min, r->max);
+}
+
+static uint32_t ir_range_cmp_mask(ir_op op)
+{
+	/* bit 0 - less, bit 1 - equal, bit 2 - greater */
+	switch (op) {
+		case IR_EQ:  return 2;
+		case IR_NE:  return 5;
+		case IR_LT:
+		case IR_ULT: return 1;
+		case IR_GE:
+		case IR_UGE: return 6;
+		case IR_LE:
+		case IR_ULE: return 3;
+		default:
+			IR_ASSERT(op == IR_GT || op == IR_UGT);
+			return 4;
+	}
+}
+
+static ir_op ir_range_swap_cmp(ir_op op)
+{
+	return (op == IR_EQ || op == IR_NE) ? op : (ir_op)(op ^ 3);
+}
+
+/* Check if "a <known> b" implies "a <op> b". Returns -1 if unknown */
+static int ir_range_cmp_implies(ir_op known, ir_op op)
+{
+	uint32_t known_mask, op_mask;
+
+	if (known != IR_EQ && known != IR_NE && op != IR_EQ && op != IR_NE
+	 && (known >= IR_ULT) != (op >= IR_ULT)) {
+		return -1;
+	}
+	known_mask = ir_range_cmp_mask(known);
+	op_mask = ir_range_cmp_mask(op);
+	if ((known_mask & op_mask) == known_mask) {
+		return 1;
+	} else if (!(known_mask & op_mask)) {
+		return 0;
+	}
+	return -1;
+}
+
+static ir_ref ir_range_strip_pi(const ir_ctx *ctx, const ir_range_ctx *rc, ir_ref ref)
+{
+	while (ref > 0 && IR_RANGE_IS_PI(rc, ref)) {
+		ref = ctx->ir_base[ref].op2;
+	}
+	return ref;
+}
+
+static bool ir_range_is_bound(const ir_ctx *ctx, const ir_range_ctx *rc, ir_ref bound, ir_ref ref)
+{
+	if (!bound) {
+		return IR_IS_CONST_REF(ref)
+			&& !IR_IS_SYM_CONST(ctx->ir_base[ref].op)
+			&& ir_normalize_int_val(ctx->ir_base[ref].type, ctx->ir_base[ref].val.u64) == 0;
+	}
+	return ir_range_strip_pi(ctx, rc, bound) == ir_range_strip_pi(ctx, rc, ref);
+}
+
+/* Evaluate "a <op> b" using the relations kept by PI constraints of "a" and "b" */
+static int ir_range_cmp_relation(const ir_ctx *ctx, const ir_range_ctx *rc, ir_op op, ir_ref a, ir_ref b)
+{
+	const ir_range_pi *pi;
+	int res;
+
+	for (; a > 0 && IR_RANGE_IS_PI(rc, a); a = ctx->ir_base[a].op2) {
+		pi = IR_RANGE_PI(rc, a);
+		if (ir_range_is_bound(ctx, rc, pi->bound, b)) {
+			res = ir_range_cmp_implies(pi->op, op);
+			if (res >= 0) {
+				return res;
+			}
+		}
+	}
+	for (; b > 0 && IR_RANGE_IS_PI(rc, b); b = ctx->ir_base[b].op2) {
+		pi = IR_RANGE_PI(rc, b);
+		if (ir_range_is_bound(ctx, rc, pi->bound, a)) {
+			res = ir_range_cmp_implies(ir_range_swap_cmp(pi->op), op);
+			if (res >= 0) {
+				return res;
+			}
+		}
+	}
+	return -1;
+}
+
+/* Evaluate "a <op> b" using ranges. Returns -1 if unknown */
+static int ir_range_cmp(ir_op op, const ir_range *a, const ir_range *b)
+{
+	if (op >= IR_ULT) {
+		/* all the values of unsigned types are positive */
+		if (a->min < 0 || b->min < 0) {
+			return -1;
+		}
+		op = (ir_op)(op - IR_ULT + IR_LT);
+	}
+	switch (op) {
+		case IR_EQ:
+		case IR_NE:
+			if (a->min == a->max && b->min == b->max && a->min == b->min) {
+				return op == IR_EQ;
+			} else if (a->max < b->min || a->min > b->max) {
+				return op == IR_NE;
+			}
+			break;
+		case IR_LT:
+			if (a->max < b->min) return 1;
+			if (a->min >= b->max) return 0;
+			break;
+		case IR_GE:
+			if (a->min >= b->max) return 1;
+			if (a->max < b->min) return 0;
+			break;
+		case IR_LE:
+			if (a->max <= b->min) return 1;
+			if (a->min > b->max) return 0;
+			break;
+		case IR_GT:
+			if (a->min > b->max) return 1;
+			if (a->max <= b->min) return 0;
+			break;
+		default:
+			IR_ASSERT(0);
+			break;
+	}
+	return -1;
+}
+
+static bool ir_range_eval_pi(const ir_ctx *ctx, const ir_range_ctx *rc, ir_ref ref, const ir_insn *insn, ir_range *r)
+{
+	const ir_range_pi *pi = IR_RANGE_PI(rc, ref);
+	ir_range c, b;
+	ir_op op = pi->op;
+
+	if (!ir_range_get(ctx, rc, insn->op2, r)) {
+		return 0;
+	}
+	if (!pi->bound) {
+		b.min = b.max = 0;
+	} else if (!ir_range_get(ctx, rc, pi->bound, &b)) {
+		return 0;
+	}
+
+	ir_range_limits(insn->type, &c);
+	if (op >= IR_ULT) {
+		if (IR_IS_TYPE_SIGNED(insn->type)) {
+			/* "x ULT y" implies "x >= 0" if "y >= 0" */
+			if ((op != IR_ULT && op != IR_ULE) || b.min < 0) {
+				return 1;
+			}
+			c.min = 0;
+		}
+		op = (ir_op)(op - IR_ULT + IR_LT);
+	}
+	switch (op) {
+		case IR_EQ:
+			c = b;
+			break;
+		case IR_NE:
+			if (b.min == b.max) {
+				c = *r;
+				if (c.min == b.min) {
+					c.min++;
+				} else if (c.max == b.min) {
+					c.max--;
+				}
+			}
+			break;
+		case IR_LT:
+			if (b.max == INT64_MIN) {
+				return 1;
+			}
+			c.max = b.max - 1;
+			break;
+		case IR_LE:
+			c.max = b.max;
+			break;
+		case IR_GT:
+			if (b.min == INT64_MAX) {
+				return 1;
+			}
+			c.min = b.min + 1;
+			break;
+		case IR_GE:
+			c.min = b.min;
+			break;
+		default:
+			IR_ASSERT(0);
+			break;
+	}
+	if (c.min > r->max || c.max < r->min || c.min > c.max) {
+		/* unreachable code */
+		return 1;
+	}
+	if (c.min > r->min) r->min = c.min;
+	if (c.max < r->max) r->max = c.max;
+	return 1;
+}
+
+/* Returns 0 if the range of "ref" can't be evaluated yet */
+static bool ir_range_eval(const ir_ctx *ctx, const ir_range_ctx *rc, ir_ref ref, const ir_insn *insn, ir_range *r)
+{
+	ir_range a, b;
+	ir_type type = insn->type, op_type;
+	ir_ref j, n;
+	const ir_ref *p;
+	int res;
+
+	if (insn->op == IR_PI) {
+		return ir_range_eval_pi(ctx, rc, ref, insn, r);
+	} else if (insn->op == IR_PHI) {
+		bool found = 0;
+
+		n = insn->inputs_count;
+		for (j = 2, p = insn->ops + 2; j <= n; j++, p++) {
+			if (*p == ref || !ir_range_get(ctx, rc, *p, &a)) {
+				continue;
+			}
+			if (!found) {
+				*r = a;
+				found = 1;
+			} else {
+				if (a.min < r->min) r->min = a.min;
+				if (a.max > r->max) r->max = a.max;
+			}
+		}
+		return found;
+	} else if (insn->op >= IR_EQ && insn->op <= IR_UGT) {
+		op_type = ctx->ir_base[insn->op1].type;
+		r->min = 0;
+		r->max = 1;
+		if (!ir_range_type(op_type) || insn->op1 == insn->op2) {
+			return 1;
+		}
+		res = ir_range_cmp_relation(ctx, rc, insn->op, insn->op1, insn->op2);
+		if (res < 0) {
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			res = ir_range_cmp(insn->op, &a, &b);
+		}
+		if (res >= 0) {
+			r->min = r->max = res;
+		}
+		return 1;
+	} else if (insn->op == IR_OVERFLOW) {
+		const ir_insn *op_insn = &ctx->ir_base[insn->op1];
+
+		r->min = 0;
+		r->max = 1;
+		if ((op_insn->op == IR_ADD_OV || op_insn->op == IR_SUB_OV || op_insn->op == IR_MUL_OV)
+		 && ir_range_type(op_insn->type)) {
+			if (!ir_range_get(ctx, rc, op_insn->op1, &a) || !ir_range_get(ctx, rc, op_insn->op2, &b)) {
+				return 0;
+			}
+			if (ir_range_arith(op_insn->op, op_insn->type, &a, &b, r)) {
+				r->min = r->max = 0;
+			} else {
+				r->min = 0;
+				r->max = 1;
+			}
+		}
+		return 1;
+	}
+
+	ir_range_limits(type, r);
+	switch (insn->op) {
+		case IR_COPY:
+			return ir_range_get(ctx, rc, insn->op1, r);
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_ADD_OV:
+		case IR_SUB_OV:
+		case IR_MUL_OV:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (!ir_range_arith(insn->op, type, &a, &b, r)) {
+				ir_range_limits(type, r);
+			}
+			break;
+		case IR_NEG:
+			if (!ir_range_get(ctx, rc, insn->op1, &a)) {
+				return 0;
+			}
+			if (IR_IS_TYPE_SIGNED(type) && a.min > r->min) {
+				r->min = -a.max;
+				r->max = -a.min;
+			}
+			break;
+		case IR_ABS:
+			if (!ir_range_get(ctx, rc, insn->op1, &a)) {
+				return 0;
+			}
+			if (a.min >= 0) {
+				*r = a;
+			} else if (a.min > r->min) {
+				if (a.max <= 0) {
+					r->min = -a.max;
+					r->max = -a.min;
+				} else {
+					r->min = 0;
+					r->max = (-a.min > a.max) ? -a.min : a.max;
+				}
+			}
+			break;
+		case IR_NOT:
+			if (ctx->ir_base[insn->op1].type != type) {
+				break;
+			} else if (!ir_range_get(ctx, rc, insn->op1, &a)) {
+				return 0;
+			}
+			if (type == IR_BOOL) {
+				r->min = !a.max;
+				r->max = !a.min;
+			} else if (IR_IS_TYPE_SIGNED(type)) {
+				r->min = ~a.max;
+				r->max = ~a.min;
+			} else {
+				int64_t umax = r->max;
+
+				r->min = umax - a.max;
+				r->max = umax - a.min;
+			}
+			break;
+		case IR_AND:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (a.min >= 0 || b.min >= 0) {
+				r->min = 0;
+				if (a.min < 0) {
+					r->max = b.max;
+				} else if (b.min < 0 || a.max < b.max) {
+					r->max = a.max;
+				} else {
+					r->max = b.max;
+				}
+			}
+			break;
+		case IR_OR:
+		case IR_XOR:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (a.min >= 0 && b.min >= 0) {
+				uint64_t mask = (uint64_t)(a.max | b.max);
+
+				mask |= mask >> 1;
+				mask |= mask >> 2;
+				mask |= mask >> 4;
+				mask |= mask >> 8;
+				mask |= mask >> 16;
+				mask |= mask >> 32;
+				r->min = (insn->op == IR_OR) ? ((a.min > b.min) ? a.min : b.min) : 0;
+				r->max = (int64_t)mask;
+			}
+			break;
+		case IR_SHR:
+		case IR_SAR:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			/* SAR of an unsigned value shifts in its most significant bit */
+			if (b.min == b.max && b.min >= 0 && b.min < ir_type_size[type] * 8
+			 && (IR_IS_TYPE_SIGNED(type) ? (a.min >= 0 || insn->op == IR_SAR) : insn->op == IR_SHR)) {
+				r->min = a.min >> b.min;
+				r->max = a.max >> b.min;
+			}
+			break;
+		case IR_DIV:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (b.min == b.max && b.min > 0) {
+				r->min = a.min / b.min;
+				r->max = a.max / b.min;
+			}
+			break;
+		case IR_MOD:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (b.min == b.max && b.min > 0) {
+				r->min = (a.min >= 0) ? 0 : ((a.min > 1 - b.min) ? a.min : 1 - b.min);
+				r->max = (a.max <= 0) ? 0 : ((a.max < b.min - 1) ? a.max : b.min - 1);
+			}
+			break;
+		case IR_MIN:
+		case IR_MAX:
+			if (!ir_range_get(ctx, rc, insn->op1, &a) || !ir_range_get(ctx, rc, insn->op2, &b)) {
+				return 0;
+			}
+			if (insn->op == IR_MIN) {
+				r->min = (a.min < b.min) ? a.min : b.min;
+				r->max = (a.max < b.max) ? a.max : b.max;
+			} else {
+				r->min = (a.min > b.min) ? a.min : b.min;
+				r->max = (a.max > b.max) ? a.max : b.max;
+			}
+			break;
+		case IR_COND:
+			if (!ir_range_get(ctx, rc, insn->op2, &a) || !ir_range_get(ctx, rc, insn->op3, &b)) {
+				return 0;
+			}
+			r->min = (a.min < b.min) ? a.min : b.min;
+			r->max = (a.max > b.max) ? a.max : b.max;
+			break;
+		case IR_ZEXT:
+		case IR_SEXT:
+		case IR_TRUNC:
+		case IR_BITCAST:
+			op_type = ctx->ir_base[insn->op1].type;
+			if (!ir_range_type(op_type)) {
+				break;
+			}
+			if (!ir_range_get(ctx, rc, insn->op1, &a)) {
+				return 0;
+			}
+			if (insn->op == IR_ZEXT && a.min < 0) {
+				/* negative values become big positive ones */
+				r->min = 0;
+				r->max = (int64_t)((UINT64_C(1) << (ir_type_size[op_type] * 8)) - 1);
+			} else if (insn->op == IR_SEXT && !IR_IS_TYPE_SIGNED(op_type)
+			 && a.max >= (INT64_C(1) << (ir_type_size[op_type] * 8 - 1))) {
+				/* big positive values become negative ones */
+				break;
+			} else if (ir_range_fits(type, a.min, a.max)) {
+				*r = a;
+			}
+			break;
+		default:
+			break;
+	}
+	return 1;
+}
+
+/* Check if control node "ref" is dominated by control node "ctrl" */
+static bool ir_range_dominates(const ir_ctx *ctx, ir_ref ctrl, ir_ref ref, int *budget)
+{
+	const ir_insn *insn;
+	ir_ref j, n;
+
+	while (ref != ctrl) {
+		if (--(*budget) <= 0 || ref <= 0) {
+			return 0;
+		}
+		insn = &ctx->ir_base[ref];
+		switch (insn->op) {
+			case IR_START:
+			case IR_ENTRY:
+				return 0;
+			case IR_MERGE:
+				/* all the predecessors must be dominated */
+				n = insn->inputs_count;
+				for (j = 1; j <= n; j++) {
+					if (!ir_range_dominates(ctx, ctrl, ir_insn_op(insn, j), budget)) {
+						return 0;
+					}
+				}
+				return 1;
+			default:
+				/* for LOOP_BEGIN follow the entry edge */
+				ref = insn->op1;
+				break;
+		}
+	}
+	return 1;
+}
+
+/* Check if all the uses of "ref" in instruction "use" are dominated by control node "ctrl" */
+static bool ir_range_use_is_dominated(const ir_ctx *ctx, ir_ref ctrl, ir_ref ref, ir_ref use, int depth, int *budget)
+{
+	const ir_insn *insn = &ctx->ir_base[use];
+	uint32_t flags = ir_op_flags[insn->op];
+	const ir_use_list *use_list;
+	const ir_insn *merge;
+	ir_ref j, n;
+
+	if (insn->op == IR_PHI) {
+		merge = &ctx->ir_base[insn->op1];
+		n = insn->inputs_count;
+		for (j = 2; j <= n; j++) {
+			if (ir_insn_op(insn, j) == ref
+			 && !ir_range_dominates(ctx, ctrl, ir_insn_op(merge, j - 1), budget)) {
+				return 0;
+			}
+		}
+		return 1;
+	} else if (insn->op == IR_PI || (flags & IR_OP_FLAG_CONTROL)) {
+		return ir_range_dominates(ctx, ctrl, insn->op1, budget);
+	} else if (IR_IS_FOLDABLE_OP(insn->op) && depth < IR_RANGE_USE_DEPTH) {
+		/* floating instruction is dominated if all its uses are dominated */
+		use_list = &ctx->use_lists[use];
+		n = use_list->count;
+		if (n == 0) {
+			return 0;
+		}
+		for (j = 0; j < n; j++) {
+			if (!ir_range_use_is_dominated(ctx, ctrl, use, ctx->use_edges[use_list->refs + j], depth + 1, budget)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Insert "PI(ctrl, ref) <op> bound" and use it instead of "ref" in the dominated instructions */
+static void ir_range_insert_pi(ir_ctx *ctx, ir_range_ctx *rc, ir_ref ctrl, ir_ref ref, ir_op op, ir_ref bound)
+{
+	ir_use_list *use_list = &ctx->use_lists[ref];
+	ir_ref j, k, n, use, pi = IR_UNUSED;
+	ir_insn *insn;
+	int budget;
+
+	n = use_list->count;
+	if (n < 2) {
+		/* the only use is the condition itself */
+		return;
+	}
+	if (n > rc->uses_limit) {
+		rc->uses_limit = n;
+		rc->uses = ir_mem_realloc(rc->uses, n * sizeof(ir_ref));
+	}
+	memcpy(rc->uses, &ctx->use_edges[use_list->refs], n * sizeof(ir_ref));
+
+	for (j = 0; j < n; j++) {
+		use = rc->uses[j];
+		if (j > 0 && use == rc->uses[j - 1]) {
+			continue;
+		}
+		budget = IR_RANGE_DOM_BUDGET;
+		if (!ir_range_use_is_dominated(ctx, ctrl, ref, use, 0, &budget)) {
+			continue;
+		}
+		if (!pi) {
+			pi = ir_emit2(ctx, IR_OPTX(IR_PI, ctx->ir_base[ref].type, 2), ctrl, ref);
+			ir_use_list_add(ctx, ctrl, pi);
+			ir_use_list_add(ctx, ref, pi);
+			if (rc->pis_count == rc->pis_limit) {
+				rc->pis_limit = rc->pis_limit ? rc->pis_limit * 2 : 16;
+				rc->pis = ir_mem_realloc(rc->pis, rc->pis_limit * sizeof(ir_range_pi));
+			}
+			IR_ASSERT(pi == rc->insns_count + rc->pis_count);
+			rc->pis[rc->pis_count].bound = bound;
+			rc->pis[rc->pis_count].op = op;
+			rc->pis_count++;
+		}
+		insn = &ctx->ir_base[use];
+		for (k = 1; k <= insn->inputs_count; k++) {
+			if (ir_insn_op(insn, k) == ref) {
+				ir_insn_set_op(insn, k, pi);
+				ir_use_list_remove_one(ctx, ref, use);
+				ir_use_list_add(ctx, pi, use);
+			}
+		}
+	}
+}
+
+static void ir_range_add_constraints(ir_ctx *ctx, ir_range_ctx *rc, ir_ref ctrl, ir_ref cond, bool val)
+{
+	const ir_insn *insn;
+	ir_op op;
+
+	if (IR_IS_CONST_REF(cond)) {
+		return;
+	}
+	insn = &ctx->ir_base[cond];
+	if (!ir_range_type(insn->type)) {
+		return;
+	}
+	ir_range_insert_pi(ctx, rc, ctrl, cond, val ? IR_NE : IR_EQ, IR_UNUSED);
+
+	insn = &ctx->ir_base[cond];
+	if (insn->op == IR_NOT && insn->type == IR_BOOL) {
+		ir_range_add_constraints(ctx, rc, ctrl, insn->op1, !val);
+	} else if (insn->op >= IR_EQ && insn->op <= IR_UGT
+	 && ir_range_type(ctx->ir_base[insn->op1].type)
+	 && insn->op1 != insn->op2) {
+		ir_ref op1 = insn->op1;
+		ir_ref op2 = insn->op2;
+
+		op = val ? insn->op : (ir_op)(insn->op ^ 1);
+		if (op1 > 0) {
+			ir_range_insert_pi(ctx, rc, ctrl, op1, op, op2);
+		}
+		if (op2 > 0) {
+			ir_range_insert_pi(ctx, rc, ctrl, op2, ir_range_swap_cmp(op), op1);
+		}
+	}
+}
+
+static bool ir_range_update(ir_range_ctx *rc, ir_ref ref, const ir_insn *insn, const ir_range *r)
+{
+	ir_range *old = &rc->ranges[ref];
+	ir_range limits, new_range;
+
+	if (!rc->state[ref]) {
+		*old = *r;
+		rc->state[ref] = 1;
+		return 1;
+	}
+	new_range.min = (r->min < old->min) ? r->min : old->min;
+	new_range.max = (r->max > old->max) ? r->max : old->max;
+	if (new_range.min == old->min && new_range.max == old->max) {
+		return 0;
+	}
+	if (insn->op == IR_PHI && rc->state[ref] > IR_RANGE_WIDEN_LIMIT) {
+		ir_range_limits(insn->type, &limits);
+		if (new_range.min < old->min) new_range.min = limits.min;
+		if (new_range.max > old->max) new_range.max = limits.max;
+	}
+	*old = new_range;
+	if (rc->state[ref] < 255) {
+		rc->state[ref]++;
+	}
+	return 1;
+}
+
+static void ir_range_analyze(const ir_ctx *ctx, ir_range_ctx *rc)
+{
+	ir_bitqueue worklist;
+	ir_range r;
+	ir_ref i, j, n, use;
+	const ir_insn *insn;
+	const ir_ref *p;
+	bool changed;
+
+	ir_bitqueue_init(&worklist, ctx->insns_count);
+	for (i = 1, insn = ctx->ir_base + 1; i < ctx->insns_count;) {
+		if (ir_range_is_evaluated_op(insn->op) && ir_range_type(insn->type)
+		 && (insn->op != IR_NOP)) {
+			ir_bitqueue_add(&worklist, i);
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+
+	do {
+		while ((i = ir_bitqueue_pop(&worklist)) >= 0) {
+			insn = &ctx->ir_base[i];
+			if (ir_range_eval(ctx, rc, i, insn, &r) && ir_range_update(rc, i, insn, &r)) {
+				n = ctx->use_lists[i].count;
+				for (p = &ctx->use_edges[ctx->use_lists[i].refs]; n > 0; p++, n--) {
+					use = *p;
+					if (ir_range_is_evaluated_op(ctx->ir_base[use].op) && ir_range_type(ctx->ir_base[use].type)) {
+						ir_bitqueue_add(&worklist, use);
+					}
+				}
+			}
+		}
+		/* PI constraints depend on the ranges of their bounds */
+		changed = 0;
+		for (i = rc->insns_count; i < ctx->insns_count; i++) {
+			insn = &ctx->ir_base[i];
+			if (ir_range_eval(ctx, rc, i, insn, &r)
+			 && (!rc->state[i] || r.min < rc->ranges[i].min || r.max > rc->ranges[i].max)) {
+				ir_bitqueue_add(&worklist, i);
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	/* Narrowing */
+	for (j = 0; j < IR_RANGE_NARROW_PASSES; j++) {
+		for (i = 1, insn = ctx->ir_base + 1; i < ctx->insns_count;) {
+			if (rc->state[i] && ir_range_eval(ctx, rc, i, insn, &r)) {
+				if (r.min > rc->ranges[i].min && r.min <= rc->ranges[i].max) {
+					rc->ranges[i].min = r.min;
+				}
+				if (r.max < rc->ranges[i].max && r.max >= rc->ranges[i].min) {
+					rc->ranges[i].max = r.max;
+				}
+			}
+			n = ir_insn_len(insn);
+			i += n;
+			insn += n;
+		}
+	}
+
+	ir_bitqueue_free(&worklist);
+}
+
+static ir_ref ir_range_const(ir_ctx *ctx, const ir_range *r, ir_type type)
+{
+	ir_val val;
+
+	IR_ASSERT(r->min == r->max);
+	val.i64 = r->min;
+	return ir_const(ctx, val, type);
+}
+
+static void ir_range_remove_pis(ir_ctx *ctx, ir_range_ctx *rc, ir_bitqueue *iter_worklist)
+{
+	ir_ref i, j, n, use, new_ref;
+	ir_insn *insn, *use_insn;
+	ir_use_list *use_list;
+
+	for (i = rc->insns_count; i < ctx->insns_count; i++) {
+		insn = &ctx->ir_base[i];
+		IR_ASSERT(insn->op == IR_PI);
+		ir_use_list_remove_one(ctx, insn->op1, i);
+		if (insn->op2 > 0) {
+			ir_use_list_remove_one(ctx, insn->op2, i);
+		}
+		if (rc->state[i] && rc->ranges[i].min == rc->ranges[i].max) {
+			new_ref = ir_range_const(ctx, &rc->ranges[i], insn->type);
+		} else {
+			new_ref = insn->op2;
+		}
+
+		use_list = &ctx->use_lists[i];
+		n = use_list->count;
+		for (j = 0; j < n; j++) {
+			use = ctx->use_edges[use_list->refs + j];
+			use_insn = &ctx->ir_base[use];
+			ir_insn_set_op(use_insn, ir_insn_find_op(use_insn, i), new_ref);
+			if (new_ref > 0) {
+				ir_use_list_add(ctx, new_ref, use);
+				use_list = &ctx->use_lists[i];
+			} else if (use < rc->insns_count) {
+				/* schedule folding */
+				ir_bitqueue_add(iter_worklist, use);
+			}
+		}
+
+		ctx->use_lists[i].count = 0;
+		ctx->use_lists[i].refs = 0;
+		MAKE_NOP(insn);
+	}
+	ctx->insns_count = rc->insns_count;
+}
+
+/* Returns 1 if a condition of IF or SWITCH was folded (the CFG has to be cleaned up) */
+static bool ir_range_opt(ir_ctx *ctx, ir_bitqueue *iter_worklist)
+{
+	ir_range_ctx rc;
+	ir_ref i, j, n, use, if_true, if_false;
+	ir_insn *insn;
+	ir_bitset no_overflow;
+	ir_range a, b, r;
+	bool folded_branch = 0;
+
+	memset(&rc, 0, sizeof(ir_range_ctx));
+	rc.insns_count = ctx->insns_count;
+
+	/* Insert PI constraints */
+	for (i = 1, insn = ctx->ir_base + 1; i < rc.insns_count;) {
+		if (insn->op == IR_IF) {
+			ir_get_true_false_refs(ctx, i, &if_true, &if_false);
+			ir_range_add_constraints(ctx, &rc, if_true, insn->op2, 1);
+			ir_range_add_constraints(ctx, &rc, if_false, ctx->ir_base[i].op2, 0);
+		} else if (insn->op == IR_GUARD || insn->op == IR_GUARD_NOT) {
+			ir_range_add_constraints(ctx, &rc, i, insn->op2, insn->op == IR_GUARD);
+		}
+		insn = &ctx->ir_base[i];
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+
+	rc.ranges = ir_mem_malloc(ctx->insns_count * sizeof(ir_range));
+	rc.state = ir_mem_calloc(ctx->insns_count, sizeof(uint8_t));
+	ir_range_analyze(ctx, &rc);
+
+	/* Find arithmetic operations that can't overflow (before PI removal) */
+	no_overflow = ir_bitset_malloc(rc.insns_count);
+	for (i = 1, insn = ctx->ir_base + 1; i < rc.insns_count;) {
+		if ((insn->op == IR_ADD_OV || insn->op == IR_SUB_OV || insn->op == IR_MUL_OV)
+		 && ir_range_type(insn->type)
+		 && ir_range_get(ctx, &rc, insn->op1, &a)
+		 && ir_range_get(ctx, &rc, insn->op2, &b)
+		 && ir_range_arith(insn->op, insn->type, &a, &b, &r)) {
+			ir_bitset_incl(no_overflow, i);
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+
+	ir_range_remove_pis(ctx, &rc, iter_worklist);
+
+	/* Replace instructions with a single possible value by constants */
+	ctx->iter_worklist = iter_worklist;
+	for (i = 1, insn = ctx->ir_base + 1; i < ctx->insns_count;) {
+		if (rc.state[i]
+		 && rc.ranges[i].min == rc.ranges[i].max
+		 && IR_IS_FOLDABLE_OP(insn->op)
+		 && insn->op != IR_NOP
+		 && ctx->use_lists[i].count) {
+			ir_use_list *use_list = &ctx->use_lists[i];
+
+			for (j = 0; j < use_list->count; j++) {
+				use = ctx->use_edges[use_list->refs + j];
+				if (ctx->ir_base[use].op == IR_IF || ctx->ir_base[use].op == IR_SWITCH) {
+					folded_branch = 1;
+				}
+			}
+			ir_iter_replace_insn(ctx, i, ir_range_const(ctx, &rc.ranges[i], insn->type));
+		} else if (ir_bitset_in(no_overflow, i)
+		 && (insn->op == IR_ADD_OV || insn->op == IR_SUB_OV || insn->op == IR_MUL_OV)) {
+			ir_use_list *use_list = &ctx->use_lists[i];
+
+			for (j = 0; j < use_list->count; j++) {
+				use = ctx->use_edges[use_list->refs + j];
+				if (ctx->ir_base[use].op == IR_OVERFLOW) {
+					ir_iter_replace_insn(ctx, use, IR_FALSE);
+					j = -1; /* the use list was modified */
+				}
+			}
+			insn = &ctx->ir_base[i];
+			insn->op = (insn->op == IR_ADD_OV) ? IR_ADD : (insn->op == IR_SUB_OV) ? IR_SUB : IR_MUL;
+			ir_bitqueue_add(iter_worklist, i);
+		}
+		n = ir_insn_len(insn);
+		i += n;
+		insn += n;
+	}
+	ctx->iter_worklist = NULL;
+
+	ir_mem_free(no_overflow);
+	ir_mem_free(rc.state);
+	ir_mem_free(rc.ranges);
+	if (rc.pis) {
+		ir_mem_free(rc.pis);
+	}
+	if (rc.uses) {
+		ir_mem_free(rc.uses);
+	}
+
+	return folded_branch;
+}
+
 int ir_sccp(ir_ctx *ctx)
 {
 	ir_bitqueue sccp_worklist, iter_worklist;
@@ -4083,11 +5396,22 @@ int ir_sccp(ir_ctx *ctx)
 	ir_sccp_transform(ctx, _values, &sccp_worklist, &iter_worklist);
 	ctx->flags2 &= ~IR_OPT_IN_SCCP;
 
+	ctx->flags2 |= IR_CFG_REACHABLE;
+
+	if ((ctx->flags & IR_OPT_RANGES) && ir_range_opt(ctx, &iter_worklist)) {
+		/* Some branches became unreachable. Let SCCP remove them together with their code
+		 * (ir_iter_opt() would only disconnect them, leaving dead STOREs and CALLs behind).
+		 */
+		memset(_values, 0, ctx->insns_count * sizeof(ir_sccp_val));
+		ctx->flags2 |= IR_OPT_IN_SCCP;
+		ir_sccp_analyze(ctx, _values, &sccp_worklist, &iter_worklist);
+		ir_sccp_transform(ctx, _values, &sccp_worklist, &iter_worklist);
+		ctx->flags2 &= ~IR_OPT_IN_SCCP;
+	}
+
 	ir_mem_free(_values);
 	ir_bitqueue_free(&sccp_worklist);
 
-	ctx->flags2 |= IR_CFG_REACHABLE;
-
 	ir_iter_opt(ctx, &iter_worklist);
 
 	ir_bitqueue_free(&iter_worklist);
@@ -0,0 +1,895 @@
+/*
+ * IR - Lightweight JIT Compilation Framework
+ * (Tail Duplication of dispatch blocks)
+ * Copyright (C) 2022 Zend by Perforce.
+ * Authors: Dmitry Stogov <dmitry@php.net>
+ */
+
+#include "ir.h"
+#include "ir_private.h"
+
+/* Interpreters built on IR funnel all the opcode handlers through a single
+ * dispatch block, that loads the next opcode and performs an indirect jump
+ * (SWITCH or IJMP). All the handlers share the same indirect branch, and
+ * the branch predictor can't learn the sequences of opcodes.
+ *
+ * This pass clones small dispatch blocks into each predecessor. A dispatch
+ * block starts with MERGE (or LOOP_BEGIN) and ends with SWITCH or IJMP on
+ * a value computed in the block. In the copy, the block PHIs are replaced
+ * by the inputs coming from the predecessor. Each SWITCH successor becomes
+ * a MERGE of the corresponding CASE nodes of all the copies.
+ *
+ * The values defined in the dispatch block (PHIs, LOADs, etc) may be used
+ * after it. These uses are updated to the value that reaches the start of
+ * the using block, creating new PHIs on demand (SSA update). Data nodes
+ * that depend only on the block values, but are not used by the block
+ * itself, are re-materialized at the using blocks in the same way.
+ *
+ * IGOTO is not duplicated here. Its successors are labeled blocks, and the
+ * backend already duplicates the empty IGOTO blocks (IR_IGOTO_DUP).
+ */
+
+#define IR_TAIL_DUP_MAX_INSNS   16     /* max number of cloned nodes of a single block */
+#define IR_TAIL_DUP_MAX_DEPS    64     /* max number of re-materialized data nodes */
+#define IR_TAIL_DUP_MAX_PREDS   256    /* max number of predecessors */
+#define IR_TAIL_DUP_BUDGET      4096   /* max number of new nodes for a single block */
+
+typedef struct _ir_tail_dup_ctx {
+	uint32_t   b;               /* dispatch block */
+	ir_ref     start;
+	ir_ref     end;
+	ir_ref     preds_count;
+	ir_ref     size;            /* ctx->insns_count before the transformation */
+	ir_ref     *idx;            /* node -> index in "nodes" + 1 */
+	uint32_t   *early;          /* node -> block (control nodes) or earliest block (data nodes) */
+	uint32_t   values_count;    /* "nodes" [0 .. values_count) are defined in the block */
+	ir_list    nodes;           /* PHIs, control chain, data slice, then dependent data nodes */
+	ir_list    chain;           /* control chain after the block start (including the block end) */
+	ir_list    uses;            /* uses of the block values (user, operand, value, block start) */
+	ir_ref     *defs;           /* [k * preds_count + i] - value of "nodes[k]" in copy "i" */
+	ir_ref     *pos;            /* [i] - start of the predecessor block of copy "i" */
+	ir_ref     **memo;          /* [k][b] - value of "nodes[k]" at start of block "b" */
+	uint32_t   *copy_of;        /* block -> copy number + 1 */
+	ir_list    phis;            /* created PHIs */
+	ir_list    pending;         /* created PHIs without inputs (PHI, k) */
+} ir_tail_dup_ctx;
+
+static bool ir_tail_dup_is_chain_op(ir_op op)
+{
+	switch (op) {
+		case IR_LOAD:
+		case IR_STORE:
+		case IR_VLOAD:
+		case IR_VSTORE:
+		case IR_RLOAD:
+		case IR_RSTORE:
+		case IR_TLS:
+		case IR_CALL:
+		case IR_GUARD:
+		case IR_GUARD_NOT:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Pure data node with fixed inputs (it may be cloned and re-materialized) */
+static bool ir_tail_dup_is_pure(const ir_ctx *ctx, ir_ref ref)
+{
+	const ir_insn *insn = &ctx->ir_base[ref];
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref j, n;
+
+	if (!(flags & IR_OP_FLAG_DATA)
+	 || (flags & IR_OP_FLAG_PINNED)
+	 || IR_OP_HAS_VAR_INPUTS(flags)) {
+		return 0;
+	}
+	n = IR_INPUT_EDGES_COUNT(flags);
+	for (j = 1; j <= n; j++) {
+		if (IR_OPND_KIND(flags, j) != IR_OPND_DATA && ir_insn_op(insn, j)) {
+			return 0; /* control dependent node (e.g. PI) */
+		}
+	}
+	return 1;
+}
+
+static uint32_t ir_tail_dup_early(const ir_ctx *ctx, uint32_t *early, ir_ref ref)
+{
+	const ir_insn *insn;
+	const ir_ref *p;
+	ir_ref n, input;
+	uint32_t b, result, dom_depth;
+
+	if (early[ref]) {
+		return early[ref];
+	}
+	insn = &ctx->ir_base[ref];
+	if (ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) {
+		return 0; /* unreachable control node */
+	} else if (insn->op == IR_PHI) {
+		result = early[insn->op1];
+	} else {
+		result = 1;
+		dom_depth = 0;
+		n = insn->inputs_count;
+		for (p = insn->ops + 1; n > 0; p++, n--) {
+			input = *p;
+			if (input > 0) {
+				b = ir_tail_dup_early(ctx, early, input);
+				if (b && dom_depth < ctx->cfg_blocks[b].dom_depth) {
+					dom_depth = ctx->cfg_blocks[b].dom_depth;
+					result = b;
+				}
+			}
+		}
+	}
+	early[ref] = result;
+	return result;
+}
+
+static bool ir_tail_dup_dominates(const ir_ctx *ctx, uint32_t b1, uint32_t b2)
+{
+	uint32_t b1_depth = ctx->cfg_blocks[b1].dom_depth;
+
+	while (ctx->cfg_blocks[b2].dom_depth > b1_depth) {
+		b2 = ctx->cfg_blocks[b2].dom_parent;
+	}
+	return b1 == b2;
+}
+
+static void ir_tail_dup_add_node(ir_tail_dup_ctx *data, ir_ref ref)
+{
+	ir_list_push(&data->nodes, ref);
+	data->idx[ref] = ir_list_len(&data->nodes);
+}
+
+static bool ir_tail_dup_in_block(const ir_tail_dup_ctx *data, ir_ref ref)
+{
+	return ref > 0 && ref < data->size && data->idx[ref] && (uint32_t)data->idx[ref] <= data->values_count;
+}
+
+/* Collect the data nodes computed in the block for its control nodes */
+static bool ir_tail_dup_collect_slice(ir_ctx *ctx, ir_tail_dup_ctx *data, ir_ref ref, uint32_t *count)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	uint32_t flags = ir_op_flags[insn->op];
+	ir_ref j, n, input;
+
+	n = ir_input_edges_count(ctx, insn);
+	for (j = 1; j <= n; j++) {
+		input = ir_insn_op(insn, j);
+		if (input > 0
+		 && IR_OPND_KIND(flags, j) == IR_OPND_DATA
+		 && !data->idx[input]
+		 && ir_tail_dup_early(ctx, data->early, input) == data->b) {
+			if (!ir_tail_dup_is_pure(ctx, input) || ++(*count) > IR_TAIL_DUP_MAX_INSNS) {
+				return 0;
+			}
+			ir_tail_dup_add_node(data, input);
+			if (!ir_tail_dup_collect_slice(ctx, data, input, count)) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static void ir_tail_dup_add_use(ir_tail_dup_ctx *data, ir_ref use, ir_ref j, ir_ref val, ir_ref pos)
+{
+	ir_list_push(&data->uses, use);
+	ir_list_push(&data->uses, j);
+	ir_list_push(&data->uses, val);
+	ir_list_push(&data->uses, pos);
+}
+
+/* Collect the uses of the block values outside of the block */
+static bool ir_tail_dup_collect_uses(ir_ctx *ctx, ir_tail_dup_ctx *data)
+{
+	uint32_t k, e;
+	ir_ref ref, use, j, n, *p;
+	ir_insn *insn;
+
+	for (k = 0; k < ir_list_len(&data->nodes); k++) {
+		ref = ir_list_at(&data->nodes, k);
+		n = ctx->use_lists[ref].count;
+		for (p = &ctx->use_edges[ctx->use_lists[ref].refs]; n > 0; p++, n--) {
+			use = *p;
+			if (use == data->end || ir_tail_dup_in_block(data, use)) {
+				/* PHIs inputs are replaced in copies, other uses are cloned */
+				continue;
+			}
+			insn = &ctx->ir_base[use];
+			if (insn->op == IR_PHI) {
+				const ir_insn *merge = &ctx->ir_base[insn->op1];
+
+				for (j = 2; j <= insn->inputs_count; j++) {
+					if (ir_insn_op(insn, j) == ref) {
+						e = data->early[ir_insn_op(merge, j - 1)];
+						if (!e) {
+							return 0;
+						}
+						ir_tail_dup_add_use(data, use, j, ref, ctx->cfg_blocks[e].start);
+					}
+				}
+				continue;
+			} else if (ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) {
+				e = data->early[use];
+			} else if (!ir_tail_dup_is_pure(ctx, use)) {
+				return 0;
+			} else {
+				e = ir_tail_dup_early(ctx, data->early, use);
+				if (e == data->b) {
+					/* the node depends only on the block values, re-materialize it at the uses */
+					if (!data->idx[use]) {
+						if (ir_list_len(&data->nodes) - data->values_count >= IR_TAIL_DUP_MAX_DEPS) {
+							return 0;
+						}
+						ir_tail_dup_add_node(data, use);
+					}
+					continue;
+				}
+			}
+			if (!e || !ir_tail_dup_dominates(ctx, data->b, e)) {
+				return 0;
+			}
+			for (j = 1; j <= insn->inputs_count; j++) {
+				if (ir_insn_op(insn, j) == ref) {
+					ir_tail_dup_add_use(data, use, j, ref, ctx->cfg_blocks[e].start);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+static bool ir_tail_dup_check(ir_ctx *ctx, ir_tail_dup_ctx *data, uint32_t b)
+{
+	ir_block *bb = &ctx->cfg_blocks[b];
+	ir_insn *insn;
+	ir_ref ref, n, *p, next = IR_UNUSED;
+	uint32_t count = 0, succs = 0;
+
+	if ((ctx->ir_base[bb->start].op != IR_MERGE && ctx->ir_base[bb->start].op != IR_LOOP_BEGIN)
+	 || (ctx->ir_base[bb->end].op != IR_SWITCH && ctx->ir_base[bb->end].op != IR_IJMP)
+	 || bb->predecessors_count < 2
+	 || bb->predecessors_count > IR_TAIL_DUP_MAX_PREDS
+	 || (bb->flags & (IR_BB_ENTRY|IR_BB_UNREACHABLE))) {
+		return 0;
+	}
+
+	/* the selector must be computed in the block */
+	ref = ctx->ir_base[bb->end].op2;
+	if (ref <= 0 || ir_tail_dup_early(ctx, data->early, ref) != b) {
+		return 0;
+	}
+
+	data->b = b;
+	data->start = bb->start;
+	data->end = bb->end;
+	data->preds_count = bb->predecessors_count;
+	data->values_count = 0;
+	ir_list_clear(&data->nodes);
+	ir_list_clear(&data->chain);
+	ir_list_clear(&data->uses);
+
+	/* PHIs */
+	n = ctx->use_lists[bb->start].count;
+	for (p = &ctx->use_edges[ctx->use_lists[bb->start].refs]; n > 0; p++, n--) {
+		ref = *p;
+		insn = &ctx->ir_base[ref];
+		if (insn->op == IR_PHI) {
+			ir_tail_dup_add_node(data, ref);
+		} else if ((ir_op_flags[insn->op] & IR_OP_FLAG_CONTROL) && !next) {
+			next = ref;
+		} else {
+			goto fail;
+		}
+	}
+
+	/* control chain */
+	ref = next;
+	while (1) {
+		insn = &ctx->ir_base[ref];
+		if (++count > IR_TAIL_DUP_MAX_INSNS) {
+			goto fail;
+		}
+		ir_list_push(&data->chain, ref);
+		if (ref == bb->end) {
+			break;
+		} else if (!ir_tail_dup_is_chain_op(insn->op)) {
+			goto fail;
+		}
+		ir_tail_dup_add_node(data, ref);
+		ref = ir_next_control(ctx, ref);
+	}
+
+	/* data nodes computed in the block */
+	for (n = 0; n < (ir_ref)ir_list_len(&data->chain); n++) {
+		if (!ir_tail_dup_collect_slice(ctx, data, ir_list_at(&data->chain, n), &count)) {
+			goto fail;
+		}
+	}
+	data->values_count = ir_list_len(&data->nodes);
+
+	if (!ir_tail_dup_collect_uses(ctx, data)) {
+		goto fail;
+	}
+
+	if (ctx->ir_base[bb->end].op == IR_SWITCH) {
+		succs = ctx->use_lists[bb->end].count;
+	}
+	if ((count + 2 * succs) * data->preds_count + succs > IR_TAIL_DUP_BUDGET) {
+		goto fail;
+	}
+	return 1;
+
+fail:
+	/* reset the node indexes */
+	for (n = 0; n < (ir_ref)ir_list_len(&data->nodes); n++) {
+		data->idx[ir_list_at(&data->nodes, n)] = 0;
+	}
+	ir_list_clear(&data->nodes);
+	return 0;
+}
+
+/* Emit a data node through the folding engine */
+static ir_ref ir_tail_dup_fold(ir_ctx *ctx, uint32_t opt, ir_ref op1, ir_ref op2, ir_ref op3)
+{
+	ir_ref ref;
+
+restart:
+	switch (ir_folding(ctx, opt, op1, op2, op3, ctx->ir_base + op1, ctx->ir_base + op2, ctx->ir_base + op3)) {
+		case IR_FOLD_DO_RESTART:
+			opt = ctx->fold_insn.optx;
+			op1 = ctx->fold_insn.op1;
+			op2 = ctx->fold_insn.op2;
+			op3 = ctx->fold_insn.op3;
+			goto restart;
+		case IR_FOLD_DO_CSE:
+		case IR_FOLD_DO_EMIT:
+			opt = ctx->fold_insn.opt;
+			ref = ir_emit(ctx, opt, ctx->fold_insn.op1, ctx->fold_insn.op2, ctx->fold_insn.op3);
+			ctx->ir_base[ref].inputs_count = IR_INPUT_EDGES_COUNT(ir_op_flags[opt & IR_OPT_OP_MASK]);
+			if (ctx->fold_insn.op1 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op1, ref);
+			}
+			if (ctx->fold_insn.op2 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op2, ref);
+			}
+			if (ctx->fold_insn.op3 > 0) {
+				ir_use_list_add(ctx, ctx->fold_insn.op3, ref);
+			}
+			return ref;
+		case IR_FOLD_DO_COPY:
+			return ctx->fold_insn.op1;
+		case IR_FOLD_DO_CONST:
+			return ir_const(ctx, ctx->fold_insn.val, ctx->fold_insn.type);
+		default:
+			IR_ASSERT(0);
+			return IR_UNUSED;
+	}
+}
+
+/* Copy a node with the same operands */
+static ir_ref ir_tail_dup_copy_insn(ir_ctx *ctx, ir_ref ref)
+{
+	ir_ref n = ctx->ir_base[ref].inputs_count;
+	ir_ref new_ref = ir_emit_N(ctx, ctx->ir_base[ref].opt, n);
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_insn *new_insn = &ctx->ir_base[new_ref];
+
+	memcpy(new_insn->ops + 1, insn->ops + 1, sizeof(ir_ref) * IR_MAX(n, 3));
+	return new_ref;
+}
+
+static ir_ref ir_tail_dup_map(ir_ctx *ctx, ir_tail_dup_ctx *data, ir_ref ref, ir_ref i, bool *placeholder);
+
+static ir_ref ir_tail_dup_clone(ir_ctx *ctx, ir_tail_dup_ctx *data, ir_ref ref, ir_ref i, ir_ref control)
+{
+	uint32_t flags = ir_op_flags[ctx->ir_base[ref].op];
+	ir_ref j, n = ctx->ir_base[ref].inputs_count;
+	ir_ref new_ref, input, ops[4];
+	bool placeholder = 0;
+	ir_insn *insn;
+
+	IR_ASSERT(IR_OP_HAS_VAR_INPUTS(flags) || n <= 3);
+	if (!(flags & IR_OP_FLAG_CONTROL)) {
+		/* data node of the slice */
+		ops[1] = ops[2] = ops[3] = IR_UNUSED;
+		for (j = 1; j <= 3; j++) {
+			input = ir_insn_op(&ctx->ir_base[ref], j);
+			ops[j] = (j <= n && IR_OPND_KIND(flags, j) == IR_OPND_DATA) ?
+				ir_tail_dup_map(ctx, data, input, i, &placeholder) : input;
+		}
+		if (!placeholder) {
+			return ir_tail_dup_fold(ctx, ctx->ir_base[ref].opt, ops[1], ops[2], ops[3]);
+		}
+	}
+
+	new_ref = ir_tail_dup_copy_insn(ctx, ref);
+	for (j = 1; j <= n; j++) {
+		insn = &ctx->ir_base[new_ref];
+		input = ir_insn_op(insn, j);
+		if (j == 1 && (flags & IR_OP_FLAG_CONTROL)) {
+			input = control;
+		} else if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			if (flags & IR_OP_FLAG_CONTROL) {
+				placeholder = 0;
+				input = ir_tail_dup_map(ctx, data, input, i, &placeholder);
+			} else {
+				input = ops[j];
+			}
+			if (input > 0 && input < data->size && data->idx[input]) {
+				/* the PHI input depends on the block values, it's resolved after CFG rebuild */
+				ir_tail_dup_add_use(data, new_ref, j, input, data->pos[i]);
+			}
+		}
+		ir_insn_set_op(&ctx->ir_base[new_ref], j, input);
+		if (input > 0) {
+			ir_use_list_add(ctx, input, new_ref);
+		}
+	}
+	return new_ref;
+}
+
+static ir_ref ir_tail_dup_map(ir_ctx *ctx, ir_tail_dup_ctx *data, ir_ref ref, ir_ref i, bool *placeholder)
+{
+	ir_ref k, val;
+
+	if (ref <= 0 || ref >= data->size || !data->idx[ref]) {
+		return ref;
+	}
+	k = data->idx[ref] - 1;
+	IR_ASSERT((uint32_t)k < data->values_count);
+	val = data->defs[k * data->preds_count + i];
+	if (!val) {
+		IR_ASSERT(!(ir_op_flags[ctx->ir_base[ref].op] & IR_OP_FLAG_CONTROL));
+		val = ir_tail_dup_clone(ctx, data, ref, i, IR_UNUSED);
+		data->defs[k * data->preds_count + i] = val;
+	}
+	if (val > 0 && val < data->size && data->idx[val]) {
+		*placeholder = 1;
+	}
+	return val;
+}
+
+/* Remove a node that is not used any more, "set" contains all the removed nodes */
+static void ir_tail_dup_remove_insn(ir_ctx *ctx, ir_bitset set, ir_ref set_size, ir_ref ref)
+{
+	ir_insn *insn = &ctx->ir_base[ref];
+	ir_ref n, *p, input;
+
+	n = insn->inputs_count;
+	insn->opt = IR_NOP; /* keep "inputs_count" */
+	if (n < 3) {
+		insn->op3 = IR_UNUSED;
+	}
+	for (p = insn->ops + 1; n > 0; p++, n--) {
+		input = *p;
+		*p = IR_UNUSED;
+		if (input > 0 && (input >= set_size || !ir_bitset_in(set, input))) {
+			ir_use_list_remove_all(ctx, input, ref);
+		}
+	}
+	CLEAR_USES(ref);
+}
+
+static ir_ref ir_tail_dup_value_at(ir_ctx *ctx, ir_tail_dup_ctx *data, uint32_t k, uint32_t b);
+
+static ir_ref ir_tail_dup_resolve(ir_ctx *ctx, ir_tail_dup_ctx *data, ir_ref ref, uint32_t b)
+{
+	uint32_t k, flags;
+	ir_ref j, *memo, ops[4];
+	ir_insn *insn;
+
+	if (ref <= 0 || ref >= data->size || !data->idx[ref]) {
+		return ref;
+	}
+	k = data->idx[ref] - 1;
+	if (k < data->values_count) {
+		return ir_tail_dup_value_at(ctx, data, k, b);
+	}
+
+	/* re-materialize the dependent data node */
+	memo = data->memo[k];
+	if (!memo) {
+		memo = data->memo[k] = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_ref));
+	} else if (memo[b]) {
+		return memo[b];
+	}
+	insn = &ctx->ir_base[ref];
+	flags = ir_op_flags[insn->op];
+	ops[1] = insn->op1;
+	ops[2] = insn->op2;
+	ops[3] = insn->op3;
+	for (j = 1; j <= 3; j++) {
+		if (IR_OPND_KIND(flags, j) == IR_OPND_DATA) {
+			ops[j] = ir_tail_dup_resolve(ctx, data, ops[j], b);
+		}
+	}
+	memo[b] = ir_tail_dup_fold(ctx, ctx->ir_base[ref].opt, ops[1], ops[2], ops[3]);
+	return memo[b];
+}
+
+/* Value of "nodes[k]" at the end of copy "i" */
+static ir_ref ir_tail_dup_copy_value(ir_ctx *ctx, ir_tail_dup_ctx *data, uint32_t k, ir_ref i)
+{
+	ir_ref val = data->defs[k * data->preds_count + i];
+
+	if (!val) {
+		/* the slice node is not used by the copy */
+		val = ir_tail_dup_clone(ctx, data, ir_list_at(&data->nodes, k), i, IR_UNUSED);
+	}
+	if (val > 0 && val < data->size && data->idx[val]) {
+		val = ir_tail_dup_resolve(ctx, data, val, ctx->cfg_map[data->pos[i]]);
+	}
+	data->defs[k * data->preds_count + i] = val;
+	return val;
+}
+
+/* Value of "nodes[k]" at the start of block "b" */
+static ir_ref ir_tail_dup_value_at(ir_ctx *ctx, ir_tail_dup_ctx *data, uint32_t k, uint32_t b)
+{
+	ir_ref *memo = data->memo[k];
+	ir_ref val, merge;
+	ir_block *bb;
+	uint32_t pred, b0 = b;
+
+	if (!memo) {
+		memo = data->memo[k] = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(ir_ref));
+	}
+	while (1) {
+		if (memo[b]) {
+			val = memo[b];
+			break;
+		}
+		bb = &ctx->cfg_blocks[b];
+		if (bb->predecessors_count == 0) {
+			/* unreachable from the copies */
+			ir_val c;
+
+			c.i64 = 0;
+			val = ir_const(ctx, c, ctx->ir_base[ir_list_at(&data->nodes, k)].type);
+			break;
+		} else if (bb->predecessors_count > 1) {
+			merge = bb->start;
+			IR_ASSERT(ctx->ir_base[merge].op == IR_MERGE || ctx->ir_base[merge].op == IR_LOOP_BEGIN);
+			val = ir_emit_N(ctx, IR_OPT(IR_PHI, ctx->ir_base[ir_list_at(&data->nodes, k)].type),
+				ctx->ir_base[merge].inputs_count + 1);
+			ir_set_op(ctx, val, 1, merge);
+			ir_use_list_add(ctx, merge, val);
+			ir_list_push(&data->phis, val);
+			ir_list_push(&data->pending, val);
+			ir_list_push(&data->pending, k);
+			break;
+		}
+		pred = ctx->cfg_edges[bb->predecessors];
+		if (data->copy_of[pred]) {
+			val = ir_tail_dup_copy_value(ctx, data, k, data->copy_of[pred] - 1);
+			break;
+		}
+		b = pred;
+	}
+
+	/* remember the value for all the blocks of the path */
+	while (1) {
+		memo[b0] = val;
+		if (b0 == b) {
+			break;
+		}
+		b0 = ctx->cfg_edges[ctx->cfg_blocks[b0].predecessors];
+	}
+	return val;
+}
+
+static void ir_tail_dup_fill_phis(ir_ctx *ctx, ir_tail_dup_ctx *data)
+{
+	ir_ref phi, merge, j, n, end, val;
+	uint32_t k, pred;
+
+	while (ir_list_len(&data->pending)) {
+		k = ir_list_pop(&data->pending);
+		phi = ir_list_pop(&data->pending);
+		merge = ctx->ir_base[phi].op1;
+		n = ctx->ir_base[merge].inputs_count;
+		for (j = 1; j <= n; j++) {
+			end = ir_insn_op(&ctx->ir_base[merge], j);
+			pred = ctx->cfg_map[end];
+			if (data->copy_of[pred]) {
+				val = ir_tail_dup_copy_value(ctx, data, k, data->copy_of[pred] - 1);
+			} else {
+				val = ir_tail_dup_value_at(ctx, data, k, pred);
+			}
+			ir_set_op(ctx, phi, j + 1, val);
+			if (val > 0) {
+				ir_use_list_add(ctx, val, phi);
+			}
+		}
+	}
+}
+
+/* Remove the PHIs with the same inputs */
+static void ir_tail_dup_remove_redundant_phis(ir_ctx *ctx, ir_tail_dup_ctx *data)
+{
+	ir_ref phi, same, val, j, n;
+	uint32_t i;
+	bool changed;
+
+	do {
+		changed = 0;
+		for (i = 0; i < ir_list_len(&data->phis); i++) {
+			phi = ir_list_at(&data->phis, i);
+			if (ctx->ir_base[phi].op != IR_PHI) {
+				continue;
+			}
+			n = ctx->ir_base[phi].inputs_count;
+			same = IR_UNUSED;
+			for (j = 2; j <= n; j++) {
+				val = ir_insn_op(&ctx->ir_base[phi], j);
+				if (val == phi || val == same) {
+					continue;
+				} else if (same) {
+					break;
+				}
+				same = val;
+			}
+			if (j <= n || !same) {
+				continue;
+			}
+			ir_use_list_remove_all(ctx, phi, phi);
+			ir_replace(ctx, phi, same);
+			CLEAR_USES(phi);
+			ir_use_list_remove_one(ctx, ctx->ir_base[phi].op1, phi);
+			if (same > 0) {
+				ir_use_list_remove_all(ctx, same, phi);
+			}
+			MAKE_NOP(&ctx->ir_base[phi]);
+			ctx->ir_base[phi].inputs_count = n;
+			for (j = 4; j <= n; j++) {
+				ir_insn_set_op(&ctx->ir_base[phi], j, IR_UNUSED);
+			}
+			changed = 1;
+		}
+	} while (changed);
+}
+
+static void ir_tail_dup_unlink_terminator(ir_ctx *ctx, ir_ref ref)
+{
+	ir_ref *p = &ctx->ir_base[1].op1;
+
+	while (*p != ref) {
+		IR_ASSERT(*p);
+		p = &ctx->ir_base[*p].op3;
+	}
+	*p = ctx->ir_base[ref].op3;
+}
+
+static bool ir_tail_dup_block(ir_ctx *ctx, ir_tail_dup_ctx *data)
+{
+	ir_ref i, j, n, ref, end, prev, control, first, merge, *ends = NULL;
+	ir_list cases;
+	ir_bitset removed;
+	uint32_t k;
+	ir_op op = ctx->ir_base[data->end].op;
+
+	data->defs = ir_mem_calloc(data->values_count * data->preds_count, sizeof(ir_ref));
+	data->pos = ir_mem_malloc(data->preds_count * sizeof(ir_ref));
+	for (i = 0; i < data->preds_count; i++) {
+		ref = ir_insn_op(&ctx->ir_base[data->start], i + 1);
+		data->pos[i] = ctx->cfg_blocks[data->early[ref]].start;
+	}
+
+	/* PHIs are replaced by the corresponding inputs */
+	for (k = 0; k < data->values_count; k++) {
+		ref = ir_list_at(&data->nodes, k);
+		if (ctx->ir_base[ref].op == IR_PHI && ctx->ir_base[ref].op1 == data->start) {
+			for (i = 0; i < data->preds_count; i++) {
+				data->defs[k * data->preds_count + i] = ir_insn_op(&ctx->ir_base[ref], i + 2);
+			}
+		}
+	}
+
+	ir_list_init(&cases, 16);
+	if (op == IR_SWITCH) {
+		n = ctx->use_lists[data->end].count;
+		for (j = 0; j < n; j++) {
+			ir_list_push(&cases, ctx->use_edges[ctx->use_lists[data->end].refs + j]);
+		}
+		ends = ir_mem_malloc(ir_list_len(&cases) * data->preds_count * sizeof(ir_ref));
+	} else {
+		ir_tail_dup_unlink_terminator(ctx, data->end);
+	}
+
+	/* clone the block into each predecessor */
+	for (i = 0; i < data->preds_count; i++) {
+		end = ir_insn_op(&ctx->ir_base[data->start], i + 1);
+		prev = ctx->ir_base[end].op1;
+		control = first = IR_UNUSED;
+		for (j = 0; j < (ir_ref)ir_list_len(&data->chain); j++) {
+			ref = ir_list_at(&data->chain, j);
+			control = ir_tail_dup_clone(ctx, data, ref, i, control ? control : prev);
+			if (!first) {
+				first = control;
+			}
+			if (data->idx[ref]) {
+				data->defs[(data->idx[ref] - 1) * data->preds_count + i] = control;
+			}
+		}
+		ir_use_list_remove_one(ctx, prev, end);
+
+		if (op == IR_IJMP) {
+			ctx->ir_base[control].op3 = ctx->ir_base[1].op1;
+			ctx->ir_base[1].op1 = control;
+		} else {
+			for (k = 0; k < ir_list_len(&cases); k++) {
+				ref = ir_tail_dup_copy_insn(ctx, ir_list_at(&cases, k));
+				ctx->ir_base[ref].op1 = control;
+				ir_use_list_add(ctx, control, ref);
+				ends[k * data->preds_count + i] = ir_emit1(ctx, IR_OPTX(IR_END, IR_VOID, 1), ref);
+				ir_use_list_add(ctx, ref, ends[k * data->preds_count + i]);
+			}
+		}
+	}
+
+	/* each SWITCH successor becomes a MERGE of the copies */
+	for (k = 0; k < ir_list_len(&cases); k++) {
+		ref = ir_list_at(&cases, k);
+		merge = ir_emit_N(ctx, IR_MERGE, data->preds_count);
+		for (i = 0; i < data->preds_count; i++) {
+			end = ends[k * data->preds_count + i];
+			ir_set_op(ctx, merge, i + 1, end);
+			ir_use_list_add(ctx, end, merge);
+			if (data->pos[i] == ref) {
+				data->pos[i] = merge;
+			}
+		}
+		ir_replace(ctx, ref, merge);
+		CLEAR_USES(ref);
+		for (j = 0; j < (ir_ref)ir_list_len(&data->uses); j += 4) {
+			if (ir_list_at(&data->uses, j + 3) == ref) {
+				ir_list_set(&data->uses, j + 3, merge);
+			}
+		}
+	}
+
+	/* detach the original block */
+	for (i = 0; i < data->preds_count; i++) {
+		end = ir_insn_op(&ctx->ir_base[data->start], i + 1);
+		ctx->ir_base[end].op1 = IR_UNUSED;
+		MAKE_NOP(&ctx->ir_base[end]);
+		CLEAR_USES(end);
+		ir_set_op(ctx, data->start, i + 1, IR_UNUSED);
+	}
+
+	ir_reset_cfg(ctx);
+	if (!ir_build_cfg(ctx)) {
+		return 0;
+	}
+
+	/* SSA update for the uses of the block values */
+	data->memo = ir_mem_calloc(ir_list_len(&data->nodes), sizeof(ir_ref*));
+	data->copy_of = ir_mem_calloc(ctx->cfg_blocks_count + 1, sizeof(uint32_t));
+	for (i = 0; i < data->preds_count; i++) {
+		data->copy_of[ctx->cfg_map[data->pos[i]]] = i + 1;
+	}
+	ir_list_clear(&data->phis);
+	ir_list_clear(&data->pending);
+	for (j = 0; j < (ir_ref)ir_list_len(&data->uses); j += 4) {
+		ir_ref use = ir_list_at(&data->uses, j);
+		ir_ref op_num = ir_list_at(&data->uses, j + 1);
+		ir_ref val = ir_list_at(&data->uses, j + 2);
+
+		if (ir_insn_op(&ctx->ir_base[use], op_num) == val) {
+			val = ir_tail_dup_resolve(ctx, data, val, ctx->cfg_map[ir_list_at(&data->uses, j + 3)]);
+			ir_insn_set_op(&ctx->ir_base[use], op_num, val);
+			if (val > 0) {
+				ir_use_list_add(ctx, val, use);
+			}
+			ir_tail_dup_fill_phis(ctx, data);
+		}
+	}
+	ir_tail_dup_remove_redundant_phis(ctx, data);
+
+	/* remove the original block and the re-materialized nodes */
+	removed = ir_bitset_malloc(data->size);
+	ir_bitset_incl(removed, data->start);
+	for (j = 0; j < (ir_ref)ir_list_len(&data->nodes); j++) {
+		ir_bitset_incl(removed, ir_list_at(&data->nodes, j));
+	}
+	ir_bitset_incl(removed, data->end);
+	for (k = 0; k < ir_list_len(&cases); k++) {
+		ir_bitset_incl(removed, ir_list_at(&cases, k));
+	}
+	for (j = 0; j < (ir_ref)ir_list_len(&data->nodes); j++) {
+		ir_tail_dup_remove_insn(ctx, removed, data->size, ir_list_at(&data->nodes, j));
+	}
+	ir_tail_dup_remove_insn(ctx, removed, data->size, data->end);
+	for (k = 0; k < ir_list_len(&cases); k++) {
+		ir_tail_dup_remove_insn(ctx, removed, data->size, ir_list_at(&cases, k));
+	}
+	ir_tail_dup_remove_insn(ctx, removed, data->size, data->start);
+	ir_mem_free(removed);
+
+	for (k = 0; k < ir_list_len(&data->nodes); k++) {
+		if (data->memo[k]) {
+			ir_mem_free(data->memo[k]);
+		}
+	}
+	ir_mem_free(data->memo);
+	ir_mem_free(data->copy_of);
+	if (ends) {
+		ir_mem_free(ends);
+	}
+	ir_list_free(&cases);
+	ir_mem_free(data->pos);
+	ir_mem_free(data->defs);
+
+	return ir_build_dominators_tree(ctx);
+}
+
+int ir_tail_dup(ir_ctx *ctx)
+{
+	ir_tail_dup_ctx data;
+	uint32_t b;
+	ir_ref ref, limit;
+	ir_block *bb;
+	bool found, changed = 0, ret = 1;
+
+	IR_ASSERT(ctx->cfg_blocks && ctx->use_lists);
+
+	if (ctx->entries_count) {
+		return 1;
+	}
+
+	limit = ctx->insns_count * 2;
+	ir_list_init(&data.nodes, 16);
+	ir_list_init(&data.chain, 16);
+	ir_list_init(&data.uses, 16);
+	ir_list_init(&data.phis, 16);
+	ir_list_init(&data.pending, 16);
+
+	do {
+		data.size = ctx->insns_count;
+		data.idx = ir_mem_calloc(data.size, sizeof(ir_ref));
+		data.early = ir_mem_calloc(data.size, sizeof(uint32_t));
+
+		/* map control nodes to blocks */
+		for (b = 1, bb = ctx->cfg_blocks + 1; b <= ctx->cfg_blocks_count; b++, bb++) {
+			if (bb->flags & IR_BB_UNREACHABLE) {
+				continue;
+			}
+			ref = bb->start;
+			while (1) {
+				data.early[ref] = b;
+				if (ref == bb->end) {
+					break;
+				}
+				ref = ir_next_control(ctx, ref);
+			}
+		}
+
+		found = 0;
+		for (b = 1; b <= ctx->cfg_blocks_count; b++) {
+			if (ir_tail_dup_check(ctx, &data, b)) {
+				found = changed = 1;
+				ret = ir_tail_dup_block(ctx, &data);
+				break;
+			}
+		}
+
+		ir_mem_free(data.early);
+		ir_mem_free(data.idx);
+	} while (ret && found && ctx->insns_count < limit);
+
+	ir_list_free(&data.pending);
+	ir_list_free(&data.phis);
+	ir_list_free(&data.uses);
+	ir_list_free(&data.chain);
+	ir_list_free(&data.nodes);
+
+	if (changed && ret) {
+		ret = ir_find_loops(ctx);
+	}
+	return ret;
+}
@@ -190,6 +190,15 @@ static int skip_test(test *t)
 	return 0;
 }
 
+static void set_env(const char *name, const char *value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
 static int same_text(const char *exp, const char *out)
 {
 	int i, j;
@@ -316,6 +325,7 @@ static int run_test(const char *filename, test *t, int show_diff)
 		return 0;
 	}
 
+	set_env("TEST_FILE", code_filename);
 	ret = system(cmd);
 
 	if (ret != -1) {
@@ -530,6 +540,8 @@ static void print_help(const char *exe_name)
 	    "  --code-extension <ext>   - produce code files with the given extension\n"
 	    "  --show-diff              - show diff of the failed tests\n"
 	    "  --no-color               - disable color output\n"
+	    "The <cmd> and the code file are also passed in TEST_CMD and TEST_FILE environment\n"
+	    "variables (for tests that run <cmd> several times, e.g. to save and load a file)\n"
 	    , exe_name);
 }
 
@@ -633,6 +645,7 @@ int main(int argc, char **argv)
 	}
 
 	init_console();
+	set_env("TEST_CMD", test_cmd);
 
 	find_files(tests, tests_count);
 